@@ -101,4 +101,11 @@
 #define PERFETTO_BUILDFLAG_DEFINE_PERFETTO_ANDROID_USERDEBUG_BUILD() 0
 #endif
 
+// The epoll-based task runner is available only on Linux and Android.
+#if defined(PERFETTO_USE_EPOLL_TASK_RUNNER) && defined(__linux__)
+#define PERFETTO_BUILDFLAG_DEFINE_PERFETTO_EPOLL_TASK_RUNNER() 1
+#else
+#define PERFETTO_BUILDFLAG_DEFINE_PERFETTO_EPOLL_TASK_RUNNER() 0
+#endif
+
 #endif  // INCLUDE_PERFETTO_BASE_BUILD_CONFIG_H_
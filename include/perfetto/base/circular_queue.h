@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PERFETTO_BASE_CIRCULAR_QUEUE_H_
+#define INCLUDE_PERFETTO_BASE_CIRCULAR_QUEUE_H_
+
+#include <stddef.h>
+
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace base {
+
+// A FIFO queue backed by a ring buffer that doubles its capacity when full and
+// never shrinks. Unlike std::deque, which allocates and frees a block every
+// few elements when used as a FIFO, this doesn't allocate at all in the steady
+// state. Popped slots are reset to a default-constructed T, so that resources
+// held by the element (e.g. the captures of a std::function) are released
+// right away. Not thread safe.
+template <typename T>
+class CircularQueue {
+ public:
+  explicit CircularQueue(size_t initial_capacity = 64)
+      : entries_(RoundUpToPowerOfTwo(initial_capacity)) {}
+
+  void push_back(T value) {
+    if (size() == entries_.size())
+      Grow();
+    entries_[end_ & mask()] = std::move(value);
+    end_++;
+  }
+
+  T& front() {
+    PERFETTO_DCHECK(!empty());
+    return entries_[begin_ & mask()];
+  }
+
+  void pop_front() {
+    PERFETTO_DCHECK(!empty());
+    entries_[begin_ & mask()] = T();
+    begin_++;
+  }
+
+  size_t size() const { return end_ - begin_; }
+  bool empty() const { return begin_ == end_; }
+  size_t capacity() const { return entries_.size(); }
+
+ private:
+  CircularQueue(const CircularQueue&) = delete;
+  CircularQueue& operator=(const CircularQueue&) = delete;
+
+  static size_t RoundUpToPowerOfTwo(size_t n) {
+    size_t res = 1;
+    while (res < n)
+      res <<= 1;
+    return res;
+  }
+
+  size_t mask() const { return entries_.size() - 1; }
+
+  void Grow() {
+    std::vector<T> entries(entries_.size() * 2);
+    size_t n = size();
+    for (size_t i = 0; i < n; i++)
+      entries[i] = std::move(entries_[(begin_ + i) & mask()]);
+    entries_.swap(entries);
+    begin_ = 0;
+    end_ = n;
+  }
+
+  std::vector<T> entries_;
+
+  // Free-running counters, the slot of an element is given by |index| & mask().
+  // Wrapping around is fine as the capacity is always a power of two.
+  size_t begin_ = 0;
+  size_t end_ = 0;
+};
+
+}  // namespace base
+}  // namespace perfetto
+
+#endif  // INCLUDE_PERFETTO_BASE_CIRCULAR_QUEUE_H_
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PERFETTO_BASE_EPOLL_TASK_RUNNER_H_
+#define INCLUDE_PERFETTO_BASE_EPOLL_TASK_RUNNER_H_
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/event.h"
+#include "perfetto/base/scoped_file.h"
+#include "perfetto/base/task_runner.h"
+#include "perfetto/base/thread_checker.h"
+#include "perfetto/base/time.h"
+
+#include <stdint.h>
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace perfetto {
+namespace base {
+
+// A drop-in replacement of UnixTaskRunner for Linux and Android, based on
+// epoll(7) rather than poll(2). Each file descriptor watch is registered
+// once with EPOLLONESHOT and re-armed when its task runs, so the cost of a
+// wakeup doesn't depend on the number of watched file descriptors. Delayed
+// tasks are kept in a heap and wake up the task runner through a timerfd.
+class EpollTaskRunner : public TaskRunner {
+ public:
+  EpollTaskRunner();
+  ~EpollTaskRunner() override;
+
+  // Start executing tasks. Doesn't return until Quit() is called. Run() may be
+  // called multiple times on the same task runner.
+  void Run();
+  void Quit();
+
+  // Checks whether there are any pending immediate tasks to run. Note that
+  // delayed tasks don't count even if they are due to run.
+  bool IsIdleForTesting();
+
+  // TaskRunner implementation:
+  void PostTask(std::function<void()>) override;
+  void PostDelayedTask(std::function<void()>, uint32_t delay_ms) override;
+  void AddFileDescriptorWatch(int fd, std::function<void()>) override;
+  void RemoveFileDescriptorWatch(int fd) override;
+
+ private:
+  struct DelayedTask {
+    TimeMillis run_time;
+    uint64_t seq;  // Keeps FIFO ordering for tasks with the same |run_time|.
+    std::function<void()> task;
+  };
+
+  struct WatchTask {
+    std::function<void()> callback;
+    // True for file descriptors that don't support epoll (e.g. regular
+    // files). They are always readable, as they would be for poll(2).
+    bool always_ready;
+  };
+
+  // Orders |delayed_tasks_| as a min-heap on (|run_time|, |seq|).
+  static bool IsLater(const DelayedTask&, const DelayedTask&);
+
+  void WakeUp();
+  void RunImmediateAndDelayedTask();
+  void RunFileDescriptorWatch(int fd);
+  void UpdateTimerLocked();
+
+  ThreadChecker thread_checker_;
+  ScopedFile epoll_fd_;
+
+  // Used to wake up the task runner when a new task is posted.
+  Event event_;
+
+  // Expires when the earliest delayed task is due.
+  ScopedFile timer_fd_;
+
+  // --- Begin lock-protected members ---
+
+  std::mutex lock_;
+
+  std::deque<std::function<void()>> immediate_tasks_;
+  std::vector<DelayedTask> delayed_tasks_;  // Heap, see IsLater().
+  uint64_t last_delayed_task_seq_ = 0;
+  TimeMillis timer_run_time_{};  // The deadline set on |timer_fd_|, if any.
+  bool quit_ = false;
+
+  std::map<int, WatchTask> watch_tasks_;
+
+  // --- End lock-protected members ---
+};
+
+}  // namespace base
+}  // namespace perfetto
+
+#endif  // INCLUDE_PERFETTO_BASE_EPOLL_TASK_RUNNER_H_
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PERFETTO_BASE_LZ_CODEC_H_
+#define INCLUDE_PERFETTO_BASE_LZ_CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace perfetto {
+namespace base {
+
+// A small and fast LZ77-family block codec, used to compress trace data
+// in-process without depending on third-party compression libraries.
+// The format is a sequence of:
+//   [token] [literal length ext]* [literals] [offset (LE16)] [match len ext]*
+// where the high nibble of |token| is the literal length and the low nibble is
+// the match length - kLzMinMatch (15 means "more bytes follow", each extension
+// byte adds up to 255). The last sequence of a block has literals only.
+// Blocks are self-contained: matches never reference data outside the block.
+// The encoded data does not store the decompressed size, the caller must keep
+// track of it.
+
+constexpr size_t kLzMinMatch = 4;
+constexpr size_t kLzMaxOffset = 65535;
+
+// Returns the worst-case size of the compressed output for |src_size| bytes of
+// (incompressible) input.
+constexpr size_t LzCompressBound(size_t src_size) {
+  return src_size + src_size / 255 + 16;
+}
+
+// Compresses |src_size| bytes from |src| into |dst|. Returns the number of
+// bytes written in |dst| or 0 if the compressed output doesn't fit into
+// |dst_capacity|. Passing a |dst_capacity| < |src_size| is allowed and is the
+// cheapest way to bail out early on incompressible data.
+size_t LzCompress(const uint8_t* src,
+                  size_t src_size,
+                  uint8_t* dst,
+                  size_t dst_capacity);
+
+// Decompresses |src_size| bytes from |src| into |dst|. Returns true only if
+// the input is well formed and decompresses to exactly |dst_size| bytes.
+// The input is treated as untrusted: no read or write ever happens outside of
+// the [src, src + src_size) and [dst, dst + dst_size) ranges.
+bool LzDecompress(const uint8_t* src,
+                  size_t src_size,
+                  uint8_t* dst,
+                  size_t dst_size);
+
+}  // namespace base
+}  // namespace perfetto
+
+#endif  // INCLUDE_PERFETTO_BASE_LZ_CODEC_H_
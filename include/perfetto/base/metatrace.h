@@ -17,43 +17,104 @@
 #ifndef INCLUDE_PERFETTO_BASE_METATRACE_H_
 #define INCLUDE_PERFETTO_BASE_METATRACE_H_
 
-#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
 
+#include <atomic>
+#include <functional>
 #include <string>
 
-#include "perfetto/base/logging.h"
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/time.h"
 #include "perfetto/base/utils.h"
 
 namespace perfetto {
 namespace base {
 
+// Self-tracing of the tracing service and probes. Each PERFETTO_METATRACE()
+// scope emits one fixed-size record into a ring buffer owned by the calling
+// thread. Writing a record takes no locks and does no syscalls beyond reading
+// the clock, so instrumentation points can stay in hot paths. When metatracing
+// is disabled (the default) a scope costs a single relaxed atomic load.
+//
+// Records are consumed either on demand, via ReadRecords(), or by a background
+// thread that is started when the PERFETTO_METATRACE_FILE env var is set. That
+// thread periodically appends the records to the file in the JSON trace event
+// format, which both trace_processor and the legacy catapult viewer can load.
 class MetaTrace {
  public:
-  MetaTrace(const char* evt_name, size_t cpu) : evt_name_(evt_name), cpu_(cpu) {
-    WriteEvent('B', evt_name, cpu);
+  // Max number of records that each thread can buffer before the reader drains
+  // them. Further records are dropped (and counted) until then.
+  static constexpr size_t kRingCapacity = 1024;
+
+  struct Record {
+    uint64_t begin_ns;
+    uint32_t duration_ns;
+
+    // Opaque to the metatrace, conventionally the CPU the event refers to. The
+    // JSON conversion uses it as the pid and tid of the event, so that every
+    // CPU gets its own track.
+    uint32_t arg;
+
+    // Must have static storage duration, only the pointer is copied.
+    const char* name;
+  };
+
+  // Invoked with the records of each thread, oldest first.
+  using ReadCallback = std::function<void(const Record&)>;
+
+  MetaTrace(const char* evt_name, size_t arg) {
+    State state = g_state_.load(std::memory_order_relaxed);
+    if (PERFETTO_UNLIKELY(state == State::kUninitialized))
+      state = InitFromEnv();
+    if (PERFETTO_LIKELY(state != State::kEnabled))
+      return;
+    evt_name_ = evt_name;
+    arg_ = static_cast<uint32_t>(arg);
+    begin_ns_ = static_cast<uint64_t>(GetWallTimeNs().count());
   }
 
-  MetaTrace(const std::string& str, size_t cpu)
-      : str_copy_(str), evt_name_(str_copy_.c_str()), cpu_(cpu) {
-    WriteEvent('B', evt_name_, cpu);
+  ~MetaTrace() {
+    if (PERFETTO_UNLIKELY(evt_name_))
+      WriteRecord();
   }
 
-  ~MetaTrace() { WriteEvent('E', evt_name_, cpu_); }
+  // Starts or stops recording. Records already in the ring buffers are kept
+  // until the next ReadRecords() call.
+  static void Enable();
+  static void Disable();
+  static bool IsEnabled();
+
+  // Drains the ring buffers of all threads (including threads that have
+  // since exited) invoking |callback| for each record. Returns the number of
+  // records that were dropped because a ring buffer was full. |callback| must
+  // not emit metatrace events itself.
+  static uint64_t ReadRecords(const ReadCallback& callback);
+
+  // Returns a JSON trace event (complete, i.e. "ph": "X") followed by a comma,
+  // in the same format used for the PERFETTO_METATRACE_FILE.
+  static std::string RecordToJson(const Record&);
 
  private:
+  enum class State : uint8_t { kUninitialized, kDisabled, kEnabled };
+
   MetaTrace(const MetaTrace&) = delete;
   MetaTrace& operator=(const MetaTrace&) = delete;
 
-  void WriteEvent(char type, const char* evt_name, size_t cpu);
+  static State InitFromEnv();
+  void WriteRecord();
+
+  static std::atomic<State> g_state_;
 
-  std::string str_copy_;
-  const char* const evt_name_;
-  const size_t cpu_;
+  // Non-null only if the metatrace was enabled when the scope was entered.
+  const char* evt_name_ = nullptr;
+  uint32_t arg_ = 0;
+  uint64_t begin_ns_ = 0;
 };
 
 #define PERFETTO_METATRACE_UID2(a, b) a##b
 #define PERFETTO_METATRACE_UID(x) PERFETTO_METATRACE_UID2(metatrace_, x)
-#if PERFETTO_DCHECK_IS_ON() && !PERFETTO_BUILDFLAG(PERFETTO_CHROMIUM_BUILD)
+#if !PERFETTO_BUILDFLAG(PERFETTO_CHROMIUM_BUILD)
 
 #define PERFETTO_METATRACE(...) \
   ::perfetto::base::MetaTrace PERFETTO_METATRACE_UID(__COUNTER__)(__VA_ARGS__)
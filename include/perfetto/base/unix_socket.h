@@ -28,6 +28,7 @@
 #include "perfetto/base/utils.h"
 #include "perfetto/base/weak_ptr.h"
 
+struct iovec;
 struct msghdr;
 
 namespace perfetto {
@@ -82,6 +83,14 @@ class UnixSocketRaw {
                const int* send_fds = nullptr,
                size_t num_fds = 0);
 
+  // Scatter-gather version of the above. Sends the concatenation of the
+  // |iov_len| buffers in |iov|, which is modified if the data is sent in more
+  // than one sendmsg() call.
+  ssize_t Send(struct iovec* iov,
+               size_t iov_len,
+               const int* send_fds = nullptr,
+               size_t num_fds = 0);
+
   // Re-enter sendmsg until all the data has been sent or an error occurs.
   // TODO(fmayer): Figure out how to do timeouts here for heapprofd.
   ssize_t SendMsgAll(struct msghdr* msg);
@@ -203,6 +212,14 @@ class UnixSocket {
                                              TaskRunner*,
                                              SockType = SockType::kStream);
 
+  // Creates an instance from an already connected socket, e.g. one that has
+  // been accepted on another thread and moved to |task_runner| via
+  // ReleaseSocket(). Unlike Connect(), no OnConnect() call will follow.
+  static std::unique_ptr<UnixSocket> AdoptConnected(ScopedFile,
+                                                    EventListener*,
+                                                    TaskRunner*,
+                                                    SockType = SockType::kStream);
+
   // This class gives the hard guarantee that no callback is called on the
   // passed EventListener immediately after the object has been destroyed.
   // Any queued callback will be silently dropped.
@@ -213,6 +230,11 @@ class UnixSocket {
   // be reused with Listen() or Connect().
   void Shutdown(bool notify);
 
+  // Stops watching the connected socket and returns its file descriptor,
+  // without closing the connection or notifying the EventListener. The socket
+  // goes into the kDisconnected state.
+  ScopedFile ReleaseSocket();
+
   // Returns true is the message was queued, false if there was no space in the
   // output buffer, in which case the client should retry or give up.
   // If any other error happens the socket will be shutdown and
@@ -241,6 +263,24 @@ class UnixSocket {
     return Send(msg.c_str(), msg.size() + 1, -1, blocking);
   }
 
+  // Scatter-gather version of Send(). Sends the concatenation of the |iov_len|
+  // buffers in |iov| as if they were a single message, without copying them.
+  // |iov| can be modified.
+  bool Send(struct iovec* iov,
+            size_t iov_len,
+            const int* send_fds,
+            size_t num_fds,
+            BlockingMode blocking = BlockingMode::kNonBlocking);
+
+  inline bool Send(struct iovec* iov,
+                   size_t iov_len,
+                   int send_fd = -1,
+                   BlockingMode blocking = BlockingMode::kNonBlocking) {
+    if (send_fd != -1)
+      return Send(iov, iov_len, &send_fd, 1, blocking);
+    return Send(iov, iov_len, nullptr, 0, blocking);
+  }
+
   // Returns the number of bytes (<= |len|) written in |msg| or 0 if there
   // is no data in the buffer to read or an error occurs (in which case a
   // EventListener::OnDisconnect() will follow).
@@ -18,6 +18,7 @@
 #define INCLUDE_PERFETTO_BASE_UNIX_TASK_RUNNER_H_
 
 #include "perfetto/base/build_config.h"
+#include "perfetto/base/circular_queue.h"
 #include "perfetto/base/event.h"
 #include "perfetto/base/scoped_file.h"
 #include "perfetto/base/task_runner.h"
@@ -25,16 +26,24 @@
 #include "perfetto/base/time.h"
 
 #include <poll.h>
+#include <atomic>
 #include <chrono>
-#include <deque>
 #include <map>
 #include <mutex>
+#include <thread>
 #include <vector>
 
 namespace perfetto {
 namespace base {
 
 // Runs a task runner on the current thread.
+//
+// Tasks posted from the thread that is executing Run() (e.g. tasks posting
+// other tasks, or file descriptor watches) go straight into a queue owned by
+// that thread, without locking or waking up the task runner. Tasks posted from
+// other threads are appended to a lock-protected inbox, which the task runner
+// moves to its own queue in one go. Only the first of these posts made while
+// the task runner is blocked in poll(2) wakes it up.
 class UnixTaskRunner : public TaskRunner {
  public:
   UnixTaskRunner();
@@ -58,6 +67,15 @@ class UnixTaskRunner : public TaskRunner {
  private:
   void WakeUp();
 
+  // Returns true if called on the thread that is executing Run().
+  bool RunsTasksOnCurrentThread() const;
+
+  // Takes the tasks posted by other threads, so that they run after the ones
+  // already queued.
+  void MovePostedTasks();
+  bool HasImmediateTasks() const;
+  std::function<void()> PopImmediateTask();
+
   void UpdateWatchTasksLocked();
 
   int GetDelayMsToNextTaskLocked() const;
@@ -73,14 +91,39 @@ class UnixTaskRunner : public TaskRunner {
 
   std::vector<struct pollfd> poll_fds_;
 
+  // The thread executing Run(), if any.
+  std::atomic<std::thread::id> run_thread_id_{};
+
+  // --- Begin members accessed only by the thread executing Run() ---
+
+  // A batch of tasks taken from |posted_tasks_|, to be run from
+  // |next_moved_task_| on. These all precede the ones in |immediate_tasks_|.
+  // Swapped with |posted_tasks_| when fully consumed, to reuse its capacity.
+  std::vector<std::function<void()>> moved_tasks_;
+  size_t next_moved_task_ = 0;
+
+  CircularQueue<std::function<void()>> immediate_tasks_;
+
+  // --- End members accessed only by the thread executing Run() ---
+
+  // Set when |posted_tasks_| is not empty. Allows to check that without taking
+  // the lock.
+  std::atomic<bool> has_posted_tasks_{false};
+
   // --- Begin lock-protected members ---
 
   std::mutex lock_;
 
-  std::deque<std::function<void()>> immediate_tasks_;
+  // Immediate tasks posted by other threads.
+  std::vector<std::function<void()>> posted_tasks_;
+
   std::multimap<TimeMillis, std::function<void()>> delayed_tasks_;
   bool quit_ = false;
 
+  // True while the task runner is, or is about to be, blocked in poll(2) and
+  // hasn't been woken up yet.
+  bool poll_pending_ = false;
+
   struct WatchTask {
     std::function<void()> callback;
     size_t poll_fd_index;  // Index into |poll_fds_|.
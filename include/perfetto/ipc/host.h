@@ -17,6 +17,8 @@
 #ifndef INCLUDE_PERFETTO_IPC_HOST_H_
 #define INCLUDE_PERFETTO_IPC_HOST_H_
 
+#include <stddef.h>
+
 #include <memory>
 
 #include "perfetto/base/scoped_file.h"
@@ -40,13 +42,19 @@ class Host {
  public:
   // Creates an instance and starts listening on the given |socket_name|.
   // Returns nullptr if listening on the socket fails.
+  // If |num_io_threads| > 0, the socket I/O and the decoding of the frames of
+  // each client connection are moved to one of |num_io_threads| background
+  // threads. Services are still invoked, and must reply, only on the passed
+  // TaskRunner.
   static std::unique_ptr<Host> CreateInstance(const char* socket_name,
-                                              base::TaskRunner*);
+                                              base::TaskRunner*,
+                                              size_t num_io_threads = 0);
 
   // Like the above but takes a file descriptor to a pre-bound unix socket.
   // Returns nullptr if listening on the socket fails.
   static std::unique_ptr<Host> CreateInstance(base::ScopedFile socket_fd,
-                                              base::TaskRunner*);
+                                              base::TaskRunner*,
+                                              size_t num_io_threads = 0);
 
   virtual ~Host();
 
@@ -53,6 +53,14 @@ class PERFETTO_EXPORT Message {
   // static_assert in the .cc file will bark.
   static constexpr uint32_t kMaxNestingDepth = 10;
 
+  // Upper bound of the encoded size of the message, 0 if unknown. Generated
+  // stubs of messages that only have non-repeated scalar fields override this
+  // (assuming each field is set at most once), which allows
+  // BeginNestedMessage() to reserve a 1 byte size field for the small ones.
+  // Messages that exceed it anyway (e.g. a field set twice) are moved behind a
+  // regular size field, see WidenSizeField().
+  static constexpr uint32_t kMaxEncodedSize = 0;
+
   // Ctor and Dtor of Message are never called, with the exeception
   // of root (non-nested) messages. Nested messages are allocated via placement
   // new in the |nested_messages_arena_| and implictly destroyed when the arena
@@ -71,13 +79,18 @@ class PERFETTO_EXPORT Message {
   uint32_t Finalize();
 
   // Optional. If is_valid() == true, the corresponding memory region (its
-  // length == proto_utils::kMessageLengthFieldSize) is backfilled with the size
-  // of this message (minus |size_already_written| below). This is the mechanism
-  // used by messages to backfill their corresponding size field in the parent
-  // message.
+  // length == size_field_size()) is backfilled with the size of this message
+  // (minus |size_already_written| below). This is the mechanism used by
+  // messages to backfill their corresponding size field in the parent message.
   uint8_t* size_field() const { return size_field_; }
   void set_size_field(uint8_t* size_field) { size_field_ = size_field; }
 
+  // proto_utils::kMessageLengthFieldSize, unless the message has been started
+  // by BeginNestedMessage() with a shorter reservation. Those are guaranteed to
+  // never span across chunks, hence never need to be patched: the message is
+  // widened before it can outgrow the chunk.
+  uint32_t size_field_size() const { return size_field_size_; }
+
   // This is to deal with case of backfilling the size of a root (non-nested)
   // message which is split into multiple chunks. Upon finalization only the
   // partial size that lies in the last chunk has to be backfilled.
@@ -106,12 +119,36 @@ class PERFETTO_EXPORT Message {
     WriteToStream(buffer, pos);
   }
 
+  // Same as above, for callers that know the field id at compile time (e.g.
+  // the generated stubs). The tag is pre-encoded and, when the current chunk
+  // has enough headroom for the worst case, the field is written in place
+  // rather than going through the intermediate buffer.
+  template <uint32_t field_id, typename T>
+  void AppendVarInt(T value) {
+    if (nested_message_)
+      EndNestedMessage();
+
+    constexpr uint32_t kTag = proto_utils::MakeTagVarInt(field_id);
+    constexpr size_t kMaxSize =
+        proto_utils::VarIntSize(kTag) + proto_utils::MaxVarIntSize<T>();
+    uint8_t buffer[proto_utils::kMaxSimpleFieldEncodedSize];
+    uint8_t* const begin = BeginField(kMaxSize, buffer);
+    uint8_t* pos = proto_utils::WriteTag<kTag>(begin);
+    pos = proto_utils::WriteVarInt(value, pos);
+    EndField(begin, pos, buffer);
+  }
+
   // Proto types: sint64, sint32.
   template <typename T>
   void AppendSignedVarInt(uint32_t field_id, T value) {
     AppendVarInt(field_id, proto_utils::ZigZagEncode(value));
   }
 
+  template <uint32_t field_id, typename T>
+  void AppendSignedVarInt(T value) {
+    AppendVarInt<field_id>(proto_utils::ZigZagEncode(value));
+  }
+
   // Proto types: bool, enum (small).
   // Faster version of AppendVarInt for tiny numbers.
   void AppendTinyVarInt(uint32_t field_id, int32_t value) {
@@ -127,6 +164,21 @@ class PERFETTO_EXPORT Message {
     WriteToStream(buffer, pos);
   }
 
+  template <uint32_t field_id>
+  void AppendTinyVarInt(int32_t value) {
+    PERFETTO_DCHECK(0 <= value && value < 0x80);
+    if (nested_message_)
+      EndNestedMessage();
+
+    constexpr uint32_t kTag = proto_utils::MakeTagVarInt(field_id);
+    constexpr size_t kMaxSize = proto_utils::VarIntSize(kTag) + 1;
+    uint8_t buffer[proto_utils::kMaxSimpleFieldEncodedSize];
+    uint8_t* const begin = BeginField(kMaxSize, buffer);
+    uint8_t* pos = proto_utils::WriteTag<kTag>(begin);
+    *pos++ = static_cast<uint8_t>(value);
+    EndField(begin, pos, buffer);
+  }
+
   // Proto types: fixed64, sfixed64, fixed32, sfixed32, double, float.
   template <typename T>
   void AppendFixed(uint32_t field_id, T value) {
@@ -143,6 +195,21 @@ class PERFETTO_EXPORT Message {
     WriteToStream(buffer, pos);
   }
 
+  template <uint32_t field_id, typename T>
+  void AppendFixed(T value) {
+    if (nested_message_)
+      EndNestedMessage();
+
+    constexpr uint32_t kTag = proto_utils::MakeTagFixed<T>(field_id);
+    constexpr size_t kMaxSize = proto_utils::VarIntSize(kTag) + sizeof(T);
+    uint8_t buffer[proto_utils::kMaxSimpleFieldEncodedSize];
+    uint8_t* const begin = BeginField(kMaxSize, buffer);
+    uint8_t* pos = proto_utils::WriteTag<kTag>(begin);
+    memcpy(pos, &value, sizeof(T));
+    pos += sizeof(T);
+    EndField(begin, pos, buffer);
+  }
+
   void AppendString(uint32_t field_id, const char* str);
   void AppendBytes(uint32_t field_id, const void* value, size_t size);
 
@@ -152,6 +219,10 @@ class PERFETTO_EXPORT Message {
                               ContiguousMemoryRange* ranges,
                               size_t num_ranges);
 
+  // Appends bytes that already are the encoding of one or more fields of this
+  // message (e.g. copied from another message of the same type), as-is.
+  void AppendRawProtoBytes(const void* src, size_t size);
+
   // Begins a nested message, using the static storage provided by the parent
   // class (see comment in |nested_messages_arena_|). The nested message ends
   // either when Finalize() is called or when any other Append* method is called
@@ -167,7 +238,7 @@ class PERFETTO_EXPORT Message {
     static_assert(sizeof(T) == sizeof(Message),
                   "Message subclasses cannot introduce extra state.");
     T* message = reinterpret_cast<T*>(nested_messages_arena_);
-    BeginNestedMessageInternal(field_id, message);
+    BeginNestedMessageInternal(field_id, message, T::kMaxEncodedSize);
     return message;
   }
 
@@ -175,19 +246,55 @@ class PERFETTO_EXPORT Message {
   Message(const Message&) = delete;
   Message& operator=(const Message&) = delete;
 
-  void BeginNestedMessageInternal(uint32_t field_id, Message*);
+  void BeginNestedMessageInternal(uint32_t field_id,
+                                  Message*,
+                                  uint32_t max_encoded_size);
 
   // Called by Finalize and Append* methods.
   void EndNestedMessage();
 
+  // Moves the message behind a kMessageLengthFieldSize size field, if it has a
+  // short one and appending |size| more bytes could exceed its bound.
+  void ReserveForAppend(size_t size) {
+    if (PERFETTO_UNLIKELY(size_field_size_ <
+                          proto_utils::kMessageLengthFieldSize) &&
+        size_ + size > short_size_limit_) {
+      WidenSizeField();
+    }
+  }
+  void WidenSizeField();
+
   void WriteToStream(const uint8_t* src_begin, const uint8_t* src_end) {
     PERFETTO_DCHECK(!finalized_);
     PERFETTO_DCHECK(src_begin <= src_end);
     const uint32_t size = static_cast<uint32_t>(src_end - src_begin);
+    ReserveForAppend(size);
     stream_writer_->WriteBytes(src_begin, size);
     size_ += size;
   }
 
+  // Used by the field-id-templated Append* methods. Returns the location
+  // where a field of at most |max_size| bytes should be encoded: the stream
+  // writer itself if the current chunk has enough headroom, |buffer| otherwise.
+  uint8_t* BeginField(size_t max_size, uint8_t* buffer) {
+    PERFETTO_DCHECK(max_size <= proto_utils::kMaxSimpleFieldEncodedSize);
+    ReserveForAppend(max_size);
+    if (PERFETTO_LIKELY(stream_writer_->bytes_available() >= max_size))
+      return stream_writer_->write_ptr();
+    return buffer;
+  }
+
+  // Commits the field [begin, end) encoded at the location returned by
+  // BeginField().
+  void EndField(const uint8_t* begin, const uint8_t* end, uint8_t* buffer) {
+    if (PERFETTO_UNLIKELY(begin == buffer))
+      return WriteToStream(begin, end);
+    PERFETTO_DCHECK(!finalized_);
+    const uint32_t size = static_cast<uint32_t>(end - begin);
+    stream_writer_->ReserveBytesUnsafe(size);
+    size_ += size;
+  }
+
   // Only POD fields are allowed. This class's dtor is never called.
   // See the comment on the static_assert in the the corresponding .cc file.
 
@@ -210,6 +317,13 @@ class PERFETTO_EXPORT Message {
   // kMaxNestingDepth. |nesting_depth_| == 0 for root (non-nested) messages.
   uint8_t nesting_depth_;
 
+  // Size of the reservation pointed by |size_field_|, see size_field_size().
+  uint8_t size_field_size_;
+
+  // With a short size field, the max |size_| the message can reach before it
+  // has to be widened: the kMaxEncodedSize it was started with.
+  uint8_t short_size_limit_;
+
 #if PERFETTO_DCHECK_IS_ON()
   // Current generation of message. Incremented on Reset.
   // Used to detect stale handles.
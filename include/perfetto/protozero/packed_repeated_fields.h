@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PERFETTO_PROTOZERO_PACKED_REPEATED_FIELDS_H_
+#define INCLUDE_PERFETTO_PROTOZERO_PACKED_REPEATED_FIELDS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/protozero/proto_utils.h"
+
+namespace protozero {
+
+// Accumulates the values of a packed repeated varint field (e.g.
+// "repeated int64 foo = 1 [packed = true];"), which the generated stubs then
+// append in one go with set_foo(const PackedVarInt&). Reset() keeps the memory,
+// so that a buffer reused across messages stops allocating after the first few.
+class PackedVarInt {
+ public:
+  template <typename T>
+  void Append(T value) {
+    constexpr size_t kMaxSize = proto_utils::MaxVarIntSize<T>();
+    if (PERFETTO_UNLIKELY(size_ + kMaxSize > storage_.size()))
+      storage_.resize(std::max(storage_.size() * 2, size_ + kMaxSize));
+    uint8_t* end = proto_utils::WriteVarInt(value, storage_.data() + size_);
+    size_ = static_cast<size_t>(end - storage_.data());
+  }
+
+  void Reset() { size_ = 0; }
+
+  const uint8_t* data() const { return storage_.data(); }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+ private:
+  std::vector<uint8_t> storage_;
+  size_t size_ = 0;  // The bytes of |storage_| in use.
+};
+
+// Iterates over the values of a packed repeated varint field, given its
+// payload (e.g. from the generated decoder). Usage:
+//   bool parse_error = false;
+//   for (auto it = decoder.foo(&parse_error); it; ++it)
+//     Use(*it);
+//   if (parse_error)
+//     ...
+// The iteration stops early, setting |*parse_error|, if the payload ends with
+// a truncated varint.
+template <typename T>
+class PackedVarIntIterator {
+ public:
+  PackedVarIntIterator(const uint8_t* data, size_t size, bool* parse_error)
+      : pos_(data), end_(data + size), parse_error_(parse_error) {
+    Next();
+  }
+
+  explicit operator bool() const { return valid_; }
+  T operator*() const { return value_; }
+
+  PackedVarIntIterator& operator++() {
+    Next();
+    return *this;
+  }
+
+ private:
+  void Next() {
+    valid_ = false;
+    if (pos_ >= end_)
+      return;
+    uint64_t value = 0;
+    const uint8_t* next = proto_utils::ParseVarInt(pos_, end_, &value);
+    if (PERFETTO_UNLIKELY(next == pos_)) {
+      *parse_error_ = true;
+      pos_ = end_;
+      return;
+    }
+    pos_ = next;
+    value_ = static_cast<T>(value);
+    valid_ = true;
+  }
+
+  const uint8_t* pos_;
+  const uint8_t* const end_;
+  bool* const parse_error_;
+  T value_ = 0;
+  bool valid_ = false;
+};
+
+}  // namespace protozero
+
+#endif  // INCLUDE_PERFETTO_PROTOZERO_PACKED_REPEATED_FIELDS_H_
@@ -26,6 +26,13 @@
 
 namespace protozero {
 
+// A reference to the payload of a length-delimited field (bytes or a nested
+// message) within the buffer being decoded.
+struct ConstBytes {
+  const uint8_t* data;
+  size_t size;
+};
+
 // Reads and decodes protobuf messages from a fixed length buffer. This class
 // does not allocate and does no more work than necessary so can be used in
 // performance sensitive contexts.
@@ -34,7 +41,9 @@ class ProtoDecoder {
   using StringView = ::perfetto::base::StringView;
 
   // The field of a protobuf message. |id| == 0 if the tag is not valid (e.g.
-  // because the full tag was unable to be read etc.).
+  // because the full tag was unable to be read etc.). The typed as_*()
+  // accessors of a value-initialized Field (e.g. of a field missing from the
+  // message, see TypedProtoDecoder) return 0 / empty values.
   struct Field {
     struct LengthDelimited {
       const uint8_t* data;
@@ -48,30 +57,47 @@ class ProtoDecoder {
       LengthDelimited length_limited;
     };
 
+    inline bool valid() const { return id != 0; }
+
+    inline bool as_bool() const {
+      PERFETTO_DCHECK(!valid() || type == proto_utils::ProtoWireType::kVarInt);
+      return int_value != 0;
+    }
+
     inline uint32_t as_uint32() const {
-      PERFETTO_DCHECK(type == proto_utils::ProtoWireType::kVarInt ||
+      PERFETTO_DCHECK(!valid() || type == proto_utils::ProtoWireType::kVarInt ||
                       type == proto_utils::ProtoWireType::kFixed32);
       return static_cast<uint32_t>(int_value);
     }
 
     inline int32_t as_int32() const {
-      PERFETTO_DCHECK(type == proto_utils::ProtoWireType::kVarInt ||
+      PERFETTO_DCHECK(!valid() || type == proto_utils::ProtoWireType::kVarInt ||
                       type == proto_utils::ProtoWireType::kFixed32);
       return static_cast<int32_t>(int_value);
     }
 
     inline uint64_t as_uint64() const {
-      PERFETTO_DCHECK(type == proto_utils::ProtoWireType::kVarInt ||
+      PERFETTO_DCHECK(!valid() || type == proto_utils::ProtoWireType::kVarInt ||
                       type == proto_utils::ProtoWireType::kFixed64);
       return int_value;
     }
 
     inline int64_t as_int64() const {
-      PERFETTO_DCHECK(type == proto_utils::ProtoWireType::kVarInt ||
+      PERFETTO_DCHECK(!valid() || type == proto_utils::ProtoWireType::kVarInt ||
                       type == proto_utils::ProtoWireType::kFixed64);
       return static_cast<int64_t>(int_value);
     }
 
+    inline int32_t as_sint32() const {
+      PERFETTO_DCHECK(!valid() || type == proto_utils::ProtoWireType::kVarInt);
+      return proto_utils::ZigZagDecode(static_cast<uint32_t>(int_value));
+    }
+
+    inline int64_t as_sint64() const {
+      PERFETTO_DCHECK(!valid() || type == proto_utils::ProtoWireType::kVarInt);
+      return proto_utils::ZigZagDecode(int_value);
+    }
+
     // A relaxed version for when we are storing any int as an int64
     // in the raw events table.
     inline int64_t as_integer() const {
@@ -82,7 +108,7 @@ class ProtoDecoder {
     }
 
     inline float as_float() const {
-      PERFETTO_DCHECK(type == proto_utils::ProtoWireType::kFixed32);
+      PERFETTO_DCHECK(!valid() || type == proto_utils::ProtoWireType::kFixed32);
       float res;
       uint32_t value32 = static_cast<uint32_t>(int_value);
       memcpy(&res, &value32, sizeof(res));
@@ -90,7 +116,7 @@ class ProtoDecoder {
     }
 
     inline double as_double() const {
-      PERFETTO_DCHECK(type == proto_utils::ProtoWireType::kFixed64);
+      PERFETTO_DCHECK(!valid() || type == proto_utils::ProtoWireType::kFixed64);
       double res;
       memcpy(&res, &int_value, sizeof(res));
       return res;
@@ -108,11 +134,18 @@ class ProtoDecoder {
     }
 
     inline StringView as_string() const {
-      PERFETTO_DCHECK(type == proto_utils::ProtoWireType::kLengthDelimited);
+      PERFETTO_DCHECK(!valid() ||
+                      type == proto_utils::ProtoWireType::kLengthDelimited);
       return StringView(reinterpret_cast<const char*>(length_limited.data),
                         length_limited.length);
     }
 
+    inline ConstBytes as_bytes() const {
+      PERFETTO_DCHECK(!valid() ||
+                      type == proto_utils::ProtoWireType::kLengthDelimited);
+      return ConstBytes{length_limited.data, length_limited.length};
+    }
+
     inline const uint8_t* data() const {
       PERFETTO_DCHECK(type == proto_utils::ProtoWireType::kLengthDelimited);
       return length_limited.data;
@@ -190,6 +223,123 @@ class ProtoDecoder {
   const uint8_t* current_position_ = nullptr;
 };
 
+// Iterates, in order, over the occurrences of a repeated field by scanning the
+// message they belong to. Usage:
+//   for (auto it = decoder.foo(); it; ++it)
+//     Use(it->as_uint32());
+// Each occurrence is one element, so this must not be used for packed fields,
+// whose elements are all in one length-delimited occurrence: the generated
+// decoders use PackedVarIntIterator for the [packed = true] fields. If a writer
+// packs a field not declared as such, the as_*() accessors of the scalar types
+// DCHECK on the unexpected wire type.
+class RepeatedFieldIterator {
+ public:
+  RepeatedFieldIterator(uint32_t field_id,
+                        const uint8_t* buffer,
+                        size_t length)
+      : field_id_(field_id), decoder_(buffer, length) {
+    FindNext();
+  }
+
+  explicit operator bool() const { return field_.valid(); }
+  const ProtoDecoder::Field& operator*() const { return field_; }
+  const ProtoDecoder::Field* operator->() const { return &field_; }
+
+  RepeatedFieldIterator& operator++() {
+    FindNext();
+    return *this;
+  }
+
+ private:
+  void FindNext() {
+    for (field_ = decoder_.ReadField(); field_.valid();
+         field_ = decoder_.ReadField()) {
+      if (field_.id == field_id_)
+        return;
+    }
+  }
+
+  const uint32_t field_id_;
+  ProtoDecoder decoder_;
+  ProtoDecoder::Field field_;
+};
+
+// Non-templated part of TypedProtoDecoder, see below.
+class TypedProtoDecoderBase {
+ public:
+  using Field = ProtoDecoder::Field;
+
+  const uint8_t* buffer() const { return buffer_; }
+  size_t length() const { return length_; }
+
+  // Returns false if the message ended with a truncated field, in which case
+  // the fields before it are still accessible.
+  bool IsEndOfBuffer() const { return end_of_buffer_; }
+
+ protected:
+  TypedProtoDecoderBase(const uint8_t* buffer, size_t length)
+      : buffer_(buffer), length_(length) {}
+
+  // Decodes all the fields in one pass. |fields| has |max_field_id| + 1
+  // entries, only those whose bit is set in |present| are initialized. Fields
+  // with an id > |max_field_id| are skipped.
+  void ParseAllFields(Field* fields, uint64_t* present, uint32_t max_field_id);
+
+  RepeatedFieldIterator GetRepeated(uint32_t field_id) const {
+    return RepeatedFieldIterator(field_id, buffer_, length_);
+  }
+
+  static const Field& missing_field() { return kMissingField; }
+
+ private:
+  static const Field kMissingField;
+
+  const uint8_t* const buffer_;
+  const size_t length_;
+  bool end_of_buffer_ = false;
+};
+
+// Decodes a message in one pass into a table indexed by field id, giving O(1)
+// access to its fields. Neither the decoder nor the returned values allocate:
+// strings and bytes point into the decoded buffer, which must outlive them. For
+// non-repeated fields the last occurrence wins, as per proto semantics.
+// The protozero plugin generates a subclass for each message (e.g.
+// FooDecoder for Foo) with typed accessors, e.g.:
+//   FooDecoder foo(buf, size);
+//   if (foo.has_bar())
+//     Use(foo.bar());
+//   for (auto it = foo.baz(); it; ++it)
+//     Use(it->as_string());
+template <uint32_t MAX_FIELD_ID>
+class TypedProtoDecoder : public TypedProtoDecoderBase {
+ public:
+  TypedProtoDecoder(const uint8_t* buffer, size_t length)
+      : TypedProtoDecoderBase(buffer, length) {
+    ParseAllFields(fields(), present_, MAX_FIELD_ID);
+  }
+
+  template <uint32_t field_id>
+  const Field& at() const {
+    static_assert(field_id <= MAX_FIELD_ID, "Field id out of range");
+    if (present_[field_id / 64] & (1ull << (field_id % 64)))
+      return fields()[field_id];
+    return missing_field();
+  }
+
+ private:
+  Field* fields() { return reinterpret_cast<Field*>(storage_); }
+  const Field* fields() const {
+    return reinterpret_cast<const Field*>(storage_);
+  }
+
+  // One bit per field id, set if the field has been found.
+  uint64_t present_[MAX_FIELD_ID / 64 + 1];
+
+  // Left uninitialized on purpose, so that messages with high field ids don't
+  // need to clear the whole table every time.
+  alignas(Field) uint8_t storage_[sizeof(Field) * (MAX_FIELD_ID + 1)];
+};
+
 }  // namespace protozero
 
 #endif  // INCLUDE_PERFETTO_PROTOZERO_PROTO_DECODER_H_
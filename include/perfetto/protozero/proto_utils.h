@@ -138,6 +138,18 @@ constexpr uint32_t MakeTagLengthDelimited(uint32_t field_id) {
          static_cast<uint32_t>(ProtoWireType::kLengthDelimited);
 }
 
+// Returns the number of bytes needed to encode |value| as a varint.
+constexpr size_t VarIntSize(uint64_t value) {
+  return value < 0x80 ? 1 : 1 + VarIntSize(value >> 7);
+}
+
+// Upper bound of the encoded size of a varint of type T. Signed values are
+// sign-extended to 64 bits by WriteVarInt(), hence take up to 10 bytes.
+template <typename T>
+constexpr size_t MaxVarIntSize() {
+  return std::is_unsigned<T>::value ? (sizeof(T) * 8 + 6) / 7 : 10;
+}
+
 // Proto types: sint64, sint32.
 template <typename T>
 inline typename std::make_unsigned<T>::type ZigZagEncode(T value) {
@@ -145,6 +157,13 @@ inline typename std::make_unsigned<T>::type ZigZagEncode(T value) {
       (value << 1) ^ (value >> (sizeof(T) * 8 - 1)));
 }
 
+template <typename T>
+inline typename std::make_signed<T>::type ZigZagDecode(T value) {
+  static_assert(std::is_unsigned<T>::value, "ZigZag values are unsigned");
+  return static_cast<typename std::make_signed<T>::type>((value >> 1) ^
+                                                         (0 - (value & 1)));
+}
+
 template <typename T>
 inline uint8_t* WriteVarInt(T value, uint8_t* target) {
   // If value is <= 0 we must first sign extend to int64_t (see [1]).
@@ -174,6 +193,17 @@ inline uint8_t* WriteVarInt(T value, uint8_t* target) {
   return target + 1;
 }
 
+// Writes the compile-time constant |tag|. Tags of fields with id < 16 take a
+// single byte, in which case this boils down to a single store.
+template <uint32_t tag>
+inline uint8_t* WriteTag(uint8_t* target) {
+  if (tag < 0x80) {
+    *target = static_cast<uint8_t>(tag);
+    return target + 1;
+  }
+  return WriteVarInt(tag, target);
+}
+
 // Writes a fixed-size redundant encoding of the given |value|. This is
 // used to backfill fixed-size reservations for the length field using a
 // non-canonical varint encoding (e.g. \x81\x80\x80\x00 instead of \x01).
@@ -181,14 +211,20 @@ inline uint8_t* WriteVarInt(T value, uint8_t* target) {
 // In particular, this is used for nested messages. The size of a nested message
 // is not known until all its field have been written. |kMessageLengthFieldSize|
 // bytes are reserved to encode the size field and backfilled at the end.
-inline void WriteRedundantVarInt(uint32_t value, uint8_t* buf) {
-  for (size_t i = 0; i < kMessageLengthFieldSize; ++i) {
-    const uint8_t msb = (i < kMessageLengthFieldSize - 1) ? 0x80 : 0;
+// Nested messages whose size is bounded at compile time can use a shorter
+// reservation, see |size| and Message::BeginNestedMessage().
+inline void WriteRedundantVarInt(uint32_t value, uint8_t* buf, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    const uint8_t msb = (i < size - 1) ? 0x80 : 0;
     buf[i] = static_cast<uint8_t>(value) | msb;
     value >>= 7;
   }
 }
 
+inline void WriteRedundantVarInt(uint32_t value, uint8_t* buf) {
+  WriteRedundantVarInt(value, buf, kMessageLengthFieldSize);
+}
+
 template <uint32_t field_id>
 void StaticAssertSingleBytePreamble() {
   static_assert(field_id < 16,
@@ -200,7 +236,7 @@ void StaticAssertSingleBytePreamble() {
 // The parsed int value is stored in the output arg |value|. Returns a pointer
 // to the next unconsumed byte (so start < retval <= end) or |start| if the
 // VarInt could not be fully parsed because there was not enough space in the
-// buffer.
+// buffer or it is longer than 10 bytes.
 inline const uint8_t* ParseVarInt(const uint8_t* start,
                                   const uint8_t* end,
                                   uint64_t* value) {
@@ -208,11 +244,11 @@ inline const uint8_t* ParseVarInt(const uint8_t* start,
   uint64_t shift = 0;
   *value = 0;
   do {
-    if (PERFETTO_UNLIKELY(pos >= end)) {
+    // Varints longer than 10 bytes are malformed (the input can be untrusted).
+    if (PERFETTO_UNLIKELY(pos >= end || shift >= 64ull)) {
       *value = 0;
       return start;
     }
-    PERFETTO_DCHECK(shift < 64ull);
     *value |= static_cast<uint64_t>(*pos & 0x7f) << shift;
     shift += 7;
   } while (*pos++ & 0x80);
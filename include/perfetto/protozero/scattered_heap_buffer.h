@@ -20,11 +20,21 @@
 #include <memory>
 #include <vector>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/protozero/scattered_stream_writer.h"
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#include <sys/uio.h>
+#endif
+
 namespace protozero {
 
+// Backs a ScatteredStreamWriter with heap-allocated slices, whose size grows
+// geometrically from |initial_slice_size_bytes| to |maximum_slice_size_bytes|.
+// Callers that build many messages in a row can Reset() the buffer between
+// them: the slices are then recycled, so that after the first few messages
+// no more allocations are needed.
 class ScatteredHeapBuffer : public protozero::ScatteredStreamWriter::Delegate {
  public:
   class Slice {
@@ -45,7 +55,7 @@ class ScatteredHeapBuffer : public protozero::ScatteredStreamWriter::Delegate {
     size_t size() const { return size_; }
     size_t unused_bytes() const { return unused_bytes_; }
     void set_unused_bytes(size_t unused_bytes) {
-      PERFETTO_DCHECK(unused_bytes_ <= size_);
+      PERFETTO_DCHECK(unused_bytes <= size_);
       unused_bytes_ = unused_bytes;
     }
 
@@ -65,6 +75,20 @@ class ScatteredHeapBuffer : public protozero::ScatteredStreamWriter::Delegate {
   // Stitch all the slices into a single contiguous buffer.
   std::vector<uint8_t> StitchSlices();
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  // Appends to |iovecs| one entry for the used part of each slice, e.g. to
+  // pass the message to writev() or UnixSocket::Send() without stitching it.
+  // The entries are valid until the next Reset() or the destruction of this
+  // buffer.
+  void GetUsedIovecs(std::vector<struct iovec>* iovecs);
+#endif
+
+  // Discards the current message and resets the writer (if any), so that the
+  // next write starts a new message. The slices are kept and handed out again,
+  // in the same order, before any new one is allocated. They are freed only
+  // when the buffer is destroyed.
+  void Reset();
+
   const std::vector<Slice>& slices() const { return slices_; }
 
   void set_writer(protozero::ScatteredStreamWriter* writer) {
@@ -78,10 +102,14 @@ class ScatteredHeapBuffer : public protozero::ScatteredStreamWriter::Delegate {
   size_t GetTotalSize();
 
  private:
+  const size_t initial_slice_size_;
   size_t next_slice_size_;
   const size_t maximum_slice_size_;
   protozero::ScatteredStreamWriter* writer_ = nullptr;
   std::vector<Slice> slices_;
+
+  // Slices recycled by Reset(). The back is the one to be reused first.
+  std::vector<Slice> free_slices_;
 };
 
 }  // namespace protozero
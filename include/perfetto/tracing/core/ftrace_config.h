@@ -39,13 +39,42 @@
 namespace perfetto {
 namespace protos {
 class FtraceConfig;
-}
+class FtraceConfig_EventFilter;
+}  // namespace protos
 }  // namespace perfetto
 
 namespace perfetto {
 
 class PERFETTO_EXPORT FtraceConfig {
  public:
+  class PERFETTO_EXPORT EventFilter {
+   public:
+    EventFilter();
+    ~EventFilter();
+    EventFilter(EventFilter&&) noexcept;
+    EventFilter& operator=(EventFilter&&);
+    EventFilter(const EventFilter&);
+    EventFilter& operator=(const EventFilter&);
+
+    // Conversion methods from/to the corresponding protobuf types.
+    void FromProto(const perfetto::protos::FtraceConfig_EventFilter&);
+    void ToProto(perfetto::protos::FtraceConfig_EventFilter*) const;
+
+    const std::string& event() const { return event_; }
+    void set_event(const std::string& value) { event_ = value; }
+
+    const std::string& filter() const { return filter_; }
+    void set_filter(const std::string& value) { filter_ = value; }
+
+   private:
+    std::string event_ = {};
+    std::string filter_ = {};
+
+    // Allows to preserve unknown protobuf fields for compatibility
+    // with future versions of .proto files.
+    std::string unknown_fields_;
+  };
+
   FtraceConfig();
   ~FtraceConfig();
   FtraceConfig(FtraceConfig&&) noexcept;
@@ -92,12 +121,48 @@ class PERFETTO_EXPORT FtraceConfig {
   uint32_t drain_period_ms() const { return drain_period_ms_; }
   void set_drain_period_ms(uint32_t value) { drain_period_ms_ = value; }
 
+  bool compact_sched() const { return compact_sched_; }
+  void set_compact_sched(bool value) { compact_sched_ = value; }
+
+  bool adaptive_drain() const { return adaptive_drain_; }
+  void set_adaptive_drain(bool value) { adaptive_drain_ = value; }
+
+  int event_pids_size() const { return static_cast<int>(event_pids_.size()); }
+  const std::vector<int32_t>& event_pids() const { return event_pids_; }
+  int32_t* add_event_pids() {
+    event_pids_.emplace_back();
+    return &event_pids_.back();
+  }
+
+  int cpus_size() const { return static_cast<int>(cpus_.size()); }
+  const std::vector<uint32_t>& cpus() const { return cpus_; }
+  uint32_t* add_cpus() {
+    cpus_.emplace_back();
+    return &cpus_.back();
+  }
+
+  int event_filters_size() const {
+    return static_cast<int>(event_filters_.size());
+  }
+  const std::vector<EventFilter>& event_filters() const {
+    return event_filters_;
+  }
+  EventFilter* add_event_filters() {
+    event_filters_.emplace_back();
+    return &event_filters_.back();
+  }
+
  private:
   std::vector<std::string> ftrace_events_;
   std::vector<std::string> atrace_categories_;
   std::vector<std::string> atrace_apps_;
   uint32_t buffer_size_kb_ = {};
   uint32_t drain_period_ms_ = {};
+  bool compact_sched_ = {};
+  bool adaptive_drain_ = {};
+  std::vector<int32_t> event_pids_;
+  std::vector<uint32_t> cpus_;
+  std::vector<EventFilter> event_filters_;
 
   // Allows to preserve unknown protobuf fields for compatibility
   // with future versions of .proto files.
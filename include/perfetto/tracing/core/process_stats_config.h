@@ -82,11 +82,41 @@ class PERFETTO_EXPORT ProcessStatsConfig {
   uint32_t proc_stats_poll_ms() const { return proc_stats_poll_ms_; }
   void set_proc_stats_poll_ms(uint32_t value) { proc_stats_poll_ms_ = value; }
 
+  bool proc_stats_incremental_scan() const {
+    return proc_stats_incremental_scan_;
+  }
+  void set_proc_stats_incremental_scan(bool value) {
+    proc_stats_incremental_scan_ = value;
+  }
+
+  bool proc_stats_delta_encoding() const { return proc_stats_delta_encoding_; }
+  void set_proc_stats_delta_encoding(bool value) {
+    proc_stats_delta_encoding_ = value;
+  }
+
+  uint32_t proc_stats_delta_threshold_kb() const {
+    return proc_stats_delta_threshold_kb_;
+  }
+  void set_proc_stats_delta_threshold_kb(uint32_t value) {
+    proc_stats_delta_threshold_kb_ = value;
+  }
+
+  uint32_t proc_stats_keyframe_interval() const {
+    return proc_stats_keyframe_interval_;
+  }
+  void set_proc_stats_keyframe_interval(uint32_t value) {
+    proc_stats_keyframe_interval_ = value;
+  }
+
  private:
   std::vector<Quirks> quirks_;
   bool scan_all_processes_on_start_ = {};
   bool record_thread_names_ = {};
   uint32_t proc_stats_poll_ms_ = {};
+  bool proc_stats_incremental_scan_ = {};
+  bool proc_stats_delta_encoding_ = {};
+  uint32_t proc_stats_delta_threshold_kb_ = {};
+  uint32_t proc_stats_keyframe_interval_ = {};
 
   // Allows to preserve unknown protobuf fields for compatibility
   // with future versions of .proto files.
@@ -59,6 +59,7 @@ class TestConfig_DummyFields;
 class TraceConfig_ProducerConfig;
 class TraceConfig_StatsdMetadata;
 class TraceConfig_GuardrailOverrides;
+class TraceConfig_TraceFilter;
 }  // namespace protos
 }  // namespace perfetto
 
@@ -89,9 +90,13 @@ class PERFETTO_EXPORT TraceConfig {
     FillPolicy fill_policy() const { return fill_policy_; }
     void set_fill_policy(FillPolicy value) { fill_policy_ = value; }
 
+    bool compress_chunks() const { return compress_chunks_; }
+    void set_compress_chunks(bool value) { compress_chunks_ = value; }
+
    private:
     uint32_t size_kb_ = {};
     FillPolicy fill_policy_ = {};
+    bool compress_chunks_ = {};
 
     // Allows to preserve unknown protobuf fields for compatibility
     // with future versions of .proto files.
@@ -125,9 +130,17 @@ class PERFETTO_EXPORT TraceConfig {
       return &producer_name_filter_.back();
     }
 
+    bool share_with_other_sessions() const {
+      return share_with_other_sessions_;
+    }
+    void set_share_with_other_sessions(bool value) {
+      share_with_other_sessions_ = value;
+    }
+
    private:
     DataSourceConfig config_ = {};
     std::vector<std::string> producer_name_filter_;
+    bool share_with_other_sessions_ = {};
 
     // Allows to preserve unknown protobuf fields for compatibility
     // with future versions of .proto files.
@@ -238,6 +251,38 @@ class PERFETTO_EXPORT TraceConfig {
     std::string unknown_fields_;
   };
 
+  enum CompressionType {
+    COMPRESSION_TYPE_UNSPECIFIED = 0,
+    COMPRESSION_TYPE_LZ = 1,
+  };
+
+  class PERFETTO_EXPORT TraceFilter {
+   public:
+    TraceFilter();
+    ~TraceFilter();
+    TraceFilter(TraceFilter&&) noexcept;
+    TraceFilter& operator=(TraceFilter&&);
+    TraceFilter(const TraceFilter&);
+    TraceFilter& operator=(const TraceFilter&);
+
+    // Conversion methods from/to the corresponding protobuf types.
+    void FromProto(const perfetto::protos::TraceConfig_TraceFilter&);
+    void ToProto(perfetto::protos::TraceConfig_TraceFilter*) const;
+
+    const std::string& bytecode() const { return bytecode_; }
+    void set_bytecode(const std::string& value) { bytecode_ = value; }
+    void set_bytecode(const void* p, size_t s) {
+      bytecode_.assign(reinterpret_cast<const char*>(p), s);
+    }
+
+   private:
+    std::string bytecode_ = {};
+
+    // Allows to preserve unknown protobuf fields for compatibility
+    // with future versions of .proto files.
+    std::string unknown_fields_;
+  };
+
   TraceConfig();
   ~TraceConfig();
   TraceConfig(TraceConfig&&) noexcept;
@@ -312,6 +357,14 @@ class PERFETTO_EXPORT TraceConfig {
   uint32_t flush_period_ms() const { return flush_period_ms_; }
   void set_flush_period_ms(uint32_t value) { flush_period_ms_ = value; }
 
+  CompressionType compression_type() const { return compression_type_; }
+  void set_compression_type(CompressionType value) {
+    compression_type_ = value;
+  }
+
+  const TraceFilter& trace_filter() const { return trace_filter_; }
+  TraceFilter* mutable_trace_filter() { return &trace_filter_; }
+
  private:
   std::vector<BufferConfig> buffers_;
   std::vector<DataSource> data_sources_;
@@ -326,6 +379,8 @@ class PERFETTO_EXPORT TraceConfig {
   GuardrailOverrides guardrail_overrides_ = {};
   bool deferred_start_ = {};
   uint32_t flush_period_ms_ = {};
+  CompressionType compression_type_ = {};
+  TraceFilter trace_filter_ = {};
 
   // Allows to preserve unknown protobuf fields for compatibility
   // with future versions of .proto files.
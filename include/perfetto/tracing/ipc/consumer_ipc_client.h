@@ -17,6 +17,8 @@
 #ifndef INCLUDE_PERFETTO_TRACING_IPC_CONSUMER_IPC_CLIENT_H_
 #define INCLUDE_PERFETTO_TRACING_IPC_CONSUMER_IPC_CLIENT_H_
 
+#include <stddef.h>
+
 #include <memory>
 #include <string>
 
@@ -44,6 +46,16 @@ class ConsumerIPCClient {
   static std::unique_ptr<TracingService::ConsumerEndpoint>
   Connect(const char* service_sock_name, Consumer*, base::TaskRunner*);
 
+  // As above, but asks the service to return the trace data read through
+  // ReadBuffers() via a shared memory ring of |read_buffers_shm_size| bytes
+  // (a multiple of 4KB), rather than copying it into the IPC messages. This is
+  // worth it only for consumers that read large amounts of data.
+  static std::unique_ptr<TracingService::ConsumerEndpoint> Connect(
+      const char* service_sock_name,
+      Consumer*,
+      base::TaskRunner*,
+      size_t read_buffers_shm_size);
+
  protected:
   ConsumerIPCClient() = delete;
 };
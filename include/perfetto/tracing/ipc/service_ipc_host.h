@@ -17,6 +17,8 @@
 #ifndef INCLUDE_PERFETTO_TRACING_IPC_SERVICE_IPC_HOST_H_
 #define INCLUDE_PERFETTO_TRACING_IPC_SERVICE_IPC_HOST_H_
 
+#include <stddef.h>
+
 #include <memory>
 
 #include "perfetto/base/scoped_file.h"
@@ -36,7 +38,12 @@ class TracingService;
 //   src/tracing/ipc/service/service_ipc_host_impl.cc
 class ServiceIPCHost {
  public:
-  static std::unique_ptr<ServiceIPCHost> CreateInstance(base::TaskRunner*);
+  // If |num_io_threads| > 0, the socket I/O and the IPC frame decoding of the
+  // producer and consumer connections run on that many background threads.
+  // The service business logic always runs on the passed TaskRunner.
+  static std::unique_ptr<ServiceIPCHost> CreateInstance(
+      base::TaskRunner*,
+      size_t num_io_threads = 0);
   virtual ~ServiceIPCHost();
 
   // Start listening on the Producer & Consumer ports. Returns false in case of
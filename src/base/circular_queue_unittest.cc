@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/base/circular_queue.h"
+
+#include <memory>
+
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace base {
+namespace {
+
+TEST(CircularQueueTest, PushPop) {
+  CircularQueue<int> queue(4);
+  EXPECT_TRUE(queue.empty());
+  EXPECT_EQ(4u, queue.capacity());
+  for (int i = 0; i < 4; i++)
+    queue.push_back(i);
+  EXPECT_EQ(4u, queue.size());
+  for (int i = 0; i < 4; i++) {
+    EXPECT_EQ(i, queue.front());
+    queue.pop_front();
+  }
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(CircularQueueTest, CapacityIsRoundedUp) {
+  CircularQueue<int> queue(5);
+  EXPECT_EQ(8u, queue.capacity());
+}
+
+TEST(CircularQueueTest, WrapAroundDoesNotGrow) {
+  CircularQueue<int> queue(4);
+  int next_pushed = 0;
+  int next_popped = 0;
+  for (int i = 0; i < 100; i++) {
+    queue.push_back(next_pushed++);
+    queue.push_back(next_pushed++);
+    EXPECT_EQ(next_popped++, queue.front());
+    queue.pop_front();
+    EXPECT_EQ(next_popped++, queue.front());
+    queue.pop_front();
+  }
+  EXPECT_TRUE(queue.empty());
+  EXPECT_EQ(4u, queue.capacity());
+}
+
+TEST(CircularQueueTest, GrowKeepsOrder) {
+  CircularQueue<int> queue(4);
+  // Move the begin of the queue to the middle of the buffer first.
+  queue.push_back(-1);
+  queue.push_back(-1);
+  queue.pop_front();
+  queue.pop_front();
+  for (int i = 0; i < 100; i++)
+    queue.push_back(i);
+  EXPECT_EQ(128u, queue.capacity());
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ(i, queue.front());
+    queue.pop_front();
+  }
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(CircularQueueTest, PopReleasesElement) {
+  CircularQueue<std::shared_ptr<int>> queue;
+  std::shared_ptr<int> value(new int(42));
+  queue.push_back(value);
+  EXPECT_EQ(2, value.use_count());
+  queue.pop_front();
+  EXPECT_EQ(1, value.use_count());
+}
+
+}  // namespace
+}  // namespace base
+}  // namespace perfetto
@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/base/epoll_task_runner.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/utils.h"
+
+namespace perfetto {
+namespace base {
+
+namespace {
+
+constexpr int kMaxEventsPerWait = 64;
+
+// Edge-triggered and disarmed after each event. RunFileDescriptorWatch()
+// re-arms the fd, which also re-reports it if it's still readable.
+constexpr uint32_t kWatchEvents = EPOLLIN | EPOLLHUP | EPOLLET | EPOLLONESHOT;
+
+bool EpollCtl(int epoll_fd, int op, int fd, uint32_t events) {
+  struct epoll_event ev = {};
+  ev.events = events;
+  ev.data.fd = fd;
+  return epoll_ctl(epoll_fd, op, fd, &ev) == 0;
+}
+
+}  // namespace
+
+EpollTaskRunner::EpollTaskRunner()
+    : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)),
+      timer_fd_(
+          timerfd_create(kWallTimeClockSource, TFD_NONBLOCK | TFD_CLOEXEC)) {
+  PERFETTO_CHECK(epoll_fd_);
+  PERFETTO_CHECK(timer_fd_);
+  // These two are level-triggered and never disarmed, Run() clears them.
+  PERFETTO_CHECK(EpollCtl(*epoll_fd_, EPOLL_CTL_ADD, event_.fd(), EPOLLIN));
+  PERFETTO_CHECK(EpollCtl(*epoll_fd_, EPOLL_CTL_ADD, *timer_fd_, EPOLLIN));
+}
+
+EpollTaskRunner::~EpollTaskRunner() = default;
+
+// static
+bool EpollTaskRunner::IsLater(const DelayedTask& a, const DelayedTask& b) {
+  if (a.run_time != b.run_time)
+    return a.run_time > b.run_time;
+  return a.seq > b.seq;
+}
+
+void EpollTaskRunner::WakeUp() {
+  event_.Notify();
+}
+
+void EpollTaskRunner::Run() {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  quit_ = false;
+  struct epoll_event events[kMaxEventsPerWait];
+  for (;;) {
+    int timeout_ms;
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      if (quit_)
+        return;
+      // Delayed tasks wake us up through |timer_fd_|.
+      timeout_ms = immediate_tasks_.empty() ? -1 : 0;
+    }
+    int ret = PERFETTO_EINTR(
+        epoll_wait(*epoll_fd_, events, kMaxEventsPerWait, timeout_ms));
+    PERFETTO_CHECK(ret >= 0);
+
+    for (int i = 0; i < ret; i++) {
+      int fd = events[i].data.fd;
+      // The wake-up event is handled inline to avoid an infinite recursion of
+      // posted tasks.
+      if (fd == event_.fd()) {
+        event_.Clear();
+        continue;
+      }
+      if (fd == *timer_fd_) {
+        uint64_t expirations;
+        ssize_t rsize = read(*timer_fd_, &expirations, sizeof(expirations));
+        PERFETTO_DCHECK(rsize == sizeof(expirations) || errno == EAGAIN);
+        ignore_result(rsize);
+        // Re-arm the timer in case the expired task has been run already.
+        std::lock_guard<std::mutex> lock(lock_);
+        timer_run_time_ = TimeMillis(0);
+        UpdateTimerLocked();
+        continue;
+      }
+
+      // The fd has been disarmed by EPOLLONESHOT, RunFileDescriptorWatch()
+      // will re-arm it. Binding to |this| is safe since we are the only object
+      // executing the task.
+      PostTask(std::bind(&EpollTaskRunner::RunFileDescriptorWatch, this, fd));
+    }
+
+    // To avoid starvation we always interleave all types of tasks -- immediate,
+    // delayed and file descriptor watches.
+    RunImmediateAndDelayedTask();
+  }
+}
+
+void EpollTaskRunner::Quit() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    quit_ = true;
+  }
+  WakeUp();
+}
+
+bool EpollTaskRunner::IsIdleForTesting() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return immediate_tasks_.empty();
+}
+
+void EpollTaskRunner::RunImmediateAndDelayedTask() {
+  std::function<void()> immediate_task;
+  std::function<void()> delayed_task;
+  TimeMillis now = GetWallTimeMs();
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (!immediate_tasks_.empty()) {
+      immediate_task = std::move(immediate_tasks_.front());
+      immediate_tasks_.pop_front();
+    }
+    if (!delayed_tasks_.empty() && now >= delayed_tasks_.front().run_time) {
+      std::pop_heap(delayed_tasks_.begin(), delayed_tasks_.end(), &IsLater);
+      delayed_task = std::move(delayed_tasks_.back().task);
+      delayed_tasks_.pop_back();
+      UpdateTimerLocked();
+    }
+  }
+
+  errno = 0;
+  if (immediate_task)
+    RunTask(immediate_task);
+  errno = 0;
+  if (delayed_task)
+    RunTask(delayed_task);
+}
+
+void EpollTaskRunner::RunFileDescriptorWatch(int fd) {
+  std::function<void()> task;
+  bool always_ready;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    auto it = watch_tasks_.find(fd);
+    if (it == watch_tasks_.end())
+      return;
+    always_ready = it->second.always_ready;
+    // Re-arm the fd before running the task, as UnixTaskRunner does, so that
+    // an fd that is not fully drained by the task is reported again.
+    if (!always_ready && !EpollCtl(*epoll_fd_, EPOLL_CTL_MOD, fd, kWatchEvents))
+      PERFETTO_DPLOG("epoll_ctl(MOD, %d)", fd);
+    task = it->second.callback;
+  }
+  errno = 0;
+  RunTask(task);
+  if (always_ready)
+    PostTask(std::bind(&EpollTaskRunner::RunFileDescriptorWatch, this, fd));
+}
+
+void EpollTaskRunner::UpdateTimerLocked() {
+  TimeMillis run_time(0);
+  if (!delayed_tasks_.empty()) {
+    // A zero |it_value| would disarm the timer.
+    run_time = std::max(delayed_tasks_.front().run_time, TimeMillis(1));
+  }
+  if (run_time == timer_run_time_)
+    return;
+  timer_run_time_ = run_time;
+  struct itimerspec timer_spec = {};
+  timer_spec.it_value = ToPosixTimespec(run_time);
+  if (timerfd_settime(*timer_fd_, TFD_TIMER_ABSTIME, &timer_spec, nullptr))
+    PERFETTO_DPLOG("timerfd_settime");
+}
+
+void EpollTaskRunner::PostTask(std::function<void()> task) {
+  bool was_empty;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    was_empty = immediate_tasks_.empty();
+    immediate_tasks_.push_back(std::move(task));
+  }
+  if (was_empty)
+    WakeUp();
+}
+
+void EpollTaskRunner::PostDelayedTask(std::function<void()> task,
+                                      uint32_t delay_ms) {
+  TimeMillis run_time = GetWallTimeMs() + TimeMillis(delay_ms);
+  std::lock_guard<std::mutex> lock(lock_);
+  delayed_tasks_.push_back({run_time, ++last_delayed_task_seq_, std::move(task)});
+  std::push_heap(delayed_tasks_.begin(), delayed_tasks_.end(), &IsLater);
+  // The timer wakes up the task runner, no need for WakeUp().
+  UpdateTimerLocked();
+}
+
+void EpollTaskRunner::AddFileDescriptorWatch(int fd,
+                                             std::function<void()> task) {
+  PERFETTO_DCHECK(fd >= 0);
+  bool always_ready = false;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    PERFETTO_DCHECK(!watch_tasks_.count(fd));
+    if (!EpollCtl(*epoll_fd_, EPOLL_CTL_ADD, fd, kWatchEvents)) {
+      PERFETTO_CHECK(errno == EPERM);
+      always_ready = true;
+    }
+    watch_tasks_[fd] = {std::move(task), always_ready};
+  }
+  if (always_ready)
+    PostTask(std::bind(&EpollTaskRunner::RunFileDescriptorWatch, this, fd));
+}
+
+void EpollTaskRunner::RemoveFileDescriptorWatch(int fd) {
+  PERFETTO_DCHECK(fd >= 0);
+  std::lock_guard<std::mutex> lock(lock_);
+  auto it = watch_tasks_.find(fd);
+  PERFETTO_DCHECK(it != watch_tasks_.end());
+  if (it == watch_tasks_.end())
+    return;
+  // This fails harmlessly if the fd has already been closed, in which case the
+  // kernel has removed it from the epoll set already.
+  if (!it->second.always_ready)
+    epoll_ctl(*epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  watch_tasks_.erase(it);
+}
+
+}  // namespace base
+}  // namespace perfetto
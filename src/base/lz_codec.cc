@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/base/lz_codec.h"
+
+#include <string.h>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace base {
+
+namespace {
+
+constexpr size_t kHashLog = 12;
+constexpr size_t kHashSize = 1 << kHashLog;
+
+// Matches are never started within the last kLastLiterals bytes of the input.
+// This guarantees that Read32() never reads past the end of |src|.
+constexpr size_t kLastLiterals = 5;
+
+constexpr size_t kRunMask = 15;
+
+inline uint32_t Read32(const uint8_t* ptr) {
+  uint32_t value;
+  memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+inline uint32_t Hash(uint32_t value) {
+  return (value * 2654435761u) >> (32 - kHashLog);
+}
+
+inline size_t LengthExtSize(size_t len) {
+  return len < kRunMask ? 0 : (len - kRunMask) / 255 + 1;
+}
+
+inline uint8_t* WriteLengthExt(uint8_t* dst, size_t len) {
+  for (len -= kRunMask; len >= 255; len -= 255)
+    *(dst++) = 255;
+  *(dst++) = static_cast<uint8_t>(len);
+  return dst;
+}
+
+inline bool ReadLengthExt(const uint8_t** ptr,
+                          const uint8_t* end,
+                          size_t* len) {
+  for (;;) {
+    if (*ptr >= end)
+      return false;
+    uint8_t byte = *((*ptr)++);
+    *len += byte;
+    if (byte != 255)
+      return true;
+  }
+}
+
+// Emits a sequence made of |literals_size| literals followed (iff
+// |match_len| > 0) by a back-reference. Returns nullptr if |dst_end| is hit.
+uint8_t* EmitSequence(uint8_t* dst,
+                      uint8_t* dst_end,
+                      const uint8_t* literals,
+                      size_t literals_size,
+                      size_t offset,
+                      size_t match_len) {
+  size_t match_code = match_len ? match_len - kLzMinMatch : 0;
+  size_t required = 1 + LengthExtSize(literals_size) + literals_size;
+  if (match_len)
+    required += 2 + LengthExtSize(match_code);
+  if (required > static_cast<size_t>(dst_end - dst))
+    return nullptr;
+
+  uint8_t* token = dst++;
+  *token = static_cast<uint8_t>(
+      (literals_size < kRunMask ? literals_size : kRunMask) << 4);
+  if (literals_size >= kRunMask)
+    dst = WriteLengthExt(dst, literals_size);
+  if (literals_size)
+    memcpy(dst, literals, literals_size);
+  dst += literals_size;
+
+  if (!match_len)
+    return dst;
+  PERFETTO_DCHECK(offset > 0 && offset <= kLzMaxOffset);
+  *(dst++) = static_cast<uint8_t>(offset & 0xff);
+  *(dst++) = static_cast<uint8_t>(offset >> 8);
+  *token |= static_cast<uint8_t>(match_code < kRunMask ? match_code : kRunMask);
+  if (match_code >= kRunMask)
+    dst = WriteLengthExt(dst, match_code);
+  return dst;
+}
+
+}  // namespace
+
+size_t LzCompress(const uint8_t* src,
+                  size_t src_size,
+                  uint8_t* dst,
+                  size_t dst_capacity) {
+  uint8_t* const dst_begin = dst;
+  uint8_t* const dst_end = dst + dst_capacity;
+
+  // Each entry holds (position + 1) of the last 4-byte sequence seen with the
+  // given hash, 0 means empty.
+  uint32_t table[kHashSize];
+  memset(table, 0, sizeof(table));
+
+  size_t anchor = 0;  // Start of the pending literals.
+  size_t pos = 0;
+  if (src_size > kLastLiterals + kLzMinMatch) {
+    const size_t match_limit = src_size - kLastLiterals;
+    while (pos + kLzMinMatch <= match_limit) {
+      const uint32_t seq = Read32(src + pos);
+      uint32_t* entry = &table[Hash(seq)];
+      const size_t candidate = *entry;
+      *entry = static_cast<uint32_t>(pos + 1);
+      if (candidate && pos - (candidate - 1) <= kLzMaxOffset &&
+          Read32(src + candidate - 1) == seq) {
+        const size_t ref = candidate - 1;
+        size_t match_len = kLzMinMatch;
+        while (pos + match_len < match_limit &&
+               src[ref + match_len] == src[pos + match_len]) {
+          match_len++;
+        }
+        dst = EmitSequence(dst, dst_end, src + anchor, pos - anchor, pos - ref,
+                           match_len);
+        if (!dst)
+          return 0;
+        pos += match_len;
+        anchor = pos;
+        continue;
+      }
+      // Skip faster through long runs of incompressible data.
+      pos += 1 + ((pos - anchor) >> 6);
+    }
+  }
+
+  dst = EmitSequence(dst, dst_end, src + anchor, src_size - anchor, 0, 0);
+  if (!dst)
+    return 0;
+  return static_cast<size_t>(dst - dst_begin);
+}
+
+bool LzDecompress(const uint8_t* src,
+                  size_t src_size,
+                  uint8_t* dst,
+                  size_t dst_size) {
+  const uint8_t* src_end = src + src_size;
+  uint8_t* const dst_begin = dst;
+  uint8_t* const dst_end = dst + dst_size;
+  while (src < src_end) {
+    const uint8_t token = *(src++);
+    size_t literals_size = token >> 4;
+    if (literals_size == kRunMask &&
+        !ReadLengthExt(&src, src_end, &literals_size)) {
+      return false;
+    }
+    if (literals_size > static_cast<size_t>(src_end - src) ||
+        literals_size > static_cast<size_t>(dst_end - dst)) {
+      return false;
+    }
+    if (literals_size)
+      memcpy(dst, src, literals_size);
+    src += literals_size;
+    dst += literals_size;
+
+    // The last sequence of the block has only literals.
+    if (src == src_end)
+      break;
+
+    if (src_end - src < 2)
+      return false;
+    const size_t offset = src[0] | static_cast<size_t>(src[1]) << 8;
+    src += 2;
+    if (offset == 0 || offset > static_cast<size_t>(dst - dst_begin))
+      return false;
+    size_t match_len = token & kRunMask;
+    if (match_len == kRunMask && !ReadLengthExt(&src, src_end, &match_len))
+      return false;
+    match_len += kLzMinMatch;
+    if (match_len > static_cast<size_t>(dst_end - dst))
+      return false;
+    const uint8_t* ref = dst - offset;
+    if (offset >= match_len) {
+      memcpy(dst, ref, match_len);
+      dst += match_len;
+    } else {
+      // Overlapping copy (e.g. a run of the same byte), must go forward.
+      for (size_t i = 0; i < match_len; i++)
+        *(dst++) = *(ref++);
+    }
+  }
+  return dst == dst_end;
+}
+
+}  // namespace base
+}  // namespace perfetto
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/base/lz_codec.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace base {
+namespace {
+
+std::vector<uint8_t> Compress(const std::vector<uint8_t>& src) {
+  std::vector<uint8_t> dst(LzCompressBound(src.size()));
+  size_t size = LzCompress(src.data(), src.size(), dst.data(), dst.size());
+  EXPECT_GT(size, 0u);
+  dst.resize(size);
+  return dst;
+}
+
+void CheckRoundTrip(const std::vector<uint8_t>& src) {
+  std::vector<uint8_t> compressed = Compress(src);
+  std::vector<uint8_t> decompressed(src.size());
+  ASSERT_TRUE(LzDecompress(compressed.data(), compressed.size(),
+                           decompressed.data(), decompressed.size()));
+  EXPECT_EQ(src, decompressed);
+}
+
+std::vector<uint8_t> RandomBytes(size_t size, uint32_t seed) {
+  std::minstd_rand0 rnd(seed);
+  std::vector<uint8_t> data(size);
+  for (size_t i = 0; i < size; i++)
+    data[i] = static_cast<uint8_t>(rnd());
+  return data;
+}
+
+TEST(LzCodecTest, EmptyAndTinyInputs) {
+  for (size_t size = 0; size < 16; size++)
+    CheckRoundTrip(RandomBytes(size, static_cast<uint32_t>(size)));
+}
+
+TEST(LzCodecTest, RepetitiveInputCompresses) {
+  std::string text;
+  for (int i = 0; i < 1000; i++)
+    text += "sched_switch: prev_comm=surfaceflinger next_comm=swapper/" +
+            std::to_string(i % 8) + "\n";
+  std::vector<uint8_t> src(text.begin(), text.end());
+  EXPECT_LT(Compress(src).size(), src.size() / 4);
+  CheckRoundTrip(src);
+}
+
+TEST(LzCodecTest, LongRunsAndOverlappingMatches) {
+  CheckRoundTrip(std::vector<uint8_t>(100000, 0));
+  std::vector<uint8_t> src = RandomBytes(3, 42);
+  for (size_t i = 0; i < 5000; i++)
+    src.push_back(src[i]);
+  CheckRoundTrip(src);
+}
+
+TEST(LzCodecTest, IncompressibleInput) {
+  std::vector<uint8_t> src = RandomBytes(65536, 1);
+  CheckRoundTrip(src);
+
+  // Bailing out when the output doesn't fit in the given capacity.
+  std::vector<uint8_t> dst(src.size() - 1);
+  EXPECT_EQ(0u, LzCompress(src.data(), src.size(), dst.data(), dst.size()));
+}
+
+TEST(LzCodecTest, MalformedInputIsRejected) {
+  std::vector<uint8_t> src = RandomBytes(1000, 3);
+  src.insert(src.end(), src.begin(), src.end());
+  std::vector<uint8_t> compressed = Compress(src);
+  std::vector<uint8_t> dst(src.size());
+
+  // Wrong decompressed size.
+  EXPECT_FALSE(LzDecompress(compressed.data(), compressed.size(), dst.data(),
+                            dst.size() - 1));
+  EXPECT_FALSE(LzDecompress(compressed.data(), compressed.size() - 1,
+                            dst.data(), dst.size()));
+
+  // Garbage input must never overflow |dst|.
+  for (uint32_t seed = 0; seed < 1000; seed++) {
+    std::vector<uint8_t> garbage = RandomBytes(64, seed);
+    LzDecompress(garbage.data(), garbage.size(), dst.data(), 128);
+  }
+
+  // Back-reference before the beginning of the output.
+  const uint8_t bad_offset[] = {0x10, 'a', 0x02, 0x00};
+  EXPECT_FALSE(LzDecompress(bad_offset, sizeof(bad_offset), dst.data(), 5));
+}
+
+}  // namespace
+}  // namespace base
+}  // namespace perfetto
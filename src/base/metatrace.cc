@@ -17,11 +17,19 @@
 #include "perfetto/base/metatrace.h"
 
 #include <fcntl.h>
+#include <stdio.h>
 #include <stdlib.h>
 
-#include "perfetto/base/build_config.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include "perfetto/base/file_utils.h"
-#include "perfetto/base/time.h"
+#include "perfetto/base/logging.h"
 
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
 #include <corecrt_io.h>
@@ -31,30 +39,203 @@ namespace perfetto {
 namespace base {
 
 namespace {
-int MaybeOpenTraceFile() {
-  static const char* tracing_path = getenv("PERFETTO_METATRACE_FILE");
-  if (tracing_path == nullptr)
-    return -1;
-  static int fd = open(tracing_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-  return fd;
+
+constexpr auto kFlushPeriod = std::chrono::milliseconds(100);
+
+// Single-producer (the owning thread) single-consumer (ReadRecords(), which is
+// serialized by the Registry mutex) ring buffer. When full, new records are
+// dropped rather than overwriting old ones, so that the reader never observes
+// a record while it is being written.
+class Ring {
+ public:
+  void Append(const MetaTrace::Record& record) {
+    uint64_t wr = write_pos_.load(std::memory_order_relaxed);
+    uint64_t rd = read_pos_.load(std::memory_order_acquire);
+    if (PERFETTO_UNLIKELY(wr - rd >= MetaTrace::kRingCapacity)) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    records_[wr % MetaTrace::kRingCapacity] = record;
+    write_pos_.store(wr + 1, std::memory_order_release);
+  }
+
+  uint64_t Read(const MetaTrace::ReadCallback& callback) {
+    uint64_t rd = read_pos_.load(std::memory_order_relaxed);
+    uint64_t wr = write_pos_.load(std::memory_order_acquire);
+    for (; rd < wr; rd++)
+      callback(records_[rd % MetaTrace::kRingCapacity]);
+    read_pos_.store(wr, std::memory_order_release);
+    return dropped_.exchange(0, std::memory_order_relaxed);
+  }
+
+  bool empty() const {
+    return write_pos_.load(std::memory_order_relaxed) ==
+           read_pos_.load(std::memory_order_relaxed);
+  }
+
+  // True while the ring is owned by a live thread. Guarded by Registry::mutex.
+  bool in_use = false;
+
+ private:
+  std::array<MetaTrace::Record, MetaTrace::kRingCapacity> records_;
+  std::atomic<uint64_t> write_pos_{0};
+  std::atomic<uint64_t> read_pos_{0};
+  std::atomic<uint64_t> dropped_{0};
+};
+
+struct Registry {
+  std::mutex mutex;
+
+  // Never shrinks: the ring of an exited thread is kept, with its pending
+  // records, and handed over to the next thread that needs one once drained.
+  std::vector<std::unique_ptr<Ring>> rings;
+};
+
+Registry* GetRegistry() {
+  static Registry* registry = new Registry();
+  return registry;
+}
+
+// Releases the ring of the calling thread when the thread exits.
+class ThreadRingHolder {
+ public:
+  ~ThreadRingHolder() {
+    if (!ring)
+      return;
+    std::lock_guard<std::mutex> lock(GetRegistry()->mutex);
+    ring->in_use = false;
+  }
+
+  Ring* ring = nullptr;
+};
+
+thread_local ThreadRingHolder g_thread_ring;
+
+Ring* GetThreadRing() {
+  if (PERFETTO_LIKELY(g_thread_ring.ring))
+    return g_thread_ring.ring;
+  Registry* registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  Ring* ring = nullptr;
+  for (const auto& it : registry->rings) {
+    if (!it->in_use && it->empty()) {
+      ring = it.get();
+      break;
+    }
+  }
+  if (!ring) {
+    registry->rings.emplace_back(new Ring());
+    ring = registry->rings.back().get();
+  }
+  ring->in_use = true;
+  g_thread_ring.ring = ring;
+  return ring;
+}
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+void FlushToFileForever(int fd) {
+  // The JSON array is never terminated as the process can go away at any
+  // point. Both trace_processor and catapult tolerate that.
+  ignore_result(WriteAll(fd, "[\n", 2));
+  std::string json;
+  for (;;) {
+    std::this_thread::sleep_for(kFlushPeriod);
+    json.clear();
+    MetaTrace::ReadRecords([&json](const MetaTrace::Record& record) {
+      json += MetaTrace::RecordToJson(record);
+    });
+    if (!json.empty())
+      ignore_result(WriteAll(fd, json.data(), json.size()));
+  }
 }
+#endif
+
 }  // namespace
 
-void MetaTrace::WriteEvent(char type, const char* evt_name, size_t cpu) {
-  int fd = MaybeOpenTraceFile();
-  if (fd == -1)
-    return;
+// static
+constexpr size_t MetaTrace::kRingCapacity;
+
+std::atomic<MetaTrace::State> MetaTrace::g_state_{State::kUninitialized};
+
+// static
+MetaTrace::State MetaTrace::InitFromEnv() {
+  static const State env_state = [] {
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+    const char* path = getenv("PERFETTO_METATRACE_FILE");
+    if (path) {
+      int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd != -1) {
+        std::thread(FlushToFileForever, fd).detach();
+        return State::kEnabled;
+      }
+      PERFETTO_PLOG("Failed to open %s", path);
+    }
+#endif
+    return State::kDisabled;
+  }();
+
+  // Enable() and Disable() take precedence over the env var.
+  State state = State::kUninitialized;
+  if (g_state_.compare_exchange_strong(state, env_state,
+                                       std::memory_order_relaxed)) {
+    return env_state;
+  }
+  return state;
+}
+
+// static
+void MetaTrace::Enable() {
+  InitFromEnv();
+  g_state_.store(State::kEnabled, std::memory_order_relaxed);
+}
 
-  // The JSON event format expects both "pid" and "tid" fields to create
-  // per-process tracks. Here what we really want to achieve is having one track
-  // per cpu. So we just pretend that each CPU is its own process with
-  // pid == tid == cpu.
+// static
+void MetaTrace::Disable() {
+  InitFromEnv();
+  g_state_.store(State::kDisabled, std::memory_order_relaxed);
+}
+
+// static
+bool MetaTrace::IsEnabled() {
+  State state = g_state_.load(std::memory_order_relaxed);
+  if (state == State::kUninitialized)
+    state = InitFromEnv();
+  return state == State::kEnabled;
+}
+
+// static
+uint64_t MetaTrace::ReadRecords(const ReadCallback& callback) {
+  Registry* registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  uint64_t dropped = 0;
+  for (const auto& ring : registry->rings)
+    dropped += ring->Read(callback);
+  return dropped;
+}
+
+// static
+std::string MetaTrace::RecordToJson(const Record& record) {
   char json[256];
-  int len = sprintf(json,
-                    "{\"ts\": %f, \"cat\": \"PERF\", \"ph\": \"%c\", \"name\": "
-                    "\"%s\", \"pid\": %zu, \"tid\": %zu},\n",
-                    GetWallTimeNs().count() / 1000.0, type, evt_name, cpu, cpu);
-  ignore_result(WriteAll(fd, json, static_cast<size_t>(len)));
+  int len = snprintf(json, sizeof(json),
+                     "{\"ts\": %.3f, \"dur\": %.3f, \"cat\": \"PERF\", "
+                     "\"ph\": \"X\", \"name\": \"%s\", \"pid\": %u, "
+                     "\"tid\": %u},\n",
+                     static_cast<double>(record.begin_ns) / 1000.0,
+                     static_cast<double>(record.duration_ns) / 1000.0,
+                     record.name, record.arg, record.arg);
+  PERFETTO_DCHECK(len > 0 && static_cast<size_t>(len) < sizeof(json));
+  return std::string(json, static_cast<size_t>(len));
+}
+
+void MetaTrace::WriteRecord() {
+  Record record;
+  record.begin_ns = begin_ns_;
+  uint64_t end_ns = static_cast<uint64_t>(GetWallTimeNs().count());
+  record.duration_ns = static_cast<uint32_t>(
+      std::min<uint64_t>(end_ns - begin_ns_, UINT32_MAX));
+  record.arg = arg_;
+  record.name = evt_name_;
+  GetThreadRing()->Append(record);
 }
 
 }  // namespace base
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/base/metatrace.h"
+
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace base {
+namespace {
+
+class MetaTraceTest : public ::testing::Test {
+ public:
+  void SetUp() override { ReadAll(); }
+  void TearDown() override { MetaTrace::Disable(); }
+
+  static std::vector<MetaTrace::Record> ReadAll(uint64_t* dropped = nullptr) {
+    std::vector<MetaTrace::Record> records;
+    uint64_t res = MetaTrace::ReadRecords(
+        [&records](const MetaTrace::Record& r) { records.push_back(r); });
+    if (dropped)
+      *dropped = res;
+    return records;
+  }
+};
+
+TEST_F(MetaTraceTest, NoRecordsWhenDisabled) {
+  MetaTrace::Disable();
+  EXPECT_FALSE(MetaTrace::IsEnabled());
+  { PERFETTO_METATRACE("evt", 1); }
+  EXPECT_TRUE(ReadAll().empty());
+}
+
+TEST_F(MetaTraceTest, NestedScopes) {
+  MetaTrace::Enable();
+  EXPECT_TRUE(MetaTrace::IsEnabled());
+  {
+    PERFETTO_METATRACE("outer", 1);
+    { PERFETTO_METATRACE("inner", 2); }
+  }
+  std::vector<MetaTrace::Record> records = ReadAll();
+  ASSERT_EQ(2u, records.size());
+
+  // Records are written when the scope ends, so the inner one comes first.
+  const MetaTrace::Record& inner = records[0];
+  const MetaTrace::Record& outer = records[1];
+  EXPECT_STREQ("inner", inner.name);
+  EXPECT_EQ(2u, inner.arg);
+  EXPECT_STREQ("outer", outer.name);
+  EXPECT_EQ(1u, outer.arg);
+  EXPECT_LE(outer.begin_ns, inner.begin_ns);
+  EXPECT_GE(outer.begin_ns + outer.duration_ns,
+            inner.begin_ns + inner.duration_ns);
+
+  EXPECT_TRUE(ReadAll().empty());
+}
+
+TEST_F(MetaTraceTest, FullRingDropsNewRecords) {
+  MetaTrace::Enable();
+  for (size_t i = 0; i < MetaTrace::kRingCapacity + 10; i++) {
+    PERFETTO_METATRACE("evt", i);
+  }
+  uint64_t dropped = 0;
+  std::vector<MetaTrace::Record> records = ReadAll(&dropped);
+  ASSERT_EQ(MetaTrace::kRingCapacity, records.size());
+  EXPECT_EQ(10u, dropped);
+  for (size_t i = 0; i < records.size(); i++)
+    EXPECT_EQ(i, records[i].arg);
+
+  // Once drained, the ring accepts records again.
+  { PERFETTO_METATRACE("evt", 42); }
+  records = ReadAll(&dropped);
+  ASSERT_EQ(1u, records.size());
+  EXPECT_EQ(42u, records[0].arg);
+  EXPECT_EQ(0u, dropped);
+}
+
+TEST_F(MetaTraceTest, ConcurrentWritersAndReader) {
+  constexpr uint32_t kNumThreads = 4;
+  constexpr uint32_t kEventsPerThread = 500;
+  MetaTrace::Enable();
+
+  std::map<uint32_t, uint32_t> events_per_arg;
+  auto read = [&events_per_arg] {
+    for (const auto& record : ReadAll())
+      events_per_arg[record.arg]++;
+  };
+
+  // Run two rounds, so that the second one reuses the rings of the threads
+  // that exited in the first.
+  for (int round = 0; round < 2; round++) {
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < kNumThreads; i++) {
+      threads.emplace_back([i] {
+        for (uint32_t j = 0; j < kEventsPerThread; j++) {
+          PERFETTO_METATRACE("evt", i);
+        }
+      });
+    }
+    for (int i = 0; i < 10; i++)
+      read();
+    for (auto& thread : threads)
+      thread.join();
+  }
+  read();
+
+  ASSERT_EQ(kNumThreads, events_per_arg.size());
+  for (const auto& it : events_per_arg)
+    EXPECT_EQ(2 * kEventsPerThread, it.second);
+}
+
+TEST_F(MetaTraceTest, RecordToJson) {
+  MetaTrace::Record record{};
+  record.begin_ns = 1500;
+  record.duration_ns = 2000;
+  record.arg = 3;
+  record.name = "evt";
+  EXPECT_EQ(
+      "{\"ts\": 1.500, \"dur\": 2.000, \"cat\": \"PERF\", \"ph\": \"X\", "
+      "\"name\": \"evt\", \"pid\": 3, \"tid\": 3},\n",
+      MetaTrace::RecordToJson(record));
+}
+
+}  // namespace
+}  // namespace base
+}  // namespace perfetto
@@ -25,6 +25,14 @@
 #include "perfetto/base/android_task_runner.h"
 #endif
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+#include "perfetto/base/epoll_task_runner.h"
+#endif
+
+#include <fcntl.h>
+
+#include <string>
 #include <thread>
 
 #include "perfetto/base/file_utils.h"
@@ -42,7 +50,11 @@ class TaskRunnerTest : public ::testing::Test {
 
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID) && \
     !PERFETTO_BUILDFLAG(PERFETTO_CHROMIUM_BUILD)
-using TaskRunnerTypes = ::testing::Types<AndroidTaskRunner, UnixTaskRunner>;
+using TaskRunnerTypes =
+    ::testing::Types<AndroidTaskRunner, UnixTaskRunner, EpollTaskRunner>;
+#elif PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+using TaskRunnerTypes = ::testing::Types<UnixTaskRunner, EpollTaskRunner>;
 #else
 using TaskRunnerTypes = ::testing::Types<UnixTaskRunner>;
 #endif
@@ -271,6 +283,34 @@ TYPED_TEST(TaskRunnerTest, PostManyDelayedTasks) {
   task_runner.Run();
 }
 
+TYPED_TEST(TaskRunnerTest, DelayedTasksRunInDeadlineOrder) {
+  auto& task_runner = this->task_runner;
+  std::string order;
+  task_runner.PostDelayedTask([&order] { order += "c"; }, 20);
+  task_runner.PostDelayedTask([&order] { order += "a"; }, 10);
+  task_runner.PostDelayedTask([&order] { order += "d"; }, 20);
+  task_runner.PostDelayedTask([&order] { order += "b"; }, 10);
+  task_runner.PostDelayedTask([&task_runner] { task_runner.Quit(); }, 30);
+  task_runner.Run();
+  EXPECT_EQ("abcd", order);
+}
+
+TYPED_TEST(TaskRunnerTest, FileDescriptorWatchOnRegularFile) {
+  // Files that don't support polling, like /dev/null, are always readable.
+  auto& task_runner = this->task_runner;
+  ScopedFile fd(open("/dev/null", O_RDONLY));
+  ASSERT_TRUE(fd);
+  int num_calls = 0;
+  task_runner.AddFileDescriptorWatch(*fd, [&task_runner, &fd, &num_calls] {
+    if (++num_calls < 3)
+      return;
+    task_runner.RemoveFileDescriptorWatch(*fd);
+    task_runner.Quit();
+  });
+  task_runner.Run();
+  EXPECT_EQ(3, num_calls);
+}
+
 TYPED_TEST(TaskRunnerTest, RunAgain) {
   auto& task_runner = this->task_runner;
   int counter = 0;
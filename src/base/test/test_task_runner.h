@@ -31,6 +31,8 @@
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID) && \
     !PERFETTO_BUILDFLAG(PERFETTO_CHROMIUM_BUILD)
 #include "perfetto/base/android_task_runner.h"
+#elif PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
+#include "perfetto/base/epoll_task_runner.h"
 #endif
 
 namespace perfetto {
@@ -39,6 +41,8 @@ namespace base {
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID) && \
     !PERFETTO_BUILDFLAG(PERFETTO_CHROMIUM_BUILD)
 using PlatformTaskRunner = AndroidTaskRunner;
+#elif PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
+using PlatformTaskRunner = EpollTaskRunner;
 #else
 using PlatformTaskRunner = UnixTaskRunner;
 #endif
@@ -251,11 +251,18 @@ ssize_t UnixSocketRaw::Send(const void* msg,
                             size_t len,
                             const int* send_fds,
                             size_t num_fds) {
+  iovec iov = {const_cast<void*>(msg), len};
+  return Send(&iov, 1, send_fds, num_fds);
+}
+
+ssize_t UnixSocketRaw::Send(struct iovec* iov,
+                            size_t iov_len,
+                            const int* send_fds,
+                            size_t num_fds) {
   PERFETTO_DCHECK(fd_);
   msghdr msg_hdr = {};
-  iovec iov = {const_cast<void*>(msg), len};
-  msg_hdr.msg_iov = &iov;
-  msg_hdr.msg_iovlen = 1;
+  msg_hdr.msg_iov = iov;
+  msg_hdr.msg_iovlen = static_cast<decltype(msg_hdr.msg_iovlen)>(iov_len);
   alignas(cmsghdr) char control_buf[256];
 
   if (num_fds > 0) {
@@ -389,6 +396,16 @@ std::unique_ptr<UnixSocket> UnixSocket::Connect(const std::string& socket_name,
   return sock;
 }
 
+// static
+std::unique_ptr<UnixSocket> UnixSocket::AdoptConnected(
+    ScopedFile fd,
+    EventListener* event_listener,
+    TaskRunner* task_runner,
+    SockType sock_type) {
+  return std::unique_ptr<UnixSocket>(new UnixSocket(
+      event_listener, task_runner, std::move(fd), State::kConnected, sock_type));
+}
+
 UnixSocket::UnixSocket(EventListener* event_listener,
                        TaskRunner* task_runner,
                        SockType sock_type)
@@ -560,6 +577,15 @@ bool UnixSocket::Send(const void* msg,
                       const int* send_fds,
                       size_t num_fds,
                       BlockingMode blocking_mode) {
+  iovec iov = {const_cast<void*>(msg), len};
+  return Send(&iov, 1, send_fds, num_fds, blocking_mode);
+}
+
+bool UnixSocket::Send(struct iovec* iov,
+                      size_t iov_len,
+                      const int* send_fds,
+                      size_t num_fds,
+                      BlockingMode blocking_mode) {
   // TODO(b/117139237): Non-blocking sends are broken because we do not
   // properly handle partial sends.
   PERFETTO_DCHECK(blocking_mode == BlockingMode::kBlocking);
@@ -571,7 +597,10 @@ bool UnixSocket::Send(const void* msg,
 
   if (blocking_mode == BlockingMode::kBlocking)
     sock_raw_.SetBlocking(true);
-  const ssize_t sz = sock_raw_.Send(msg, len, send_fds, num_fds);
+  size_t len = 0;
+  for (size_t i = 0; i < iov_len; i++)
+    len += iov[i].iov_len;
+  const ssize_t sz = sock_raw_.Send(iov, iov_len, send_fds, num_fds);
   int saved_errno = errno;
   if (blocking_mode == BlockingMode::kBlocking)
     sock_raw_.SetBlocking(false);
@@ -624,6 +653,15 @@ void UnixSocket::Shutdown(bool notify) {
   state_ = State::kDisconnected;
 }
 
+ScopedFile UnixSocket::ReleaseSocket() {
+  PERFETTO_DCHECK(state_ == State::kConnected);
+  // The pending OnEvent() callbacks, if any, will see a disconnected socket
+  // and bail out.
+  task_runner_->RemoveFileDescriptorWatch(sock_raw_.fd());
+  state_ = State::kDisconnected;
+  return sock_raw_.ReleaseFd();
+}
+
 size_t UnixSocket::Receive(void* msg,
                            size_t len,
                            ScopedFile* fd_vec,
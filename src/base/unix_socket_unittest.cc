@@ -717,6 +717,31 @@ TEST_F(UnixSocketTest, PartialSendMsgAll) {
   ASSERT_EQ(memcmp(send_buf, recv_buf, sizeof(send_buf)), 0);
 }
 
+TEST_F(UnixSocketTest, ScatteredSendWithFd) {
+  UnixSocketRaw send_sock;
+  UnixSocketRaw recv_sock;
+  std::tie(send_sock, recv_sock) = UnixSocketRaw::CreatePair(SockType::kStream);
+  ASSERT_TRUE(send_sock);
+  ASSERT_TRUE(recv_sock);
+
+  char hello[] = "hello ";
+  char empty[] = "";
+  char world[] = "world";
+  struct iovec iov[3] = {{hello, strlen(hello)},
+                         {empty, 0},
+                         {world, sizeof(world)}};
+  int send_fd = send_sock.fd();
+  ASSERT_EQ(static_cast<ssize_t>(strlen(hello) + sizeof(world)),
+            send_sock.Send(iov, base::ArraySize(iov), &send_fd, 1));
+
+  char recv_buf[32];
+  ScopedFile recv_fd;
+  ASSERT_EQ(static_cast<ssize_t>(strlen(hello) + sizeof(world)),
+            recv_sock.Receive(recv_buf, sizeof(recv_buf), &recv_fd, 1));
+  ASSERT_STREQ("hello world", recv_buf);
+  ASSERT_TRUE(recv_fd);
+}
+
 // TODO(primiano): add a test to check that in the case of a peer sending a fd
 // and the other end just doing a recv (without taking it), the fd is closed and
 // not left around.
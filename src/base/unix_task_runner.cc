@@ -40,17 +40,25 @@ void UnixTaskRunner::WakeUp() {
   event_.Notify();
 }
 
+bool UnixTaskRunner::RunsTasksOnCurrentThread() const {
+  return run_thread_id_.load(std::memory_order_relaxed) ==
+         std::this_thread::get_id();
+}
+
 void UnixTaskRunner::Run() {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   quit_ = false;
+  run_thread_id_ = std::this_thread::get_id();
   for (;;) {
     int poll_timeout_ms;
     {
       std::lock_guard<std::mutex> lock(lock_);
       if (quit_)
-        return;
+        break;
       poll_timeout_ms = GetDelayMsToNextTaskLocked();
       UpdateWatchTasksLocked();
+      // From now on, other threads need to wake us up to get anything done.
+      poll_pending_ = poll_timeout_ms != 0;
     }
     int ret = PERFETTO_EINTR(poll(
         &poll_fds_[0], static_cast<nfds_t>(poll_fds_.size()), poll_timeout_ms));
@@ -61,6 +69,8 @@ void UnixTaskRunner::Run() {
     PostFileDescriptorWatches();
     RunImmediateAndDelayedTask();
   }
+  // Tasks posted from now on, even from this thread, go through the inbox.
+  run_thread_id_ = std::thread::id();
 }
 
 void UnixTaskRunner::Quit() {
@@ -72,8 +82,40 @@ void UnixTaskRunner::Quit() {
 }
 
 bool UnixTaskRunner::IsIdleForTesting() {
+  PERFETTO_DCHECK(RunsTasksOnCurrentThread());
+  return !HasImmediateTasks() && !has_posted_tasks_;
+}
+
+void UnixTaskRunner::MovePostedTasks() {
+  if (!HasImmediateTasks()) {
+    // Common case: take the whole batch without copying it.
+    moved_tasks_.clear();
+    next_moved_task_ = 0;
+    std::lock_guard<std::mutex> lock(lock_);
+    posted_tasks_.swap(moved_tasks_);
+    has_posted_tasks_.store(false, std::memory_order_relaxed);
+    return;
+  }
   std::lock_guard<std::mutex> lock(lock_);
-  return immediate_tasks_.empty();
+  for (auto& task : posted_tasks_)
+    immediate_tasks_.push_back(std::move(task));
+  posted_tasks_.clear();
+  has_posted_tasks_.store(false, std::memory_order_relaxed);
+}
+
+bool UnixTaskRunner::HasImmediateTasks() const {
+  return next_moved_task_ < moved_tasks_.size() || !immediate_tasks_.empty();
+}
+
+std::function<void()> UnixTaskRunner::PopImmediateTask() {
+  std::function<void()> task;
+  if (next_moved_task_ < moved_tasks_.size()) {
+    task = std::move(moved_tasks_[next_moved_task_++]);
+  } else if (!immediate_tasks_.empty()) {
+    task = std::move(immediate_tasks_.front());
+    immediate_tasks_.pop_front();
+  }
+  return task;
 }
 
 void UnixTaskRunner::UpdateWatchTasksLocked() {
@@ -89,16 +131,15 @@ void UnixTaskRunner::UpdateWatchTasksLocked() {
 }
 
 void UnixTaskRunner::RunImmediateAndDelayedTask() {
-  // If locking overhead becomes an issue, add a separate work queue.
   std::function<void()> immediate_task;
   std::function<void()> delayed_task;
   TimeMillis now = GetWallTimeMs();
+  if (has_posted_tasks_.load(std::memory_order_acquire))
+    MovePostedTasks();
+  immediate_task = PopImmediateTask();
   {
     std::lock_guard<std::mutex> lock(lock_);
-    if (!immediate_tasks_.empty()) {
-      immediate_task = std::move(immediate_tasks_.front());
-      immediate_tasks_.pop_front();
-    }
+    poll_pending_ = false;
     if (!delayed_tasks_.empty()) {
       auto it = delayed_tasks_.begin();
       if (now >= it->first) {
@@ -131,9 +172,10 @@ void UnixTaskRunner::PostFileDescriptorWatches() {
     }
 
     // Binding to |this| is safe since we are the only object executing the
-    // task.
-    PostTask(std::bind(&UnixTaskRunner::RunFileDescriptorWatch, this,
-                       poll_fds_[i].fd));
+    // task. Unlike std::bind(), this lambda is small enough to be stored
+    // inline by std::function.
+    int fd = poll_fds_[i].fd;
+    PostTask([this, fd] { RunFileDescriptorWatch(fd); });
 
     // Make the fd negative while a posted task is pending. This makes poll(2)
     // ignore the fd.
@@ -164,7 +206,7 @@ void UnixTaskRunner::RunFileDescriptorWatch(int fd) {
 
 int UnixTaskRunner::GetDelayMsToNextTaskLocked() const {
   PERFETTO_DCHECK_THREAD(thread_checker_);
-  if (!immediate_tasks_.empty())
+  if (HasImmediateTasks() || has_posted_tasks_)
     return 0;
   if (!delayed_tasks_.empty()) {
     TimeMillis diff = delayed_tasks_.begin()->first - GetWallTimeMs();
@@ -174,36 +216,57 @@ int UnixTaskRunner::GetDelayMsToNextTaskLocked() const {
 }
 
 void UnixTaskRunner::PostTask(std::function<void()> task) {
-  bool was_empty;
+  if (RunsTasksOnCurrentThread()) {
+    // Tasks posted by other threads before this one must run first.
+    if (has_posted_tasks_.load(std::memory_order_acquire))
+      MovePostedTasks();
+    immediate_tasks_.push_back(std::move(task));
+    return;
+  }
+  bool wake_up;
   {
     std::lock_guard<std::mutex> lock(lock_);
-    was_empty = immediate_tasks_.empty();
-    immediate_tasks_.push_back(std::move(task));
+    posted_tasks_.push_back(std::move(task));
+    has_posted_tasks_.store(true, std::memory_order_release);
+    wake_up = poll_pending_;
+    poll_pending_ = false;
   }
-  if (was_empty)
+  if (wake_up)
     WakeUp();
 }
 
 void UnixTaskRunner::PostDelayedTask(std::function<void()> task,
                                      uint32_t delay_ms) {
   TimeMillis runtime = GetWallTimeMs() + TimeMillis(delay_ms);
+  bool wake_up;
   {
     std::lock_guard<std::mutex> lock(lock_);
+    // A wake-up is needed only if poll(2) would time out after |runtime|.
+    wake_up = poll_pending_ && (delayed_tasks_.empty() ||
+                                runtime < delayed_tasks_.begin()->first);
+    if (wake_up)
+      poll_pending_ = false;
     delayed_tasks_.insert(std::make_pair(runtime, std::move(task)));
   }
-  WakeUp();
+  if (wake_up)
+    WakeUp();
 }
 
 void UnixTaskRunner::AddFileDescriptorWatch(int fd,
                                             std::function<void()> task) {
   PERFETTO_DCHECK(fd >= 0);
+  bool wake_up;
   {
     std::lock_guard<std::mutex> lock(lock_);
     PERFETTO_DCHECK(!watch_tasks_.count(fd));
     watch_tasks_[fd] = {std::move(task), SIZE_MAX};
     watch_tasks_changed_ = true;
+    // Otherwise the poll set will be refreshed before the next poll(2).
+    wake_up = poll_pending_;
+    poll_pending_ = false;
   }
-  WakeUp();
+  if (wake_up)
+    WakeUp();
 }
 
 void UnixTaskRunner::RemoveFileDescriptorWatch(int fd) {
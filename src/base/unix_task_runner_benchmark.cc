@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "perfetto/base/unix_task_runner.h"
+
+namespace {
+
+using ::perfetto::base::UnixTaskRunner;
+
+constexpr int kTasksPerThread = 10000;
+
+// Measures the throughput of tasks posted concurrently by N other threads.
+static void BM_UnixTaskRunnerPostTaskFromThreads(benchmark::State& state) {
+  const int num_threads = static_cast<int>(state.range(0));
+  UnixTaskRunner task_runner;
+  for (auto _ : state) {
+    int remaining = num_threads * kTasksPerThread;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; i++) {
+      threads.emplace_back([&task_runner, &remaining] {
+        for (int j = 0; j < kTasksPerThread; j++) {
+          task_runner.PostTask([&task_runner, &remaining] {
+            if (--remaining == 0)
+              task_runner.Quit();
+          });
+        }
+      });
+    }
+    task_runner.Run();
+    for (auto& thread : threads)
+      thread.join();
+  }
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * num_threads * kTasksPerThread));
+}
+
+// Measures the throughput of tasks posted by other tasks, i.e. from the thread
+// that runs them.
+static void BM_UnixTaskRunnerPostTaskFromTask(benchmark::State& state) {
+  UnixTaskRunner task_runner;
+  for (auto _ : state) {
+    int remaining = kTasksPerThread;
+    std::function<void()> task;
+    task = [&task_runner, &remaining, &task] {
+      if (--remaining == 0) {
+        task_runner.Quit();
+        return;
+      }
+      task_runner.PostTask(task);
+    };
+    task_runner.PostTask(task);
+    task_runner.Run();
+  }
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * kTasksPerThread));
+}
+
+}  // namespace
+
+BENCHMARK(BM_UnixTaskRunnerPostTaskFromThreads)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4)
+    ->Arg(8)
+    ->UseRealTime();
+BENCHMARK(BM_UnixTaskRunnerPostTaskFromTask);
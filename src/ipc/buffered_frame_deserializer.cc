@@ -25,6 +25,7 @@
 #include "google/protobuf/io/zero_copy_stream_impl_lite.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/utils.h"
+#include "perfetto/protozero/proto_decoder.h"
 
 #include "src/ipc/wire_protocol.pb.h"
 
@@ -33,10 +34,156 @@ namespace ipc {
 
 namespace {
 
+using protozero::ProtoDecoder;
+using protozero::proto_utils::MakeTagLengthDelimited;
+using protozero::proto_utils::MakeTagVarInt;
+using protozero::proto_utils::ProtoWireType;
+using protozero::proto_utils::WriteVarInt;
+
 // The header is just the number of bytes of the Frame protobuf message.
 constexpr size_t kHeaderSize = sizeof(uint32_t);
+
+// Frames returned through RecycleFrame() are kept for reuse only if they are
+// at most this big, to not hold on to the memory of the (rare) large frames.
+constexpr int kMaxPooledFrameSize = static_cast<int>(base::kPageSize);
+constexpr size_t kMaxPooledFrames = 16;
+
+// Field ids of the Frame messages, taken from wire_protocol.proto so that the
+// hand-rolled encoding below can't go out of sync with it.
+constexpr uint32_t kFrameRequestId = Frame::kRequestIdFieldNumber;
+constexpr uint32_t kFrameInvokeMethod = Frame::kMsgInvokeMethodFieldNumber;
+constexpr uint32_t kFrameInvokeMethodReply =
+    Frame::kMsgInvokeMethodReplyFieldNumber;
+constexpr uint32_t kInvokeMethodServiceId =
+    Frame::InvokeMethod::kServiceIdFieldNumber;
+constexpr uint32_t kInvokeMethodMethodId =
+    Frame::InvokeMethod::kMethodIdFieldNumber;
+constexpr uint32_t kInvokeMethodArgsProto =
+    Frame::InvokeMethod::kArgsProtoFieldNumber;
+constexpr uint32_t kInvokeMethodDropReply =
+    Frame::InvokeMethod::kDropReplyFieldNumber;
+constexpr uint32_t kInvokeMethodReplySuccess =
+    Frame::InvokeMethodReply::kSuccessFieldNumber;
+constexpr uint32_t kInvokeMethodReplyHasMore =
+    Frame::InvokeMethodReply::kHasMoreFieldNumber;
+constexpr uint32_t kInvokeMethodReplyReplyProto =
+    Frame::InvokeMethodReply::kReplyProtoFieldNumber;
+
+bool DecodeInvokeMethod(const ProtoDecoder::Field& field,
+                        Frame::InvokeMethod* msg) {
+  ProtoDecoder decoder(field.data(), field.size());
+  for (auto f = decoder.ReadField(); f.id != 0; f = decoder.ReadField()) {
+    const bool is_varint = f.type == ProtoWireType::kVarInt;
+    if (f.id == kInvokeMethodServiceId && is_varint) {
+      msg->set_service_id(f.as_uint32());
+    } else if (f.id == kInvokeMethodMethodId && is_varint) {
+      msg->set_method_id(f.as_uint32());
+    } else if (f.id == kInvokeMethodArgsProto &&
+               f.type == ProtoWireType::kLengthDelimited) {
+      msg->set_args_proto(f.data(), f.size());
+    } else if (f.id == kInvokeMethodDropReply && is_varint) {
+      msg->set_drop_reply(f.int_value != 0);
+    } else {
+      return false;
+    }
+  }
+  return decoder.IsEndOfBuffer();
+}
+
+bool DecodeInvokeMethodReply(const ProtoDecoder::Field& field,
+                             Frame::InvokeMethodReply* msg) {
+  ProtoDecoder decoder(field.data(), field.size());
+  for (auto f = decoder.ReadField(); f.id != 0; f = decoder.ReadField()) {
+    const bool is_varint = f.type == ProtoWireType::kVarInt;
+    if (f.id == kInvokeMethodReplySuccess && is_varint) {
+      msg->set_success(f.int_value != 0);
+    } else if (f.id == kInvokeMethodReplyHasMore && is_varint) {
+      msg->set_has_more(f.int_value != 0);
+    } else if (f.id == kInvokeMethodReplyReplyProto &&
+               f.type == ProtoWireType::kLengthDelimited) {
+      msg->set_reply_proto(f.data(), f.size());
+    } else {
+      return false;
+    }
+  }
+  return decoder.IsEndOfBuffer();
+}
+
+// Decodes the InvokeMethod and InvokeMethodReply frames, which are the hot
+// ones, into |frame| without going through the libprotobuf parser. Unlike
+// Frame::Clear(), this keeps the (recycled) |frame|'s sub-message and strings,
+// so their memory is reused. Returns false if the frame is of any other type or
+// has any unexpected field, in which case the caller falls back on the full
+// parser, which also takes care of rejecting malformed frames.
+bool DecodeHotFrame(const char* data, size_t size, Frame* frame) {
+  ProtoDecoder decoder(reinterpret_cast<const uint8_t*>(data), size);
+  frame->clear_request_id();
+  frame->clear_data_for_testing();
+  frame->mutable_unknown_fields()->clear();
+  bool has_msg = false;
+  for (auto f = decoder.ReadField(); f.id != 0; f = decoder.ReadField()) {
+    if (f.id == kFrameRequestId && f.type == ProtoWireType::kVarInt) {
+      frame->set_request_id(f.as_uint64());
+      continue;
+    }
+    // Repeated sub-messages are merged by the full parser, not worth handling
+    // here.
+    if (has_msg || f.type != ProtoWireType::kLengthDelimited)
+      return false;
+    has_msg = true;
+    if (f.id == kFrameInvokeMethod) {
+      Frame::InvokeMethod* msg = frame->mutable_msg_invoke_method();
+      msg->Clear();
+      if (!DecodeInvokeMethod(f, msg))
+        return false;
+    } else if (f.id == kFrameInvokeMethodReply) {
+      Frame::InvokeMethodReply* msg = frame->mutable_msg_invoke_method_reply();
+      msg->Clear();
+      if (!DecodeInvokeMethodReply(f, msg))
+        return false;
+    } else {
+      return false;
+    }
+  }
+  return has_msg && decoder.IsEndOfBuffer();
+}
+
+uint8_t* WriteVarIntField(uint32_t field_id, uint64_t value, uint8_t* ptr) {
+  ptr = WriteVarInt(MakeTagVarInt(field_id), ptr);
+  return WriteVarInt(value, ptr);
+}
+
+// Writes the header and the fields of a frame that has |request_id| and the
+// |msg_field_id| sub-message. The latter is made of the already encoded
+// |msg_fields| followed by |payload_size| bytes that are sent separately.
+size_t WriteEnvelope(RequestID request_id,
+                     uint32_t msg_field_id,
+                     const uint8_t* msg_fields,
+                     size_t msg_fields_size,
+                     size_t payload_size,
+                     uint8_t* buf) {
+  uint8_t* ptr = buf + kHeaderSize;
+  ptr = WriteVarIntField(kFrameRequestId, request_id, ptr);
+  ptr = WriteVarInt(MakeTagLengthDelimited(msg_field_id), ptr);
+  ptr = WriteVarInt(msg_fields_size + payload_size, ptr);
+  memcpy(ptr, msg_fields, msg_fields_size);
+  ptr += msg_fields_size;
+  const size_t envelope_size = static_cast<size_t>(ptr - buf);
+  PERFETTO_DCHECK(envelope_size <= BufferedFrameDeserializer::kMaxEnvelopeSize);
+
+  const size_t frame_size = envelope_size - kHeaderSize + payload_size;
+  // Don't send messages larger than what the receiver can handle.
+  PERFETTO_DCHECK(kHeaderSize + frame_size <= kIPCBufferSize);
+  const uint32_t header = static_cast<uint32_t>(frame_size);
+  memcpy(buf, base::AssumeLittleEndian(&header), kHeaderSize);
+  return envelope_size;
+}
+
 }  // namespace
 
+// static
+constexpr size_t BufferedFrameDeserializer::kMaxEnvelopeSize;
+
 BufferedFrameDeserializer::BufferedFrameDeserializer(size_t max_capacity)
     : capacity_(max_capacity) {
   PERFETTO_CHECK(max_capacity % base::kPageSize == 0);
@@ -60,13 +207,15 @@ BufferedFrameDeserializer::BeginReceive() {
     buf_.AdviseDontNeed(buf() + base::kPageSize, capacity_ - base::kPageSize);
   }
 
-  PERFETTO_CHECK(capacity_ > size_);
-  return ReceiveBuffer{buf() + size_, capacity_ - size_};
+  const size_t write_offset = read_offset_ + size_;
+  PERFETTO_CHECK(capacity_ > write_offset);
+  return ReceiveBuffer{buf() + write_offset, capacity_ - write_offset};
 }
 
 bool BufferedFrameDeserializer::EndReceive(size_t recv_size) {
-  PERFETTO_CHECK(recv_size + size_ <= capacity_);
+  PERFETTO_CHECK(recv_size + read_offset_ + size_ <= capacity_);
   size_ += recv_size;
+  dirty_size_ = std::max(dirty_size_, read_offset_ + size_);
 
   // At this point the contents buf_ can contain:
   // A) Only a fragment of the header (the size of the frame). E.g.,
@@ -84,24 +233,25 @@ bool BufferedFrameDeserializer::EndReceive(size_t recv_size) {
   //
   // C Is the more likely case and the one we are optimizing for. A, B, D can
   // happen because of the streaming nature of the socket.
-  // The invariant of this function is that, when it returns, buf_ is either
-  // empty (we drained all the complete frames) or starts with the header of the
-  // next, still incomplete, frame.
+  // The invariant of this function is that, when it returns, the data at
+  // |read_offset_| is either empty (we drained all the complete frames) or
+  // starts with the header of the next, still incomplete, frame.
 
   size_t consumed_size = 0;
+  size_t next_frame_size = 0;  // Stays 0 if the next header is incomplete.
   for (;;) {
+    next_frame_size = 0;
     if (size_ < consumed_size + kHeaderSize)
       break;  // Case A, not enough data to read even the header.
 
     // Read the header into |payload_size|.
     uint32_t payload_size = 0;
-    const char* rd_ptr = buf() + consumed_size;
+    const char* rd_ptr = buf() + read_offset_ + consumed_size;
     memcpy(base::AssumeLittleEndian(&payload_size), rd_ptr, kHeaderSize);
 
     // Saturate the |payload_size| to prevent overflows. The > capacity_ check
     // below will abort the parsing.
-    size_t next_frame_size =
-        std::min(static_cast<size_t>(payload_size), capacity_);
+    next_frame_size = std::min(static_cast<size_t>(payload_size), capacity_);
     next_frame_size += kHeaderSize;
     rd_ptr += kHeaderSize;
 
@@ -123,33 +273,38 @@ bool BufferedFrameDeserializer::EndReceive(size_t recv_size) {
   }
 
   PERFETTO_DCHECK(consumed_size <= size_);
-  if (consumed_size > 0) {
-    // Shift out the consumed data from the buffer. In the typical case (C)
-    // there is nothing to shift really, just setting size_ = 0 is enough.
-    // Shifting is only for the (unlikely) case D.
-    size_ -= consumed_size;
-    if (size_ > 0) {
-      // Case D. We consumed some frames but there is a leftover at the end of
-      // the buffer. Shift out the consumed bytes, so that on the next round
-      // |buf_| starts with the header of the next unconsumed frame.
-      const char* move_begin = buf() + consumed_size;
-      PERFETTO_CHECK(move_begin > buf());
-      PERFETTO_CHECK(move_begin + size_ <= buf() + capacity_);
-      memmove(buf(), move_begin, size_);
-    }
-    // If we just finished decoding a large frame that used more than one page,
-    // release the extra memory in the buffer. Large frames should be quite
-    // rare.
-    if (consumed_size > base::kPageSize) {
-      size_t size_rounded_up = (size_ / base::kPageSize + 1) * base::kPageSize;
-      if (size_rounded_up < capacity_) {
-        char* madvise_begin = buf() + size_rounded_up;
-        const size_t madvise_size = capacity_ - size_rounded_up;
-        PERFETTO_CHECK(madvise_begin > buf() + size_);
-        PERFETTO_CHECK(madvise_begin + madvise_size <= buf() + capacity_);
-        buf_.AdviseDontNeed(madvise_begin, madvise_size);
-      }
+  read_offset_ += consumed_size;
+  size_ -= consumed_size;
+  if (size_ == 0) {
+    // Case C. Nothing left, just rewind.
+    read_offset_ = 0;
+  } else if (read_offset_ > 0 &&
+             (next_frame_size == 0 ||
+              read_offset_ + next_frame_size > capacity_)) {
+    // Case D. Leave the partial frame where it is, so the rest of it is
+    // received right after it, unless it doesn't fit in the tail of the buffer.
+    // In that case (or if we don't know its size yet, which means that there
+    // are < 4 bytes to move) shift it to the beginning of the buffer.
+    const char* move_begin = buf() + read_offset_;
+    PERFETTO_CHECK(move_begin + size_ <= buf() + capacity_);
+    memmove(buf(), move_begin, size_);
+    read_offset_ = 0;
+  }
+
+  // If we just rewound the buffer after having used more than one page (e.g.
+  // because of a large frame) release the extra memory. The buffer is not
+  // released while it's being used as a ring, to not page-fault on it again.
+  if (consumed_size > 0 && read_offset_ == 0 &&
+      dirty_size_ > base::kPageSize) {
+    size_t size_rounded_up = (size_ / base::kPageSize + 1) * base::kPageSize;
+    if (size_rounded_up < capacity_) {
+      char* madvise_begin = buf() + size_rounded_up;
+      const size_t madvise_size = capacity_ - size_rounded_up;
+      PERFETTO_CHECK(madvise_begin > buf() + size_);
+      PERFETTO_CHECK(madvise_begin + madvise_size <= buf() + capacity_);
+      buf_.AdviseDontNeed(madvise_begin, madvise_size);
     }
+    dirty_size_ = size_rounded_up;
   }
   // At this point |size_| == 0 for case C, > 0 for cases A, B, D.
   return true;
@@ -163,14 +318,31 @@ std::unique_ptr<Frame> BufferedFrameDeserializer::PopNextFrame() {
   return frame;
 }
 
+void BufferedFrameDeserializer::RecycleFrame(std::unique_ptr<Frame> frame) {
+  if (!frame || frame_pool_.size() >= kMaxPooledFrames ||
+      frame->ByteSize() > kMaxPooledFrameSize) {
+    return;
+  }
+  frame_pool_.emplace_back(std::move(frame));
+}
+
 void BufferedFrameDeserializer::DecodeFrame(const char* data, size_t size) {
   if (size == 0)
     return;
-  std::unique_ptr<Frame> frame(new Frame);
-  const int sz = static_cast<int>(size);
-  ::google::protobuf::io::ArrayInputStream stream(data, sz);
-  if (frame->ParseFromBoundedZeroCopyStream(&stream, sz))
-    decoded_frames_.push_back(std::move(frame));
+  std::unique_ptr<Frame> frame;
+  if (frame_pool_.empty()) {
+    frame.reset(new Frame);
+  } else {
+    frame = std::move(frame_pool_.back());
+    frame_pool_.pop_back();
+  }
+  if (!DecodeHotFrame(data, size, frame.get())) {
+    const int sz = static_cast<int>(size);
+    ::google::protobuf::io::ArrayInputStream stream(data, sz);
+    if (!frame->ParseFromBoundedZeroCopyStream(&stream, sz))
+      return RecycleFrame(std::move(frame));
+  }
+  decoded_frames_.push_back(std::move(frame));
 }
 
 // static
@@ -189,5 +361,45 @@ std::string BufferedFrameDeserializer::Serialize(const Frame& frame) {
   return buf;
 }
 
+// static
+size_t BufferedFrameDeserializer::SerializeInvokeMethodEnvelope(
+    RequestID request_id,
+    ServiceID service_id,
+    MethodID method_id,
+    bool drop_reply,
+    size_t payload_size,
+    uint8_t* buf) {
+  uint8_t fields[kMaxEnvelopeSize];
+  uint8_t* ptr = fields;
+  ptr = WriteVarIntField(kInvokeMethodServiceId, service_id, ptr);
+  ptr = WriteVarIntField(kInvokeMethodMethodId, method_id, ptr);
+  ptr = WriteVarIntField(kInvokeMethodDropReply, drop_reply, ptr);
+  ptr = WriteVarInt(MakeTagLengthDelimited(kInvokeMethodArgsProto), ptr);
+  ptr = WriteVarInt(payload_size, ptr);
+  return WriteEnvelope(request_id, kFrameInvokeMethod, fields,
+                       static_cast<size_t>(ptr - fields), payload_size, buf);
+}
+
+// static
+size_t BufferedFrameDeserializer::SerializeInvokeMethodReplyEnvelope(
+    RequestID request_id,
+    bool success,
+    bool has_more,
+    size_t payload_size,
+    uint8_t* buf) {
+  uint8_t fields[kMaxEnvelopeSize];
+  uint8_t* ptr = fields;
+  ptr = WriteVarIntField(kInvokeMethodReplySuccess, success, ptr);
+  ptr = WriteVarIntField(kInvokeMethodReplyHasMore, has_more, ptr);
+  if (success) {
+    ptr = WriteVarInt(MakeTagLengthDelimited(kInvokeMethodReplyReplyProto), ptr);
+    ptr = WriteVarInt(payload_size, ptr);
+  } else {
+    payload_size = 0;
+  }
+  return WriteEnvelope(request_id, kFrameInvokeMethodReply, fields,
+                       static_cast<size_t>(ptr - fields), payload_size, buf);
+}
+
 }  // namespace ipc
 }  // namespace perfetto
@@ -18,9 +18,11 @@
 #define SRC_IPC_BUFFERED_FRAME_DESERIALIZER_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
-#include <list>
+#include <deque>
 #include <memory>
+#include <vector>
 
 #include <sys/mman.h>
 
@@ -60,14 +62,21 @@ class Frame;  // Defined in the protobuf autogenerated wire_protocol.pb.h.
 // auto buf = rpc_frame_decoder.BeginReceive();
 // size_t rsize = socket.recv(buf.first, buf.second);
 // rpc_frame_decoder.EndReceive(rsize);
-// while (Frame frame = rpc_frame_decoder.PopNextFrame()) {
+// while (std::unique_ptr<Frame> frame = rpc_frame_decoder.PopNextFrame()) {
 //   ... process |frame|
+//   rpc_frame_decoder.RecycleFrame(std::move(frame));
 // }
 //
 // Design goals:
 // -------------
 // - Optimize for the realistic case of each recv() receiving one or more
 //   whole frames. In this case no memmove is performed.
+// - Don't move the data of partially received frames either, unless the rest
+//   of the frame doesn't fit in the tail of the buffer. The buffer is used as a
+//   ring and is compacted only when reaching its end.
+// - Don't allocate in the steady state: Frame objects (and their strings) are
+//   recycled and the InvokeMethod(Reply) frames, which are the vast majority,
+//   are decoded with protozero rather than with the full protobuf parser.
 // - Guarantee that frames lay in a virtually contiguous memory area.
 //   This allows to use the protobuf-lite deserialization API (scattered
 //   deserialization is supported only by libprotobuf-full).
@@ -92,6 +101,30 @@ class BufferedFrameDeserializer {
   // in common that doesn't justify having its own class.
   static std::string Serialize(const Frame&);
 
+  // Upper bound of the bytes written by the Serialize*Envelope() methods.
+  static constexpr size_t kMaxEnvelopeSize = 64;
+
+  // Faster versions of Serialize() for the InvokeMethod and InvokeMethodReply
+  // frames, which are the hot ones. They write into |buf| the header and the
+  // fields of the frame up to the preamble of the args_proto / reply_proto
+  // field. The |payload_size| bytes of the latter are meant to follow in the
+  // same send (see UnixSocket's scatter-gather Send()), so that the payload is
+  // not copied into the frame. Return the number of bytes written into |buf|,
+  // which must be at least kMaxEnvelopeSize bytes long.
+  static size_t SerializeInvokeMethodEnvelope(RequestID,
+                                              ServiceID,
+                                              MethodID,
+                                              bool drop_reply,
+                                              size_t payload_size,
+                                              uint8_t* buf);
+
+  // |payload_size| is ignored if !|success|, as the reply has no payload.
+  static size_t SerializeInvokeMethodReplyEnvelope(RequestID,
+                                                   bool success,
+                                                   bool has_more,
+                                                   size_t payload_size,
+                                                   uint8_t* buf);
+
   // Returns a buffer that can be passed to recv(). The buffer is deliberately
   // not initialized.
   ReceiveBuffer BeginReceive();
@@ -107,6 +140,10 @@ class BufferedFrameDeserializer {
   // if no further frames have been decoded.
   std::unique_ptr<Frame> PopNextFrame();
 
+  // Gives back a frame returned by PopNextFrame(), so that it can be reused
+  // for decoding the next frames. Optional, but avoids the allocations.
+  void RecycleFrame(std::unique_ptr<Frame>);
+
   size_t capacity() const { return capacity_; }
   size_t size() const { return size_; }
 
@@ -123,11 +160,21 @@ class BufferedFrameDeserializer {
   base::PagedMemory buf_;
   const size_t capacity_ = 0;  // sizeof(|buf_|).
 
-  // THe number of bytes in |buf_| that contain valid data (as a result of
-  // EndReceive()). This is always <= |capacity_|.
+  // Offset in |buf_| of the first byte not consumed yet, i.e. the header of
+  // the next frame.
+  size_t read_offset_ = 0;
+
+  // THe number of bytes in |buf_|, starting at |read_offset_|, that contain
+  // valid data (as a result of EndReceive()). |read_offset_| + |size_| is
+  // always <= |capacity_|.
   size_t size_ = 0;
 
-  std::list<std::unique_ptr<Frame>> decoded_frames_;
+  // Upper bound of the bytes of |buf_| that have been touched since the last
+  // time the memory was released with AdviseDontNeed().
+  size_t dirty_size_ = 0;
+
+  std::deque<std::unique_ptr<Frame>> decoded_frames_;
+  std::vector<std::unique_ptr<Frame>> frame_pool_;
 };
 
 }  // namespace ipc
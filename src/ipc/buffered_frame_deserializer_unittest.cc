@@ -80,6 +80,11 @@ void CheckedMemcpy(BufferedFrameDeserializer::ReceiveBuffer rbuf,
   memcpy(rbuf.data + offset, encoded_frame.data(), encoded_frame.size());
 }
 
+std::vector<char> SerializeFrame(const Frame& frame) {
+  std::string buf = BufferedFrameDeserializer::Serialize(frame);
+  return std::vector<char>(buf.begin(), buf.end());
+}
+
 bool FrameEq(std::vector<char> expected_frame_with_header, const Frame& frame) {
   std::string reserialized_frame = frame.SerializeAsString();
 
@@ -379,6 +384,170 @@ TEST(BufferedFrameDeserializerTest, FillCapacity) {
   }
 }
 
+// Checks that the data of a partially received frame is not moved, as long as
+// the rest of it fits in the buffer.
+TEST(BufferedFrameDeserializerTest, PartialFrameIsNotMoved) {
+  BufferedFrameDeserializer bfd;
+  std::vector<char> frame1 = GetSimpleFrame(100);
+  std::vector<char> frame2 = GetSimpleFrame(200);
+  std::vector<char> frame2_chunk1(frame2.begin(), frame2.begin() + 50);
+  std::vector<char> frame2_chunk2(frame2.begin() + 50, frame2.end());
+
+  BufferedFrameDeserializer::ReceiveBuffer rbuf = bfd.BeginReceive();
+  char* const start = rbuf.data;
+  CheckedMemcpy(rbuf, frame1);
+  CheckedMemcpy(rbuf, frame2_chunk1, frame1.size());
+  ASSERT_TRUE(bfd.EndReceive(frame1.size() + frame2_chunk1.size()));
+  ASSERT_EQ(frame2_chunk1.size(), bfd.size());
+
+  rbuf = bfd.BeginReceive();
+  ASSERT_EQ(start + frame1.size() + frame2_chunk1.size(), rbuf.data);
+  CheckedMemcpy(rbuf, frame2_chunk2);
+  ASSERT_TRUE(bfd.EndReceive(frame2_chunk2.size()));
+  ASSERT_EQ(0u, bfd.size());
+
+  std::unique_ptr<Frame> decoded_frame = bfd.PopNextFrame();
+  ASSERT_TRUE(decoded_frame);
+  ASSERT_TRUE(FrameEq(frame1, *decoded_frame));
+  decoded_frame = bfd.PopNextFrame();
+  ASSERT_TRUE(decoded_frame);
+  ASSERT_TRUE(FrameEq(frame2, *decoded_frame));
+  ASSERT_FALSE(bfd.PopNextFrame());
+
+  // Once drained, the buffer is rewound.
+  rbuf = bfd.BeginReceive();
+  ASSERT_EQ(start, rbuf.data);
+}
+
+// Checks that recycled frames are reused and correctly reset when decoding
+// frames of the same and of a different type.
+TEST(BufferedFrameDeserializerTest, RecycledFrames) {
+  BufferedFrameDeserializer bfd;
+  auto receive = [&bfd](const Frame& frame) -> std::unique_ptr<Frame> {
+    std::vector<char> serialized = SerializeFrame(frame);
+    CheckedMemcpy(bfd.BeginReceive(), serialized);
+    EXPECT_TRUE(bfd.EndReceive(serialized.size()));
+    std::unique_ptr<Frame> decoded_frame = bfd.PopNextFrame();
+    EXPECT_TRUE(decoded_frame);
+    EXPECT_FALSE(bfd.PopNextFrame());
+    if (decoded_frame) {
+      EXPECT_EQ(frame.SerializeAsString(), decoded_frame->SerializeAsString());
+    }
+    return decoded_frame;
+  };
+
+  Frame invoke;
+  invoke.set_request_id(1);
+  invoke.mutable_msg_invoke_method()->set_service_id(2);
+  invoke.mutable_msg_invoke_method()->set_method_id(3);
+  invoke.mutable_msg_invoke_method()->set_args_proto("args");
+  invoke.mutable_msg_invoke_method()->set_drop_reply(true);
+  std::unique_ptr<Frame> decoded_frame = receive(invoke);
+  ASSERT_TRUE(decoded_frame);
+  const Frame* const recycled_frame = decoded_frame.get();
+  bfd.RecycleFrame(std::move(decoded_frame));
+
+  // The fields not set in the new frame must not leak from the previous one.
+  invoke.set_request_id(4);
+  invoke.mutable_msg_invoke_method()->clear_drop_reply();
+  invoke.mutable_msg_invoke_method()->set_args_proto("other args");
+  decoded_frame = receive(invoke);
+  ASSERT_EQ(recycled_frame, decoded_frame.get());
+  bfd.RecycleFrame(std::move(decoded_frame));
+
+  Frame reply;
+  reply.set_request_id(5);
+  reply.mutable_msg_invoke_method_reply()->set_success(true);
+  reply.mutable_msg_invoke_method_reply()->set_reply_proto("reply");
+  decoded_frame = receive(reply);
+  ASSERT_EQ(recycled_frame, decoded_frame.get());
+  bfd.RecycleFrame(std::move(decoded_frame));
+
+  // Frames with other messages or unexpected fields go through the full
+  // parser.
+  Frame bind;
+  bind.set_request_id(6);
+  bind.mutable_msg_bind_service()->set_service_name("svc");
+  decoded_frame = receive(bind);
+  ASSERT_EQ(recycled_frame, decoded_frame.get());
+  bfd.RecycleFrame(std::move(decoded_frame));
+
+  invoke.add_data_for_testing("foo");
+  decoded_frame = receive(invoke);
+  ASSERT_EQ(recycled_frame, decoded_frame.get());
+}
+
+// A hot frame with a malformed nested message must be rejected.
+TEST(BufferedFrameDeserializerTest, MalformedInvokeMethodFrame) {
+  BufferedFrameDeserializer bfd;
+  Frame invoke;
+  invoke.set_request_id(1);
+  invoke.mutable_msg_invoke_method()->set_args_proto("args");
+  std::vector<char> frame = SerializeFrame(invoke);
+  // Make the |args_proto| length overflow the InvokeMethod message.
+  ASSERT_EQ('a', frame[frame.size() - 4]);
+  frame[frame.size() - 5] = 0x10;
+
+  CheckedMemcpy(bfd.BeginReceive(), frame);
+  ASSERT_TRUE(bfd.EndReceive(frame.size()));
+  ASSERT_FALSE(bfd.PopNextFrame());
+  ASSERT_EQ(0u, bfd.size());
+}
+
+// Checks that the envelope + payload written by the scatter-gather send path
+// decode to the same frames that Serialize() would produce.
+TEST(BufferedFrameDeserializerTest, SerializeEnvelopes) {
+  BufferedFrameDeserializer bfd;
+  auto check = [&bfd](const Frame& expected, const uint8_t* envelope,
+                      size_t envelope_size, const std::string& payload) {
+    BufferedFrameDeserializer::ReceiveBuffer rbuf = bfd.BeginReceive();
+    ASSERT_GE(rbuf.size, envelope_size + payload.size());
+    memcpy(rbuf.data, envelope, envelope_size);
+    memcpy(rbuf.data + envelope_size, payload.data(), payload.size());
+    ASSERT_TRUE(bfd.EndReceive(envelope_size + payload.size()));
+    std::unique_ptr<Frame> decoded_frame = bfd.PopNextFrame();
+    ASSERT_TRUE(decoded_frame);
+    EXPECT_EQ(expected.SerializeAsString(), decoded_frame->SerializeAsString());
+    EXPECT_EQ(0u, bfd.size());
+  };
+  uint8_t envelope[BufferedFrameDeserializer::kMaxEnvelopeSize];
+
+  for (size_t payload_size : std::vector<size_t>{0, 1, 127, 128, 70000}) {
+    const std::string payload(payload_size, 'x');
+    Frame invoke;
+    invoke.set_request_id(std::numeric_limits<RequestID>::max());
+    auto* req = invoke.mutable_msg_invoke_method();
+    req->set_service_id(std::numeric_limits<ServiceID>::max());
+    req->set_method_id(42);
+    req->set_args_proto(payload);
+    req->set_drop_reply(payload_size % 2);
+    size_t envelope_size =
+        BufferedFrameDeserializer::SerializeInvokeMethodEnvelope(
+            invoke.request_id(), req->service_id(), req->method_id(),
+            req->drop_reply(), payload.size(), envelope);
+    check(invoke, envelope, envelope_size, payload);
+
+    Frame reply;
+    reply.set_request_id(payload_size);
+    reply.mutable_msg_invoke_method_reply()->set_success(true);
+    reply.mutable_msg_invoke_method_reply()->set_has_more(true);
+    reply.mutable_msg_invoke_method_reply()->set_reply_proto(payload);
+    envelope_size = BufferedFrameDeserializer::SerializeInvokeMethodReplyEnvelope(
+        reply.request_id(), true, true, payload.size(), envelope);
+    check(reply, envelope, envelope_size, payload);
+  }
+
+  // Failed replies have no payload.
+  Frame reply;
+  reply.set_request_id(1);
+  reply.mutable_msg_invoke_method_reply()->set_success(false);
+  reply.mutable_msg_invoke_method_reply()->set_has_more(false);
+  size_t envelope_size =
+      BufferedFrameDeserializer::SerializeInvokeMethodReplyEnvelope(
+          1, false, false, 100, envelope);
+  check(reply, envelope, envelope_size, "");
+}
+
 }  // namespace
 }  // namespace ipc
 }  // namespace perfetto
@@ -18,6 +18,7 @@
 
 #include <fcntl.h>
 #include <inttypes.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <utility>
@@ -89,17 +90,26 @@ RequestID ClientImpl::BeginInvoke(ServiceID service_id,
                                   bool drop_reply,
                                   base::WeakPtr<ServiceProxy> service_proxy,
                                   int fd) {
-  std::string args_proto;
+  if (!method_args.IsInitialized()) {
+    PERFETTO_DLOG("BeginInvoke() failed while serializing the arguments");
+    return 0;
+  }
   RequestID request_id = ++last_request_id_;
-  Frame frame;
-  frame.set_request_id(request_id);
-  Frame::InvokeMethod* req = frame.mutable_msg_invoke_method();
-  req->set_service_id(service_id);
-  req->set_method_id(remote_method_id);
-  req->set_drop_reply(drop_reply);
-  bool did_serialize = method_args.SerializeToString(&args_proto);
-  req->set_args_proto(args_proto);
-  if (!did_serialize || !SendFrame(frame, fd)) {
+
+  // The arguments are serialized straight into |args_buf_| and sent after the
+  // frame envelope without copying them into a Frame.
+  const size_t args_size = static_cast<size_t>(method_args.ByteSize());
+  if (args_buf_.size() < args_size)
+    args_buf_.resize(args_size);
+  method_args.SerializeWithCachedSizesToArray(args_buf_.data());
+  uint8_t envelope[BufferedFrameDeserializer::kMaxEnvelopeSize];
+  size_t envelope_size =
+      BufferedFrameDeserializer::SerializeInvokeMethodEnvelope(
+          request_id, service_id, remote_method_id, drop_reply, args_size,
+          envelope);
+  struct iovec iov[2] = {{envelope, envelope_size},
+                         {args_buf_.data(), args_size}};
+  if (!SendFrame(iov, base::ArraySize(iov), fd)) {
     PERFETTO_DLOG("BeginInvoke() failed while sending the frame");
     return 0;
   }
@@ -117,12 +127,16 @@ RequestID ClientImpl::BeginInvoke(ServiceID service_id,
 bool ClientImpl::SendFrame(const Frame& frame, int fd) {
   // Serialize the frame into protobuf, add the size header, and send it.
   std::string buf = BufferedFrameDeserializer::Serialize(frame);
+  struct iovec iov = {&buf[0], buf.size()};
+  return SendFrame(&iov, 1, fd);
+}
 
+bool ClientImpl::SendFrame(struct iovec* iov, size_t iov_len, int fd) {
   // TODO(primiano): this should do non-blocking I/O. But then what if the
   // socket buffer is full? We might want to either drop the request or throttle
   // the send and PostTask the reply later? Right now we are making Send()
   // blocking as a workaround. Propagate bakpressure to the caller instead.
-  bool res = sock_->Send(buf.data(), buf.size(), fd,
+  bool res = sock_->Send(iov, iov_len, fd,
                          base::UnixSocket::BlockingMode::kBlocking);
   PERFETTO_CHECK(res || !sock_->is_connected());
   return res;
@@ -172,8 +186,10 @@ void ClientImpl::OnDataAvailable(base::UnixSocket*) {
     }
   } while (rsize > 0);
 
-  while (std::unique_ptr<Frame> frame = frame_deserializer_.PopNextFrame())
+  while (std::unique_ptr<Frame> frame = frame_deserializer_.PopNextFrame()) {
     OnFrameReceived(*frame);
+    frame_deserializer_.RecycleFrame(std::move(frame));
+  }
 }
 
 void ClientImpl::OnFrameReceived(const Frame& frame) {
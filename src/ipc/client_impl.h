@@ -25,9 +25,12 @@
 
 #include "src/ipc/wire_protocol.pb.h"
 
+#include <stdint.h>
+
 #include <list>
 #include <map>
 #include <memory>
+#include <vector>
 
 namespace perfetto {
 
@@ -77,6 +80,7 @@ class ClientImpl : public Client, public base::UnixSocket::EventListener {
   ClientImpl& operator=(const ClientImpl&) = delete;
 
   bool SendFrame(const Frame&, int fd = -1);
+  bool SendFrame(struct iovec*, size_t iov_len, int fd = -1);
   void OnFrameReceived(const Frame&);
   void OnBindServiceReply(QueuedRequest, const Frame::BindServiceReply&);
   void OnInvokeMethodReply(QueuedRequest, const Frame::InvokeMethodReply&);
@@ -86,6 +90,11 @@ class ClientImpl : public Client, public base::UnixSocket::EventListener {
   base::TaskRunner* const task_runner_;
   RequestID last_request_id_ = 0;
   BufferedFrameDeserializer frame_deserializer_;
+
+  // Reused for serializing the method arguments, to avoid allocating each
+  // time.
+  std::vector<uint8_t> args_buf_;
+
   base::ScopedFile received_fd_;
   std::map<RequestID, QueuedRequest> queued_requests_;
   std::map<ServiceID, base::WeakPtr<ServiceProxy>> service_bindings_;
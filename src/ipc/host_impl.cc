@@ -17,6 +17,8 @@
 #include "src/ipc/host_impl.h"
 
 #include <inttypes.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <utility>
@@ -35,8 +37,10 @@ namespace ipc {
 
 // static
 std::unique_ptr<Host> Host::CreateInstance(const char* socket_name,
-                                           base::TaskRunner* task_runner) {
-  std::unique_ptr<HostImpl> host(new HostImpl(socket_name, task_runner));
+                                           base::TaskRunner* task_runner,
+                                           size_t num_io_threads) {
+  std::unique_ptr<HostImpl> host(
+      new HostImpl(socket_name, task_runner, num_io_threads));
   if (!host->sock() || !host->sock()->is_listening())
     return nullptr;
   return std::move(host);
@@ -44,30 +48,46 @@ std::unique_ptr<Host> Host::CreateInstance(const char* socket_name,
 
 // static
 std::unique_ptr<Host> Host::CreateInstance(base::ScopedFile socket_fd,
-                                           base::TaskRunner* task_runner) {
+                                           base::TaskRunner* task_runner,
+                                           size_t num_io_threads) {
   std::unique_ptr<HostImpl> host(
-      new HostImpl(std::move(socket_fd), task_runner));
+      new HostImpl(std::move(socket_fd), task_runner, num_io_threads));
   if (!host->sock() || !host->sock()->is_listening())
     return nullptr;
   return std::move(host);
 }
 
-HostImpl::HostImpl(base::ScopedFile socket_fd, base::TaskRunner* task_runner)
+HostImpl::HostImpl(base::ScopedFile socket_fd,
+                   base::TaskRunner* task_runner,
+                   size_t num_io_threads)
     : task_runner_(task_runner), weak_ptr_factory_(this) {
   GOOGLE_PROTOBUF_VERIFY_VERSION;
   PERFETTO_DCHECK_THREAD(thread_checker_);
   sock_ = base::UnixSocket::Listen(std::move(socket_fd), this, task_runner_);
+  CreateIOThreads(num_io_threads);
 }
 
-HostImpl::HostImpl(const char* socket_name, base::TaskRunner* task_runner)
+HostImpl::HostImpl(const char* socket_name,
+                   base::TaskRunner* task_runner,
+                   size_t num_io_threads)
     : task_runner_(task_runner), weak_ptr_factory_(this) {
   GOOGLE_PROTOBUF_VERIFY_VERSION;
   PERFETTO_DCHECK_THREAD(thread_checker_);
   sock_ = base::UnixSocket::Listen(socket_name, this, task_runner_);
+  CreateIOThreads(num_io_threads);
 }
 
 HostImpl::~HostImpl() = default;
 
+void HostImpl::CreateIOThreads(size_t num_io_threads) {
+  if (!sock_ || !sock_->is_listening())
+    return;
+  for (size_t i = 0; i < num_io_threads; i++) {
+    io_threads_.emplace_back(
+        new IOThread(task_runner_, weak_ptr_factory_.GetWeakPtr()));
+  }
+}
+
 bool HostImpl::ExposeService(std::unique_ptr<Service> service) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   const std::string& service_name = service->GetDescriptor().service_name;
@@ -87,9 +107,22 @@ void HostImpl::OnNewIncomingConnection(
   PERFETTO_DCHECK_THREAD(thread_checker_);
   std::unique_ptr<ClientConnection> client(new ClientConnection());
   ClientID client_id = ++last_client_id_;
-  clients_by_socket_[new_conn.get()] = client.get();
   client->id = client_id;
-  client->sock = std::move(new_conn);
+  client->peer_uid = new_conn->peer_uid();
+  if (io_threads_.empty()) {
+    clients_by_socket_[new_conn.get()] = client.get();
+    client->sock = std::move(new_conn);
+  } else {
+    // Hand the connection over to one of the IO threads. From now on the
+    // socket is only accessed on that thread.
+    IOThread* io_thread = io_threads_[client_id % io_threads_.size()].get();
+    client->io_thread = io_thread;
+    std::shared_ptr<base::ScopedFile> sock_fd(
+        new base::ScopedFile(new_conn->ReleaseSocket()));
+    io_thread->task_runner()->PostTask([io_thread, client_id, sock_fd] {
+      io_thread->AdoptConnection(client_id, std::move(*sock_fd));
+    });
+  }
   clients_[client_id] = std::move(client);
 }
 
@@ -119,6 +152,23 @@ void HostImpl::OnDataAvailable(base::UnixSocket* sock) {
     if (!frame)
       break;
     OnReceivedFrame(client, *frame);
+    frame_deserializer.RecycleFrame(std::move(frame));
+  }
+}
+
+void HostImpl::OnFramesFromIOThread(ClientID client_id,
+                                    ReceivedFrames* received) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  auto it = clients_.find(client_id);
+  if (it == clients_.end())
+    return;
+  ClientConnection* client = it->second.get();
+  if (received->fd) {
+    PERFETTO_DCHECK(!client->received_fd);
+    client->received_fd = std::move(received->fd);
+  }
+  for (const std::unique_ptr<Frame>& frame : received->frames) {
+    OnReceivedFrame(client, *frame);
   }
 }
 
@@ -196,7 +246,7 @@ void HostImpl::OnInvokeMethod(ClientConnection* client,
     });
   }
 
-  service->client_info_ = ClientInfo(client->id, client->sock->peer_uid());
+  service->client_info_ = ClientInfo(client->id, client->peer_uid);
   service->received_fd_ = &client->received_fd;
   method.invoker(service, *decoded_req_args, std::move(deferred_reply));
   service->received_fd_ = nullptr;
@@ -211,33 +261,69 @@ void HostImpl::ReplyToMethodInvocation(ClientID client_id,
     return;  // client has disconnected by the time we got the async reply.
 
   ClientConnection* client = client_iter->second.get();
-  Frame reply_frame;
-  reply_frame.set_request_id(request_id);
 
   // TODO(fmayer): add a test to guarantee that the reply is consumed within the
   // same call stack and not kept around. ConsumerIPCService::OnTraceData()
   // relies on this behavior.
-  auto* reply_frame_data = reply_frame.mutable_msg_invoke_method_reply();
-  reply_frame_data->set_has_more(reply.has_more());
-  if (reply.success()) {
-    std::string reply_proto;
-    if (reply->SerializeToString(&reply_proto)) {
-      reply_frame_data->set_reply_proto(reply_proto);
-      reply_frame_data->set_success(true);
-    }
+  // The reply is serialized straight into |reply_buf_| and sent after the
+  // frame envelope without copying it into a Frame.
+  bool success = false;
+  size_t reply_size = 0;
+  if (reply.success() && reply->IsInitialized()) {
+    reply_size = static_cast<size_t>(reply->ByteSize());
+    if (reply_buf_.size() < reply_size)
+      reply_buf_.resize(reply_size);
+    reply->SerializeWithCachedSizesToArray(reply_buf_.data());
+    success = true;
   }
-  SendFrame(client, reply_frame, reply.fd());
+  uint8_t envelope[BufferedFrameDeserializer::kMaxEnvelopeSize];
+  size_t envelope_size =
+      BufferedFrameDeserializer::SerializeInvokeMethodReplyEnvelope(
+          request_id, success, reply.has_more(), reply_size, envelope);
+  struct iovec iov[2] = {{envelope, envelope_size},
+                         {reply_buf_.data(), reply_size}};
+  SendFrame(client, iov, base::ArraySize(iov), reply.fd());
 }
 
 // static
 void HostImpl::SendFrame(ClientConnection* client, const Frame& frame, int fd) {
   std::string buf = BufferedFrameDeserializer::Serialize(frame);
+  struct iovec iov = {&buf[0], buf.size()};
+  SendFrame(client, &iov, 1, fd);
+}
+
+// static
+void HostImpl::SendFrame(ClientConnection* client,
+                         struct iovec* iov,
+                         size_t iov_len,
+                         int fd) {
+  if (client->io_thread) {
+    // The frame must outlive the caller's buffers, coalesce it in one string
+    // and let the IO thread send it. The same applies to the |fd|, which the
+    // caller is allowed to close as soon as this function returns.
+    size_t frame_size = 0;
+    for (size_t i = 0; i < iov_len; i++)
+      frame_size += iov[i].iov_len;
+    std::shared_ptr<std::string> frame(new std::string());
+    frame->reserve(frame_size);
+    for (size_t i = 0; i < iov_len; i++)
+      frame->append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    std::shared_ptr<base::ScopedFile> dup_fd(new base::ScopedFile());
+    if (fd != -1)
+      dup_fd->reset(dup(fd));
+    IOThread* io_thread = client->io_thread;
+    ClientID client_id = client->id;
+    io_thread->task_runner()->PostTask([io_thread, client_id, frame, dup_fd] {
+      io_thread->SendFrame(client_id, *frame, std::move(*dup_fd));
+    });
+    return;
+  }
 
   // TODO(primiano): this should do non-blocking I/O. But then what if the
   // socket buffer is full? We might want to either drop the request or throttle
   // the send and PostTask the reply later? Right now we are making Send()
   // blocking as a workaround. Propagate bakpressure to the caller instead.
-  bool res = client->sock->Send(buf.data(), buf.size(), fd,
+  bool res = client->sock->Send(iov, iov_len, fd,
                                 base::UnixSocket::BlockingMode::kBlocking);
   PERFETTO_CHECK(res || !client->sock->is_connected());
 }
@@ -248,10 +334,18 @@ void HostImpl::OnDisconnect(base::UnixSocket* sock) {
   if (it == clients_by_socket_.end())
     return;
   ClientID client_id = it->second->id;
-  ClientInfo client_info(client_id, sock->peer_uid());
   clients_by_socket_.erase(it);
   PERFETTO_DCHECK(clients_.count(client_id));
-  clients_.erase(client_id);
+  OnClientDisconnected(client_id);
+}
+
+void HostImpl::OnClientDisconnected(ClientID client_id) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  auto it = clients_.find(client_id);
+  if (it == clients_.end())
+    return;
+  ClientInfo client_info(client_id, it->second->peer_uid);
+  clients_.erase(it);
 
   for (const auto& service_it : services_) {
     Service& service = *service_it.second.instance;
@@ -285,5 +379,109 @@ HostImpl::ExposedService::~ExposedService() = default;
 
 HostImpl::ClientConnection::~ClientConnection() = default;
 
+HostImpl::ReceivedFrames::ReceivedFrames() = default;
+HostImpl::ReceivedFrames::~ReceivedFrames() = default;
+
+HostImpl::IOThread::IOThread(base::TaskRunner* host_task_runner,
+                             base::WeakPtr<HostImpl> host)
+    : host_task_runner_(host_task_runner), host_(std::move(host)) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  thread_ = std::thread(&IOThread::Run, this);
+  ready_.wait(lock, [this] { return task_runner_ != nullptr; });
+}
+
+HostImpl::IOThread::~IOThread() {
+  task_runner()->PostTask([this] {
+    // Destroy the sockets on the thread that watches them.
+    connections_by_socket_.clear();
+    connections_.clear();
+    task_runner_->Quit();
+  });
+  thread_.join();
+}
+
+void HostImpl::IOThread::Run() {
+  base::UnixTaskRunner task_runner;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task_runner_ = &task_runner;
+  }
+  ready_.notify_one();
+  task_runner.Run();
+}
+
+void HostImpl::IOThread::AdoptConnection(ClientID client_id,
+                                         base::ScopedFile sock_fd) {
+  std::unique_ptr<Connection> conn(new Connection());
+  conn->id = client_id;
+  conn->sock = base::UnixSocket::AdoptConnected(std::move(sock_fd), this,
+                                                task_runner_);
+  connections_by_socket_[conn->sock.get()] = conn.get();
+  connections_[client_id] = std::move(conn);
+}
+
+void HostImpl::IOThread::SendFrame(ClientID client_id,
+                                   const std::string& frame,
+                                   base::ScopedFile fd) {
+  auto it = connections_.find(client_id);
+  if (it == connections_.end())
+    return;  // The client disconnected in the meantime.
+  base::UnixSocket* sock = it->second->sock.get();
+  // See the TODO in HostImpl::SendFrame() about blocking sends. Here they
+  // stall only the clients served by this thread, not the HostImpl.
+  bool res = sock->Send(frame.data(), frame.size(), fd ? *fd : -1,
+                        base::UnixSocket::BlockingMode::kBlocking);
+  PERFETTO_CHECK(res || !sock->is_connected());
+}
+
+void HostImpl::IOThread::OnDataAvailable(base::UnixSocket* sock) {
+  auto it = connections_by_socket_.find(sock);
+  if (it == connections_by_socket_.end())
+    return;
+  Connection* conn = it->second;
+  BufferedFrameDeserializer& frame_deserializer = conn->frame_deserializer;
+
+  std::shared_ptr<ReceivedFrames> received(new ReceivedFrames());
+  size_t rsize;
+  do {
+    auto buf = frame_deserializer.BeginReceive();
+    base::ScopedFile fd;
+    rsize = sock->Receive(buf.data, buf.size, &fd);
+    if (fd) {
+      PERFETTO_DCHECK(!received->fd);
+      received->fd = std::move(fd);
+    }
+    if (!frame_deserializer.EndReceive(rsize))
+      return OnDisconnect(sock);
+  } while (rsize > 0);
+
+  while (std::unique_ptr<Frame> frame = frame_deserializer.PopNextFrame())
+    received->frames.emplace_back(std::move(frame));
+  if (received->frames.empty() && !received->fd)
+    return;
+
+  base::WeakPtr<HostImpl> host = host_;
+  ClientID client_id = conn->id;
+  host_task_runner_->PostTask([host, client_id, received] {
+    if (host)
+      host->OnFramesFromIOThread(client_id, received.get());
+  });
+}
+
+void HostImpl::IOThread::OnDisconnect(base::UnixSocket* sock) {
+  auto it = connections_by_socket_.find(sock);
+  if (it == connections_by_socket_.end())
+    return;
+  ClientID client_id = it->second->id;
+  connections_by_socket_.erase(it);
+  connections_.erase(client_id);
+
+  base::WeakPtr<HostImpl> host = host_;
+  host_task_runner_->PostTask([host, client_id] {
+    if (host)
+      host->OnClientDisconnected(client_id);
+  });
+}
+
 }  // namespace ipc
 }  // namespace perfetto
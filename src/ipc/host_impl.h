@@ -17,14 +17,22 @@
 #ifndef SRC_IPC_HOST_IMPL_H_
 #define SRC_IPC_HOST_IMPL_H_
 
+#include <stdint.h>
+
+#include <condition_variable>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "perfetto/base/task_runner.h"
 #include "perfetto/base/thread_checker.h"
 #include "perfetto/base/unix_socket.h"
+#include "perfetto/base/unix_task_runner.h"
+#include "perfetto/base/weak_ptr.h"
 #include "perfetto/ipc/deferred.h"
 #include "perfetto/ipc/host.h"
 #include "src/ipc/buffered_frame_deserializer.h"
@@ -36,8 +44,12 @@ class Frame;
 
 class HostImpl : public Host, public base::UnixSocket::EventListener {
  public:
-  HostImpl(const char* socket_name, base::TaskRunner*);
-  HostImpl(base::ScopedFile socket_fd, base::TaskRunner*);
+  HostImpl(const char* socket_name,
+           base::TaskRunner*,
+           size_t num_io_threads = 0);
+  HostImpl(base::ScopedFile socket_fd,
+           base::TaskRunner*,
+           size_t num_io_threads = 0);
   ~HostImpl() override;
 
   // Host implementation.
@@ -52,13 +64,70 @@ class HostImpl : public Host, public base::UnixSocket::EventListener {
   const base::UnixSocket* sock() const { return sock_.get(); }
 
  private:
-  // Owns the per-client receive buffer (BufferedFrameDeserializer).
+  class IOThread;
+
+  // Owns the per-client receive buffer (BufferedFrameDeserializer). When the
+  // connection is served by an IOThread, |sock| and |frame_deserializer| live
+  // on that thread instead and |io_thread| is set.
   struct ClientConnection {
     ~ClientConnection();
     ClientID id;
+    uid_t peer_uid = base::kInvalidUid;
     std::unique_ptr<base::UnixSocket> sock;
     BufferedFrameDeserializer frame_deserializer;
     base::ScopedFile received_fd;
+    IOThread* io_thread = nullptr;
+  };
+
+  // The frames decoded by an IOThread in one OnDataAvailable() call, together
+  // with the file descriptor received with them, if any.
+  struct ReceivedFrames {
+    ReceivedFrames();
+    ~ReceivedFrames();
+    std::vector<std::unique_ptr<Frame>> frames;
+    base::ScopedFile fd;
+  };
+
+  // A background thread that owns the sockets of a subset of the clients.
+  // Receives and decodes their frames and posts them to the HostImpl's task
+  // runner. Sends back the replies serialized by the HostImpl.
+  class IOThread : public base::UnixSocket::EventListener {
+   public:
+    IOThread(base::TaskRunner* host_task_runner, base::WeakPtr<HostImpl>);
+    ~IOThread() override;  // Quits and joins the thread.
+
+    // The methods below must be called on |task_runner()|.
+    void AdoptConnection(ClientID, base::ScopedFile sock_fd);
+    void SendFrame(ClientID, const std::string& frame, base::ScopedFile fd);
+
+    base::TaskRunner* task_runner() const { return task_runner_; }
+
+    // base::UnixSocket::EventListener implementation.
+    void OnDisconnect(base::UnixSocket*) override;
+    void OnDataAvailable(base::UnixSocket*) override;
+
+   private:
+    struct Connection {
+      ClientID id;
+      std::unique_ptr<base::UnixSocket> sock;
+      BufferedFrameDeserializer frame_deserializer;
+    };
+
+    IOThread(const IOThread&) = delete;
+    IOThread& operator=(const IOThread&) = delete;
+
+    void Run();
+
+    base::TaskRunner* const host_task_runner_;
+    const base::WeakPtr<HostImpl> host_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    base::UnixTaskRunner* task_runner_ = nullptr;  // Protected by |mutex_|.
+
+    // Accessed only on the IO thread.
+    std::map<ClientID, std::unique_ptr<Connection>> connections_;
+    std::map<base::UnixSocket*, Connection*> connections_by_socket_;
   };
   struct ExposedService {
     ExposedService(ServiceID, const std::string&, std::unique_ptr<Service>);
@@ -75,6 +144,9 @@ class HostImpl : public Host, public base::UnixSocket::EventListener {
   HostImpl& operator=(const HostImpl&) = delete;
 
   bool Initialize(const char* socket_name);
+  void CreateIOThreads(size_t num_io_threads);
+  void OnFramesFromIOThread(ClientID, ReceivedFrames*);
+  void OnClientDisconnected(ClientID);
   void OnReceivedFrame(ClientConnection*, const Frame&);
   void OnBindService(ClientConnection*, const Frame&);
   void OnInvokeMethod(ClientConnection*, const Frame&);
@@ -82,14 +154,23 @@ class HostImpl : public Host, public base::UnixSocket::EventListener {
   const ExposedService* GetServiceByName(const std::string&);
 
   static void SendFrame(ClientConnection*, const Frame&, int fd = -1);
+  static void SendFrame(ClientConnection*,
+                        struct iovec*,
+                        size_t iov_len,
+                        int fd = -1);
 
   base::TaskRunner* const task_runner_;
   std::map<ServiceID, ExposedService> services_;
   std::unique_ptr<base::UnixSocket> sock_;  // The listening socket.
   std::map<ClientID, std::unique_ptr<ClientConnection>> clients_;
   std::map<base::UnixSocket*, ClientConnection*> clients_by_socket_;
+  std::vector<std::unique_ptr<IOThread>> io_threads_;
   ServiceID last_service_id_ = 0;
   ClientID last_client_id_ = 0;
+
+  // Reused for serializing the replies, to avoid allocating each time.
+  std::vector<uint8_t> reply_buf_;
+
   base::WeakPtrFactory<HostImpl> weak_ptr_factory_;
   PERFETTO_THREAD_CHECKER(thread_checker_)
 };
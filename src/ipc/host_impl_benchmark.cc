@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/base/unix_task_runner.h"
+#include "perfetto/ipc/client.h"
+#include "perfetto/ipc/host.h"
+#include "src/base/test/test_task_runner.h"
+#include "src/ipc/test/test_socket.h"
+
+#include "src/ipc/test/greeter_service.ipc.h"
+#include "src/ipc/test/greeter_service.pb.h"
+
+// Measures the round-trip latency of many producers sending small requests to
+// an ipc::Host, while a consumer keeps pulling large replies from it (like
+// ReadBuffers() does). The first argument is the number of IO threads of the
+// host, the second the number of producers.
+
+namespace ipc_test {
+namespace {
+
+using ::perfetto::base::TestTaskRunner;
+using ::perfetto::base::UnixTaskRunner;
+using ::perfetto::ipc::AsyncResult;
+using ::perfetto::ipc::Client;
+using ::perfetto::ipc::Deferred;
+using ::perfetto::ipc::Host;
+using ::perfetto::ipc::Service;
+using ::perfetto::ipc::ServiceProxy;
+
+constexpr char kSockName[] = TEST_SOCK_NAME("host_impl_benchmark");
+constexpr size_t kConsumerReplySize = 64 * 1024;
+
+// SayHello() is the producers' method, WaveGoodbye() the consumer's one.
+class BenchmarkGreeter : public Greeter {
+ public:
+  void SayHello(const GreeterRequestMsg& req,
+                DeferredGreeterReplyMsg reply) override {
+    auto res = AsyncResult<GreeterReplyMsg>::Create();
+    res->set_message(req.name());
+    reply.Resolve(std::move(res));
+  }
+
+  void WaveGoodbye(const GreeterRequestMsg&,
+                   DeferredGreeterReplyMsg reply) override {
+    auto res = AsyncResult<GreeterReplyMsg>::Create();
+    res->mutable_message()->assign(kConsumerReplySize, 'x');
+    reply.Resolve(std::move(res));
+  }
+};
+
+// Runs a UnixTaskRunner on a background thread.
+class BackgroundTaskRunner {
+ public:
+  BackgroundTaskRunner() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    thread_ = std::thread([this] {
+      UnixTaskRunner task_runner;
+      {
+        std::lock_guard<std::mutex> thread_lock(mutex_);
+        task_runner_ = &task_runner;
+      }
+      ready_.notify_one();
+      task_runner.Run();
+    });
+    ready_.wait(lock, [this] { return task_runner_ != nullptr; });
+  }
+
+  ~BackgroundTaskRunner() { thread_.join(); }
+
+  // Runs |fn| on the thread and waits for it to complete.
+  void RunAndWait(std::function<void()> fn) {
+    bool done = false;
+    task_runner_->PostTask([this, &fn, &done] {
+      fn();
+      std::lock_guard<std::mutex> lock(mutex_);
+      done = true;
+      ready_.notify_one();
+    });
+    std::unique_lock<std::mutex> lock(mutex_);
+    ready_.wait(lock, [&done] { return done; });
+  }
+
+  void Quit() {
+    task_runner_->PostTask([this] { task_runner_->Quit(); });
+  }
+
+  UnixTaskRunner* task_runner() const { return task_runner_; }
+
+ private:
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  UnixTaskRunner* task_runner_ = nullptr;
+};
+
+class ConnectionListener : public ServiceProxy::EventListener {
+ public:
+  explicit ConnectionListener(std::function<void()> on_connect)
+      : on_connect_(on_connect) {}
+  void OnConnect() override { on_connect_(); }
+  void OnDisconnect() override {}
+
+ private:
+  std::function<void()> on_connect_;
+};
+
+struct GreeterClient {
+  GreeterClient(const char* sock_name,
+                perfetto::base::TaskRunner* task_runner,
+                std::function<void()> on_connect)
+      : listener(on_connect),
+        client(Client::CreateInstance(sock_name, task_runner)),
+        proxy(new GreeterProxy(&listener)) {
+    client->BindService(proxy->GetWeakPtr());
+  }
+
+  ConnectionListener listener;
+  std::unique_ptr<Client> client;
+  std::unique_ptr<GreeterProxy> proxy;
+};
+
+// Issues a new WaveGoodbye() as soon as the previous one is replied, until
+// |stop| is set.
+void PullFromHost(GreeterProxy* proxy,
+                  std::atomic<bool>* stop,
+                  std::atomic<uint64_t>* bytes_received) {
+  Deferred<GreeterReplyMsg> reply(
+      [proxy, stop, bytes_received](AsyncResult<GreeterReplyMsg> res) {
+        if (!res)
+          return;  // Rejected when the consumer is destroyed.
+        *bytes_received += res->message().size();
+        if (!*stop)
+          PullFromHost(proxy, stop, bytes_received);
+      });
+  proxy->WaveGoodbye(GreeterRequestMsg(), std::move(reply));
+}
+
+static void BM_HostImplManyProducersHeavyConsumer(benchmark::State& state) {
+  const size_t num_io_threads = static_cast<size_t>(state.range(0));
+  const size_t num_producers = static_cast<size_t>(state.range(1));
+  DESTROY_TEST_SOCK(kSockName);
+
+  BackgroundTaskRunner host_thread;
+  std::unique_ptr<Host> host;
+  host_thread.RunAndWait([&host, &host_thread, num_io_threads] {
+    host = Host::CreateInstance(kSockName, host_thread.task_runner(),
+                                num_io_threads);
+    PERFETTO_CHECK(host);
+    host->ExposeService(std::unique_ptr<Service>(new BenchmarkGreeter()));
+  });
+
+  TestTaskRunner task_runner;
+  std::vector<std::unique_ptr<GreeterClient>> producers;
+  size_t num_connected = 0;
+  auto all_connected = task_runner.CreateCheckpoint("all_connected");
+  for (size_t i = 0; i < num_producers; i++) {
+    producers.emplace_back(new GreeterClient(
+        kSockName, &task_runner, [&num_connected, num_producers, all_connected] {
+          if (++num_connected == num_producers)
+            all_connected();
+        }));
+  }
+  task_runner.RunUntilCheckpoint("all_connected");
+
+  // The consumer has its own thread, so that receiving its replies doesn't
+  // slow down the producers.
+  BackgroundTaskRunner consumer_thread;
+  std::unique_ptr<GreeterClient> consumer;
+  std::atomic<bool> stop_consumer{false};
+  std::atomic<uint64_t> consumer_bytes{0};
+  consumer_thread.RunAndWait(
+      [&consumer, &consumer_thread, &stop_consumer, &consumer_bytes] {
+        consumer.reset(new GreeterClient(
+            kSockName, consumer_thread.task_runner(),
+            [&consumer, &stop_consumer, &consumer_bytes] {
+              PullFromHost(consumer->proxy.get(), &stop_consumer,
+                           &consumer_bytes);
+            }));
+      });
+
+  uint64_t iterations = 0;
+  GreeterRequestMsg req;
+  req.set_name("producer");
+  for (auto _ : state) {
+    std::string checkpoint_name = "replies." + std::to_string(iterations++);
+    auto all_replied = task_runner.CreateCheckpoint(checkpoint_name);
+    size_t num_pending = num_producers;
+    for (auto& producer : producers) {
+      Deferred<GreeterReplyMsg> reply(
+          [&num_pending, all_replied](AsyncResult<GreeterReplyMsg> res) {
+            PERFETTO_CHECK(res);
+            if (--num_pending == 0)
+              all_replied();
+          });
+      producer->proxy->SayHello(req, std::move(reply));
+    }
+    task_runner.RunUntilCheckpoint(checkpoint_name);
+  }
+
+  stop_consumer = true;
+  producers.clear();
+  consumer_thread.RunAndWait([&consumer] { consumer.reset(); });
+  consumer_thread.Quit();
+  host_thread.RunAndWait([&host] { host.reset(); });
+  host_thread.Quit();
+
+  state.SetItemsProcessed(static_cast<int64_t>(iterations * num_producers));
+  state.counters["Con B/s"] = benchmark::Counter(
+      static_cast<double>(consumer_bytes), benchmark::Counter::kIsRate);
+}
+
+void ManyProducersArgs(benchmark::internal::Benchmark* b) {
+  for (int io_threads : {0, 1, 2}) {
+    for (int producers : {8, 32})
+      b->Args({io_threads, producers});
+  }
+}
+
+}  // namespace
+}  // namespace ipc_test
+
+BENCHMARK(ipc_test::BM_HostImplManyProducersHeavyConsumer)
+    ->Apply(ipc_test::ManyProducersArgs)
+    ->UseRealTime();
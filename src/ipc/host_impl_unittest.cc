@@ -17,6 +17,8 @@
 #include "src/ipc/host_impl.h"
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
@@ -163,12 +165,15 @@ class FakeClient : public base::UnixSocket::EventListener {
   ServiceID last_bound_service_id_;
 };
 
-class HostImplTest : public ::testing::Test {
+// The test parameter is the number of IO threads of the host.
+class HostImplTest : public ::testing::TestWithParam<size_t> {
  public:
   void SetUp() override {
     DESTROY_TEST_SOCK(kSockName);
     task_runner_.reset(new base::TestTaskRunner());
-    Host* host = Host::CreateInstance(kSockName, task_runner_.get()).release();
+    Host* host =
+        Host::CreateInstance(kSockName, task_runner_.get(), GetParam())
+            .release();
     ASSERT_NE(nullptr, host);
     host_.reset(static_cast<HostImpl*>(host));
     cli_.reset(new FakeClient(task_runner_.get()));
@@ -192,7 +197,12 @@ class HostImplTest : public ::testing::Test {
   std::unique_ptr<FakeClient> cli_;
 };
 
-TEST_F(HostImplTest, BindService) {
+size_t const kNumIOThreads[] = {0, 2};
+INSTANTIATE_TEST_CASE_P(IOThreads,
+                        HostImplTest,
+                        ::testing::ValuesIn(kNumIOThreads));
+
+TEST_P(HostImplTest, BindService) {
   // First bind the service when it doesn't exists yet and check that the
   // BindService() request fails.
   cli_->BindService("FakeService");  // FakeService does not exist yet.
@@ -217,7 +227,7 @@ TEST_F(HostImplTest, BindService) {
   task_runner_->RunUntilCheckpoint("on_bind_success");
 }
 
-TEST_F(HostImplTest, InvokeNonExistingMethod) {
+TEST_P(HostImplTest, InvokeNonExistingMethod) {
   FakeService* fake_service = new FakeService("FakeService");
   ASSERT_TRUE(host_->ExposeService(std::unique_ptr<Service>(fake_service)));
   auto on_bind = task_runner_->CreateCheckpoint("on_bind");
@@ -237,7 +247,7 @@ TEST_F(HostImplTest, InvokeNonExistingMethod) {
   task_runner_->RunUntilCheckpoint("on_invoke_failure");
 }
 
-TEST_F(HostImplTest, InvokeMethod) {
+TEST_P(HostImplTest, InvokeMethod) {
   FakeService* fake_service = new FakeService("FakeService");
   ASSERT_TRUE(host_->ExposeService(std::unique_ptr<Service>(fake_service)));
   auto on_bind = task_runner_->CreateCheckpoint("on_bind");
@@ -275,7 +285,7 @@ TEST_F(HostImplTest, InvokeMethod) {
   task_runner_->RunUntilCheckpoint("on_reply_received");
 }
 
-TEST_F(HostImplTest, InvokeMethodDropReply) {
+TEST_P(HostImplTest, InvokeMethodDropReply) {
   FakeService* fake_service = new FakeService("FakeService");
   ASSERT_TRUE(host_->ExposeService(std::unique_ptr<Service>(fake_service)));
   auto on_bind = task_runner_->CreateCheckpoint("on_bind");
@@ -318,7 +328,7 @@ TEST_F(HostImplTest, InvokeMethodDropReply) {
   task_runner_->RunUntilCheckpoint("on_reply_received");
 }
 
-TEST_F(HostImplTest, SendFileDescriptor) {
+TEST_P(HostImplTest, SendFileDescriptor) {
   FakeService* fake_service = new FakeService("FakeService");
   ASSERT_TRUE(host_->ExposeService(std::unique_ptr<Service>(fake_service)));
   auto on_bind = task_runner_->CreateCheckpoint("on_bind");
@@ -360,7 +370,7 @@ TEST_F(HostImplTest, SendFileDescriptor) {
   task_runner_->RunUntilCheckpoint("on_fd_received");
 }
 
-TEST_F(HostImplTest, ReceiveFileDescriptor) {
+TEST_P(HostImplTest, ReceiveFileDescriptor) {
   auto received = task_runner_->CreateCheckpoint("received");
   FakeService* fake_service = new FakeService("FakeService");
   ASSERT_TRUE(host_->ExposeService(std::unique_ptr<Service>(fake_service)));
@@ -396,7 +406,7 @@ TEST_F(HostImplTest, ReceiveFileDescriptor) {
 }
 
 // Invoke a method and immediately after disconnect the client.
-TEST_F(HostImplTest, OnClientDisconnect) {
+TEST_P(HostImplTest, OnClientDisconnect) {
   FakeService* fake_service = new FakeService("FakeService");
   ASSERT_TRUE(host_->ExposeService(std::unique_ptr<Service>(fake_service)));
   auto on_bind = task_runner_->CreateCheckpoint("on_bind");
@@ -421,7 +431,7 @@ TEST_F(HostImplTest, OnClientDisconnect) {
 
 // Like InvokeMethod, but instead of resolving the Deferred reply within the
 // call stack, std::move()-s it outside an replies
-TEST_F(HostImplTest, MoveReplyObjectAndReplyAsynchronously) {
+TEST_P(HostImplTest, MoveReplyObjectAndReplyAsynchronously) {
   FakeService* fake_service = new FakeService("FakeService");
   ASSERT_TRUE(host_->ExposeService(std::unique_ptr<Service>(fake_service)));
   auto on_bind = task_runner_->CreateCheckpoint("on_bind");
@@ -470,8 +480,56 @@ TEST_F(HostImplTest, MoveReplyObjectAndReplyAsynchronously) {
   task_runner_->RunUntilCheckpoint("on_reply_received");
 }
 
+// Several clients invoke the same method. Each one must get back its own reply,
+// regardless of which IO thread (if any) serves its connection.
+TEST_P(HostImplTest, ManyClients) {
+  FakeService* fake_service = new FakeService("FakeService");
+  ASSERT_TRUE(host_->ExposeService(std::unique_ptr<Service>(fake_service)));
+  EXPECT_CALL(*fake_service, OnFakeMethod1(_, _))
+      .WillRepeatedly(Invoke([](const RequestProto& req, DeferredBase* reply) {
+        std::unique_ptr<ReplyProto> reply_args(new ReplyProto());
+        reply_args->set_data("reply_to_" + req.data());
+        reply->Resolve(AsyncResult<ProtoMessage>(
+            std::unique_ptr<ProtoMessage>(reply_args.release())));
+      }));
+
+  static constexpr size_t kNumClients = 5;
+  std::vector<std::unique_ptr<FakeClient>> clients;
+  for (size_t i = 0; i < kNumClients; i++) {
+    std::string id = std::to_string(i);
+    clients.emplace_back(new FakeClient(task_runner_.get()));
+    FakeClient* cli = clients.back().get();
+    auto on_connect = task_runner_->CreateCheckpoint("on_connect_" + id);
+    EXPECT_CALL(*cli, OnConnect()).WillOnce(Invoke(on_connect));
+    task_runner_->RunUntilCheckpoint("on_connect_" + id);
+
+    auto on_bind = task_runner_->CreateCheckpoint("on_bind_" + id);
+    cli->BindService("FakeService");
+    EXPECT_CALL(*cli, OnServiceBound(_)).WillOnce(InvokeWithoutArgs(on_bind));
+    task_runner_->RunUntilCheckpoint("on_bind_" + id);
+  }
+
+  for (size_t i = 0; i < kNumClients; i++) {
+    std::string id = std::to_string(i);
+    FakeClient* cli = clients[i].get();
+    auto on_reply = task_runner_->CreateCheckpoint("on_reply_" + id);
+    EXPECT_CALL(*cli, OnInvokeMethodReply(_))
+        .WillOnce(Invoke([on_reply, id](const Frame::InvokeMethodReply& reply) {
+          ASSERT_TRUE(reply.success());
+          ReplyProto reply_args;
+          reply_args.ParseFromString(reply.reply_proto());
+          ASSERT_EQ("reply_to_" + id, reply_args.data());
+          on_reply();
+        }));
+    RequestProto req_args;
+    req_args.set_data(id);
+    cli->InvokeMethod(cli->last_bound_service_id_, 1, req_args);
+  }
+  for (size_t i = 0; i < kNumClients; i++)
+    task_runner_->RunUntilCheckpoint("on_reply_" + std::to_string(i));
+}
+
 // TODO(primiano): add the tests below in next CLs.
-// TEST(HostImplTest, ManyClients) {}
 // TEST(HostImplTest, OverlappingRequstsOutOfOrder) {}
 // TEST(HostImplTest, StreamingRequest) {}
 // TEST(HostImplTest, ManyDropReplyRequestsDontLeakMemory) {}
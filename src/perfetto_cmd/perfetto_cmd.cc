@@ -60,6 +60,10 @@ namespace {
 
 constexpr uint32_t kFlushTimeoutMs = 5000;
 
+// Size of the shared memory ring used to receive the trace data from the
+// service, rather than receiving it over the socket.
+constexpr size_t kReadBuffersShmSize = 4 * 1024 * 1024;
+
 perfetto::PerfettoCmd* g_consumer_cmd;
 
 class LoggingErrorReporter : public ErrorReporter {
@@ -484,8 +488,8 @@ int PerfettoCmd::Main(int argc, char** argv) {
   if (!limiter.ShouldTrace(args))
     return 1;
 
-  consumer_endpoint_ =
-      ConsumerIPCClient::Connect(GetConsumerSocket(), this, &task_runner_);
+  consumer_endpoint_ = ConsumerIPCClient::Connect(
+      GetConsumerSocket(), this, &task_runner_, kReadBuffersShmSize);
   SetupCtrlCSignalHandler();
   task_runner_.Run();
 
@@ -37,6 +37,10 @@
 #include "perfetto/base/android_task_runner.h"
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
 
+#if PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
+#include "perfetto/base/epoll_task_runner.h"
+#endif
+
 namespace perfetto {
 
 // Temporary directory for DropBox traces. Note that this is automatically
@@ -45,6 +49,8 @@ extern const char* kTempDropBoxTraceDir;
 
 #if PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
 using PlatformTaskRunner = base::AndroidTaskRunner;
+#elif PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
+using PlatformTaskRunner = base::EpollTaskRunner;
 #else
 using PlatformTaskRunner = base::UnixTaskRunner;
 #endif
@@ -16,6 +16,8 @@
 
 #include "perfetto/protozero/message.h"
 
+#include <string.h>
+
 #include <type_traits>
 
 #include "perfetto/base/logging.h"
@@ -32,6 +34,9 @@ namespace protozero {
 // static
 constexpr uint32_t Message::kMaxNestingDepth;
 
+// static
+constexpr uint32_t Message::kMaxEncodedSize;
+
 // Do NOT put any code in the constructor or use default initialization.
 // Use the Reset() method below instead. See the header for the reason why.
 
@@ -55,6 +60,8 @@ void Message::Reset(ScatteredStreamWriter* stream_writer) {
   stream_writer_ = stream_writer;
   size_ = 0;
   size_field_ = nullptr;
+  size_field_size_ = proto_utils::kMessageLengthFieldSize;
+  short_size_limit_ = 0;
   size_already_written_ = 0;
   nested_message_ = nullptr;
   nesting_depth_ = 0;
@@ -86,6 +93,14 @@ void Message::AppendBytes(uint32_t field_id, const void* src, size_t size) {
   WriteToStream(src_u8, src_u8 + size);
 }
 
+void Message::AppendRawProtoBytes(const void* src, size_t size) {
+  if (nested_message_)
+    EndNestedMessage();
+
+  const uint8_t* src_u8 = reinterpret_cast<const uint8_t*>(src);
+  WriteToStream(src_u8, src_u8 + size);
+}
+
 size_t Message::AppendScatteredBytes(uint32_t field_id,
                                      ContiguousMemoryRange* ranges,
                                      size_t num_ranges) {
@@ -124,8 +139,10 @@ uint32_t Message::Finalize() {
     PERFETTO_DCHECK(!finalized_);
     PERFETTO_DCHECK(size_ < proto_utils::kMaxMessageLength);
     PERFETTO_DCHECK(size_ >= size_already_written_);
-    proto_utils::WriteRedundantVarInt(size_ - size_already_written_,
-                                      size_field_);
+    const uint32_t size = size_ - size_already_written_;
+    PERFETTO_DCHECK(size_field_size_ == proto_utils::kMessageLengthFieldSize ||
+                    size <= short_size_limit_);
+    proto_utils::WriteRedundantVarInt(size, size_field_, size_field_size_);
     size_field_ = nullptr;
   }
 
@@ -138,10 +155,16 @@ uint32_t Message::Finalize() {
   return size_;
 }
 
-void Message::BeginNestedMessageInternal(uint32_t field_id, Message* message) {
+void Message::BeginNestedMessageInternal(uint32_t field_id,
+                                         Message* message,
+                                         uint32_t max_encoded_size) {
   if (nested_message_)
     EndNestedMessage();
 
+  // A message that starts nested messages can't be bounded anymore.
+  if (size_field_size_ < proto_utils::kMessageLengthFieldSize)
+    WidenSizeField();
+
   // Write the proto preamble for the nested message.
   uint8_t data[proto_utils::kMaxTagEncodedSize];
   uint8_t* data_end = proto_utils::WriteVarInt(
@@ -154,15 +177,42 @@ void Message::BeginNestedMessageInternal(uint32_t field_id, Message* message) {
 
   // The length of the nested message cannot be known upfront. So right now
   // just reserve the bytes to encode the size after the nested message is done.
-  message->set_size_field(
-      stream_writer_->ReserveBytes(proto_utils::kMessageLengthFieldSize));
-  size_ += proto_utils::kMessageLengthFieldSize;
+  // If the message is known to be small and the current chunk has room for it
+  // behind a regular size field, reserve a single byte. The room guarantees
+  // that the size field never needs patching, and that the message can still
+  // be widened if it turns out to be larger than expected.
+  // The parent accounts for the size field in EndNestedMessage(), once its
+  // final size is known.
+  size_t size_field_size = proto_utils::kMessageLengthFieldSize;
+  if (max_encoded_size && max_encoded_size < 0x80 &&
+      stream_writer_->bytes_available() >=
+          proto_utils::kMessageLengthFieldSize + max_encoded_size) {
+    size_field_size = 1;
+    message->short_size_limit_ = static_cast<uint8_t>(max_encoded_size);
+  }
+  message->set_size_field(stream_writer_->ReserveBytes(size_field_size));
+  message->size_field_size_ = static_cast<uint8_t>(size_field_size);
   nested_message_ = message;
 }
 
 void Message::EndNestedMessage() {
-  size_ += nested_message_->Finalize();
+  size_ += nested_message_->size_field_size_ + nested_message_->Finalize();
   nested_message_ = nullptr;
 }
 
+void Message::WidenSizeField() {
+  // The message has not exceeded |short_size_limit_| yet, so it's still
+  // contiguous and BeginNestedMessageInternal() left room for the extra bytes
+  // in the chunk.
+  PERFETTO_DCHECK(!finalized_ && !nested_message_);
+  PERFETTO_DCHECK(size_field_ + size_field_size_ + size_ ==
+                  stream_writer_->write_ptr());
+  const size_t extra = proto_utils::kMessageLengthFieldSize - size_field_size_;
+  PERFETTO_DCHECK(stream_writer_->bytes_available() >= extra);
+  stream_writer_->ReserveBytesUnsafe(extra);
+  memmove(size_field_ + proto_utils::kMessageLengthFieldSize,
+          size_field_ + size_field_size_, size_);
+  size_field_size_ = proto_utils::kMessageLengthFieldSize;
+}
+
 }  // namespace protozero
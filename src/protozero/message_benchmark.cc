@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+
+#include "benchmark/benchmark.h"
+#include "perfetto/protozero/message.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "perfetto/protozero/scattered_stream_writer.h"
+
+namespace {
+
+using ::protozero::Message;
+using ::protozero::ScatteredHeapBuffer;
+using ::protozero::ScatteredStreamWriter;
+
+constexpr size_t kSliceSize = 64 * 1024;
+constexpr uint32_t kFieldsPerMessage = 1000;
+
+// Bound of the fields written by WriteNestedMessage() below: three uint32
+// varints and a bool, as the generator would compute it.
+class SmallMessage : public Message {
+ public:
+  static constexpr uint32_t kMaxEncodedSize = 20;
+};
+
+class UnboundedMessage : public Message {};
+
+// Calls |fn| kFieldsPerMessage times on a root message and reports both the
+// number of bytes encoded and the number of calls, as a smaller encoding
+// yields fewer bytes/s for the same amount of work.
+template <typename Fn>
+void RunBenchmark(benchmark::State& state, Fn fn) {
+  ScatteredHeapBuffer buffer(kSliceSize, kSliceSize);
+  ScatteredStreamWriter writer(&buffer);
+  buffer.set_writer(&writer);
+  Message msg;
+  int64_t bytes = 0;
+  for (auto _ : state) {
+    buffer.Reset();
+    msg.Reset(&writer);
+    for (uint32_t i = 0; i < kFieldsPerMessage; i++)
+      fn(&msg, i);
+    bytes += msg.Finalize();
+  }
+  state.SetBytesProcessed(bytes);
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * kFieldsPerMessage));
+}
+
+// Spreads the values over 1 to 5 byte varints.
+uint32_t GetValue(uint32_t i) {
+  return i * 2654435761u >> (i % 32);
+}
+
+static void BM_ProtoZeroAppendVarInt(benchmark::State& state) {
+  RunBenchmark(state, [](Message* msg, uint32_t i) {
+    msg->AppendVarInt(1 + (i & 1), GetValue(i));
+  });
+}
+
+static void BM_ProtoZeroAppendVarIntConstFieldId(benchmark::State& state) {
+  RunBenchmark(state, [](Message* msg, uint32_t i) {
+    if (i & 1) {
+      msg->AppendVarInt<2>(GetValue(i));
+    } else {
+      msg->AppendVarInt<1>(GetValue(i));
+    }
+  });
+}
+
+static void BM_ProtoZeroAppendFixed(benchmark::State& state) {
+  RunBenchmark(state, [](Message* msg, uint32_t i) {
+    msg->AppendFixed(1 + (i & 1), static_cast<uint64_t>(GetValue(i)));
+  });
+}
+
+static void BM_ProtoZeroAppendFixedConstFieldId(benchmark::State& state) {
+  RunBenchmark(state, [](Message* msg, uint32_t i) {
+    if (i & 1) {
+      msg->AppendFixed<2>(static_cast<uint64_t>(GetValue(i)));
+    } else {
+      msg->AppendFixed<1>(static_cast<uint64_t>(GetValue(i)));
+    }
+  });
+}
+
+// Resembles the typical ftrace event: a handful of small ints in a nested
+// message.
+template <typename T>
+void WriteNestedMessage(Message* msg, uint32_t i) {
+  T* nested = msg->BeginNestedMessage<T>(1);
+  nested->template AppendVarInt<1>(GetValue(i));
+  nested->template AppendVarInt<2>(GetValue(i + 1));
+  nested->template AppendVarInt<3>(GetValue(i + 2));
+  nested->template AppendTinyVarInt<4>(1);
+}
+
+static void BM_ProtoZeroNestedMessages(benchmark::State& state) {
+  RunBenchmark(state, WriteNestedMessage<UnboundedMessage>);
+}
+
+static void BM_ProtoZeroNestedSmallMessages(benchmark::State& state) {
+  RunBenchmark(state, WriteNestedMessage<SmallMessage>);
+}
+
+}  // namespace
+
+BENCHMARK(BM_ProtoZeroAppendVarInt);
+BENCHMARK(BM_ProtoZeroAppendVarIntConstFieldId);
+BENCHMARK(BM_ProtoZeroAppendFixed);
+BENCHMARK(BM_ProtoZeroAppendFixedConstFieldId);
+BENCHMARK(BM_ProtoZeroNestedMessages);
+BENCHMARK(BM_ProtoZeroNestedSmallMessages);
@@ -39,6 +39,11 @@ constexpr const char kEndWatermark[] = {'9', '8', '7', '6',
 
 class FakeRootMessage : public Message {};
 class FakeChildMessage : public Message {};
+// As if generated for a message with a single uint32 field, with id 1.
+class FakeSmallChildMessage : public Message {
+ public:
+  static constexpr uint32_t kMaxEncodedSize = 6;
+};
 
 uint32_t SimpleHash(const std::string& str) {
   uint32_t hash = 5381;
@@ -207,6 +212,91 @@ TEST_F(MessageTest, NestedMessagesSimple) {
   ASSERT_EQ("2803", GetNextSerializedBytes(2));
 }
 
+// The appenders templated on the field id must produce the same encoding as
+// the runtime ones, both when writing in place and when the field straddles
+// two chunks.
+TEST_F(MessageTest, BasicTypesWithConstFieldIds) {
+  Message* msg = NewMessage();
+  msg->AppendVarInt<1>(0);
+  msg->AppendVarInt<2>(std::numeric_limits<uint32_t>::max());
+  msg->AppendVarInt<3>(42);
+  msg->AppendVarInt<4>(std::numeric_limits<uint64_t>::max());
+  msg->AppendFixed<5>(3.1415f /* float */);
+  msg->AppendFixed<6>(3.14159265358979323846 /* double */);
+  msg->AppendTinyVarInt<7>(1);
+  msg->AppendVarInt<300>(-1);
+  msg->AppendSignedVarInt<3>(-21);
+
+  EXPECT_EQ(51u, msg->Finalize());
+  EXPECT_EQ(51u, GetNumSerializedBytes());
+
+  ASSERT_EQ("0800", GetNextSerializedBytes(2));
+  ASSERT_EQ("10FFFFFFFF0F", GetNextSerializedBytes(6));
+  ASSERT_EQ("182A", GetNextSerializedBytes(2));
+  ASSERT_EQ("20FFFFFFFFFFFFFFFFFF01", GetNextSerializedBytes(11));
+  ASSERT_EQ("2D560E4940", GetNextSerializedBytes(5));
+  ASSERT_EQ("31182D4454FB210940", GetNextSerializedBytes(9));
+  ASSERT_EQ("3801", GetNextSerializedBytes(2));
+  ASSERT_EQ("E012FFFFFFFFFFFFFFFFFF01", GetNextSerializedBytes(12));
+  ASSERT_EQ("1829", GetNextSerializedBytes(2));
+}
+
+// Messages with a bounded size get a short size field, unless they could end
+// up spanning across chunks.
+TEST_F(MessageTest, NestedMessagesWithBoundedSize) {
+  Message* root_msg = NewMessage();
+  root_msg->AppendVarInt(1 /* field_id */, 1);
+
+  FakeSmallChildMessage* nested_msg =
+      root_msg->BeginNestedMessage<FakeSmallChildMessage>(2 /* field_id */);
+  EXPECT_EQ(1u, nested_msg->size_field_size());
+  nested_msg->AppendVarInt<1>(5u);
+  root_msg->AppendVarInt(3 /* field_id */, 3);
+
+  // Leave 5 bytes in the first chunk after the preamble, which are not enough
+  // for a regular size field (4 bytes) followed by the message (6 bytes max).
+  root_msg->AppendVarInt(4 /* field_id */, 1);
+  nested_msg =
+      root_msg->BeginNestedMessage<FakeSmallChildMessage>(5 /* field_id */);
+  EXPECT_EQ(proto_utils::kMessageLengthFieldSize,
+            nested_msg->size_field_size());
+  nested_msg->AppendVarInt<1>(5u);
+
+  EXPECT_EQ(17u, root_msg->Finalize());
+  EXPECT_EQ(17u, GetNumSerializedBytes());
+
+  ASSERT_EQ("0801", GetNextSerializedBytes(2));
+  ASSERT_EQ("12020805", GetNextSerializedBytes(4));
+  ASSERT_EQ("1803", GetNextSerializedBytes(2));
+  ASSERT_EQ("2001", GetNextSerializedBytes(2));
+  ASSERT_EQ("2A828080000805", GetNextSerializedBytes(7));
+}
+
+// A message with a short size field that exceeds its kMaxEncodedSize, e.g.
+// because a field is set twice, is moved behind a regular size field and can
+// then span across chunks.
+TEST_F(MessageTest, NestedMessageExceedingItsBoundedSize) {
+  Message* root_msg = NewMessage();
+  FakeSmallChildMessage* nested_msg =
+      root_msg->BeginNestedMessage<FakeSmallChildMessage>(1 /* field_id */);
+  EXPECT_EQ(1u, nested_msg->size_field_size());
+  nested_msg->AppendVarInt<1>(5u);
+  EXPECT_EQ(1u, nested_msg->size_field_size());
+  nested_msg->AppendVarInt<1>(6u);
+  EXPECT_EQ(proto_utils::kMessageLengthFieldSize,
+            nested_msg->size_field_size());
+  nested_msg->AppendBytes(3 /* field_id */, "abcdefgh", 8);
+  root_msg->AppendVarInt(2 /* field_id */, 1);
+
+  EXPECT_EQ(21u, root_msg->Finalize());
+  EXPECT_EQ(21u, GetNumSerializedBytes());
+
+  ASSERT_EQ("0A8E808000", GetNextSerializedBytes(5));
+  ASSERT_EQ("08050806", GetNextSerializedBytes(4));
+  ASSERT_EQ("1A086162636465666768", GetNextSerializedBytes(10));
+  ASSERT_EQ("1001", GetNextSerializedBytes(2));
+}
+
 // Tests using a AppendScatteredBytes to append raw bytes to
 // a message using multiple individual buffers.
 TEST_F(MessageTest, AppendScatteredBytes) {
@@ -229,6 +319,21 @@ TEST_F(MessageTest, AppendScatteredBytes) {
   EXPECT_EQ("42424242", GetNextSerializedBytes(4));
 }
 
+// Raw proto bytes are copied as-is and accounted in the size of the enclosing
+// nested message.
+TEST_F(MessageTest, AppendRawProtoBytes) {
+  Message* root_msg = NewMessage();
+  Message* nested_msg = root_msg->BeginNestedMessage<FakeChildMessage>(1);
+  const uint8_t kFields[] = {0x08, 0x2A, 0x10, 0x01};  // {1: 42, 2: 1}.
+  nested_msg->AppendRawProtoBytes(kFields, sizeof(kFields));
+  EXPECT_EQ(9u, root_msg->Finalize());
+  EXPECT_EQ(9u, GetNumSerializedBytes());
+
+  EXPECT_EQ("0A", GetNextSerializedBytes(1));
+  EXPECT_EQ("84808000", GetNextSerializedBytes(4));
+  EXPECT_EQ("082A1001", GetNextSerializedBytes(4));
+}
+
 // Checks that the size field of root and nested messages is properly written
 // on finalization.
 TEST_F(MessageTest, BackfillSizeOnFinalization) {
@@ -90,7 +90,8 @@ ProtoDecoder::Field ProtoDecoder::ReadField() {
       // Alternatively, we may not have space to fully read the length
       // delimited field. Set the id to zero and return but don't update the
       // offset so a future read can read this field.
-      if (new_pos == pos || new_pos + field_intvalue > end) {
+      if (new_pos == pos ||
+          field_intvalue > static_cast<uint64_t>(end - new_pos)) {
         return field;
       }
       pos = new_pos;
@@ -127,4 +128,22 @@ ProtoDecoder::Field ProtoDecoder::ReadField() {
   return field;
 }
 
+// static
+const ProtoDecoder::Field TypedProtoDecoderBase::kMissingField{};
+
+void TypedProtoDecoderBase::ParseAllFields(Field* fields,
+                                           uint64_t* present,
+                                           uint32_t max_field_id) {
+  memset(present, 0, sizeof(uint64_t) * (max_field_id / 64 + 1));
+  ProtoDecoder decoder(buffer_, length_);
+  for (auto fld = decoder.ReadField(); fld.valid(); fld = decoder.ReadField()) {
+    // Skip fields unknown to this version of the decoder.
+    if (fld.id > max_field_id)
+      continue;
+    fields[fld.id] = fld;
+    present[fld.id / 64] |= 1ull << (fld.id % 64);
+  }
+  end_of_buffer_ = decoder.IsEndOfBuffer();
+}
+
 }  // namespace protozero
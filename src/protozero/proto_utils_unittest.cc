@@ -172,6 +172,28 @@ TEST(ProtoUtilsTest, RedundantVarIntEncoding) {
   EXPECT_EQ(0, memcmp("\xFF\xFF\xFF\x7F", buf, sizeof(buf)));
 }
 
+TEST(ProtoUtilsTest, ShortRedundantVarIntEncoding) {
+  uint8_t buf[2];
+
+  WriteRedundantVarInt(1, buf, 1);
+  EXPECT_EQ(0, memcmp("\x01", buf, 1));
+
+  WriteRedundantVarInt(1, buf, 2);
+  EXPECT_EQ(0, memcmp("\x81\x00", buf, 2));
+
+  WriteRedundantVarInt(0x3FFF, buf, 2);
+  EXPECT_EQ(0, memcmp("\xFF\x7F", buf, 2));
+}
+
+TEST(ProtoUtilsTest, VarIntSize) {
+  for (size_t i = 0; i < ArraySize(kVarIntExpectations); ++i) {
+    const VarIntExpectation& exp = kVarIntExpectations[i];
+    EXPECT_EQ(exp.encoded_size, VarIntSize(exp.int_value));
+  }
+  static_assert(VarIntSize(MakeTagVarInt(15)) == 1, "VarIntSize not constexpr");
+  static_assert(VarIntSize(MakeTagVarInt(16)) == 2, "VarIntSize not constexpr");
+}
+
 TEST(ProtoUtilsTest, VarIntDecoding) {
   for (size_t i = 0; i < ArraySize(kVarIntExpectations); ++i) {
     const VarIntExpectation& exp = kVarIntExpectations[i];
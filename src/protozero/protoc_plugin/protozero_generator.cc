@@ -69,6 +69,10 @@ struct EnumDescriptorComp {
   }
 };
 
+// Fields with higher ids are not exposed by the generated decoders, as the
+// size of their field table grows linearly with the max field id.
+constexpr int kMaxDecoderFieldId = 999;
+
 inline std::string ProtoStubName(const FileDescriptor* proto) {
   return StripSuffixString(proto->name(), ".proto") + ".pbzero";
 }
@@ -158,6 +162,58 @@ class GeneratorJob {
     return true;
   }
 
+  // Returns an upper bound of the encoded size of |message|, assuming that
+  // each field is set at most once, or 0 if the size is unbounded (e.g. the
+  // message has repeated, string, bytes or nested message fields).
+  uint32_t GetMaxEncodedSize(const Descriptor* message) {
+    uint32_t size = 0;
+    for (int i = 0; i < message->field_count(); ++i) {
+      const FieldDescriptor* field = message->field(i);
+      if (field->is_repeated())
+        return 0;
+
+      uint32_t value_size = 0;
+      switch (field->type()) {
+        case FieldDescriptor::TYPE_BOOL:
+          value_size = 1;
+          break;
+        case FieldDescriptor::TYPE_ENUM:
+          value_size = IsTinyEnumField(field) ? 1 : 10;
+          break;
+        case FieldDescriptor::TYPE_UINT32:
+        case FieldDescriptor::TYPE_SINT32:
+          value_size = 5;
+          break;
+        case FieldDescriptor::TYPE_INT32:  // Negative values take 10 bytes.
+        case FieldDescriptor::TYPE_INT64:
+        case FieldDescriptor::TYPE_UINT64:
+        case FieldDescriptor::TYPE_SINT64:
+          value_size = 10;
+          break;
+        case FieldDescriptor::TYPE_FIXED32:
+        case FieldDescriptor::TYPE_SFIXED32:
+        case FieldDescriptor::TYPE_FLOAT:
+          value_size = 4;
+          break;
+        case FieldDescriptor::TYPE_FIXED64:
+        case FieldDescriptor::TYPE_SFIXED64:
+        case FieldDescriptor::TYPE_DOUBLE:
+          value_size = 8;
+          break;
+        default:
+          return 0;
+      }
+
+      uint32_t tag_size = 1;
+      for (uint32_t tag = static_cast<uint32_t>(field->number()) << 3;
+           tag >= 0x80; tag >>= 7) {
+        tag_size++;
+      }
+      size += tag_size + value_size;
+    }
+    return size;
+  }
+
   void CollectDescriptors() {
     // Collect message descriptors in DFS order.
     std::vector<const Descriptor*> stack;
@@ -271,8 +327,10 @@ class GeneratorJob {
         "#include <stddef.h>\n"
         "#include <stdint.h>\n\n"
         "#include \"perfetto/base/export.h\"\n"
+        "#include \"perfetto/protozero/proto_decoder.h\"\n"
         "#include \"perfetto/protozero/proto_field_descriptor.h\"\n"
-        "#include \"perfetto/protozero/message.h\"\n",
+        "#include \"perfetto/protozero/message.h\"\n"
+        "#include \"perfetto/protozero/packed_repeated_fields.h\"\n",
         "greeting", greeting, "guard", guard);
     stub_cc_->Print(
         "$greeting$\n"
@@ -442,10 +500,19 @@ class GeneratorJob {
     }
     setter["appender"] = appender;
     setter["cpp_type"] = cpp_type;
-    stub_h_->Print(setter,
-                   "void $action$_$name$($cpp_type$ value) {\n"
-                   "  $appender$($id$, value);\n"
-                   "}\n");
+    // Strings go through the generic appender, all the other types use the
+    // variants templated on the field id, which pre-encode the tag.
+    if (field->type() == FieldDescriptor::TYPE_STRING) {
+      stub_h_->Print(setter,
+                     "void $action$_$name$($cpp_type$ value) {\n"
+                     "  $appender$($id$, value);\n"
+                     "}\n");
+    } else {
+      stub_h_->Print(setter,
+                     "void $action$_$name$($cpp_type$ value) {\n"
+                     "  $appender$<$id$>(value);\n"
+                     "}\n");
+    }
 
     // For strings also generate a variant for non-null terminated strings.
     if (field->type() == FieldDescriptor::TYPE_STRING) {
@@ -458,6 +525,38 @@ class GeneratorJob {
     }
   }
 
+  // Returns the C++ type of the values of a packed repeated field, or an empty
+  // string if the type of the field can't be packed by protozero. Only varints
+  // are supported for now.
+  std::string GetPackedCppType(const FieldDescriptor* field) {
+    switch (field->type()) {
+      case FieldDescriptor::TYPE_INT32:
+        return "int32_t";
+      case FieldDescriptor::TYPE_INT64:
+        return "int64_t";
+      case FieldDescriptor::TYPE_UINT32:
+        return "uint32_t";
+      case FieldDescriptor::TYPE_UINT64:
+        return "uint64_t";
+      default:
+        return "";
+    }
+  }
+
+  // Packed fields are written in one go from a buffer of pre-encoded values,
+  // rather than one value at a time.
+  void GeneratePackedFieldDescriptor(const FieldDescriptor* field) {
+    if (GetPackedCppType(field).empty()) {
+      Abort("Unsupported packed field type.");
+      return;
+    }
+    stub_h_->Print(
+        "void set_$name$(const ::protozero::PackedVarInt& packed_buffer) {\n"
+        "  AppendBytes($id$, packed_buffer.data(), packed_buffer.size());\n"
+        "}\n",
+        "name", field->name(), "id", std::to_string(field->number()));
+  }
+
   void GenerateNestedMessageFieldDescriptor(const FieldDescriptor* field) {
     std::string action = field->is_repeated() ? "add" : "set";
     std::string inner_class = GetCppClassName(field->message_type());
@@ -550,7 +649,144 @@ class GeneratorJob {
     stub_cc_->Print("}\n\n");
   }
 
+  void GenerateDecoder(const Descriptor* message) {
+    int max_field_id = 0;
+    for (int i = 0; i < message->field_count(); ++i) {
+      const int id = message->field(i)->number();
+      if (id <= kMaxDecoderFieldId && id > max_field_id)
+        max_field_id = id;
+    }
+
+    std::string class_name = GetCppClassName(message) + "Decoder";
+    stub_h_->Print(
+        "class $name$ : public "
+        "::protozero::TypedProtoDecoder</*MAX_FIELD_ID=*/$max$> {\n"
+        " public:\n",
+        "name", class_name, "max", std::to_string(max_field_id));
+    stub_h_->Indent();
+    stub_h_->Print(
+        "$name$(const uint8_t* data, size_t len) "
+        ": TypedProtoDecoder(data, len) {}\n",
+        "name", class_name);
+
+    for (int i = 0; i < message->field_count(); ++i) {
+      const FieldDescriptor* field = message->field(i);
+      if (field->number() > kMaxDecoderFieldId) {
+        stub_h_->Print("// Field $name$ (id $id$) is too big to be decoded.\n",
+                       "name", field->name(), "id",
+                       std::to_string(field->number()));
+        continue;
+      }
+
+      std::map<std::string, std::string> getter;
+      getter["name"] = field->name();
+      getter["id"] = std::to_string(field->number());
+      stub_h_->Print(
+          getter, "bool has_$name$() const { return at<$id$>().valid(); }\n");
+
+      // Packed fields are expected to be written only once per message (as
+      // protozero does), so the last occurrence is the whole field.
+      if (field->is_packed()) {
+        getter["cpp_type"] = GetPackedCppType(field);
+        if (getter["cpp_type"].empty()) {
+          Abort("Unsupported packed field type.");
+          return;
+        }
+        stub_h_->Print(
+            getter,
+            "::protozero::PackedVarIntIterator<$cpp_type$> $name$("
+            "bool* parse_error) const { "
+            "return ::protozero::PackedVarIntIterator<$cpp_type$>("
+            "at<$id$>().as_bytes().data, at<$id$>().as_bytes().size, "
+            "parse_error); }\n");
+        continue;
+      }
+
+      if (field->is_repeated()) {
+        stub_h_->Print(getter,
+                       "::protozero::RepeatedFieldIterator $name$() const { "
+                       "return GetRepeated($id$); }\n");
+        continue;
+      }
+
+      std::string cpp_type;
+      std::string accessor;
+      switch (field->type()) {
+        case FieldDescriptor::TYPE_BOOL:
+          cpp_type = "bool";
+          accessor = "as_bool";
+          break;
+        case FieldDescriptor::TYPE_INT32:
+        case FieldDescriptor::TYPE_SFIXED32:
+          cpp_type = "int32_t";
+          accessor = "as_int32";
+          break;
+        case FieldDescriptor::TYPE_INT64:
+        case FieldDescriptor::TYPE_SFIXED64:
+          cpp_type = "int64_t";
+          accessor = "as_int64";
+          break;
+        case FieldDescriptor::TYPE_UINT32:
+        case FieldDescriptor::TYPE_FIXED32:
+          cpp_type = "uint32_t";
+          accessor = "as_uint32";
+          break;
+        case FieldDescriptor::TYPE_UINT64:
+        case FieldDescriptor::TYPE_FIXED64:
+          cpp_type = "uint64_t";
+          accessor = "as_uint64";
+          break;
+        case FieldDescriptor::TYPE_SINT32:
+          cpp_type = "int32_t";
+          accessor = "as_sint32";
+          break;
+        case FieldDescriptor::TYPE_SINT64:
+          cpp_type = "int64_t";
+          accessor = "as_sint64";
+          break;
+        case FieldDescriptor::TYPE_FLOAT:
+          cpp_type = "float";
+          accessor = "as_float";
+          break;
+        case FieldDescriptor::TYPE_DOUBLE:
+          cpp_type = "double";
+          accessor = "as_double";
+          break;
+        case FieldDescriptor::TYPE_ENUM:
+          getter["enum_type"] = GetCppClassName(field->enum_type(), true);
+          stub_h_->Print(
+              getter,
+              "$enum_type$ $name$() const { return "
+              "static_cast<$enum_type$>(at<$id$>().as_int32()); }\n");
+          continue;
+        case FieldDescriptor::TYPE_STRING:
+          cpp_type = "::perfetto::base::StringView";
+          accessor = "as_string";
+          break;
+        case FieldDescriptor::TYPE_BYTES:
+        case FieldDescriptor::TYPE_MESSAGE:
+          // Nested messages can be decoded passing these to their decoder.
+          cpp_type = "::protozero::ConstBytes";
+          accessor = "as_bytes";
+          break;
+        case FieldDescriptor::TYPE_GROUP:
+          Abort("Unsupported field type.");
+          return;
+      }
+      getter["cpp_type"] = cpp_type;
+      getter["accessor"] = accessor;
+      stub_h_->Print(getter,
+                     "$cpp_type$ $name$() const { "
+                     "return at<$id$>().$accessor$(); }\n");
+    }
+
+    stub_h_->Outdent();
+    stub_h_->Print("};\n\n");
+  }
+
   void GenerateMessageDescriptor(const Descriptor* message) {
+    GenerateDecoder(message);
+
     stub_h_->Print(
         "class PERFETTO_EXPORT $name$ : public ::protozero::Message {\n"
         " public:\n",
@@ -559,6 +795,16 @@ class GeneratorJob {
 
     GenerateReflectionForMessageFields(message);
 
+    stub_h_->Print("using Decoder = $name$Decoder;\n", "name",
+                   GetCppClassName(message));
+
+    // Allows BeginNestedMessage() to reserve a shorter size field.
+    const uint32_t max_encoded_size = GetMaxEncodedSize(message);
+    if (max_encoded_size) {
+      stub_h_->Print("static constexpr uint32_t kMaxEncodedSize = $size$;\n",
+                     "size", std::to_string(max_encoded_size));
+    }
+
     // Using statements for nested messages.
     for (int i = 0; i < message->nested_type_count(); ++i) {
       const Descriptor* nested_message = message->nested_type(i);
@@ -592,10 +838,8 @@ class GeneratorJob {
     for (int i = 0; i < message->field_count(); ++i) {
       const FieldDescriptor* field = message->field(i);
       if (field->is_packed()) {
-        Abort("Packed repeated fields are not supported.");
-        return;
-      }
-      if (field->type() != FieldDescriptor::TYPE_MESSAGE) {
+        GeneratePackedFieldDescriptor(field);
+      } else if (field->type() != FieldDescriptor::TYPE_MESSAGE) {
         GenerateSimpleFieldDescriptor(field);
       } else {
         GenerateNestedMessageFieldDescriptor(field);
@@ -36,7 +36,8 @@ ScatteredHeapBuffer::Slice::~Slice() = default;
 
 ScatteredHeapBuffer::ScatteredHeapBuffer(size_t initial_slice_size_bytes,
                                          size_t maximum_slice_size_bytes)
-    : next_slice_size_(initial_slice_size_bytes),
+    : initial_slice_size_(initial_slice_size_bytes),
+      next_slice_size_(initial_slice_size_bytes),
       maximum_slice_size_(maximum_slice_size_bytes) {
   PERFETTO_DCHECK(next_slice_size_ && maximum_slice_size_);
   PERFETTO_DCHECK(maximum_slice_size_ >= initial_slice_size_bytes);
@@ -48,11 +49,29 @@ protozero::ContiguousMemoryRange ScatteredHeapBuffer::GetNewBuffer() {
   PERFETTO_CHECK(writer_);
   AdjustUsedSizeOfCurrentSlice();
 
-  slices_.emplace_back(next_slice_size_);
-  next_slice_size_ = std::min(maximum_slice_size_, next_slice_size_ * 2);
+  if (free_slices_.empty()) {
+    slices_.emplace_back(next_slice_size_);
+  } else {
+    slices_.emplace_back(std::move(free_slices_.back()));
+    free_slices_.pop_back();
+    slices_.back().set_unused_bytes(slices_.back().size());
+  }
+  next_slice_size_ =
+      std::min(maximum_slice_size_, slices_.back().size() * 2);
   return slices_.back().GetTotalRange();
 }
 
+void ScatteredHeapBuffer::Reset() {
+  // Push the slices in reverse order, so that they come back in the order
+  // they were allocated. Any leftover free slice was allocated after them.
+  for (auto it = slices_.rbegin(); it != slices_.rend(); ++it)
+    free_slices_.emplace_back(std::move(*it));
+  slices_.clear();
+  next_slice_size_ = initial_slice_size_;
+  if (writer_)
+    writer_->Reset({nullptr, nullptr});
+}
+
 std::vector<uint8_t> ScatteredHeapBuffer::StitchSlices() {
   AdjustUsedSizeOfCurrentSlice();
   std::vector<uint8_t> buffer;
@@ -65,6 +84,18 @@ std::vector<uint8_t> ScatteredHeapBuffer::StitchSlices() {
   return buffer;
 }
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+void ScatteredHeapBuffer::GetUsedIovecs(std::vector<struct iovec>* iovecs) {
+  AdjustUsedSizeOfCurrentSlice();
+  for (const auto& slice : slices_) {
+    auto used_range = slice.GetUsedRange();
+    if (used_range.size() == 0)
+      continue;
+    iovecs->push_back({used_range.begin, used_range.size()});
+  }
+}
+#endif
+
 void ScatteredHeapBuffer::AdjustUsedSizeOfCurrentSlice() {
   if (!slices_.empty())
     slices_.back().set_unused_bytes(writer_->bytes_available());
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/protozero/scattered_heap_buffer.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "perfetto/base/build_config.h"
+
+namespace protozero {
+namespace {
+
+class ScatteredHeapBufferTest : public ::testing::Test {
+ public:
+  ScatteredHeapBufferTest() : delegate_(4, 16), writer_(&delegate_) {
+    delegate_.set_writer(&writer_);
+  }
+
+  void Write(const std::string& str) {
+    writer_.WriteBytes(reinterpret_cast<const uint8_t*>(str.data()),
+                       str.size());
+  }
+
+  std::string Stitch() {
+    std::vector<uint8_t> buf = delegate_.StitchSlices();
+    return std::string(buf.begin(), buf.end());
+  }
+
+  ScatteredHeapBuffer delegate_;
+  ScatteredStreamWriter writer_;
+};
+
+TEST_F(ScatteredHeapBufferTest, SlicesGrowGeometrically) {
+  Write(std::string(4 + 8 + 16 + 16 + 1, 'x'));
+  ASSERT_EQ(5u, delegate_.slices().size());
+  EXPECT_EQ(4u, delegate_.slices()[0].size());
+  EXPECT_EQ(8u, delegate_.slices()[1].size());
+  EXPECT_EQ(16u, delegate_.slices()[2].size());
+  EXPECT_EQ(16u, delegate_.slices()[3].size());
+  EXPECT_EQ(16u, delegate_.slices()[4].size());
+  EXPECT_EQ(std::string(45, 'x'), Stitch());
+}
+
+TEST_F(ScatteredHeapBufferTest, ResetRecyclesSlices) {
+  Write("0123456789ab");
+  ASSERT_EQ(2u, delegate_.slices().size());
+  std::vector<uint8_t*> first_slices;
+  for (const auto& slice : delegate_.slices())
+    first_slices.push_back(slice.start());
+
+  delegate_.Reset();
+  EXPECT_TRUE(delegate_.slices().empty());
+  EXPECT_EQ(0u, delegate_.GetTotalSize());
+
+  // A shorter message reuses the first slice only.
+  Write("abc");
+  ASSERT_EQ(1u, delegate_.slices().size());
+  EXPECT_EQ(first_slices[0], delegate_.slices()[0].start());
+  EXPECT_EQ("abc", Stitch());
+
+  // A longer one reuses both, in order, and then allocates a new one.
+  delegate_.Reset();
+  Write(std::string(4 + 8 + 1, 'y'));
+  ASSERT_EQ(3u, delegate_.slices().size());
+  EXPECT_EQ(first_slices[0], delegate_.slices()[0].start());
+  EXPECT_EQ(first_slices[1], delegate_.slices()[1].start());
+  EXPECT_EQ(16u, delegate_.slices()[2].size());
+  EXPECT_EQ(std::string(13, 'y'), Stitch());
+}
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+TEST_F(ScatteredHeapBufferTest, GetUsedIovecs) {
+  std::vector<struct iovec> iovecs;
+  delegate_.GetUsedIovecs(&iovecs);
+  EXPECT_TRUE(iovecs.empty());
+
+  Write("0123456789");
+  delegate_.GetUsedIovecs(&iovecs);
+  ASSERT_EQ(2u, iovecs.size());
+  EXPECT_EQ(delegate_.slices()[0].start(), iovecs[0].iov_base);
+  EXPECT_EQ(4u, iovecs[0].iov_len);
+  EXPECT_EQ(delegate_.slices()[1].start(), iovecs[1].iov_base);
+  EXPECT_EQ(6u, iovecs[1].iov_len);
+
+  std::string joined;
+  for (const auto& iov : iovecs)
+    joined.append(static_cast<const char*>(iov.iov_base), iov.iov_len);
+  EXPECT_EQ("0123456789", joined);
+}
+#endif
+
+}  // namespace
+}  // namespace protozero
@@ -16,6 +16,7 @@
 
 #include <limits>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -143,8 +144,11 @@ TEST_F(ProtoZeroConformanceTest, NestedMessages) {
   msg_c->set_value_c(1000);
   msg_a->Finalize();
 
+  // NestedC has a bounded size, hence gets a 1-byte size field rather than the
+  // usual 4-byte one.
+  EXPECT_EQ(11u, pbtest::NestedA::NestedB::NestedC::kMaxEncodedSize);
   size_t msg_size = GetNumSerializedBytes();
-  EXPECT_EQ(26u, msg_size);
+  EXPECT_EQ(20u, msg_size);
 
   std::unique_ptr<uint8_t[]> msg_binary(new uint8_t[msg_size]);
   GetSerializedBytes(0, msg_size, msg_binary.get());
@@ -157,6 +161,179 @@ TEST_F(ProtoZeroConformanceTest, NestedMessages) {
   EXPECT_EQ(1000, gold_msg_a.super_nested().value_c());
 }
 
+TEST_F(ProtoZeroConformanceTest, PackedRepeatedFields) {
+  PackedVarInt int32_values;
+  int32_values.Append(-1);
+  int32_values.Append(0);
+  int32_values.Append(std::numeric_limits<int32_t>::max());
+  PackedVarInt uint64_values;
+  for (uint64_t i = 0; i < 1000; i++)
+    uint64_values.Append(i << 40);
+
+  auto* msg = CreateMessage<pbtest::PackedRepeatedFields>();
+  msg->set_field_int32(int32_values);
+  msg->set_field_uint64(uint64_values);
+
+  size_t msg_size = GetNumSerializedBytes();
+  std::unique_ptr<uint8_t[]> msg_binary(new uint8_t[msg_size]);
+  GetSerializedBytes(0, msg_size, msg_binary.get());
+
+  pbgold::PackedRepeatedFields gold_msg;
+  ASSERT_TRUE(gold_msg.ParseFromArray(msg_binary.get(),
+                                      static_cast<int>(msg_size)));
+  ASSERT_EQ(3, gold_msg.field_int32_size());
+  EXPECT_EQ(-1, gold_msg.field_int32(0));
+  EXPECT_EQ(0, gold_msg.field_int32(1));
+  EXPECT_EQ(std::numeric_limits<int32_t>::max(), gold_msg.field_int32(2));
+  EXPECT_EQ(0, gold_msg.field_int64_size());
+  ASSERT_EQ(1000, gold_msg.field_uint64_size());
+  for (int i = 0; i < 1000; i++)
+    EXPECT_EQ(static_cast<uint64_t>(i) << 40, gold_msg.field_uint64(i));
+
+  // The buffers can be reused.
+  int32_values.Reset();
+  EXPECT_TRUE(int32_values.empty());
+  int32_values.Append(42);
+  EXPECT_EQ(1u, int32_values.size());
+}
+
+TEST(ProtoZeroDecoderTest, EveryField) {
+  pbgold::EveryField gold_msg;
+  gold_msg.set_field_int32(-1);
+  gold_msg.set_field_int64(-333123456789ll);
+  gold_msg.set_field_uint32(600);
+  gold_msg.set_field_uint64(333123456789ll);
+  gold_msg.set_field_sint32(-5);
+  gold_msg.set_field_sint64(-9000);
+  gold_msg.set_field_fixed32(12345);
+  gold_msg.set_field_fixed64(444123450000ll);
+  gold_msg.set_field_sfixed32(-69999);
+  gold_msg.set_field_sfixed64(-200);
+  gold_msg.set_field_float(3.14f);
+  gold_msg.set_field_double(0.5555);
+  gold_msg.set_field_bool(true);
+  gold_msg.set_small_enum(pbgold::SmallEnum::TO_BE);
+  gold_msg.set_signed_enum(pbgold::SignedEnum::NEGATIVE);
+  gold_msg.set_big_enum(pbgold::BigEnum::END);
+  gold_msg.set_field_string("FizzBuzz");
+  gold_msg.set_field_bytes(std::string("\x11\x00\xBE\xEF", 4));
+  gold_msg.add_repeated_int32(1);
+  gold_msg.add_repeated_int32(-1);
+  gold_msg.add_repeated_int32(100);
+  std::string serialized = gold_msg.SerializeAsString();
+
+  pbtest::EveryField::Decoder msg(
+      reinterpret_cast<const uint8_t*>(serialized.data()), serialized.size());
+  EXPECT_TRUE(msg.IsEndOfBuffer());
+  EXPECT_EQ(-1, msg.field_int32());
+  EXPECT_EQ(-333123456789ll, msg.field_int64());
+  EXPECT_EQ(600u, msg.field_uint32());
+  EXPECT_EQ(333123456789ull, msg.field_uint64());
+  EXPECT_EQ(-5, msg.field_sint32());
+  EXPECT_EQ(-9000, msg.field_sint64());
+  EXPECT_EQ(12345u, msg.field_fixed32());
+  EXPECT_EQ(444123450000ull, msg.field_fixed64());
+  EXPECT_EQ(-69999, msg.field_sfixed32());
+  EXPECT_EQ(-200, msg.field_sfixed64());
+  EXPECT_FLOAT_EQ(3.14f, msg.field_float());
+  EXPECT_DOUBLE_EQ(0.5555, msg.field_double());
+  EXPECT_TRUE(msg.field_bool());
+  EXPECT_EQ(pbtest::SmallEnum::TO_BE, msg.small_enum());
+  EXPECT_EQ(pbtest::SignedEnum::NEGATIVE, msg.signed_enum());
+  EXPECT_EQ(pbtest::BigEnum::END, msg.big_enum());
+  EXPECT_EQ("FizzBuzz", msg.field_string().ToStdString());
+  ConstBytes bytes = msg.field_bytes();
+  EXPECT_EQ(std::string("\x11\x00\xBE\xEF", 4),
+            std::string(reinterpret_cast<const char*>(bytes.data), bytes.size));
+
+  std::vector<int32_t> repeated;
+  for (auto it = msg.repeated_int32(); it; ++it)
+    repeated.push_back(it->as_int32());
+  EXPECT_EQ(std::vector<int32_t>({1, -1, 100}), repeated);
+
+  // Strings and bytes point into the decoded buffer.
+  EXPECT_GE(bytes.data, reinterpret_cast<const uint8_t*>(serialized.data()));
+  EXPECT_LT(bytes.data,
+            reinterpret_cast<const uint8_t*>(serialized.data()) +
+                serialized.size());
+
+  EXPECT_FALSE(msg.has_nested_enum());
+  EXPECT_EQ(0, static_cast<int>(msg.nested_enum()));
+}
+
+TEST(ProtoZeroDecoderTest, PackedRepeatedFields) {
+  pbgold::PackedRepeatedFields gold_msg;
+  gold_msg.add_field_int32(-1);
+  gold_msg.add_field_int32(100);
+  gold_msg.add_field_uint32(1u << 31);
+  std::string serialized = gold_msg.SerializeAsString();
+
+  pbtest::PackedRepeatedFields::Decoder msg(
+      reinterpret_cast<const uint8_t*>(serialized.data()), serialized.size());
+  bool parse_error = false;
+  std::vector<int32_t> int32_values;
+  for (auto it = msg.field_int32(&parse_error); it; ++it)
+    int32_values.push_back(*it);
+  EXPECT_EQ(std::vector<int32_t>({-1, 100}), int32_values);
+  std::vector<uint32_t> uint32_values;
+  for (auto it = msg.field_uint32(&parse_error); it; ++it)
+    uint32_values.push_back(*it);
+  EXPECT_EQ(std::vector<uint32_t>({1u << 31}), uint32_values);
+  EXPECT_FALSE(msg.has_field_int64());
+  EXPECT_FALSE(msg.field_int64(&parse_error));
+  EXPECT_FALSE(parse_error);
+
+  // A truncated varint stops the iteration and is reported.
+  const uint8_t truncated[] = {0x01, 0x80};
+  PackedVarIntIterator<uint32_t> it(truncated, sizeof(truncated),
+                                    &parse_error);
+  ASSERT_TRUE(it);
+  EXPECT_EQ(1u, *it);
+  EXPECT_FALSE(++it);
+  EXPECT_TRUE(parse_error);
+}
+
+TEST(ProtoZeroDecoderTest, NestedMessagesAndMissingFields) {
+  pbgold::NestedA gold_msg;
+  gold_msg.add_repeated_a()->mutable_value_b()->set_value_c(321);
+  gold_msg.add_repeated_a();
+  gold_msg.mutable_super_nested()->set_value_c(1000);
+  std::string serialized = gold_msg.SerializeAsString();
+
+  pbtest::NestedA::Decoder msg(
+      reinterpret_cast<const uint8_t*>(serialized.data()), serialized.size());
+  ASSERT_TRUE(msg.has_super_nested());
+  ConstBytes super_nested = msg.super_nested();
+  pbtest::NestedA::NestedB::NestedC::Decoder msg_c(super_nested.data,
+                                                  super_nested.size);
+  EXPECT_EQ(1000, msg_c.value_c());
+
+  auto it = msg.repeated_a();
+  ASSERT_TRUE(it);
+  ConstBytes nested_b = it->as_bytes();
+  pbtest::NestedA::NestedB::Decoder msg_b(nested_b.data, nested_b.size);
+  ASSERT_TRUE(msg_b.has_value_b());
+  ConstBytes value_b = msg_b.value_b();
+  EXPECT_EQ(321, pbtest::NestedA::NestedB::NestedC::Decoder(value_b.data,
+                                                             value_b.size)
+                     .value_c());
+
+  ASSERT_TRUE(++it);
+  nested_b = it->as_bytes();
+  pbtest::NestedA::NestedB::Decoder empty_b(nested_b.data, nested_b.size);
+  EXPECT_FALSE(empty_b.has_value_b());
+  EXPECT_EQ(0u, empty_b.value_b().size);
+  EXPECT_FALSE(++it);
+
+  // A truncated message still exposes the fields before the truncation.
+  pbtest::NestedA::Decoder truncated(
+      reinterpret_cast<const uint8_t*>(serialized.data()),
+      serialized.size() - 1);
+  EXPECT_FALSE(truncated.IsEndOfBuffer());
+  EXPECT_TRUE(truncated.repeated_a());
+  EXPECT_FALSE(truncated.has_super_nested());
+}
+
 TEST(ProtoZeroTest, Simple) {
   // Test the includes for indirect public import: library.pbzero.h ->
   // library_internals/galaxies.pbzero.h -> upper_import.pbzero.h .
@@ -32,6 +32,10 @@
 #include "src/trace_processor/slice_tracker.h"
 #include "src/trace_processor/trace_processor_context.h"
 
+#include "perfetto/trace/ftrace/power.pbzero.h"
+#include "perfetto/trace/ftrace/sched.pbzero.h"
+#include "perfetto/trace/ps/process_stats.pbzero.h"
+#include "perfetto/trace/ps/process_tree.pbzero.h"
 #include "perfetto/trace/trace.pb.h"
 #include "perfetto/trace/trace_packet.pb.h"
 
@@ -143,7 +147,18 @@ ProtoTraceParser::ProtoTraceParser(TraceProcessorContext* context)
       oom_score_adj_id_(context->storage->InternString("oom_score_adj")),
       ion_total_unknown_id_(context->storage->InternString("mem.ion.unknown")),
       ion_change_unknown_id_(
-          context->storage->InternString("mem.ion_change.unknown")) {
+          context->storage->InternString("mem.ion_change.unknown")),
+      sched_switch_id_(context->storage->InternString("sched_switch")),
+      sched_waking_id_(context->storage->InternString("sched_waking")),
+      prev_pid_id_(context->storage->InternString("prev_pid")),
+      prev_state_id_(context->storage->InternString("prev_state")),
+      next_comm_id_(context->storage->InternString("next_comm")),
+      next_pid_id_(context->storage->InternString("next_pid")),
+      next_prio_id_(context->storage->InternString("next_prio")),
+      comm_id_(context->storage->InternString("comm")),
+      pid_id_(context->storage->InternString("pid")),
+      prio_id_(context->storage->InternString("prio")),
+      target_cpu_id_(context->storage->InternString("target_cpu")) {
   for (const auto& name : BuildMeminfoCounterNames()) {
     meminfo_strs_id_.emplace_back(context->storage->InternString(name));
   }
@@ -428,6 +443,8 @@ void ProtoTraceParser::ParseCpuTimes(int64_t ts, TraceBlobView cpu_times) {
 void ProtoTraceParser::ParseProcessTree(TraceBlobView pstree) {
   ProtoDecoder decoder(pstree.data(), pstree.length());
 
+  // Processes and threads are parsed in the order they have been written, as
+  // that determines the ids assigned to them.
   for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
     const size_t fld_off = pstree.offset_of(fld.data());
     switch (fld.id) {
@@ -447,20 +464,13 @@ void ProtoTraceParser::ParseProcessTree(TraceBlobView pstree) {
 }
 
 void ProtoTraceParser::ParseProcessStats(int64_t ts, TraceBlobView stats) {
-  ProtoDecoder decoder(stats.data(), stats.length());
+  protos::pbzero::ProcessStats::Decoder ps(stats.data(), stats.length());
 
-  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
-    const size_t fld_off = stats.offset_of(fld.data());
-    switch (fld.id) {
-      case protos::ProcessStats::kMemCountersFieldNumber: {
-        ParseProcMemCounters(ts, stats.slice(fld_off, fld.size()));
-        break;
-      }
-      default:
-        break;
-    }
+  for (auto it = ps.mem_counters(); it; ++it) {
+    const size_t fld_off = stats.offset_of(it->data());
+    ParseProcMemCounters(ts, stats.slice(fld_off, it->size()));
   }
-  PERFETTO_DCHECK(decoder.IsEndOfBuffer());
+  PERFETTO_DCHECK(ps.IsEndOfBuffer());
 }
 
 void ProtoTraceParser::ParseProcMemCounters(int64_t ts,
@@ -492,6 +502,9 @@ void ProtoTraceParser::ParseProcMemCounters(int64_t ts,
 
   UniqueTid utid = context_->process_tracker->UpdateThread(ts, pid, 0);
 
+  // Only the counters in the message are pushed: in delta encoded traces the
+  // missing ones are unchanged since they were last pushed, and the duration
+  // of that counter event extends until the next value.
   // Skip field_id 0 (invalid) and 1 (pid).
   for (size_t field_id = 2; field_id < counter_values.size(); field_id++) {
     if (!has_counter[field_id])
@@ -511,47 +524,24 @@ void ProtoTraceParser::ParseProcMemCounters(int64_t ts,
 }
 
 void ProtoTraceParser::ParseThread(TraceBlobView thread) {
-  ProtoDecoder decoder(thread.data(), thread.length());
-  uint32_t tid = 0;
-  uint32_t tgid = 0;
-  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
-    switch (fld.id) {
-      case protos::ProcessTree::Thread::kTidFieldNumber:
-        tid = fld.as_uint32();
-        break;
-      case protos::ProcessTree::Thread::kTgidFieldNumber:
-        tgid = fld.as_uint32();
-        break;
-      default:
-        break;
-    }
-  }
-  context_->process_tracker->UpdateThread(tid, tgid);
-
-  PERFETTO_DCHECK(decoder.IsEndOfBuffer());
+  protos::pbzero::ProcessTree::Thread::Decoder thd(thread.data(),
+                                                   thread.length());
+  context_->process_tracker->UpdateThread(static_cast<uint32_t>(thd.tid()),
+                                          static_cast<uint32_t>(thd.tgid()));
+  PERFETTO_DCHECK(thd.IsEndOfBuffer());
 }
 
 void ProtoTraceParser::ParseProcess(TraceBlobView process) {
-  ProtoDecoder decoder(process.data(), process.length());
+  protos::pbzero::ProcessTree::Process::Decoder proc(process.data(),
+                                                     process.length());
 
-  uint32_t pid = 0;
+  // The process name is the first non-empty cmdline argument.
   base::StringView process_name;
-
-  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
-    switch (fld.id) {
-      case protos::ProcessTree::Process::kPidFieldNumber:
-        pid = fld.as_uint32();
-        break;
-      case protos::ProcessTree::Process::kCmdlineFieldNumber:
-        if (process_name.empty())
-          process_name = fld.as_string();
-        break;
-      default:
-        break;
-    }
-  }
-  context_->process_tracker->UpdateProcess(pid, process_name);
-  PERFETTO_DCHECK(decoder.IsEndOfBuffer());
+  for (auto it = proc.cmdline(); it && process_name.empty(); ++it)
+    process_name = it->as_string();
+  context_->process_tracker->UpdateProcess(static_cast<uint32_t>(proc.pid()),
+                                           process_name);
+  PERFETTO_DCHECK(proc.IsEndOfBuffer());
 }
 
 void ProtoTraceParser::ParseFtracePacket(uint32_t cpu,
@@ -786,75 +776,90 @@ void ProtoTraceParser::ParseIonHeapGrowOrShrink(int64_t timestamp,
 }
 
 void ProtoTraceParser::ParseCpuFreq(int64_t timestamp, TraceBlobView view) {
-  ProtoDecoder decoder(view.data(), view.length());
-
-  uint32_t cpu_affected = 0;
-  uint32_t new_freq = 0;
-  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
-    switch (fld.id) {
-      case protos::CpuFrequencyFtraceEvent::kCpuIdFieldNumber:
-        cpu_affected = fld.as_uint32();
-        break;
-      case protos::CpuFrequencyFtraceEvent::kStateFieldNumber:
-        new_freq = fld.as_uint32();
-        break;
-    }
-  }
-  context_->event_tracker->PushCounter(timestamp, new_freq, cpu_freq_name_id_,
-                                       cpu_affected, RefType::kRefCpuId);
-  PERFETTO_DCHECK(decoder.IsEndOfBuffer());
+  protos::pbzero::CpuFrequencyFtraceEvent::Decoder freq(view.data(),
+                                                        view.length());
+  context_->event_tracker->PushCounter(timestamp, freq.state(),
+                                       cpu_freq_name_id_, freq.cpu_id(),
+                                       RefType::kRefCpuId);
+  PERFETTO_DCHECK(freq.IsEndOfBuffer());
 }
 
 void ProtoTraceParser::ParseCpuIdle(int64_t timestamp, TraceBlobView view) {
-  ProtoDecoder decoder(view.data(), view.length());
-
-  uint32_t cpu_affected = 0;
-  uint32_t new_state = 0;
-  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
-    switch (fld.id) {
-      case protos::CpuIdleFtraceEvent::kCpuIdFieldNumber:
-        cpu_affected = fld.as_uint32();
-        break;
-      case protos::CpuIdleFtraceEvent::kStateFieldNumber:
-        new_state = fld.as_uint32();
-        break;
-    }
-  }
-  context_->event_tracker->PushCounter(timestamp, new_state, cpu_idle_name_id_,
-                                       cpu_affected, RefType::kRefCpuId);
-  PERFETTO_DCHECK(decoder.IsEndOfBuffer());
+  protos::pbzero::CpuIdleFtraceEvent::Decoder idle(view.data(), view.length());
+  context_->event_tracker->PushCounter(timestamp, idle.state(),
+                                       cpu_idle_name_id_, idle.cpu_id(),
+                                       RefType::kRefCpuId);
+  PERFETTO_DCHECK(idle.IsEndOfBuffer());
 }
 
 void ProtoTraceParser::ParseSchedSwitch(uint32_t cpu,
                                         int64_t timestamp,
                                         TraceBlobView sswitch) {
-  ProtoDecoder decoder(sswitch.data(), sswitch.length());
+  protos::pbzero::SchedSwitchFtraceEvent::Decoder ss(sswitch.data(),
+                                                     sswitch.length());
+  context_->event_tracker->PushSchedSwitch(
+      cpu, timestamp, static_cast<uint32_t>(ss.prev_pid()),
+      static_cast<uint32_t>(ss.prev_state()),
+      static_cast<uint32_t>(ss.next_pid()), ss.next_comm());
+  PERFETTO_DCHECK(ss.IsEndOfBuffer());
+}
 
-  uint32_t prev_pid = 0;
-  uint32_t prev_state = 0;
-  base::StringView next_comm;
-  uint32_t next_pid = 0;
-  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
-    switch (fld.id) {
-      case protos::SchedSwitchFtraceEvent::kPrevPidFieldNumber:
-        prev_pid = fld.as_uint32();
-        break;
-      case protos::SchedSwitchFtraceEvent::kPrevStateFieldNumber:
-        prev_state = fld.as_uint32();
-        break;
-      case protos::SchedSwitchFtraceEvent::kNextPidFieldNumber:
-        next_pid = fld.as_uint32();
-        break;
-      case protos::SchedSwitchFtraceEvent::kNextCommFieldNumber:
-        next_comm = fld.as_string();
-        break;
-      default:
-        break;
-    }
-  }
-  context_->event_tracker->PushSchedSwitch(cpu, timestamp, prev_pid, prev_state,
-                                           next_pid, next_comm);
-  PERFETTO_DCHECK(decoder.IsEndOfBuffer());
+void ProtoTraceParser::ParseInlineSchedSwitch(uint32_t cpu,
+                                              int64_t timestamp,
+                                              int32_t prev_pid,
+                                              int64_t prev_state,
+                                              int32_t next_pid,
+                                              int32_t next_prio,
+                                              TraceBlobView next_comm) {
+  base::StringView comm(reinterpret_cast<const char*>(next_comm.data()),
+                        next_comm.length());
+  context_->event_tracker->PushSchedSwitch(
+      cpu, timestamp, static_cast<uint32_t>(prev_pid),
+      static_cast<uint32_t>(prev_state), static_cast<uint32_t>(next_pid),
+      comm);
+
+  // Same as what ParseTypedFtraceToRaw() would store, minus the prev_comm and
+  // prev_prio that the compact encoding doesn't keep.
+  UniqueTid utid = context_->process_tracker->UpdateThread(
+      timestamp, static_cast<uint32_t>(prev_pid), 0);
+  auto* storage = context_->storage.get();
+  RowId row_id = storage->mutable_raw_events()->AddRawEvent(
+      timestamp, sched_switch_id_, utid);
+  auto* args = storage->mutable_args();
+  args->AddArg(row_id, prev_pid_id_, prev_pid_id_,
+               Variadic::Integer(prev_pid));
+  args->AddArg(row_id, prev_state_id_, prev_state_id_,
+               Variadic::Integer(prev_state));
+  args->AddArg(row_id, next_comm_id_, next_comm_id_,
+               Variadic::String(storage->InternString(comm)));
+  args->AddArg(row_id, next_pid_id_, next_pid_id_,
+               Variadic::Integer(next_pid));
+  args->AddArg(row_id, next_prio_id_, next_prio_id_,
+               Variadic::Integer(next_prio));
+}
+
+void ProtoTraceParser::ParseInlineSchedWaking(uint32_t,
+                                              int64_t timestamp,
+                                              int32_t common_pid,
+                                              int32_t pid,
+                                              int32_t target_cpu,
+                                              int32_t prio,
+                                              TraceBlobView comm) {
+  // sched_waking is only stored in the raw table, as its FtraceEvent would.
+  UniqueTid utid = context_->process_tracker->UpdateThread(
+      timestamp, static_cast<uint32_t>(common_pid), 0);
+  auto* storage = context_->storage.get();
+  RowId row_id = storage->mutable_raw_events()->AddRawEvent(
+      timestamp, sched_waking_id_, utid);
+  auto* args = storage->mutable_args();
+  base::StringView comm_view(reinterpret_cast<const char*>(comm.data()),
+                             comm.length());
+  args->AddArg(row_id, comm_id_, comm_id_,
+               Variadic::String(storage->InternString(comm_view)));
+  args->AddArg(row_id, pid_id_, pid_id_, Variadic::Integer(pid));
+  args->AddArg(row_id, prio_id_, prio_id_, Variadic::Integer(prio));
+  args->AddArg(row_id, target_cpu_id_, target_cpu_id_,
+               Variadic::Integer(target_cpu));
 }
 
 void ProtoTraceParser::ParsePrint(uint32_t,
@@ -23,6 +23,7 @@
 #include <memory>
 
 #include "perfetto/base/string_view.h"
+#include "perfetto/base/utils.h"
 #include "src/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/trace_storage.h"
 
@@ -64,6 +65,23 @@ class ProtoTraceParser {
   void ParseProcessStats(int64_t timestamp, TraceBlobView);
   void ParseProcMemCounters(int64_t timestamp, TraceBlobView);
   void ParseSchedSwitch(uint32_t cpu, int64_t timestamp, TraceBlobView);
+
+  // The events of the compact encoding of FtraceEventBundle, see TraceSorter.
+  // virtual for testing.
+  virtual void ParseInlineSchedSwitch(uint32_t cpu,
+                                      int64_t timestamp,
+                                      int32_t prev_pid,
+                                      int64_t prev_state,
+                                      int32_t next_pid,
+                                      int32_t next_prio,
+                                      TraceBlobView next_comm);
+  virtual void ParseInlineSchedWaking(uint32_t cpu,
+                                      int64_t timestamp,
+                                      int32_t common_pid,
+                                      int32_t pid,
+                                      int32_t target_cpu,
+                                      int32_t prio,
+                                      TraceBlobView comm);
   void ParseCpuFreq(int64_t timestamp, TraceBlobView);
   void ParseCpuIdle(int64_t timestamp, TraceBlobView);
   void ParsePrint(uint32_t cpu, int64_t timestamp, uint32_t pid, TraceBlobView);
@@ -125,6 +143,17 @@ class ProtoTraceParser {
   const StringId oom_score_adj_id_;
   const StringId ion_total_unknown_id_;
   const StringId ion_change_unknown_id_;
+  const StringId sched_switch_id_;
+  const StringId sched_waking_id_;
+  const StringId prev_pid_id_;
+  const StringId prev_state_id_;
+  const StringId next_comm_id_;
+  const StringId next_pid_id_;
+  const StringId next_prio_id_;
+  const StringId comm_id_;
+  const StringId pid_id_;
+  const StringId prio_id_;
+  const StringId target_cpu_id_;
   std::vector<StringId> meminfo_strs_id_;
   std::vector<StringId> vmstat_strs_id_;
   std::vector<StringId> rss_members_;
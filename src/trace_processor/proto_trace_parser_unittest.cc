@@ -16,12 +16,17 @@
 
 #include "src/trace_processor/proto_trace_tokenizer.h"
 
+#include <set>
+
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "perfetto/base/lz_codec.h"
 #include "perfetto/base/string_view.h"
+#include "perfetto/protozero/proto_utils.h"
 #include "src/trace_processor/event_tracker.h"
 #include "src/trace_processor/process_tracker.h"
 #include "src/trace_processor/proto_trace_parser.h"
+#include "src/trace_processor/stats.h"
 #include "src/trace_processor/trace_sorter.h"
 
 #include "perfetto/trace/trace.pb.h"
@@ -35,6 +40,7 @@ using ::testing::_;
 using ::testing::Args;
 using ::testing::ElementsAreArray;
 using ::testing::Eq;
+using ::testing::InSequence;
 using ::testing::Pointwise;
 using ::testing::NiceMock;
 
@@ -134,6 +140,67 @@ TEST_F(ProtoTraceParserTest, LoadSingleEvent) {
   Tokenize(trace);
 }
 
+// Returns the content of a TracePacket.compressed_packets field holding the
+// packets of |trace|: the varint-encoded decompressed size, followed by the
+// LZ-compressed packets.
+std::string CompressPackets(const protos::Trace& trace) {
+  std::string raw = trace.SerializeAsString();
+  std::string compressed(base::LzCompressBound(raw.size()), '\0');
+  size_t compressed_size = base::LzCompress(
+      reinterpret_cast<const uint8_t*>(raw.data()), raw.size(),
+      reinterpret_cast<uint8_t*>(&compressed[0]), compressed.size());
+  PERFETTO_CHECK(compressed_size > 0);
+  compressed.resize(compressed_size);
+
+  std::string payload(10, '\0');
+  uint8_t* payload_start = reinterpret_cast<uint8_t*>(&payload[0]);
+  payload.resize(static_cast<size_t>(
+      protozero::proto_utils::WriteVarInt(raw.size(), payload_start) -
+      payload_start));
+  return payload + compressed;
+}
+
+TEST_F(ProtoTraceParserTest, LoadCompressedPackets) {
+  protos::Trace inner;
+  auto* bundle = inner.add_packet()->mutable_ftrace_events();
+  bundle->set_cpu(10);
+
+  auto* event = bundle->add_event();
+  event->set_timestamp(1000);
+  event->set_pid(12);
+
+  static const char kProcName[] = "proc1";
+  auto* sched_switch = event->mutable_sched_switch();
+  sched_switch->set_prev_pid(10);
+  sched_switch->set_prev_state(32);
+  sched_switch->set_next_comm(kProcName);
+  sched_switch->set_next_pid(100);
+
+  protos::Trace trace;
+  trace.add_packet()->set_compressed_packets(CompressPackets(inner));
+
+  EXPECT_CALL(*event_, PushSchedSwitch(10, 1000, 10, 32, 100,
+                                       base::StringView(kProcName)));
+  Tokenize(trace);
+}
+
+TEST_F(ProtoTraceParserTest, LoadNestedCompressedPackets) {
+  protos::Trace inner;
+  auto* event = inner.add_packet()->mutable_ftrace_events()->add_event();
+  event->set_timestamp(1000);
+  event->mutable_sched_switch()->set_next_pid(100);
+
+  protos::Trace middle;
+  middle.add_packet()->set_compressed_packets(CompressPackets(inner));
+  protos::Trace trace;
+  trace.add_packet()->set_compressed_packets(CompressPackets(middle));
+
+  EXPECT_CALL(*event_, PushSchedSwitch(_, _, _, _, _, _)).Times(0);
+  Tokenize(trace);
+  EXPECT_EQ(context_.storage->stats()[stats::compressed_packets_invalid].value,
+            1);
+}
+
 TEST_F(ProtoTraceParserTest, LoadEventsIntoRaw) {
   InitStorage();
   protos::Trace trace;
@@ -293,6 +360,167 @@ TEST_F(ProtoTraceParserTest, LoadMultipleEvents) {
   Tokenize(trace);
 }
 
+TEST_F(ProtoTraceParserTest, LoadCompactSched) {
+  protos::Trace trace;
+
+  auto* bundle = trace.add_packet()->mutable_ftrace_events();
+  bundle->set_cpu(10);
+
+  static const char kProcName1[] = "proc1";
+  static const char kProcName2[] = "proc2";
+  auto* compact_sched = bundle->mutable_compact_sched();
+  compact_sched->add_intern_table(kProcName1);
+  compact_sched->add_intern_table(kProcName2);
+  compact_sched->set_running_pid(5);
+
+  // Timestamps are delta-encoded.
+  compact_sched->add_switch_timestamp(1000);
+  compact_sched->add_switch_prev_state(32);
+  compact_sched->add_switch_next_pid(100);
+  compact_sched->add_switch_next_prio(120);
+  compact_sched->add_switch_next_comm_index(0);
+  compact_sched->add_switch_timestamp(2);
+  compact_sched->add_switch_prev_state(1);
+  compact_sched->add_switch_next_pid(10);
+  compact_sched->add_switch_next_prio(110);
+  compact_sched->add_switch_next_comm_index(1);
+
+  compact_sched->add_waking_timestamp(1003);
+  compact_sched->add_waking_pid(10);
+  compact_sched->add_waking_target_cpu(3);
+  compact_sched->add_waking_prio(110);
+  compact_sched->add_waking_comm_index(1);
+
+  // The prev_pid is the |running_pid| for the first sched_switch, then the
+  // next_pid of the previous one.
+  EXPECT_CALL(*event_, PushSchedSwitch(10, 1000, 5, 32, 100,
+                                       base::StringView(kProcName1)));
+  EXPECT_CALL(*event_, PushSchedSwitch(10, 1002, 100, 1, 10,
+                                       base::StringView(kProcName2)));
+  Tokenize(trace);
+
+  // The events also go to the raw table, attributed to the task running on
+  // the cpu.
+  const auto& raw = context_.storage->raw_events();
+  ASSERT_EQ(raw.raw_event_count(), 3);
+  EXPECT_EQ(raw.timestamps()[0], 1000);
+  EXPECT_EQ(context_.storage->GetThread(raw.utids()[0]).tid, 5u);
+  EXPECT_EQ(raw.timestamps()[1], 1002);
+  EXPECT_EQ(context_.storage->GetThread(raw.utids()[1]).tid, 100u);
+  EXPECT_EQ(raw.timestamps()[2], 1003);
+  EXPECT_EQ(context_.storage->GetThread(raw.utids()[2]).tid, 10u);
+
+  // prev_pid, prev_state, next_comm, next_pid and next_prio for each
+  // sched_switch, comm, pid, prio and target_cpu for sched_waking.
+  const auto& args = context_.storage->args();
+  ASSERT_EQ(args.args_count(), 14);
+  EXPECT_EQ(args.arg_values()[3].int_value, 100);
+  EXPECT_EQ(args.arg_values()[5].int_value, 100);
+  EXPECT_EQ(args.arg_values()[6].int_value, 1);
+  EXPECT_EQ(args.arg_values()[9].int_value, 110);
+  EXPECT_EQ(args.arg_values()[11].int_value, 10);
+  EXPECT_EQ(args.arg_values()[12].int_value, 110);
+  EXPECT_EQ(args.arg_values()[13].int_value, 3);
+  EXPECT_EQ(context_.storage->stats()[stats::ftrace_bundle_tokenizer_errors]
+                .value,
+            0);
+}
+
+TEST_F(ProtoTraceParserTest, LoadCompactSchedFirstEventsOnCpu) {
+  protos::Trace trace;
+
+  // The first event on the cpu is a sched_waking, emitted by |running_pid|.
+  auto* bundle = trace.add_packet()->mutable_ftrace_events();
+  bundle->set_cpu(2);
+  auto* compact_sched = bundle->mutable_compact_sched();
+  compact_sched->add_intern_table("proc1");
+  compact_sched->set_running_pid(7);
+  compact_sched->add_waking_timestamp(1000);
+  compact_sched->add_waking_pid(8);
+  compact_sched->add_waking_target_cpu(2);
+  compact_sched->add_waking_prio(120);
+  compact_sched->add_waking_comm_index(0);
+  compact_sched->add_switch_timestamp(1005);
+  compact_sched->add_switch_prev_state(1);
+  compact_sched->add_switch_next_pid(8);
+  compact_sched->add_switch_next_prio(120);
+  compact_sched->add_switch_next_comm_index(0);
+
+  // The next bundle doesn't follow from the previous one (e.g. a page was
+  // lost): its prev_pid is its own |running_pid|, not the last next_pid.
+  bundle = trace.add_packet()->mutable_ftrace_events();
+  bundle->set_cpu(2);
+  compact_sched = bundle->mutable_compact_sched();
+  compact_sched->add_intern_table("proc2");
+  compact_sched->set_running_pid(9);
+  compact_sched->add_switch_timestamp(2000);
+  compact_sched->add_switch_prev_state(1);
+  compact_sched->add_switch_next_pid(10);
+  compact_sched->add_switch_next_prio(120);
+  compact_sched->add_switch_next_comm_index(0);
+
+  EXPECT_CALL(*event_,
+              PushSchedSwitch(2, 1005, 7, 1, 8, base::StringView("proc1")));
+  EXPECT_CALL(*event_,
+              PushSchedSwitch(2, 2000, 9, 1, 10, base::StringView("proc2")));
+  Tokenize(trace);
+
+  // The (timestamp, tid) of the raw events, regardless of their order.
+  const auto& raw = context_.storage->raw_events();
+  std::set<std::pair<int64_t, uint32_t>> raw_tids;
+  for (size_t i = 0; i < static_cast<size_t>(raw.raw_event_count()); i++) {
+    raw_tids.emplace(raw.timestamps()[i],
+                     context_.storage->GetThread(raw.utids()[i]).tid);
+  }
+  std::set<std::pair<int64_t, uint32_t>> expected_tids{
+      {1000, 7u}, {1005, 7u}, {2000, 9u}};
+  EXPECT_EQ(raw_tids, expected_tids);
+}
+
+TEST_F(ProtoTraceParserTest, LoadCompactSchedWithoutRunningPid) {
+  protos::Trace trace;
+
+  auto* bundle = trace.add_packet()->mutable_ftrace_events();
+  bundle->set_cpu(10);
+  auto* compact_sched = bundle->mutable_compact_sched();
+  compact_sched->add_intern_table("proc1");
+  compact_sched->add_switch_timestamp(1000);
+  compact_sched->add_switch_prev_state(32);
+  compact_sched->add_switch_next_pid(100);
+  compact_sched->add_switch_next_prio(120);
+  compact_sched->add_switch_next_comm_index(0);
+
+  EXPECT_CALL(*event_, PushSchedSwitch(_, _, _, _, _, _)).Times(0);
+  Tokenize(trace);
+  EXPECT_EQ(context_.storage->raw_events().raw_event_count(), 0);
+  EXPECT_EQ(context_.storage->stats()[stats::ftrace_bundle_tokenizer_errors]
+                .value,
+            1);
+}
+
+TEST_F(ProtoTraceParserTest, LoadCompactSchedInvalid) {
+  protos::Trace trace;
+
+  auto* bundle = trace.add_packet()->mutable_ftrace_events();
+  bundle->set_cpu(10);
+
+  // The comm index is out of the intern table.
+  auto* compact_sched = bundle->mutable_compact_sched();
+  compact_sched->add_intern_table("proc1");
+  compact_sched->set_running_pid(5);
+  compact_sched->add_switch_timestamp(1000);
+  compact_sched->add_switch_prev_state(32);
+  compact_sched->add_switch_next_pid(100);
+  compact_sched->add_switch_next_prio(120);
+  compact_sched->add_switch_next_comm_index(1);
+
+  EXPECT_CALL(*event_, PushSchedSwitch(_, _, _, _, _, _)).Times(0);
+  Tokenize(trace);
+  EXPECT_EQ(context_.storage->stats()[stats::ftrace_bundle_tokenizer_errors]
+                .value,
+            1);
+}
+
 TEST_F(ProtoTraceParserTest, LoadMultiplePackets) {
   protos::Trace trace;
 
@@ -400,6 +628,33 @@ TEST_F(ProtoTraceParserTest, LoadVmStats) {
   Tokenize(trace_1);
 }
 
+// With ProcessStatsConfig.proc_stats_delta_encoding the MemCounters only
+// contain the counters that changed. The other ones must not be pushed, so that
+// their previous value extends until the next time they are written.
+TEST_F(ProtoTraceParserTest, LoadDeltaEncodedProcessStats) {
+  protos::Trace trace;
+  auto* packet = trace.add_packet();
+  packet->set_timestamp(1000);
+  auto* counters = packet->mutable_process_stats()->add_mem_counters();
+  counters->set_pid(1);
+  counters->set_vm_size_kb(100);
+  counters->set_vm_rss_kb(10);
+  packet = trace.add_packet();
+  packet->set_timestamp(2000);
+  counters = packet->mutable_process_stats()->add_mem_counters();
+  counters->set_pid(1);
+  counters->set_vm_rss_kb(20);
+
+  InSequence in_sequence;
+  EXPECT_CALL(*event_, PushCounter(1000, 100 * 1024, _, _,
+                                   RefType::kRefUtidLookupUpid));
+  EXPECT_CALL(*event_, PushCounter(1000, 10 * 1024, _, _,
+                                   RefType::kRefUtidLookupUpid));
+  EXPECT_CALL(*event_, PushCounter(2000, 20 * 1024, _, _,
+                                   RefType::kRefUtidLookupUpid));
+  Tokenize(trace);
+}
+
 TEST_F(ProtoTraceParserTest, LoadCpuFreq) {
   protos::Trace trace_1;
   auto* bundle = trace_1.add_packet()->mutable_ftrace_events();
@@ -19,6 +19,7 @@
 #include <string>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/base/lz_codec.h"
 #include "perfetto/base/utils.h"
 #include "perfetto/protozero/proto_decoder.h"
 #include "perfetto/protozero/proto_utils.h"
@@ -29,6 +30,7 @@
 #include "src/trace_processor/trace_sorter.h"
 #include "src/trace_processor/trace_storage.h"
 
+#include "perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
 #include "perfetto/trace/trace.pb.h"
 #include "perfetto/trace/trace_packet.pb.h"
 
@@ -167,6 +169,18 @@ void ProtoTraceTokenizer::ParsePacket(TraceBlobView packet) {
       ParseFtraceBundle(packet.slice(fld_off, fld.size()));
       return;
     }
+
+    if (fld.id == protos::TracePacket::kCompressedPacketsFieldNumber) {
+      if (PERFETTO_UNLIKELY(parsing_compressed_packets_)) {
+        trace_storage_->IncrementStats(stats::compressed_packets_invalid);
+        return;
+      }
+      const size_t fld_off = packet.offset_of(fld.data());
+      parsing_compressed_packets_ = true;
+      ParseCompressedPackets(packet.slice(fld_off, fld.size()));
+      parsing_compressed_packets_ = false;
+      return;
+    }
   }
 
   // Use parent data and length because we want to parse this again
@@ -175,6 +189,42 @@ void ProtoTraceTokenizer::ParsePacket(TraceBlobView packet) {
   PERFETTO_DCHECK(decoder.IsEndOfBuffer());
 }
 
+void ProtoTraceTokenizer::ParseCompressedPackets(TraceBlobView field) {
+  // The payload is a varint with the decompressed size, followed by the
+  // LZ-compressed sequence of Trace.packet fields (see trace_packet.proto).
+  // Cap the decompressed size to something sane, this is untrusted input.
+  static constexpr uint64_t kMaxDecompressedSize = 64 * 1024 * 1024;
+  const uint8_t* start = field.data();
+  const uint8_t* end = start + field.length();
+  uint64_t raw_size = 0;
+  const uint8_t* payload = ParseVarInt(start, end, &raw_size);
+  if (payload == start || raw_size == 0 || raw_size > kMaxDecompressedSize) {
+    trace_storage_->IncrementStats(stats::compressed_packets_invalid);
+    return;
+  }
+
+  const size_t size = static_cast<size_t>(raw_size);
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[size]);
+  if (!base::LzDecompress(payload, static_cast<size_t>(end - payload), &buf[0],
+                          size)) {
+    trace_storage_->IncrementStats(stats::compressed_packets_invalid);
+    return;
+  }
+
+  TraceBlobView whole_buf(std::move(buf), 0, size);
+  ProtoDecoder decoder(whole_buf.data(), size);
+  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
+    if (fld.id != protos::Trace::kPacketFieldNumber) {
+      trace_storage_->IncrementStats(stats::compressed_packets_invalid);
+      return;
+    }
+    const size_t fld_off = whole_buf.offset_of(fld.data());
+    ParsePacket(whole_buf.slice(fld_off, fld.size()));
+  }
+  if (!decoder.IsEndOfBuffer())
+    trace_storage_->IncrementStats(stats::compressed_packets_invalid);
+}
+
 PERFETTO_ALWAYS_INLINE
 void ProtoTraceTokenizer::ParseFtraceBundle(TraceBlobView bundle) {
   constexpr auto kCpuFieldNumber = protos::FtraceEventBundle::kCpuFieldNumber;
@@ -208,6 +258,12 @@ void ProtoTraceTokenizer::ParseFtraceBundle(TraceBlobView bundle) {
         ParseFtraceEvent(cpu_32, bundle.slice(fld_off, fld.size()));
         break;
       }
+      case protos::FtraceEventBundle::kCompactSchedFieldNumber: {
+        const size_t fld_off = bundle.offset_of(fld.data());
+        auto cpu_32 = static_cast<uint32_t>(cpu);
+        ParseCompactSched(cpu_32, bundle.slice(fld_off, fld.size()));
+        break;
+      }
       default:
         break;
     }
@@ -252,5 +308,109 @@ void ProtoTraceTokenizer::ParseFtraceEvent(uint32_t cpu, TraceBlobView event) {
                                   std::move(event));
 }
 
+void ProtoTraceTokenizer::ParseCompactSched(uint32_t cpu,
+                                            TraceBlobView compact) {
+  // The event tracker keeps per-cpu state for sched_switch.
+  if (PERFETTO_UNLIKELY(cpu >= base::kMaxCpus || compact.length() == 0)) {
+    trace_storage_->IncrementStats(stats::ftrace_bundle_tokenizer_errors);
+    return;
+  }
+  protos::pbzero::FtraceEventBundle::CompactSched::Decoder decoder(
+      compact.data(), compact.length());
+
+  // Without it the prev_pid of the first sched_switch, and the task that
+  // emitted the events before it, are unknown. Rather than making them up,
+  // drop the bundle.
+  if (PERFETTO_UNLIKELY(!decoder.has_running_pid())) {
+    trace_storage_->IncrementStats(stats::ftrace_bundle_tokenizer_errors);
+    return;
+  }
+
+  // The comms are handed to the parser as slices of the intern table.
+  const size_t compact_off = compact.offset_of(compact.data());
+  compact_sched_comms_.clear();
+  for (auto it = decoder.intern_table(); it; ++it) {
+    const auto off = static_cast<size_t>(it->data() - compact.data());
+    compact_sched_comms_.emplace_back(compact_off + off, it->size());
+  }
+
+  using InlineSchedEvent = TraceSorter::InlineSchedEvent;
+  bool parse_error = false;
+
+  // The columns of each event must have the same number of values. The
+  // timestamps are deltas from the previous event of the same type. The task
+  // running on the cpu is |running_pid| until the first sched_switch, then
+  // the next_pid of the last sched_switch.
+  compact_sched_switches_.clear();
+  int32_t running_pid = decoder.running_pid();
+  InlineSchedEvent sched_switch;
+  sched_switch.type = InlineSchedEvent::Type::kSwitch;
+  uint64_t timestamp = 0;
+  auto ts_it = decoder.switch_timestamp(&parse_error);
+  auto prev_state_it = decoder.switch_prev_state(&parse_error);
+  auto next_pid_it = decoder.switch_next_pid(&parse_error);
+  auto next_prio_it = decoder.switch_next_prio(&parse_error);
+  auto comm_it = decoder.switch_next_comm_index(&parse_error);
+  for (; ts_it && prev_state_it && next_pid_it && next_prio_it && comm_it;
+       ++ts_it, ++prev_state_it, ++next_pid_it, ++next_prio_it, ++comm_it) {
+    if (PERFETTO_UNLIKELY(*comm_it >= compact_sched_comms_.size())) {
+      parse_error = true;
+      break;
+    }
+    timestamp += *ts_it;
+    sched_switch.common_pid = running_pid;
+    sched_switch.prev_state = *prev_state_it;
+    sched_switch.pid = *next_pid_it;
+    sched_switch.prio = *next_prio_it;
+    running_pid = sched_switch.pid;
+    compact_sched_switches_.emplace_back(timestamp, running_pid);
+    const auto& comm = compact_sched_comms_[*comm_it];
+    last_timestamp_ = static_cast<int64_t>(timestamp);
+    trace_sorter_->PushInlineSchedEvent(cpu, last_timestamp_, sched_switch,
+                                        compact.slice(comm.first, comm.second));
+  }
+  if (ts_it || prev_state_it || next_pid_it || next_prio_it || comm_it)
+    parse_error = true;
+
+  InlineSchedEvent sched_waking;
+  sched_waking.type = InlineSchedEvent::Type::kWaking;
+  timestamp = 0;
+  size_t num_switches_before = 0;
+  auto waking_ts_it = decoder.waking_timestamp(&parse_error);
+  auto pid_it = decoder.waking_pid(&parse_error);
+  auto target_cpu_it = decoder.waking_target_cpu(&parse_error);
+  auto prio_it = decoder.waking_prio(&parse_error);
+  auto waking_comm_it = decoder.waking_comm_index(&parse_error);
+  for (; waking_ts_it && pid_it && target_cpu_it && prio_it && waking_comm_it;
+       ++waking_ts_it, ++pid_it, ++target_cpu_it, ++prio_it,
+       ++waking_comm_it) {
+    if (PERFETTO_UNLIKELY(*waking_comm_it >= compact_sched_comms_.size())) {
+      parse_error = true;
+      break;
+    }
+    timestamp += *waking_ts_it;
+    while (num_switches_before < compact_sched_switches_.size() &&
+           compact_sched_switches_[num_switches_before].first < timestamp) {
+      num_switches_before++;
+    }
+    sched_waking.common_pid =
+        num_switches_before
+            ? compact_sched_switches_[num_switches_before - 1].second
+            : decoder.running_pid();
+    sched_waking.pid = *pid_it;
+    sched_waking.target_cpu = *target_cpu_it;
+    sched_waking.prio = *prio_it;
+    const auto& comm = compact_sched_comms_[*waking_comm_it];
+    last_timestamp_ = static_cast<int64_t>(timestamp);
+    trace_sorter_->PushInlineSchedEvent(cpu, last_timestamp_, sched_waking,
+                                        compact.slice(comm.first, comm.second));
+  }
+  if (waking_ts_it || pid_it || target_cpu_it || prio_it || waking_comm_it)
+    parse_error = true;
+
+  if (PERFETTO_UNLIKELY(parse_error))
+    trace_storage_->IncrementStats(stats::ftrace_bundle_tokenizer_errors);
+}
+
 }  // namespace trace_processor
 }  // namespace perfetto
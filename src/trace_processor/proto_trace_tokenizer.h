@@ -20,6 +20,7 @@
 #include <stdint.h>
 
 #include <memory>
+#include <utility>
 #include <vector>
 
 #include "src/trace_processor/chunked_trace_reader.h"
@@ -49,8 +50,10 @@ class ProtoTraceTokenizer : public ChunkedTraceReader {
                      uint8_t* data,
                      size_t size);
   void ParsePacket(TraceBlobView);
+  void ParseCompressedPackets(TraceBlobView);
   void ParseFtraceBundle(TraceBlobView);
   void ParseFtraceEvent(uint32_t cpu, TraceBlobView);
+  void ParseCompactSched(uint32_t cpu, TraceBlobView);
 
   TraceSorter* const trace_sorter_;
   TraceStorage* const trace_storage_;
@@ -62,6 +65,18 @@ class ProtoTraceTokenizer : public ChunkedTraceReader {
   // Temporary. Currently trace packets do not have a timestamp, so the
   // timestamp given is last_timestamp.
   int64_t last_timestamp_ = 0;
+
+  // Set while parsing the packets of a compressed_packets field. The producer
+  // never nests them, so a nested one is rejected rather than recursing.
+  bool parsing_compressed_packets_ = false;
+
+  // The (offset, size) of the strings in the intern table of the CompactSched
+  // being parsed. A member only to reuse the memory across bundles.
+  std::vector<std::pair<size_t, size_t>> compact_sched_comms_;
+
+  // The (timestamp, next_pid) of the sched_switch events of the CompactSched
+  // being parsed, to work out the task that emitted each sched_waking.
+  std::vector<std::pair<uint64_t, int32_t>> compact_sched_switches_;
 };
 
 }  // namespace trace_processor
@@ -17,6 +17,7 @@
 #include <algorithm>
 #include <utility>
 
+#include "perfetto/base/metatrace.h"
 #include "src/trace_processor/proto_trace_parser.h"
 #include "src/trace_processor/trace_sorter.h"
 
@@ -36,6 +37,7 @@ TraceSorter::TraceSorter(TraceProcessorContext* context,
 void TraceSorter::SortAndFlushEventsBeyondWindow(int64_t window_size_ns) {
   // First check if any sorting is needed.
   if (sort_start_idx_ > 0) {
+    PERFETTO_METATRACE("TraceSorter::Sort", 0);
     PERFETTO_DCHECK(sort_start_idx_ < events_.size());
     PERFETTO_DCHECK(sort_min_ts_ > 0 && sort_min_ts_ < latest_timestamp_);
 
@@ -66,7 +68,18 @@ void TraceSorter::SortAndFlushEventsBeyondWindow(int64_t window_size_ns) {
   auto* next_stage = context_->proto_parser.get();
   for (auto it = events_.begin(); it != flush_end; it++) {
     PERFETTO_DCHECK(latest_timestamp_ - it->timestamp >= window_size_ns);
-    if (it->is_ftrace()) {
+    if (it->is_inline_sched()) {
+      const InlineSchedEvent& event = it->inline_sched;
+      if (event.type == InlineSchedEvent::Type::kSwitch) {
+        next_stage->ParseInlineSchedSwitch(
+            it->cpu, it->timestamp, event.common_pid, event.prev_state,
+            event.pid, event.prio, std::move(it->blob_view));
+      } else {
+        next_stage->ParseInlineSchedWaking(
+            it->cpu, it->timestamp, event.common_pid, event.pid,
+            event.target_cpu, event.prio, std::move(it->blob_view));
+      }
+    } else if (it->is_ftrace()) {
       next_stage->ParseFtracePacket(it->cpu, it->timestamp,
                                     std::move(it->blob_view));
     } else {
@@ -60,12 +60,36 @@ namespace trace_processor {
 
 class TraceSorter {
  public:
+  // A sched_switch or sched_waking from the compact encoding of a
+  // FtraceEventBundle (see CompactSched in ftrace_event_bundle.proto). These
+  // have no FtraceEvent to point to, so the TimestampedTracePiece holds their
+  // fields and its |blob_view| is the comm, from the intern table.
+  struct InlineSchedEvent {
+    enum class Type : uint8_t { kNone = 0, kSwitch, kWaking };
+
+    Type type = Type::kNone;
+    int32_t pid = 0;         // next_pid for sched_switch.
+    int32_t prio = 0;        // next_prio for sched_switch.
+    int32_t target_cpu = 0;  // sched_waking only.
+    int64_t prev_state = 0;  // sched_switch only.
+
+    // The task running on the cpu, that emitted the event. The prev_pid for
+    // sched_switch.
+    int32_t common_pid = 0;
+  };
+
   struct TimestampedTracePiece {
     static constexpr uint32_t kNoCpu = std::numeric_limits<uint32_t>::max();
 
     TimestampedTracePiece(int64_t a, TraceBlobView b, uint32_t c)
         : timestamp(a), blob_view(std::move(b)), cpu(c) {}
 
+    TimestampedTracePiece(int64_t a,
+                          TraceBlobView b,
+                          uint32_t c,
+                          const InlineSchedEvent& e)
+        : timestamp(a), blob_view(std::move(b)), cpu(c), inline_sched(e) {}
+
     TimestampedTracePiece(TimestampedTracePiece&&) noexcept = default;
     TimestampedTracePiece& operator=(TimestampedTracePiece&&) = default;
 
@@ -80,10 +104,14 @@ class TraceSorter {
     }
 
     bool is_ftrace() const { return cpu != kNoCpu; }
+    bool is_inline_sched() const {
+      return inline_sched.type != InlineSchedEvent::Type::kNone;
+    }
 
     int64_t timestamp;
     TraceBlobView blob_view;
     uint32_t cpu;
+    InlineSchedEvent inline_sched;
   };
 
   TraceSorter(TraceProcessorContext*, OptimizationMode, int64_t window_size_ns);
@@ -100,6 +128,15 @@ class TraceSorter {
         TimestampedTracePiece(timestamp, std::move(packet), cpu));
   }
 
+  // |comm| is the next_comm of a sched_switch or the comm of a sched_waking.
+  inline void PushInlineSchedEvent(uint32_t cpu,
+                                   int64_t timestamp,
+                                   const InlineSchedEvent& event,
+                                   TraceBlobView comm) {
+    AppendAndMaybeFlushEvents(
+        TimestampedTracePiece(timestamp, std::move(comm), cpu, event));
+  }
+
   // This method passes any events older than window_size_ns to the
   // parser to be parsed and then stored.
   void SortAndFlushEventsBeyondWindow(int64_t windows_size_ns);
@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ftrace/compact_sched.h"
+
+#include <string.h>
+
+#include "perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+
+namespace perfetto {
+
+namespace {
+
+const Field* FindField(const Event& event, const char* name) {
+  for (const Field& field : event.fields) {
+    if (field.ftrace_name && strcmp(field.ftrace_name, name) == 0)
+      return &field;
+  }
+  return nullptr;
+}
+
+// Returns the offset of the field |name| of |event|, or 0 if it is missing or
+// is not of the given |type| and |size|. No field of interest is at offset 0,
+// that's where the common fields are.
+uint16_t FindFieldOffset(const Event& event,
+                         const char* name,
+                         FtraceFieldType type,
+                         uint16_t size) {
+  const Field* field = FindField(event, name);
+  if (!field || field->ftrace_type != type || field->ftrace_size != size)
+    return 0;
+  return field->ftrace_offset;
+}
+
+const Event* FindEvent(const std::vector<Event>& events, const char* name) {
+  for (const Event& event : events) {
+    if (event.ftrace_event_id && strcmp(event.group, "sched") == 0 &&
+        strcmp(event.name, name) == 0) {
+      return &event;
+    }
+  }
+  return nullptr;
+}
+
+CompactSchedSwitchFormat ValidateSwitchFormat(const Event* event) {
+  CompactSchedSwitchFormat format;
+  if (!event)
+    return format;
+  const Field* prev_state = FindField(*event, "prev_state");
+  if (!prev_state || !prev_state->ftrace_offset ||
+      !(prev_state->ftrace_type == kFtraceInt32 ||
+        prev_state->ftrace_type == kFtraceInt64)) {
+    return format;
+  }
+  format.prev_state_offset = prev_state->ftrace_offset;
+  format.prev_state_size = prev_state->ftrace_size;
+  format.next_pid_offset =
+      FindFieldOffset(*event, "next_pid", kFtracePid32, sizeof(int32_t));
+  format.next_prio_offset =
+      FindFieldOffset(*event, "next_prio", kFtraceInt32, sizeof(int32_t));
+  const Field* next_comm = FindField(*event, "next_comm");
+  if (!format.next_pid_offset || !format.next_prio_offset || !next_comm ||
+      next_comm->ftrace_type != kFtraceFixedCString) {
+    return CompactSchedSwitchFormat();
+  }
+  format.next_comm_offset = next_comm->ftrace_offset;
+  format.next_comm_size = next_comm->ftrace_size;
+  format.size = event->size;
+  format.event_id = event->ftrace_event_id;
+  return format;
+}
+
+CompactSchedWakingFormat ValidateWakingFormat(const Event* event) {
+  CompactSchedWakingFormat format;
+  if (!event)
+    return format;
+  format.pid_offset =
+      FindFieldOffset(*event, "pid", kFtracePid32, sizeof(int32_t));
+  format.target_cpu_offset =
+      FindFieldOffset(*event, "target_cpu", kFtraceInt32, sizeof(int32_t));
+  format.prio_offset =
+      FindFieldOffset(*event, "prio", kFtraceInt32, sizeof(int32_t));
+  const Field* comm = FindField(*event, "comm");
+  if (!format.pid_offset || !format.target_cpu_offset || !format.prio_offset ||
+      !comm || comm->ftrace_type != kFtraceFixedCString) {
+    return CompactSchedWakingFormat();
+  }
+  format.comm_offset = comm->ftrace_offset;
+  format.comm_size = comm->ftrace_size;
+  format.size = event->size;
+  format.event_id = event->ftrace_event_id;
+  return format;
+}
+
+}  // namespace
+
+CompactSchedEventFormat ValidateFormatForCompactSched(
+    const std::vector<Event>& events,
+    const std::vector<Field>& common_fields) {
+  CompactSchedEventFormat format;
+  for (const Field& field : common_fields) {
+    if (field.ftrace_type == kFtraceCommonPid32 &&
+        field.ftrace_size == sizeof(int32_t)) {
+      format.common_pid_offset = field.ftrace_offset;
+    }
+  }
+  // Without the common pid the metadata would miss the pids of the events.
+  if (!format.common_pid_offset)
+    return format;
+  format.sched_switch = ValidateSwitchFormat(FindEvent(events, "sched_switch"));
+  format.sched_waking = ValidateWakingFormat(FindEvent(events, "sched_waking"));
+  return format;
+}
+
+CompactSchedBuffer::CompactSchedBuffer() = default;
+CompactSchedBuffer::~CompactSchedBuffer() = default;
+
+void CompactSchedBuffer::AppendSwitch(uint64_t timestamp,
+                                      int32_t common_pid,
+                                      int64_t prev_state,
+                                      int32_t next_pid,
+                                      int32_t next_prio,
+                                      base::StringView next_comm) {
+  if (empty())
+    running_pid_ = common_pid;
+  switch_timestamp_.Append(timestamp - last_switch_timestamp_);
+  last_switch_timestamp_ = timestamp;
+  switch_prev_state_.Append(prev_state);
+  switch_next_pid_.Append(next_pid);
+  switch_next_prio_.Append(next_prio);
+  switch_next_comm_index_.Append(InternComm(next_comm));
+}
+
+void CompactSchedBuffer::AppendWaking(uint64_t timestamp,
+                                      int32_t common_pid,
+                                      int32_t pid,
+                                      int32_t target_cpu,
+                                      int32_t prio,
+                                      base::StringView comm) {
+  if (empty())
+    running_pid_ = common_pid;
+  waking_timestamp_.Append(timestamp - last_waking_timestamp_);
+  last_waking_timestamp_ = timestamp;
+  waking_pid_.Append(pid);
+  waking_target_cpu_.Append(target_cpu);
+  waking_prio_.Append(prio);
+  waking_comm_index_.Append(InternComm(comm));
+}
+
+uint32_t CompactSchedBuffer::InternComm(base::StringView comm) {
+  for (size_t i = 0; i < intern_table_.size(); i++) {
+    if (intern_table_[i] == comm)
+      return static_cast<uint32_t>(i);
+  }
+  intern_table_.push_back(comm);
+  return static_cast<uint32_t>(intern_table_.size() - 1);
+}
+
+void CompactSchedBuffer::WriteAndReset(
+    protos::pbzero::FtraceEventBundle* bundle) {
+  if (empty())
+    return;
+  auto* compact_sched = bundle->set_compact_sched();
+  compact_sched->set_running_pid(running_pid_);
+  for (const base::StringView& comm : intern_table_)
+    compact_sched->add_intern_table(comm.data(), comm.size());
+  if (!switch_timestamp_.empty()) {
+    compact_sched->set_switch_timestamp(switch_timestamp_);
+    compact_sched->set_switch_prev_state(switch_prev_state_);
+    compact_sched->set_switch_next_pid(switch_next_pid_);
+    compact_sched->set_switch_next_prio(switch_next_prio_);
+    compact_sched->set_switch_next_comm_index(switch_next_comm_index_);
+  }
+  if (!waking_timestamp_.empty()) {
+    compact_sched->set_waking_timestamp(waking_timestamp_);
+    compact_sched->set_waking_pid(waking_pid_);
+    compact_sched->set_waking_target_cpu(waking_target_cpu_);
+    compact_sched->set_waking_prio(waking_prio_);
+    compact_sched->set_waking_comm_index(waking_comm_index_);
+  }
+  compact_sched->Finalize();
+  Reset();
+}
+
+void CompactSchedBuffer::Reset() {
+  intern_table_.clear();
+  running_pid_ = 0;
+  last_switch_timestamp_ = 0;
+  switch_timestamp_.Reset();
+  switch_prev_state_.Reset();
+  switch_next_pid_.Reset();
+  switch_next_prio_.Reset();
+  switch_next_comm_index_.Reset();
+  last_waking_timestamp_ = 0;
+  waking_timestamp_.Reset();
+  waking_pid_.Reset();
+  waking_target_cpu_.Reset();
+  waking_prio_.Reset();
+  waking_comm_index_.Reset();
+}
+
+}  // namespace perfetto
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FTRACE_COMPACT_SCHED_H_
+#define SRC_TRACED_PROBES_FTRACE_COMPACT_SCHED_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "perfetto/base/string_view.h"
+#include "perfetto/protozero/packed_repeated_fields.h"
+#include "src/traced/probes/ftrace/event_info_constants.h"
+
+namespace perfetto {
+
+namespace protos {
+namespace pbzero {
+class FtraceEventBundle;
+}  // namespace pbzero
+}  // namespace protos
+
+// Where the fields used by the compact encoding of sched_switch are in the raw
+// event, for the layout of the running kernel. |event_id| is 0 if the event is
+// missing or its layout is not supported, in which case the event is written
+// as a regular FtraceEvent.
+struct CompactSchedSwitchFormat {
+  uint32_t event_id = 0;
+  uint16_t size = 0;  // Of the fixed part of the event.
+  uint16_t prev_state_offset = 0;
+  uint16_t prev_state_size = 0;  // A long: 4 or 8 bytes.
+  uint16_t next_pid_offset = 0;
+  uint16_t next_prio_offset = 0;
+  uint16_t next_comm_offset = 0;
+  uint16_t next_comm_size = 0;
+};
+
+// Same as above, for sched_waking.
+struct CompactSchedWakingFormat {
+  uint32_t event_id = 0;
+  uint16_t size = 0;
+  uint16_t pid_offset = 0;
+  uint16_t target_cpu_offset = 0;
+  uint16_t prio_offset = 0;
+  uint16_t comm_offset = 0;
+  uint16_t comm_size = 0;
+};
+
+struct CompactSchedEventFormat {
+  uint16_t common_pid_offset = 0;
+  CompactSchedSwitchFormat sched_switch;
+  CompactSchedWakingFormat sched_waking;
+};
+
+// Works out the CompactSchedEventFormat from the |events| (indexed by ftrace
+// event id) and |common_fields| of a ProtoTranslationTable.
+CompactSchedEventFormat ValidateFormatForCompactSched(
+    const std::vector<Event>& events,
+    const std::vector<Field>& common_fields);
+
+// Accumulates the sched_switch and sched_waking events of a page in the
+// columns of FtraceEventBundle.CompactSched. The comms are interned as views
+// into the page, which must stay valid until WriteAndReset() is called.
+class CompactSchedBuffer {
+ public:
+  CompactSchedBuffer();
+  ~CompactSchedBuffer();
+
+  // |common_pid| is the pid of the task that emitted the event, the prev_pid
+  // for sched_switch. Only the one of the first event is kept.
+  void AppendSwitch(uint64_t timestamp,
+                    int32_t common_pid,
+                    int64_t prev_state,
+                    int32_t next_pid,
+                    int32_t next_prio,
+                    base::StringView next_comm);
+
+  void AppendWaking(uint64_t timestamp,
+                    int32_t common_pid,
+                    int32_t pid,
+                    int32_t target_cpu,
+                    int32_t prio,
+                    base::StringView comm);
+
+  bool empty() const {
+    return switch_timestamp_.empty() && waking_timestamp_.empty();
+  }
+
+  // Writes the events appended so far into |bundle|, if any, and resets the
+  // buffer for the next page.
+  void WriteAndReset(protos::pbzero::FtraceEventBundle* bundle);
+
+  void Reset();
+
+ private:
+  CompactSchedBuffer(const CompactSchedBuffer&) = delete;
+  CompactSchedBuffer& operator=(const CompactSchedBuffer&) = delete;
+
+  uint32_t InternComm(base::StringView comm);
+
+  // A page holds at most ~100 events, so a linear search is enough.
+  std::vector<base::StringView> intern_table_;
+
+  int32_t running_pid_ = 0;
+
+  uint64_t last_switch_timestamp_ = 0;
+  protozero::PackedVarInt switch_timestamp_;
+  protozero::PackedVarInt switch_prev_state_;
+  protozero::PackedVarInt switch_next_pid_;
+  protozero::PackedVarInt switch_next_prio_;
+  protozero::PackedVarInt switch_next_comm_index_;
+
+  uint64_t last_waking_timestamp_ = 0;
+  protozero::PackedVarInt waking_timestamp_;
+  protozero::PackedVarInt waking_pid_;
+  protozero::PackedVarInt waking_target_cpu_;
+  protozero::PackedVarInt waking_prio_;
+  protozero::PackedVarInt waking_comm_index_;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FTRACE_COMPACT_SCHED_H_
@@ -17,11 +17,12 @@
 #include "src/traced/probes/ftrace/cpu_reader.h"
 
 #include <signal.h>
+#include <string.h>
 
 #include <dirent.h>
+#include <algorithm>
 #include <map>
 #include <queue>
-#include <string>
 #include <utility>
 
 #include "perfetto/base/build_config.h"
@@ -70,45 +71,14 @@ struct TimeStamp {
   uint64_t tv_sec;
 };
 
-bool ReadIntoString(const uint8_t* start,
-                    const uint8_t* end,
-                    uint32_t field_id,
-                    protozero::Message* out) {
-  for (const uint8_t* c = start; c < end; c++) {
-    if (*c != '\0')
-      continue;
-    out->AppendBytes(field_id, reinterpret_cast<const char*>(start),
-                     static_cast<uintptr_t>(c - start));
-    return true;
-  }
-  return false;
-}
-
-bool ReadDataLoc(const uint8_t* start,
-                 const uint8_t* field_start,
-                 const uint8_t* end,
-                 const Field& field,
-                 protozero::Message* message) {
-  PERFETTO_DCHECK(field.ftrace_size == 4);
-  // See
-  // https://github.com/torvalds/linux/blob/master/include/trace/trace_events.h
-  uint32_t data = 0;
-  const uint8_t* ptr = field_start;
-  if (!CpuReader::ReadAndAdvance(&ptr, end, &data)) {
-    PERFETTO_DFATAL("Buffer overflowed.");
-    return false;
-  }
-
-  const uint16_t offset = data & 0xffff;
-  const uint16_t len = (data >> 16) & 0xffff;
-  const uint8_t* const string_start = start + offset;
-  const uint8_t* const string_end = string_start + len;
-  if (string_start <= start || string_end > end) {
-    PERFETTO_DFATAL("Buffer overflowed.");
-    return false;
-  }
-  ReadIntoString(string_start, string_end, field.proto_field_id, message);
-  return true;
+// Whether the event enabled in |filter| passes its userspace filter, if any.
+bool PassesUserspaceFilter(const EventFilter* filter,
+                           uint16_t ftrace_event_id,
+                           const uint8_t* start,
+                           const uint8_t* end) {
+  const UserspaceFilter* userspace_filter = filter->userspace_filter();
+  return !userspace_filter ||
+         userspace_filter->Matches(ftrace_event_id, start, end);
 }
 
 bool SetBlocking(int fd, bool is_blocking) {
@@ -146,6 +116,115 @@ base::Optional<PageHeader> ParsePageHeader(const uint8_t** ptr,
   return base::make_optional(page_header);
 }
 
+// The structure of a raw trace buffer page is as follows:
+// First a page header:
+//   8 bytes of timestamp
+//   8 bytes of page length TODO(hjd): other fields also defined here?
+// // TODO(hjd): Document rest of format.
+// Some information about the layout of the page header is available in user
+// space at: /sys/kernel/debug/tracing/events/header_event
+// Invokes |on_event(ftrace_event_id, timestamp, start, next)| for each data
+// record in the page, where [start, next) is the payload of the record.
+// Returns the number of bytes of the page consumed, or 0 if the page is
+// malformed or |on_event| returns false.
+template <typename F>
+size_t ForEachEventInPage(const uint8_t* ptr,
+                          const ProtoTranslationTable* table,
+                          FtraceMetadata* metadata,
+                          F on_event) {
+  const uint8_t* const start_of_page = ptr;
+  const uint8_t* const end_of_page = ptr + base::kPageSize;
+
+  auto page_header = ParsePageHeader(&ptr, table->page_header_size_len());
+  if (!page_header.has_value())
+    return 0;
+
+  // ParsePageHeader advances |ptr| to point past the end of the header.
+
+  metadata->overwrite_count = static_cast<uint32_t>(page_header->overwrite);
+  const uint8_t* const end = ptr + page_header->size;
+  if (end > end_of_page)
+    return 0;
+
+  uint64_t timestamp = page_header->timestamp;
+
+  while (ptr < end) {
+    EventHeader event_header;
+    if (!CpuReader::ReadAndAdvance(&ptr, end, &event_header))
+      return 0;
+
+    timestamp += event_header.time_delta;
+
+    switch (event_header.type_or_length) {
+      case kTypePadding: {
+        // Left over page padding or discarded event.
+        if (event_header.time_delta == 0) {
+          // Not clear what the correct behaviour is in this case.
+          PERFETTO_DFATAL("Empty padding event.");
+          return 0;
+        }
+        uint32_t length;
+        if (!CpuReader::ReadAndAdvance<uint32_t>(&ptr, end, &length))
+          return 0;
+        ptr += length;
+        break;
+      }
+      case kTypeTimeExtend: {
+        // Extend the time delta.
+        uint32_t time_delta_ext;
+        if (!CpuReader::ReadAndAdvance<uint32_t>(&ptr, end, &time_delta_ext))
+          return 0;
+        // See https://goo.gl/CFBu5x
+        timestamp += (static_cast<uint64_t>(time_delta_ext)) << 27;
+        break;
+      }
+      case kTypeTimeStamp: {
+        // Sync time stamp with external clock.
+        TimeStamp time_stamp;
+        if (!CpuReader::ReadAndAdvance<TimeStamp>(&ptr, end, &time_stamp))
+          return 0;
+        // Not implemented in the kernel, nothing should generate this.
+        PERFETTO_DFATAL("Unimplemented in kernel. Should be unreachable.");
+        break;
+      }
+      // Data record:
+      default: {
+        PERFETTO_CHECK(event_header.type_or_length <= kTypeDataTypeLengthMax);
+        // type_or_length is <=28 so it represents the length of a data
+        // record. if == 0, this is an extended record and the size of the
+        // record is stored in the first uint32_t word in the payload. See
+        // Kernel's include/linux/ring_buffer.h
+        uint32_t event_size;
+        if (event_header.type_or_length == 0) {
+          if (!CpuReader::ReadAndAdvance<uint32_t>(&ptr, end, &event_size))
+            return 0;
+          // Size includes the size field itself.
+          if (event_size < 4)
+            return 0;
+          event_size -= 4;
+        } else {
+          event_size = 4 * event_header.type_or_length;
+        }
+        const uint8_t* start = ptr;
+        const uint8_t* next = ptr + event_size;
+
+        if (next > end)
+          return 0;
+
+        uint16_t ftrace_event_id;
+        if (!CpuReader::ReadAndAdvance<uint16_t>(&ptr, end, &ftrace_event_id))
+          return 0;
+        if (!on_event(ftrace_event_id, timestamp, start, next))
+          return 0;
+
+        // Jump to next event.
+        ptr = next;
+      }
+    }
+  }
+  return static_cast<size_t>(ptr - start_of_page);
+}
+
 }  // namespace
 
 using protos::pbzero::GenericFtraceEvent;
@@ -154,11 +233,16 @@ CpuReader::CpuReader(const ProtoTranslationTable* table,
                      FtraceThreadSync* thread_sync,
                      size_t cpu,
                      int generation,
-                     base::ScopedFile fd)
+                     base::ScopedFile fd,
+                     const std::set<FtraceDataSource*>& data_sources)
     : table_(table),
       thread_sync_(thread_sync),
       cpu_(cpu),
       trace_fd_(std::move(fd)) {
+  // The worker thread isn't running yet, no need to take the lock.
+  for (FtraceDataSource* data_source : data_sources)
+    sink_list_.sinks.emplace_back(new Sink(data_source));
+
   // Make reads from the raw pipe blocking so that splice() can sleep.
   PERFETTO_CHECK(trace_fd_);
   PERFETTO_CHECK(SetBlocking(*trace_fd_, true));
@@ -180,9 +264,9 @@ CpuReader::CpuReader(const ProtoTranslationTable* table,
   }
 #pragma GCC diagnostic pop
 
-  worker_thread_ = std::thread(std::bind(&RunWorkerThread, cpu_, generation,
-                                         *trace_fd_, &pool_, thread_sync_,
-                                         table->page_header_size_len()));
+  worker_thread_ =
+      std::thread(std::bind(&RunWorkerThread, cpu_, generation, *trace_fd_,
+                            &pool_, thread_sync_, table_, &sink_list_));
 }
 
 CpuReader::~CpuReader() {
@@ -206,12 +290,41 @@ CpuReader::~CpuReader() {
   worker_thread_.join();
 }
 
+CpuReader::Sink::Sink(FtraceDataSource* ds)
+    : data_source(ds),
+      filter(ds->event_filter()),
+      compact_sched(filter->compact_sched() ? new CompactSchedBuffer()
+                                            : nullptr) {}
+
+void CpuReader::AddDataSource(FtraceDataSource* data_source) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  std::lock_guard<std::mutex> lock(sink_list_.mutex);
+  sink_list_.sinks.emplace_back(new Sink(data_source));
+}
+
+void CpuReader::RemoveDataSource(FtraceDataSource* data_source) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  std::lock_guard<std::mutex> lock(sink_list_.mutex);
+  auto& sinks = sink_list_.sinks;
+  sinks.erase(std::remove_if(sinks.begin(), sinks.end(),
+                             [data_source](const std::unique_ptr<Sink>& sink) {
+                               return sink->data_source == data_source;
+                             }),
+              sinks.end());
+}
+
+std::unique_lock<std::mutex> CpuReader::BlockParsing() {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  return std::unique_lock<std::mutex>(sink_list_.mutex);
+}
+
 void CpuReader::InterruptWorkerThreadWithSignal() {
   pthread_kill(worker_thread_.native_handle(), SIGPIPE);
 }
 
-// The worker thread reads data from the ftrace trace_pipe_raw and moves it to
-// the page |pool| allowing the main thread to read and decode that.
+// The worker thread reads data from the ftrace trace_pipe_raw into the page
+// |pool| and, after each batch of reads, converts the pages into protos for
+// the main thread to pick up.
 // See //docs/ftrace.md for the design of the ftrace worker scheduler.
 // static
 void CpuReader::RunWorkerThread(size_t cpu,
@@ -219,7 +332,8 @@ void CpuReader::RunWorkerThread(size_t cpu,
                                 int trace_fd,
                                 PagePool* pool,
                                 FtraceThreadSync* thread_sync,
-                                uint16_t header_size_len) {
+                                const ProtoTranslationTable* table,
+                                SinkList* sink_list) {
 // Before attempting any changes to this function, think twice. The kernel
 // ftrace pipe code is full of caveats and bugs. This code carefully works
 // around those bugs. See b/120188810 and b/119805587 for the full narrative.
@@ -234,6 +348,7 @@ void CpuReader::RunWorkerThread(size_t cpu,
   // A blocking splice() is the only way to block and wait for a new page of
   // ftrace data.
   base::Pipe sync_pipe = base::Pipe::Create(base::Pipe::kBothNonBlock);
+  const uint16_t header_size_len = table->page_header_size_len();
 
   enum ReadMode { kRead, kSplice };
   enum Block { kBlock, kNonBlock };
@@ -356,21 +471,35 @@ void CpuReader::RunWorkerThread(size_t cpu,
         //   to happen if the system is under high load).
         // In all these cases the most useful thing we can do is skip the
         // current cycle and try again later.
-        if (read_ftrace_pipe(cur_mode, kBlock) <= 0)
+        int res = read_ftrace_pipe(cur_mode, kBlock);
+        if (res <= 0)
           break;  // Wait for next command.
+        size_t bytes_read = static_cast<size_t>(res);
 
         // If we are in read mode (because of a previous flush) check if the
         // in-kernel read cursor is page-aligned again. If a non-blocking splice
         // succeeds, it means that we can safely switch back to splice mode
         // (See b/120188810).
-        if (cur_mode == kRead && read_ftrace_pipe(kSplice, kNonBlock) > 0)
-          cur_mode = kSplice;
+        if (cur_mode == kRead) {
+          res = read_ftrace_pipe(kSplice, kNonBlock);
+          if (res > 0) {
+            cur_mode = kSplice;
+            bytes_read += static_cast<size_t>(res);
+          }
+        }
 
         // Do as many non-blocking read/splice as we can.
-        while (read_ftrace_pipe(cur_mode, kNonBlock) > kRoughlyAPage) {
+        while ((res = read_ftrace_pipe(cur_mode, kNonBlock)) > 0) {
+          bytes_read += static_cast<size_t>(res);
+          if (res <= kRoughlyAPage)
+            break;
         }
         pool->CommitWrittenPages();
-        FtraceController::OnCpuReaderRead(cpu, generation, thread_sync);
+        ParsePendingPages(cpu, pool, table, sink_list);
+        size_t pages_read =
+            (bytes_read + base::kPageSize - 1) / base::kPageSize;
+        FtraceController::OnCpuReaderRead(cpu, generation, thread_sync,
+                                          pages_read);
         break;
       }
 
@@ -380,6 +509,7 @@ void CpuReader::RunWorkerThread(size_t cpu,
         while (read_ftrace_pipe(cur_mode, kNonBlock) > kRoughlyAPage) {
         }
         pool->CommitWrittenPages();
+        ParsePendingPages(cpu, pool, table, sink_list);
         FtraceController::OnCpuReaderFlush(cpu, generation, thread_sync);
         break;
       }
@@ -392,150 +522,371 @@ void CpuReader::RunWorkerThread(size_t cpu,
   base::ignore_result(trace_fd);
   base::ignore_result(pool);
   base::ignore_result(thread_sync);
-  base::ignore_result(header_size_len);
+  base::ignore_result(table);
+  base::ignore_result(sink_list);
   PERFETTO_ELOG("Supported only on Linux/Android");
 #endif
 }
 
-// Invoked on the main thread by FtraceController, |drain_rate_ms| after the
-// first CPU wakes up from the blocking read()/splice().
-void CpuReader::Drain(const std::set<FtraceDataSource*>& data_sources) {
-  PERFETTO_DCHECK_THREAD(thread_checker_);
-  PERFETTO_METATRACE("Drain(" + std::to_string(cpu_) + ")", kMainThread);
-
-  auto page_blocks = pool_.BeginRead();
-  for (const auto& page_block : page_blocks) {
-    for (size_t i = 0; i < page_block.size(); i++) {
-      const uint8_t* page = page_block.At(i);
-
-      for (FtraceDataSource* data_source : data_sources) {
-        auto packet = data_source->trace_writer()->NewTracePacket();
-        auto* bundle = packet->set_ftrace_events();
-        auto* metadata = data_source->mutable_metadata();
-        auto* filter = data_source->event_filter();
+// Invoked on the worker thread, after each batch of reads. Converts the pages
+// into one FtraceEventBundle packet per page and data source. The pages are
+// then recycled straight away, so the pool only ever holds one batch.
+// static
+void CpuReader::ParsePendingPages(size_t cpu,
+                                  PagePool* pool,
+                                  const ProtoTranslationTable* table,
+                                  SinkList* sink_list) {
+  const auto& page_blocks = pool->BeginRead();
+  if (page_blocks.empty()) {
+    pool->EndRead();
+    return;
+  }
+  PERFETTO_METATRACE("ParsePendingPages", cpu);
 
-        // Note: The fastpath in proto_trace_parser.cc speculates on the fact
-        // that the cpu field is the first field of the proto message. If this
-        // changes, change proto_trace_parser.cc accordingly.
-        bundle->set_cpu(static_cast<uint32_t>(cpu_));
+  {
+    std::lock_guard<std::mutex> lock(sink_list->mutex);
+    std::vector<ParseTarget>& targets = sink_list->targets;
+    for (const auto& page_block : page_blocks) {
+      for (size_t i = 0; i < page_block.size(); i++) {
+        const uint8_t* page = page_block.At(i);
+
+        targets.clear();
+        for (const auto& sink : sink_list->sinks) {
+          const UserspaceFilter* userspace_filter =
+              sink->filter->userspace_filter();
+          if (userspace_filter && !userspace_filter->IsCpuEnabled(cpu))
+            continue;
+          auto* bundle = sink->packets.NewPacket()->set_ftrace_events();
+
+          // Note: The fastpath in proto_trace_parser.cc speculates on the fact
+          // that the cpu field is the first field of the proto message. If
+          // this changes, change proto_trace_parser.cc accordingly.
+          bundle->set_cpu(static_cast<uint32_t>(cpu));
+          targets.push_back({sink->filter, bundle, &sink->metadata,
+                             sink->compact_sched.get()});
+        }
+        if (targets.empty())
+          continue;
 
-        size_t evt_size = ParsePage(page, filter, bundle, table_, metadata);
+        // With several concurrent sessions, each event is decoded only once.
+        size_t evt_size = ParsePageForTargets(page, targets, table,
+                                              &sink_list->parsed_page);
         PERFETTO_DCHECK(evt_size);
-        bundle->set_overwrite_count(metadata->overwrite_count);
+        for (const ParseTarget& target : targets)
+          target.bundle->set_overwrite_count(target.metadata->overwrite_count);
       }
     }
   }
-  pool_.EndRead(std::move(page_blocks));
+  pool->EndRead();
+}
+
+// Invoked on the main thread by FtraceController, |drain_rate_ms| after the
+// first CPU wakes up from the blocking read()/splice(). By then the worker
+// thread has already done the heavy lifting, this is just a copy.
+void CpuReader::Drain() {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  PERFETTO_METATRACE("Drain", kMainThread);
+
+  std::lock_guard<std::mutex> lock(sink_list_.mutex);
+  for (const auto& sink : sink_list_.sinks) {
+    FtraceDataSource* data_source = sink->data_source;
+    sink->packets.MoveInto(data_source->trace_writer());
+
+    FtraceMetadata* metadata = data_source->mutable_metadata();
+    metadata->overwrite_count = sink->metadata.overwrite_count;
+    metadata->pids.insert(metadata->pids.end(), sink->metadata.pids.begin(),
+                          sink->metadata.pids.end());
+    metadata->inode_and_device.insert(metadata->inode_and_device.end(),
+                                      sink->metadata.inode_and_device.begin(),
+                                      sink->metadata.inode_and_device.end());
+    sink->metadata.Clear();
+  }
 }
 
-// The structure of a raw trace buffer page is as follows:
-// First a page header:
-//   8 bytes of timestamp
-//   8 bytes of page length TODO(hjd): other fields also defined here?
-// // TODO(hjd): Document rest of format.
-// Some information about the layout of the page header is available in user
-// space at: /sys/kernel/debug/tracing/events/header_event
 // This method is deliberately static so it can be tested independently.
 size_t CpuReader::ParsePage(const uint8_t* ptr,
                             const EventFilter* filter,
                             FtraceEventBundle* bundle,
                             const ProtoTranslationTable* table,
-                            FtraceMetadata* metadata) {
-  const uint8_t* const start_of_page = ptr;
-  const uint8_t* const end_of_page = ptr + base::kPageSize;
+                            FtraceMetadata* metadata,
+                            CompactSchedBuffer* compact_sched) {
+  const CompactSchedEventFormat& compact_format = table->compact_sched_format();
+  size_t res = ForEachEventInPage(
+      ptr, table, metadata,
+      [filter, bundle, table, metadata, compact_sched, &compact_format](
+          uint16_t ftrace_event_id, uint64_t timestamp, const uint8_t* start,
+          const uint8_t* next) {
+        if (!filter->IsEventEnabled(ftrace_event_id) ||
+            !PassesUserspaceFilter(filter, ftrace_event_id, start, next)) {
+          return true;
+        }
+        if (compact_sched &&
+            IsCompactSchedEvent(ftrace_event_id, compact_format)) {
+          return ParseCompactSchedEvent(ftrace_event_id, timestamp, start,
+                                        next, compact_format, compact_sched,
+                                        metadata);
+        }
+        protos::pbzero::FtraceEvent* event = bundle->add_event();
+        event->set_timestamp(timestamp);
+        return ParseEvent(ftrace_event_id, start, next, table, event, metadata);
+      });
+  if (compact_sched)
+    compact_sched->WriteAndReset(bundle);
+  return res;
+}
 
-  auto page_header = ParsePageHeader(&ptr, table->page_header_size_len());
-  if (!page_header.has_value())
-    return 0;
+CpuReader::ParsedPage::ParsedPage()
+    : heap_buffer_(4 * base::kPageSize), stream_writer_(&heap_buffer_) {
+  heap_buffer_.set_writer(&stream_writer_);
+}
 
-  // ParsePageHeader advances |ptr| to point past the end of the header.
+CpuReader::ParsedPage::~ParsedPage() = default;
 
-  metadata->overwrite_count = static_cast<uint32_t>(page_header->overwrite);
-  const uint8_t* const end = ptr + page_header->size;
-  if (end > end_of_page)
-    return 0;
+void CpuReader::ParsedPage::Reset() {
+  heap_buffer_.Reset();
+  bundle_.Reset(&stream_writer_);
+  metadata_.Clear();
+  events_.clear();
+  pids_.clear();
+  inodes_.clear();
+}
 
-  uint64_t timestamp = page_header->timestamp;
+// Number of bytes encoded so far, not counting the unused tails of the slices
+// (which are skipped when stitching them).
+uint32_t CpuReader::ParsedPage::WrittenSize() const {
+  const auto& slices = heap_buffer_.slices();
+  if (slices.empty())
+    return 0;
+  size_t size = 0;
+  for (size_t i = 0; i < slices.size() - 1; i++)
+    size += slices[i].GetUsedRange().size();
+  size += static_cast<size_t>(stream_writer_.write_ptr() -
+                              slices.back().start());
+  return static_cast<uint32_t>(size);
+}
 
-  while (ptr < end) {
-    EventHeader event_header;
-    if (!ReadAndAdvance(&ptr, end, &event_header))
-      return 0;
+const uint8_t* CpuReader::ParsedPage::Data() {
+  const auto& slices = heap_buffer_.slices();
+  if (slices.size() <= 1)
+    return slices.empty() ? nullptr : slices[0].start();
+  stitched_ = heap_buffer_.StitchSlices();
+  return stitched_.data();
+}
 
-    timestamp += event_header.time_delta;
+// static
+size_t CpuReader::ParsePageForTargets(const uint8_t* ptr,
+                                      const std::vector<ParseTarget>& targets,
+                                      const ProtoTranslationTable* table,
+                                      ParsedPage* parsed_page) {
+  if (targets.size() == 1) {
+    const ParseTarget& target = targets[0];
+    return ParsePage(ptr, target.filter, target.bundle, table, target.metadata,
+                     target.compact_sched);
+  }
 
-    switch (event_header.type_or_length) {
-      case kTypePadding: {
-        // Left over page padding or discarded event.
-        if (event_header.time_delta == 0) {
-          // Not clear what the correct behaviour is in this case.
-          PERFETTO_DFATAL("Empty padding event.");
-          return 0;
+  // Pass 1: decode the events enabled in any of the targets. The targets that
+  // want the compact format get its events straight away instead.
+  parsed_page->Reset();
+  ParsedPage* pp = parsed_page;
+  FtraceMetadata* metadata = &pp->metadata_;
+  const CompactSchedEventFormat& compact_format = table->compact_sched_format();
+  size_t res = ForEachEventInPage(
+      ptr, table, metadata,
+      [&targets, table, pp, metadata, &compact_format](
+          uint16_t ftrace_event_id, uint64_t timestamp, const uint8_t* start,
+          const uint8_t* next) {
+        const bool is_compact_sched =
+            IsCompactSchedEvent(ftrace_event_id, compact_format);
+        bool enabled = false;
+        for (const ParseTarget& target : targets) {
+          if (!target.filter->IsEventEnabled(ftrace_event_id) ||
+              !PassesUserspaceFilter(target.filter, ftrace_event_id, start,
+                                     next)) {
+            continue;
+          }
+          if (is_compact_sched && target.compact_sched) {
+            if (!ParseCompactSchedEvent(ftrace_event_id, timestamp, start,
+                                        next, compact_format,
+                                        target.compact_sched, target.metadata))
+              return false;
+            continue;
+          }
+          enabled = true;
         }
-        uint32_t length;
-        if (!ReadAndAdvance<uint32_t>(&ptr, end, &length))
-          return 0;
-        ptr += length;
-        break;
-      }
-      case kTypeTimeExtend: {
-        // Extend the time delta.
-        uint32_t time_delta_ext;
-        if (!ReadAndAdvance<uint32_t>(&ptr, end, &time_delta_ext))
-          return 0;
-        // See https://goo.gl/CFBu5x
-        timestamp += (static_cast<uint64_t>(time_delta_ext)) << 27;
-        break;
-      }
-      case kTypeTimeStamp: {
-        // Sync time stamp with external clock.
-        TimeStamp time_stamp;
-        if (!ReadAndAdvance<TimeStamp>(&ptr, end, &time_stamp))
-          return 0;
-        // Not implemented in the kernel, nothing should generate this.
-        PERFETTO_DFATAL("Unimplemented in kernel. Should be unreachable.");
-        break;
-      }
-      // Data record:
-      default: {
-        PERFETTO_CHECK(event_header.type_or_length <= kTypeDataTypeLengthMax);
-        // type_or_length is <=28 so it represents the length of a data
-        // record. if == 0, this is an extended record and the size of the
-        // record is stored in the first uint32_t word in the payload. See
-        // Kernel's include/linux/ring_buffer.h
-        uint32_t event_size;
-        if (event_header.type_or_length == 0) {
-          if (!ReadAndAdvance<uint32_t>(&ptr, end, &event_size))
-            return 0;
-          // Size includes the size field itself.
-          if (event_size < 4)
-            return 0;
-          event_size -= 4;
-        } else {
-          event_size = 4 * event_header.type_or_length;
+        if (!enabled)
+          return true;
+
+        ParsedPage::Event parsed_event;
+        parsed_event.ftrace_event_id = ftrace_event_id;
+        parsed_event.raw_begin = start;
+        parsed_event.raw_end = next;
+        parsed_event.begin = pp->WrittenSize();
+        protos::pbzero::FtraceEvent* event = pp->bundle_.add_event();
+        event->set_timestamp(timestamp);
+        bool success =
+            ParseEvent(ftrace_event_id, start, next, table, event, metadata);
+        event->Finalize();
+        parsed_event.end = pp->WrittenSize();
+
+        // The metadata is collected per event (rather than per page, as
+        // ParsePage() does) so that each target gets only the pids and inodes
+        // of the events it is interested in.
+        pp->pids_.insert(pp->pids_.end(), metadata->pids.begin(),
+                         metadata->pids.end());
+        pp->inodes_.insert(pp->inodes_.end(),
+                           metadata->inode_and_device.begin(),
+                           metadata->inode_and_device.end());
+        metadata->pids.clear();
+        metadata->inode_and_device.clear();
+        parsed_event.pids_end = static_cast<uint32_t>(pp->pids_.size());
+        parsed_event.inodes_end = static_cast<uint32_t>(pp->inodes_.size());
+        pp->events_.push_back(parsed_event);
+        return success;
+      });
+  pp->bundle_.Finalize();
+
+  // Pass 2: copy the encoded events into the bundle of each target.
+  const uint8_t* data = pp->Data();
+  for (const ParseTarget& target : targets) {
+    target.metadata->overwrite_count = metadata->overwrite_count;
+    uint32_t run_begin = 0;
+    uint32_t run_end = 0;
+    uint32_t pids_begin = 0;
+    uint32_t inodes_begin = 0;
+    for (const ParsedPage::Event& event : pp->events_) {
+      const bool wants_event =
+          target.filter->IsEventEnabled(event.ftrace_event_id) &&
+          !(target.compact_sched &&
+            IsCompactSchedEvent(event.ftrace_event_id, compact_format)) &&
+          PassesUserspaceFilter(target.filter, event.ftrace_event_id,
+                                event.raw_begin, event.raw_end);
+      if (wants_event) {
+        if (event.begin != run_end) {
+          if (run_end > run_begin)
+            target.bundle->AppendRawProtoBytes(data + run_begin,
+                                               run_end - run_begin);
+          run_begin = event.begin;
         }
-        const uint8_t* start = ptr;
-        const uint8_t* next = ptr + event_size;
+        run_end = event.end;
+        for (uint32_t i = pids_begin; i < event.pids_end; i++)
+          target.metadata->AddPid(pp->pids_[i]);
+        target.metadata->inode_and_device.insert(
+            target.metadata->inode_and_device.end(),
+            pp->inodes_.begin() + inodes_begin,
+            pp->inodes_.begin() + event.inodes_end);
+      }
+      pids_begin = event.pids_end;
+      inodes_begin = event.inodes_end;
+    }
+    if (run_end > run_begin)
+      target.bundle->AppendRawProtoBytes(data + run_begin, run_end - run_begin);
+    if (target.compact_sched)
+      target.compact_sched->WriteAndReset(target.bundle);
+  }
+  return res;
+}
 
-        if (next > end)
-          return 0;
+// static
+bool CpuReader::ParseCompactSchedEvent(uint16_t ftrace_event_id,
+                                       uint64_t timestamp,
+                                       const uint8_t* start,
+                                       const uint8_t* end,
+                                       const CompactSchedEventFormat& format,
+                                       CompactSchedBuffer* compact_sched,
+                                       FtraceMetadata* metadata) {
+  PERFETTO_DCHECK(IsCompactSchedEvent(ftrace_event_id, format));
+  const size_t length = static_cast<size_t>(end - start);
+  int32_t common_pid;
+  memcpy(&common_pid, start + format.common_pid_offset, sizeof(common_pid));
+
+  if (ftrace_event_id == format.sched_switch.event_id) {
+    const CompactSchedSwitchFormat& f = format.sched_switch;
+    if (f.size > length) {
+      PERFETTO_DFATAL("Buffer overflowed.");
+      return false;
+    }
+    int64_t prev_state;
+    if (f.prev_state_size == sizeof(int64_t)) {
+      memcpy(&prev_state, start + f.prev_state_offset, sizeof(int64_t));
+    } else {
+      int32_t prev_state_32;
+      memcpy(&prev_state_32, start + f.prev_state_offset, sizeof(int32_t));
+      prev_state = prev_state_32;
+    }
+    int32_t next_pid;
+    memcpy(&next_pid, start + f.next_pid_offset, sizeof(next_pid));
+    int32_t next_prio;
+    memcpy(&next_prio, start + f.next_prio_offset, sizeof(next_prio));
+    const char* next_comm =
+        reinterpret_cast<const char*>(start + f.next_comm_offset);
+    compact_sched->AppendSwitch(
+        timestamp, common_pid, prev_state, next_pid, next_prio,
+        base::StringView(next_comm, strnlen(next_comm, f.next_comm_size)));
+    metadata->AddCommonPid(common_pid);
+    metadata->AddPid(next_pid);
+  } else {
+    const CompactSchedWakingFormat& f = format.sched_waking;
+    if (f.size > length) {
+      PERFETTO_DFATAL("Buffer overflowed.");
+      return false;
+    }
+    int32_t pid;
+    memcpy(&pid, start + f.pid_offset, sizeof(pid));
+    int32_t target_cpu;
+    memcpy(&target_cpu, start + f.target_cpu_offset, sizeof(target_cpu));
+    int32_t prio;
+    memcpy(&prio, start + f.prio_offset, sizeof(prio));
+    const char* comm = reinterpret_cast<const char*>(start + f.comm_offset);
+    compact_sched->AppendWaking(
+        timestamp, common_pid, pid, target_cpu, prio,
+        base::StringView(comm, strnlen(comm, f.comm_size)));
+    metadata->AddCommonPid(common_pid);
+    metadata->AddPid(pid);
+  }
+  metadata->FinishEvent();
+  return true;
+}
 
-        uint16_t ftrace_event_id;
-        if (!ReadAndAdvance<uint16_t>(&ptr, end, &ftrace_event_id))
-          return 0;
-        if (filter->IsEventEnabled(ftrace_event_id)) {
-          protos::pbzero::FtraceEvent* event = bundle->add_event();
-          event->set_timestamp(timestamp);
-          if (!ParseEvent(ftrace_event_id, start, next, table, event, metadata))
-            return 0;
-        }
+// static
+bool CpuReader::ReadIntoString(const uint8_t* start,
+                               const uint8_t* end,
+                               uint32_t field_id,
+                               protozero::Message* out) {
+  for (const uint8_t* c = start; c < end; c++) {
+    if (*c != '\0')
+      continue;
+    out->AppendBytes(field_id, reinterpret_cast<const char*>(start),
+                     static_cast<uintptr_t>(c - start));
+    return true;
+  }
+  return false;
+}
 
-        // Jump to next event.
-        ptr = next;
-      }
-    }
+// static
+bool CpuReader::ReadDataLoc(const uint8_t* start,
+                            const uint8_t* field_start,
+                            const uint8_t* end,
+                            uint32_t field_id,
+                            protozero::Message* message) {
+  // See
+  // https://github.com/torvalds/linux/blob/master/include/trace/trace_events.h
+  uint32_t data = 0;
+  const uint8_t* ptr = field_start;
+  if (!ReadAndAdvance(&ptr, end, &data)) {
+    PERFETTO_DFATAL("Buffer overflowed.");
+    return false;
   }
-  return static_cast<size_t>(ptr - start_of_page);
+
+  const uint16_t offset = data & 0xffff;
+  const uint16_t len = (data >> 16) & 0xffff;
+  const uint8_t* const string_start = start + offset;
+  const uint8_t* const string_end = string_start + len;
+  if (string_start <= start || string_end > end) {
+    PERFETTO_DFATAL("Buffer overflowed.");
+    return false;
+  }
+  ReadIntoString(string_start, string_end, field_id, message);
+  return true;
 }
 
 // |start| is the start of the current event.
@@ -566,8 +917,14 @@ bool CpuReader::ParseEvent(uint16_t ftrace_event_id,
   protozero::Message* nested =
       message->BeginNestedMessage<protozero::Message>(info.proto_field_id);
 
-  // Parse generic event.
-  if (info.proto_field_id == protos::pbzero::FtraceEvent::kGenericFieldNumber) {
+  // The decoder generated for the current layout of the event, if any, does
+  // the same as the loops over info.fields below.
+  EventDecoderFunction decoder = table->GetEventDecoderById(ftrace_event_id);
+  if (decoder) {
+    success &= decoder(start, end, nested, metadata);
+  } else if (info.proto_field_id ==
+             protos::pbzero::FtraceEvent::kGenericFieldNumber) {
+    // Parse generic event.
     nested->AppendString(GenericFtraceEvent::kEventNameFieldNumber, info.name);
     for (const Field& field : info.fields) {
       auto generic_field = nested->BeginNestedMessage<protozero::Message>(
@@ -645,7 +1002,8 @@ bool CpuReader::ParseField(const Field& field,
       // TODO(hjd): Figure out how to read these.
       return true;
     case kDataLocToString:
-      return ReadDataLoc(start, field_start, end, field, message);
+      PERFETTO_DCHECK(field.ftrace_size == 4);
+      return ReadDataLoc(start, field_start, end, field_id, message);
     case kBoolToUint32:
     case kBoolToUint64:
       ReadIntoVarInt<uint8_t>(field_start, field_id, message);
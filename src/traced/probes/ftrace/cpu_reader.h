@@ -23,8 +23,10 @@
 #include <array>
 #include <atomic>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <thread>
+#include <vector>
 
 #include "perfetto/base/gtest_prod_util.h"
 #include "perfetto/base/paged_memory.h"
@@ -33,27 +35,29 @@
 #include "perfetto/base/thread_checker.h"
 #include "perfetto/protozero/message.h"
 #include "perfetto/protozero/message_handle.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "perfetto/protozero/scattered_stream_writer.h"
 #include "perfetto/traced/data_source_types.h"
+#include "src/traced/probes/ftrace/compact_sched.h"
 #include "src/traced/probes/ftrace/ftrace_config.h"
 #include "src/traced/probes/ftrace/ftrace_metadata.h"
+#include "src/traced/probes/ftrace/packet_buffer.h"
 #include "src/traced/probes/ftrace/page_pool.h"
 #include "src/traced/probes/ftrace/proto_translation_table.h"
 
+#include "perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+
 namespace perfetto {
 
 class FtraceDataSource;
 struct FtraceThreadSync;
 class ProtoTranslationTable;
 
-namespace protos {
-namespace pbzero {
-class FtraceEventBundle;
-}  // namespace pbzero
-}  // namespace protos
-
-
 // Reads raw ftrace data for a cpu and writes that into the perfetto userspace
-// buffer.
+// buffer. Pages are read and converted into protos on a per-cpu worker thread.
+// The resulting packets are staged in heap memory, one PacketBuffer for each
+// data source, until the main thread moves them into the data source's
+// TraceWriter in Drain().
 class CpuReader {
  public:
   using FtraceEventBundle = protos::pbzero::FtraceEventBundle;
@@ -62,11 +66,22 @@ class CpuReader {
             FtraceThreadSync*,
             size_t cpu,
             int generation,
-            base::ScopedFile fd);
+            base::ScopedFile fd,
+            const std::set<FtraceDataSource*>& data_sources);
   ~CpuReader();
 
-  // Drains all available data into the buffer of the passed data sources.
-  void Drain(const std::set<FtraceDataSource*>&);
+  // Starts (or stops) converting the pages read from now on into packets for
+  // the given data source. The data source's event filter must stay valid
+  // until it is removed.
+  void AddDataSource(FtraceDataSource*);
+  void RemoveDataSource(FtraceDataSource*);
+
+  // Moves the packets converted so far into the buffer of the data sources.
+  void Drain();
+
+  // Prevents the worker thread from converting pages (and hence from looking
+  // at the ProtoTranslationTable) until the returned lock is released.
+  std::unique_lock<std::mutex> BlockParsing();
 
   void InterruptWorkerThreadWithSignal();
 
@@ -130,6 +145,67 @@ class CpuReader {
     metadata->AddCommonPid(pid);
   }
 
+  // Same as the above, for callers that know the field id at compile time,
+  // i.e. the generated decoders in event_decoders.cc.
+  template <uint32_t field_id, typename T>
+  static T ReadIntoVarInt(const uint8_t* start, protozero::Message* out) {
+    T t;
+    memcpy(&t, reinterpret_cast<const void*>(start), sizeof(T));
+    out->AppendVarInt<field_id>(t);
+    return t;
+  }
+
+  template <uint32_t field_id, typename T>
+  static void ReadInode(const uint8_t* start,
+                        protozero::Message* out,
+                        FtraceMetadata* metadata) {
+    T t = ReadIntoVarInt<field_id, T>(start, out);
+    metadata->AddInode(static_cast<Inode>(t));
+  }
+
+  template <uint32_t field_id, typename T>
+  static void ReadDevId(const uint8_t* start,
+                        protozero::Message* out,
+                        FtraceMetadata* metadata) {
+    T t;
+    memcpy(&t, reinterpret_cast<const void*>(start), sizeof(T));
+    BlockDeviceID dev_id = TranslateBlockDeviceIDToUserspace<T>(t);
+    out->AppendVarInt<field_id>(dev_id);
+    metadata->AddDevice(dev_id);
+  }
+
+  template <uint32_t field_id>
+  static void ReadPid(const uint8_t* start,
+                      protozero::Message* out,
+                      FtraceMetadata* metadata) {
+    int32_t pid = ReadIntoVarInt<field_id, int32_t>(start, out);
+    metadata->AddPid(pid);
+  }
+
+  template <uint32_t field_id>
+  static void ReadCommonPid(const uint8_t* start,
+                            protozero::Message* out,
+                            FtraceMetadata* metadata) {
+    int32_t pid = ReadIntoVarInt<field_id, int32_t>(start, out);
+    metadata->AddCommonPid(pid);
+  }
+
+  // Appends the null terminated string starting at |start| as a bytes field.
+  // Returns false, and appends nothing, if there is no terminator before
+  // |end|.
+  static bool ReadIntoString(const uint8_t* start,
+                             const uint8_t* end,
+                             uint32_t field_id,
+                             protozero::Message* out);
+
+  // Appends the string referenced by the __data_loc field at |field_start| of
+  // the event starting at |start|.
+  static bool ReadDataLoc(const uint8_t* start,
+                          const uint8_t* field_start,
+                          const uint8_t* end,
+                          uint32_t field_id,
+                          protozero::Message* out);
+
   // Internally the kernel stores device ids in a different layout to that
   // exposed to userspace via stat etc. There's no userspace function to convert
   // between the formats so we have to do it ourselves.
@@ -153,11 +229,79 @@ class CpuReader {
   // run time (e.g. field offset and size) information necessary to do this.
   // The table is initialized once at start time by the ftrace controller
   // which passes it to the CpuReader which passes it here.
+  // If |compact_sched| is not null, the sched_switch and sched_waking events
+  // are written into it rather than as FtraceEvent(s), and from there into
+  // the compact_sched field of the bundle (see FtraceConfig.compact_sched).
   static size_t ParsePage(const uint8_t* ptr,
                           const EventFilter*,
                           protos::pbzero::FtraceEventBundle*,
                           const ProtoTranslationTable* table,
-                          FtraceMetadata*);
+                          FtraceMetadata*,
+                          CompactSchedBuffer* compact_sched = nullptr);
+
+  // One of the destinations of ParsePageForTargets().
+  struct ParseTarget {
+    const EventFilter* filter;
+    FtraceEventBundle* bundle;
+    FtraceMetadata* metadata;
+    CompactSchedBuffer* compact_sched;  // Null if not enabled.
+  };
+
+  // The intermediate representation of a page used by ParsePageForTargets():
+  // the events enabled in at least one target, each encoded once as an
+  // FtraceEventBundle.event field, and the metadata each of them produced.
+  // It is kept across calls only to recycle the memory.
+  class ParsedPage {
+   public:
+    ParsedPage();
+    ~ParsedPage();
+
+   private:
+    friend class CpuReader;
+
+    struct Event {
+      uint16_t ftrace_event_id;
+      // [begin, end) of the encoded event, in bytes from the start of Data().
+      uint32_t begin;
+      uint32_t end;
+      // End of the metadata of the event in |pids| and |inodes|. The begin is
+      // the end of the previous event.
+      uint32_t pids_end;
+      uint32_t inodes_end;
+      // The raw event in the page, for the targets with a UserspaceFilter.
+      const uint8_t* raw_begin;
+      const uint8_t* raw_end;
+    };
+
+    ParsedPage(const ParsedPage&) = delete;
+    ParsedPage& operator=(const ParsedPage&) = delete;
+
+    void Reset();
+    uint32_t WrittenSize() const;
+    const uint8_t* Data();
+
+    protozero::ScatteredHeapBuffer heap_buffer_;
+    protozero::ScatteredStreamWriter stream_writer_;
+    FtraceEventBundle bundle_;
+    FtraceMetadata metadata_;  // For the event being parsed.
+    std::vector<Event> events_;
+    std::vector<int32_t> pids_;
+    std::vector<std::pair<Inode, BlockDeviceID>> inodes_;
+
+    // Used only if the encoded events didn't fit in a single slice.
+    std::vector<uint8_t> stitched_;
+  };
+
+  // Equivalent to calling ParsePage() once for each target, but decodes each
+  // raw event only once, into |parsed_page|, and then copies the encoded event
+  // into the bundles of the targets whose filter enables it. Runs of events
+  // are copied in one go, so targets with the same filter are almost free.
+  // The bundles (and cpu field) must be set up by the caller, as for
+  // ParsePage().
+  static size_t ParsePageForTargets(const uint8_t* ptr,
+                                    const std::vector<ParseTarget>& targets,
+                                    const ProtoTranslationTable* table,
+                                    ParsedPage* parsed_page);
 
   // Parse a single raw ftrace event beginning at |start| and ending at |end|
   // and write it into the provided bundle as a proto.
@@ -179,13 +323,59 @@ class CpuReader {
                          protozero::Message* message,
                          FtraceMetadata* metadata);
 
+  // Whether |ftrace_event_id| is a sched_switch or a sched_waking with a
+  // layout supported by the compact format.
+  static bool IsCompactSchedEvent(uint16_t ftrace_event_id,
+                                  const CompactSchedEventFormat& format) {
+    return ftrace_event_id != 0 &&
+           (ftrace_event_id == format.sched_switch.event_id ||
+            ftrace_event_id == format.sched_waking.event_id);
+  }
+
+  // Appends the event starting at |start|, for which IsCompactSchedEvent()
+  // is true, to |compact_sched|.
+  static bool ParseCompactSchedEvent(uint16_t ftrace_event_id,
+                                     uint64_t timestamp,
+                                     const uint8_t* start,
+                                     const uint8_t* end,
+                                     const CompactSchedEventFormat& format,
+                                     CompactSchedBuffer* compact_sched,
+                                     FtraceMetadata* metadata);
+
  private:
+  // The staging area of a data source, written by the worker thread.
+  struct Sink {
+    explicit Sink(FtraceDataSource*);
+
+    FtraceDataSource* const data_source;
+    const EventFilter* const filter;
+    PacketBuffer packets;
+    FtraceMetadata metadata;
+    // Set if the config asked for compact_sched and FtraceConfigMuxer kept it.
+    std::unique_ptr<CompactSchedBuffer> compact_sched;
+  };
+
+  struct SinkList {
+    std::mutex mutex;  // Held by the worker for the whole parsing of a batch.
+    std::vector<std::unique_ptr<Sink>> sinks;
+
+    // Scratch state of the worker, kept here only to reuse the memory.
+    std::vector<ParseTarget> targets;
+    ParsedPage parsed_page;
+  };
+
   static void RunWorkerThread(size_t cpu,
                               int generation,
                               int trace_fd,
                               PagePool*,
                               FtraceThreadSync*,
-                              uint16_t header_size_len);
+                              const ProtoTranslationTable*,
+                              SinkList*);
+
+  static void ParsePendingPages(size_t cpu,
+                                PagePool*,
+                                const ProtoTranslationTable*,
+                                SinkList*);
 
   CpuReader(const CpuReader&) = delete;
   CpuReader& operator=(const CpuReader&) = delete;
@@ -194,12 +384,12 @@ class CpuReader {
   FtraceThreadSync* const thread_sync_;
   const size_t cpu_;
   PagePool pool_;
+  SinkList sink_list_;
   base::ScopedFile trace_fd_;
   std::thread worker_thread_;
   PERFETTO_THREAD_CHECKER(thread_checker_)
 };
 
-
 }  // namespace perfetto
 
 #endif  // SRC_TRACED_PROBES_FTRACE_CPU_READER_H_
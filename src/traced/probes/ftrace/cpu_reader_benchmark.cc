@@ -12,6 +12,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <memory>
+#include <vector>
+
 #include "benchmark/benchmark.h"
 
 #include "src/traced/probes/ftrace/cpu_reader.h"
@@ -302,7 +305,10 @@ using perfetto::CpuReader;
 using perfetto::FtraceMetadata;
 using perfetto::GroupAndName;
 
-static void BM_ParsePageFullOfSchedSwitch(benchmark::State& state) {
+// Compares the decoder generated for the layout of sched_switch (see
+// event_decoders.h) with the generic parsing of the fields.
+static void ParsePageFullOfSchedSwitch(benchmark::State& state,
+                                       bool use_decoders) {
   const ExamplePage* test_case = &g_full_page_sched_switch;
 
   ScatteredStreamWriterNullDelegate delegate(perfetto::base::kPageSize);
@@ -310,6 +316,7 @@ static void BM_ParsePageFullOfSchedSwitch(benchmark::State& state) {
   FtraceEventBundle writer;
 
   ProtoTranslationTable* table = GetTable(test_case->name);
+  table->SetEventDecodersEnabledForTesting(use_decoders);
   auto page = PageFromXxd(test_case->data);
 
   EventFilter filter;
@@ -322,5 +329,68 @@ static void BM_ParsePageFullOfSchedSwitch(benchmark::State& state) {
     CpuReader::ParsePage(page.get(), &filter, &writer, table, &metadata);
     metadata.Clear();
   }
+  table->SetEventDecodersEnabledForTesting(true);
+}
+
+static void BM_ParsePageFullOfSchedSwitch(benchmark::State& state) {
+  ParsePageFullOfSchedSwitch(state, true);
 }
 BENCHMARK(BM_ParsePageFullOfSchedSwitch);
+
+static void BM_ParsePageFullOfSchedSwitchGeneric(benchmark::State& state) {
+  ParsePageFullOfSchedSwitch(state, false);
+}
+BENCHMARK(BM_ParsePageFullOfSchedSwitchGeneric);
+
+// Compares parsing the same page for state.range(0) concurrent sessions with
+// one ParsePage() per session (Separate) and with ParsePageForTargets()
+// (Shared), which decodes each event only once.
+static void BM_ParsePageForSessions(benchmark::State& state, bool shared) {
+  const ExamplePage* test_case = &g_full_page_sched_switch;
+  const size_t num_sessions = static_cast<size_t>(state.range(0));
+
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+
+  EventFilter filter;
+  filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+
+  std::vector<std::unique_ptr<ScatteredStreamWriterNullDelegate>> delegates;
+  std::vector<std::unique_ptr<ScatteredStreamWriter>> streams;
+  std::vector<FtraceEventBundle> writers(num_sessions);
+  std::vector<FtraceMetadata> metadata(num_sessions);
+  std::vector<CpuReader::ParseTarget> targets;
+  for (size_t i = 0; i < num_sessions; i++) {
+    delegates.emplace_back(
+        new ScatteredStreamWriterNullDelegate(perfetto::base::kPageSize));
+    streams.emplace_back(new ScatteredStreamWriter(delegates.back().get()));
+    targets.push_back({&filter, &writers[i], &metadata[i], nullptr});
+  }
+
+  CpuReader::ParsedPage parsed_page;
+  while (state.KeepRunning()) {
+    for (size_t i = 0; i < num_sessions; i++)
+      writers[i].Reset(streams[i].get());
+    if (shared) {
+      CpuReader::ParsePageForTargets(page.get(), targets, table, &parsed_page);
+    } else {
+      for (const CpuReader::ParseTarget& target : targets) {
+        CpuReader::ParsePage(page.get(), target.filter, target.bundle, table,
+                             target.metadata);
+      }
+    }
+    for (size_t i = 0; i < num_sessions; i++)
+      metadata[i].Clear();
+  }
+}
+
+static void BM_ParsePageForSessionsSeparate(benchmark::State& state) {
+  BM_ParsePageForSessions(state, false);
+}
+BENCHMARK(BM_ParsePageForSessionsSeparate)->DenseRange(1, 4);
+
+static void BM_ParsePageForSessionsShared(benchmark::State& state) {
+  BM_ParsePageForSessions(state, true);
+}
+BENCHMARK(BM_ParsePageForSessionsShared)->DenseRange(1, 4);
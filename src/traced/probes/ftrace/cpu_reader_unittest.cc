@@ -18,9 +18,12 @@
 
 #include <sys/stat.h>
 
+#include <set>
+
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "src/traced/probes/ftrace/event_info.h"
+#include "src/traced/probes/ftrace/ftrace_config_muxer.h"
 #include "src/traced/probes/ftrace/proto_translation_table.h"
 
 #include "perfetto/base/build_config.h"
@@ -1778,4 +1781,411 @@ TEST(CpuReaderTest, ParseExt4WithOverwrite) {
   EXPECT_EQ(metadata.overwrite_count, 192ul);
 }
 
+// The per-event decoders must encode the same bundle as the generic parsing.
+TEST(CpuReaderTest, EventDecodersMatchGenericParsing) {
+  const ExamplePage* test_cases[] = {&g_three_prints, &g_six_sched_switch,
+                                     &g_full_page_sched_switch,
+                                     &g_single_print_malformed};
+  for (const ExamplePage* test_case : test_cases) {
+    ProtoTranslationTable* table = GetTable(test_case->name);
+    auto page = PageFromXxd(test_case->data);
+
+    EventFilter filter;
+    for (const GroupAndName& event : {GroupAndName("ftrace", "print"),
+                                      GroupAndName("sched", "sched_switch")}) {
+      size_t id = table->EventToFtraceId(event);
+      ASSERT_TRUE(table->GetEventDecoderById(id));
+      filter.AddEnabledEvent(id);
+    }
+
+    std::string bundles[2];
+    FtraceMetadata metadata[2];
+    size_t bytes[2];
+    for (int generic = 0; generic < 2; generic++) {
+      table->SetEventDecodersEnabledForTesting(!generic);
+      BundleProvider bundle_provider(base::kPageSize);
+      bytes[generic] =
+          CpuReader::ParsePage(page.get(), &filter, bundle_provider.writer(),
+                               table, &metadata[generic]);
+      auto bundle = bundle_provider.ParseProto();
+      ASSERT_TRUE(bundle);
+      bundles[generic] = bundle->SerializeAsString();
+    }
+    table->SetEventDecodersEnabledForTesting(true);
+
+    EXPECT_EQ(bytes[1], bytes[0]);
+    EXPECT_EQ(bundles[1], bundles[0]);
+    EXPECT_EQ(metadata[1].pids, metadata[0].pids);
+  }
+}
+
+// Parsing a page once for several targets must give each of them exactly what
+// a separate ParsePage() with its own filter would.
+TEST(CpuReaderTest, ParsePageForTargetsMatchesParsePage) {
+  const ExamplePage* test_case = &g_full_page_ext4;
+  // The page was captured on this device, rather than being synthetic.
+  ProtoTranslationTable* table =
+      GetTable("android_walleye_OPM5.171019.017.A1_4.4.88");
+  auto page = PageFromXxd(test_case->data);
+
+  auto ext4_id = [table](const char* name) {
+    return table->EventToFtraceId(GroupAndName("ext4", name));
+  };
+  const std::vector<std::vector<size_t>> filter_ids = {
+      {ext4_id("ext4_journal_start"), ext4_id("ext4_mark_inode_dirty"),
+       ext4_id("ext4_da_write_begin"), ext4_id("ext4_da_write_end")},
+      {ext4_id("ext4_mark_inode_dirty")},
+      {ext4_id("ext4_journal_start"), ext4_id("ext4_mark_inode_dirty"),
+       ext4_id("ext4_da_write_begin"), ext4_id("ext4_da_write_end")},
+      {ext4_id("ext4_da_write_end"), ext4_id("ext4_sync_file_enter")},
+      {},
+  };
+  const size_t kNumTargets = filter_ids.size();
+
+  std::vector<EventFilter> filters(kNumTargets);
+  std::vector<std::unique_ptr<BundleProvider>> providers;
+  std::vector<FtraceMetadata> metadata(kNumTargets);
+  std::vector<CpuReader::ParseTarget> targets;
+  for (size_t i = 0; i < kNumTargets; i++) {
+    for (size_t id : filter_ids[i]) {
+      ASSERT_TRUE(id);
+      filters[i].AddEnabledEvent(id);
+    }
+    providers.emplace_back(new BundleProvider(base::kPageSize));
+    targets.push_back(
+        {&filters[i], providers[i]->writer(), &metadata[i], nullptr});
+  }
+
+  // Run it twice, to cover the reuse of the ParsedPage.
+  CpuReader::ParsedPage parsed_page;
+  for (int repeat = 0; repeat < 2; repeat++) {
+    for (size_t i = 0; i < kNumTargets; i++)
+      metadata[i].Clear();
+    ASSERT_TRUE(CpuReader::ParsePageForTargets(page.get(), targets, table,
+                                               &parsed_page));
+  }
+
+  for (size_t i = 0; i < kNumTargets; i++) {
+    BundleProvider expected_provider(base::kPageSize);
+    FtraceMetadata expected_metadata{};
+    ASSERT_TRUE(CpuReader::ParsePage(page.get(), &filters[i],
+                                     expected_provider.writer(), table,
+                                     &expected_metadata));
+    auto expected = expected_provider.ParseProto();
+    ASSERT_TRUE(expected);
+    EXPECT_EQ(filter_ids[i].empty(), expected->event().size() == 0);
+
+    // The bundles of the targets contain the events of both repeats.
+    auto actual = providers[i]->ParseProto();
+    ASSERT_TRUE(actual);
+    ASSERT_EQ(2 * expected->event().size(), actual->event().size());
+    for (int j = 0; j < expected->event().size(); j++) {
+      EXPECT_EQ(expected->event(j).SerializeAsString(),
+                actual->event(j).SerializeAsString());
+    }
+
+    EXPECT_EQ(expected_metadata.overwrite_count, metadata[i].overwrite_count);
+    EXPECT_EQ(expected_metadata.pids, metadata[i].pids);
+    EXPECT_EQ(expected_metadata.inode_and_device,
+              metadata[i].inode_and_device);
+  }
+  EXPECT_FALSE(metadata[0].pids.empty());
+  EXPECT_FALSE(metadata[0].inode_and_device.empty());
+  EXPECT_EQ(0, providers[kNumTargets - 1]->ParseProto()->event().size());
+}
+
+// The compact encoding must carry the same sched_switch data as the
+// FtraceEvent(s), once the deltas and the interning are undone.
+TEST(CpuReaderTest, ParseFullPageSchedSwitchCompact) {
+  const ExamplePage* test_case = &g_full_page_sched_switch;
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+
+  EventFilter filter;
+  filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+
+  BundleProvider full_provider(base::kPageSize);
+  FtraceMetadata full_metadata{};
+  ASSERT_TRUE(CpuReader::ParsePage(page.get(), &filter, full_provider.writer(),
+                                   table, &full_metadata));
+  BundleProvider compact_provider(base::kPageSize);
+  FtraceMetadata compact_metadata{};
+  CompactSchedBuffer compact_buffer;
+  ASSERT_TRUE(CpuReader::ParsePage(page.get(), &filter,
+                                   compact_provider.writer(), table,
+                                   &compact_metadata, &compact_buffer));
+  EXPECT_TRUE(compact_buffer.empty());
+
+  auto full = full_provider.ParseProto();
+  auto compact = compact_provider.ParseProto();
+  ASSERT_TRUE(full);
+  ASSERT_TRUE(compact);
+  EXPECT_EQ(0, compact->event_size());
+  ASSERT_TRUE(compact->has_compact_sched());
+  const auto& compact_sched = compact->compact_sched();
+  const int num_events = full->event_size();
+  ASSERT_EQ(59, num_events);
+  ASSERT_EQ(num_events, compact_sched.switch_timestamp_size());
+  ASSERT_EQ(num_events, compact_sched.switch_prev_state_size());
+  ASSERT_EQ(num_events, compact_sched.switch_next_pid_size());
+  ASSERT_EQ(num_events, compact_sched.switch_next_prio_size());
+  ASSERT_EQ(num_events, compact_sched.switch_next_comm_index_size());
+  EXPECT_EQ(0, compact_sched.waking_timestamp_size());
+  EXPECT_LT(compact_sched.intern_table_size(), num_events);
+  EXPECT_EQ(full->event(0).sched_switch().prev_pid(),
+            compact_sched.running_pid());
+
+  uint64_t timestamp = 0;
+  for (int i = 0; i < num_events; i++) {
+    const auto& sched_switch = full->event(i).sched_switch();
+    timestamp += compact_sched.switch_timestamp(i);
+    EXPECT_EQ(full->event(i).timestamp(), timestamp);
+    EXPECT_EQ(sched_switch.prev_state(), compact_sched.switch_prev_state(i));
+    EXPECT_EQ(sched_switch.next_pid(), compact_sched.switch_next_pid(i));
+    EXPECT_EQ(sched_switch.next_prio(), compact_sched.switch_next_prio(i));
+    uint32_t comm_index = compact_sched.switch_next_comm_index(i);
+    ASSERT_LT(comm_index,
+              static_cast<uint32_t>(compact_sched.intern_table_size()));
+    EXPECT_EQ(sched_switch.next_comm(),
+              compact_sched.intern_table(static_cast<int>(comm_index)));
+  }
+
+  // The whole point of it.
+  EXPECT_LT(compact->ByteSize() * 3, full->ByteSize());
+
+  EXPECT_EQ(std::set<int32_t>(full_metadata.pids.begin(),
+                              full_metadata.pids.end()),
+            std::set<int32_t>(compact_metadata.pids.begin(),
+                              compact_metadata.pids.end()));
+}
+
+// A page with a sched_waking followed by the sched_switch to the woken task,
+// with the layout of android_walleye_OPM5.171019.017.A1_4.4.88.
+std::unique_ptr<uint8_t[]> MakeSchedWakingAndSwitchPage() {
+  BinaryWriter writer;
+  writer.Write<uint64_t>(1000);  // Page timestamp.
+  writer.Write<uint64_t>(112);   // Commit: size of the two events.
+
+  writer.Write<uint32_t>(10 | (5 << 5));  // 40 bytes, 5ns after the page.
+  writer.Write<uint16_t>(44);             // sched_waking.
+  writer.Write<uint16_t>(0);              // Flags and preempt count.
+  writer.Write<int32_t>(100);             // common_pid.
+  writer.WriteFixedString(16, "wakee");
+  writer.Write<int32_t>(200);  // pid.
+  writer.Write<int32_t>(120);  // prio.
+  writer.Write<int32_t>(1);    // success.
+  writer.Write<int32_t>(3);    // target_cpu.
+
+  writer.Write<uint32_t>(16 | (7 << 5));  // 64 bytes, 7ns after the waking.
+  writer.Write<uint16_t>(47);             // sched_switch.
+  writer.Write<uint16_t>(0);
+  writer.Write<int32_t>(100);
+  writer.WriteFixedString(16, "waker");
+  writer.Write<int32_t>(100);  // prev_pid.
+  writer.Write<int32_t>(110);  // prev_prio.
+  writer.Write<int64_t>(1);    // prev_state.
+  writer.WriteFixedString(16, "wakee");
+  writer.Write<int32_t>(200);  // next_pid.
+  writer.Write<int32_t>(120);  // next_prio.
+
+  std::unique_ptr<uint8_t[]> page(new uint8_t[base::kPageSize]());
+  memcpy(page.get(), writer.GetCopy().get(), writer.written());
+  return page;
+}
+
+TEST(CpuReaderTest, ParsePageForTargetsCompactSched) {
+  ProtoTranslationTable* table =
+      GetTable("android_walleye_OPM5.171019.017.A1_4.4.88");
+  auto page = MakeSchedWakingAndSwitchPage();
+
+  EventFilter filter;
+  filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_waking")));
+  filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+
+  // One target with the compact encoding and one without.
+  BundleProvider compact_provider(base::kPageSize);
+  BundleProvider full_provider(base::kPageSize);
+  FtraceMetadata metadata[2];
+  CompactSchedBuffer compact_buffer;
+  std::vector<CpuReader::ParseTarget> targets;
+  targets.push_back(
+      {&filter, compact_provider.writer(), &metadata[0], &compact_buffer});
+  targets.push_back({&filter, full_provider.writer(), &metadata[1], nullptr});
+  CpuReader::ParsedPage parsed_page;
+  ASSERT_TRUE(
+      CpuReader::ParsePageForTargets(page.get(), targets, table, &parsed_page));
+
+  auto full = full_provider.ParseProto();
+  ASSERT_TRUE(full);
+  ASSERT_EQ(2, full->event_size());
+  EXPECT_EQ(1005u, full->event(0).timestamp());
+  EXPECT_EQ(200, full->event(0).sched_waking().pid());
+  EXPECT_EQ(1012u, full->event(1).timestamp());
+  EXPECT_EQ("wakee", full->event(1).sched_switch().next_comm());
+  EXPECT_FALSE(full->has_compact_sched());
+
+  auto compact = compact_provider.ParseProto();
+  ASSERT_TRUE(compact);
+  EXPECT_EQ(0, compact->event_size());
+  const auto& compact_sched = compact->compact_sched();
+  ASSERT_EQ(1, compact_sched.intern_table_size());
+  EXPECT_EQ("wakee", compact_sched.intern_table(0));
+  EXPECT_EQ(100, compact_sched.running_pid());
+
+  ASSERT_EQ(1, compact_sched.waking_timestamp_size());
+  EXPECT_EQ(1005u, compact_sched.waking_timestamp(0));
+  EXPECT_EQ(200, compact_sched.waking_pid(0));
+  EXPECT_EQ(3, compact_sched.waking_target_cpu(0));
+  EXPECT_EQ(120, compact_sched.waking_prio(0));
+  EXPECT_EQ(0u, compact_sched.waking_comm_index(0));
+
+  ASSERT_EQ(1, compact_sched.switch_timestamp_size());
+  EXPECT_EQ(1012u, compact_sched.switch_timestamp(0));
+  EXPECT_EQ(1, compact_sched.switch_prev_state(0));
+  EXPECT_EQ(200, compact_sched.switch_next_pid(0));
+  EXPECT_EQ(120, compact_sched.switch_next_prio(0));
+  EXPECT_EQ(0u, compact_sched.switch_next_comm_index(0));
+
+  EXPECT_THAT(metadata[0].pids, ElementsAre(100, 200, 100, 200));
+}
+
+TEST(CpuReaderTest, ParsePageForTargetsUserspaceFilter) {
+  const ExamplePage* test_case = &g_full_page_sched_switch;
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+  size_t sched_switch_id =
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch"));
+
+  EventFilter filter;
+  filter.AddEnabledEvent(sched_switch_id);
+  BundleProvider all_provider(base::kPageSize);
+  FtraceMetadata all_metadata{};
+  ASSERT_TRUE(CpuReader::ParsePage(page.get(), &filter, all_provider.writer(),
+                                   table, &all_metadata));
+  auto all = all_provider.ParseProto();
+  ASSERT_TRUE(all);
+  ASSERT_GT(all->event_size(), 1);
+  const uint32_t pid = all->event(0).pid();
+
+  // Only the events emitted by |pid| pass the userspace filter.
+  EventFilter pid_filter;
+  pid_filter.AddEnabledEvent(sched_switch_id);
+  std::unique_ptr<UserspaceFilter> userspace_filter(new UserspaceFilter());
+  for (const Field& field : table->common_fields()) {
+    if (field.ftrace_type == kFtraceCommonPid32)
+      userspace_filter->SetPids({static_cast<int32_t>(pid)},
+                                field.ftrace_offset);
+  }
+  pid_filter.set_userspace_filter(std::move(userspace_filter));
+
+  BundleProvider unfiltered_provider(base::kPageSize);
+  BundleProvider filtered_provider(base::kPageSize);
+  FtraceMetadata metadata[2];
+  std::vector<CpuReader::ParseTarget> targets;
+  targets.push_back(
+      {&filter, unfiltered_provider.writer(), &metadata[0], nullptr});
+  targets.push_back(
+      {&pid_filter, filtered_provider.writer(), &metadata[1], nullptr});
+  CpuReader::ParsedPage parsed_page;
+  ASSERT_TRUE(
+      CpuReader::ParsePageForTargets(page.get(), targets, table, &parsed_page));
+
+  auto unfiltered = unfiltered_provider.ParseProto();
+  ASSERT_TRUE(unfiltered);
+  EXPECT_EQ(all->event_size(), unfiltered->event_size());
+
+  auto filtered = filtered_provider.ParseProto();
+  ASSERT_TRUE(filtered);
+  int expected_size = 0;
+  for (const auto& event : all->event())
+    expected_size += event.pid() == pid;
+  EXPECT_LT(expected_size, all->event_size());
+  ASSERT_EQ(expected_size, filtered->event_size());
+  for (const auto& event : filtered->event())
+    EXPECT_EQ(pid, event.pid());
+}
+
+// Compact sched can't encode the prev_pid of sched_switch events that follow
+// filtered out ones, so the muxer only keeps it for unfiltered configs.
+TEST(CpuReaderTest, PidFilterDisablesCompactSched) {
+  const ExamplePage* test_case = &g_full_page_sched_switch;
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+  size_t sched_switch_id =
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch"));
+
+  EventFilter filter;
+  filter.AddEnabledEvent(sched_switch_id);
+  BundleProvider all_provider(base::kPageSize);
+  FtraceMetadata all_metadata{};
+  ASSERT_TRUE(CpuReader::ParsePage(page.get(), &filter, all_provider.writer(),
+                                   table, &all_metadata));
+  auto all = all_provider.ParseProto();
+  ASSERT_TRUE(all);
+  ASSERT_GT(all->event_size(), 1);
+  const int32_t pid = static_cast<int32_t>(all->event(0).pid());
+
+  NiceMock<MockFtraceProcfs> ftrace;
+  FtraceConfigMuxer muxer(&ftrace, table);
+  FtraceConfig config;
+  *config.add_ftrace_events() = "sched/sched_switch";
+  config.set_compact_sched(true);
+  FtraceConfigId unfiltered_id = muxer.SetupConfig(config);
+  *config.add_event_pids() = pid;
+  FtraceConfigId filtered_id = muxer.SetupConfig(config);
+  ASSERT_TRUE(unfiltered_id);
+  ASSERT_TRUE(filtered_id);
+
+  const EventFilter* unfiltered = muxer.GetEventFilter(unfiltered_id);
+  const EventFilter* filtered = muxer.GetEventFilter(filtered_id);
+  EXPECT_TRUE(unfiltered->compact_sched());
+  EXPECT_TRUE(muxer.GetConfigForTesting(unfiltered_id)->compact_sched());
+  EXPECT_FALSE(filtered->compact_sched());
+  EXPECT_FALSE(muxer.GetConfigForTesting(filtered_id)->compact_sched());
+  // The kernel traces all the pids for the unfiltered config.
+  ASSERT_TRUE(filtered->userspace_filter());
+
+  // What CpuReader::Sink does with the filters of the muxer.
+  BundleProvider compact_provider(base::kPageSize);
+  BundleProvider full_provider(base::kPageSize);
+  FtraceMetadata metadata[2];
+  CompactSchedBuffer compact_buffer;
+  std::vector<CpuReader::ParseTarget> targets;
+  targets.push_back({unfiltered, compact_provider.writer(), &metadata[0],
+                     unfiltered->compact_sched() ? &compact_buffer : nullptr});
+  targets.push_back({filtered, full_provider.writer(), &metadata[1],
+                     filtered->compact_sched() ? &compact_buffer : nullptr});
+  CpuReader::ParsedPage parsed_page;
+  ASSERT_TRUE(
+      CpuReader::ParsePageForTargets(page.get(), targets, table, &parsed_page));
+
+  auto compact = compact_provider.ParseProto();
+  ASSERT_TRUE(compact);
+  EXPECT_EQ(0, compact->event_size());
+  EXPECT_EQ(all->event_size(),
+            compact->compact_sched().switch_timestamp_size());
+
+  // The filtered config gets the matching events in full, with their real
+  // prev_pid rather than one inferred from the previous kept event.
+  std::vector<std::pair<uint64_t, int32_t>> expected;
+  for (const auto& event : all->event()) {
+    const auto& sched_switch = event.sched_switch();
+    if (static_cast<int32_t>(event.pid()) == pid ||
+        sched_switch.prev_pid() == pid || sched_switch.next_pid() == pid) {
+      expected.emplace_back(event.timestamp(), sched_switch.prev_pid());
+    }
+  }
+  auto full = full_provider.ParseProto();
+  ASSERT_TRUE(full);
+  EXPECT_FALSE(full->has_compact_sched());
+  std::vector<std::pair<uint64_t, int32_t>> actual;
+  for (const auto& event : full->event())
+    actual.emplace_back(event.timestamp(), event.sched_switch().prev_pid());
+  EXPECT_LT(expected.size(), static_cast<size_t>(all->event_size()));
+  EXPECT_EQ(expected, actual);
+}
+
 }  // namespace perfetto
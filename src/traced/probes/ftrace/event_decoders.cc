@@ -0,0 +1,363 @@
+// Autogenerated by:
+// ../../tools/ftrace_proto_gen/ftrace_decoder_gen.cc
+// Do not edit.
+
+#include "src/traced/probes/ftrace/event_decoders.h"
+
+#include "perfetto/protozero/message.h"
+#include "src/traced/probes/ftrace/cpu_reader.h"
+#include "src/traced/probes/ftrace/ftrace_metadata.h"
+
+namespace perfetto {
+
+namespace {
+
+// ftrace/print as in:
+//   android_flounder_lte_LRX16F_3.10.40
+//   android_walleye_OPM5.171019.017.A1_4.4.88
+//   synthetic
+bool DecodePrint0(const uint8_t* start,
+                  const uint8_t* end,
+                  protozero::Message* message,
+                  FtraceMetadata* /*metadata*/) {
+  bool success = true;
+  CpuReader::ReadIntoVarInt<1, uint64_t>(start + 8, message);
+  success &= CpuReader::ReadIntoString(start + 16, end, 2, message);
+  return success;
+}
+
+// ftrace/print as in:
+//   android_hammerhead_MRA59G_3.4.0
+bool DecodePrint1(const uint8_t* start,
+                  const uint8_t* end,
+                  protozero::Message* message,
+                  FtraceMetadata* /*metadata*/) {
+  bool success = true;
+  CpuReader::ReadIntoVarInt<1, uint32_t>(start + 12, message);
+  success &= CpuReader::ReadIntoString(start + 16, end, 2, message);
+  return success;
+}
+
+// ftrace/print as in:
+//   android_seed_N2F62_3.10.49
+bool DecodePrint2(const uint8_t* start,
+                  const uint8_t* end,
+                  protozero::Message* message,
+                  FtraceMetadata* /*metadata*/) {
+  bool success = true;
+  CpuReader::ReadIntoVarInt<1, uint32_t>(start + 8, message);
+  success &= CpuReader::ReadIntoString(start + 12, end, 2, message);
+  return success;
+}
+
+// sched/sched_switch as in:
+//   android_flounder_lte_LRX16F_3.10.40
+//   android_walleye_OPM5.171019.017.A1_4.4.88
+//   synthetic
+bool DecodeSchedSwitch0(const uint8_t* start,
+                        const uint8_t* /*end*/,
+                        protozero::Message* message,
+                        FtraceMetadata* metadata) {
+  bool success = true;
+  success &= CpuReader::ReadIntoString(start + 8, start + 24, 1, message);
+  CpuReader::ReadPid<2>(start + 24, message, metadata);
+  CpuReader::ReadIntoVarInt<3, int32_t>(start + 28, message);
+  CpuReader::ReadIntoVarInt<4, int64_t>(start + 32, message);
+  success &= CpuReader::ReadIntoString(start + 40, start + 56, 5, message);
+  CpuReader::ReadPid<6>(start + 56, message, metadata);
+  CpuReader::ReadIntoVarInt<7, int32_t>(start + 60, message);
+  return success;
+}
+
+// sched/sched_switch as in:
+//   android_hammerhead_MRA59G_3.4.0
+bool DecodeSchedSwitch1(const uint8_t* start,
+                        const uint8_t* /*end*/,
+                        protozero::Message* message,
+                        FtraceMetadata* metadata) {
+  bool success = true;
+  success &= CpuReader::ReadIntoString(start + 12, start + 28, 1, message);
+  CpuReader::ReadPid<2>(start + 28, message, metadata);
+  CpuReader::ReadIntoVarInt<3, int32_t>(start + 32, message);
+  CpuReader::ReadIntoVarInt<4, int32_t>(start + 36, message);
+  success &= CpuReader::ReadIntoString(start + 40, start + 56, 5, message);
+  CpuReader::ReadPid<6>(start + 56, message, metadata);
+  CpuReader::ReadIntoVarInt<7, int32_t>(start + 60, message);
+  return success;
+}
+
+// sched/sched_switch as in:
+//   android_seed_N2F62_3.10.49
+bool DecodeSchedSwitch2(const uint8_t* start,
+                        const uint8_t* /*end*/,
+                        protozero::Message* message,
+                        FtraceMetadata* metadata) {
+  bool success = true;
+  success &= CpuReader::ReadIntoString(start + 8, start + 24, 1, message);
+  CpuReader::ReadPid<2>(start + 24, message, metadata);
+  CpuReader::ReadIntoVarInt<3, int32_t>(start + 28, message);
+  CpuReader::ReadIntoVarInt<4, int32_t>(start + 32, message);
+  success &= CpuReader::ReadIntoString(start + 36, start + 52, 5, message);
+  CpuReader::ReadPid<6>(start + 52, message, metadata);
+  CpuReader::ReadIntoVarInt<7, int32_t>(start + 56, message);
+  return success;
+}
+
+// sched/sched_wakeup as in:
+//   android_flounder_lte_LRX16F_3.10.40
+//   android_seed_N2F62_3.10.49
+//   android_walleye_OPM5.171019.017.A1_4.4.88
+bool DecodeSchedWakeup0(const uint8_t* start,
+                        const uint8_t* /*end*/,
+                        protozero::Message* message,
+                        FtraceMetadata* metadata) {
+  bool success = true;
+  success &= CpuReader::ReadIntoString(start + 8, start + 24, 1, message);
+  CpuReader::ReadPid<2>(start + 24, message, metadata);
+  CpuReader::ReadIntoVarInt<3, int32_t>(start + 28, message);
+  CpuReader::ReadIntoVarInt<4, int32_t>(start + 32, message);
+  CpuReader::ReadIntoVarInt<5, int32_t>(start + 36, message);
+  return success;
+}
+
+// sched/sched_wakeup as in:
+//   android_hammerhead_MRA59G_3.4.0
+bool DecodeSchedWakeup1(const uint8_t* start,
+                        const uint8_t* /*end*/,
+                        protozero::Message* message,
+                        FtraceMetadata* metadata) {
+  bool success = true;
+  success &= CpuReader::ReadIntoString(start + 12, start + 28, 1, message);
+  CpuReader::ReadPid<2>(start + 28, message, metadata);
+  CpuReader::ReadIntoVarInt<3, int32_t>(start + 32, message);
+  CpuReader::ReadIntoVarInt<4, int32_t>(start + 36, message);
+  CpuReader::ReadIntoVarInt<5, int32_t>(start + 40, message);
+  return success;
+}
+
+// sched/sched_waking as in:
+//   android_walleye_OPM5.171019.017.A1_4.4.88
+bool DecodeSchedWaking0(const uint8_t* start,
+                        const uint8_t* /*end*/,
+                        protozero::Message* message,
+                        FtraceMetadata* metadata) {
+  bool success = true;
+  success &= CpuReader::ReadIntoString(start + 8, start + 24, 1, message);
+  CpuReader::ReadPid<2>(start + 24, message, metadata);
+  CpuReader::ReadIntoVarInt<3, int32_t>(start + 28, message);
+  CpuReader::ReadIntoVarInt<4, int32_t>(start + 32, message);
+  CpuReader::ReadIntoVarInt<5, int32_t>(start + 36, message);
+  return success;
+}
+
+// power/cpu_frequency as in:
+//   android_flounder_lte_LRX16F_3.10.40
+//   android_seed_N2F62_3.10.49
+//   android_walleye_OPM5.171019.017.A1_4.4.88
+bool DecodeCpuFrequency0(const uint8_t* start,
+                         const uint8_t* /*end*/,
+                         protozero::Message* message,
+                         FtraceMetadata* /*metadata*/) {
+  CpuReader::ReadIntoVarInt<1, uint32_t>(start + 8, message);
+  CpuReader::ReadIntoVarInt<2, uint32_t>(start + 12, message);
+  return true;
+}
+
+// power/cpu_frequency as in:
+//   android_hammerhead_MRA59G_3.4.0
+bool DecodeCpuFrequency1(const uint8_t* start,
+                         const uint8_t* /*end*/,
+                         protozero::Message* message,
+                         FtraceMetadata* /*metadata*/) {
+  CpuReader::ReadIntoVarInt<1, uint32_t>(start + 12, message);
+  CpuReader::ReadIntoVarInt<2, uint32_t>(start + 16, message);
+  return true;
+}
+
+// power/cpu_idle as in:
+//   android_flounder_lte_LRX16F_3.10.40
+//   android_seed_N2F62_3.10.49
+//   android_walleye_OPM5.171019.017.A1_4.4.88
+bool DecodeCpuIdle0(const uint8_t* start,
+                    const uint8_t* /*end*/,
+                    protozero::Message* message,
+                    FtraceMetadata* /*metadata*/) {
+  CpuReader::ReadIntoVarInt<1, uint32_t>(start + 8, message);
+  CpuReader::ReadIntoVarInt<2, uint32_t>(start + 12, message);
+  return true;
+}
+
+// power/cpu_idle as in:
+//   android_hammerhead_MRA59G_3.4.0
+bool DecodeCpuIdle1(const uint8_t* start,
+                    const uint8_t* /*end*/,
+                    protozero::Message* message,
+                    FtraceMetadata* /*metadata*/) {
+  CpuReader::ReadIntoVarInt<1, uint32_t>(start + 12, message);
+  CpuReader::ReadIntoVarInt<2, uint32_t>(start + 16, message);
+  return true;
+}
+
+}  // namespace
+
+std::vector<EventDecoder> GetStaticEventDecoders() {
+  std::vector<EventDecoder> decoders;
+
+  {
+    decoders.emplace_back(EventDecoder{});
+    EventDecoder* decoder = &decoders.back();
+    decoder->group = "ftrace";
+    decoder->name = "print";
+    decoder->fields.push_back({1, 8, 8, kUint64ToUint64});
+    decoder->fields.push_back({2, 16, 0, kCStringToString});
+    decoder->decode = &DecodePrint0;
+  }
+
+  {
+    decoders.emplace_back(EventDecoder{});
+    EventDecoder* decoder = &decoders.back();
+    decoder->group = "ftrace";
+    decoder->name = "print";
+    decoder->fields.push_back({1, 12, 4, kUint32ToUint64});
+    decoder->fields.push_back({2, 16, 0, kCStringToString});
+    decoder->decode = &DecodePrint1;
+  }
+
+  {
+    decoders.emplace_back(EventDecoder{});
+    EventDecoder* decoder = &decoders.back();
+    decoder->group = "ftrace";
+    decoder->name = "print";
+    decoder->fields.push_back({1, 8, 4, kUint32ToUint64});
+    decoder->fields.push_back({2, 12, 0, kCStringToString});
+    decoder->decode = &DecodePrint2;
+  }
+
+  {
+    decoders.emplace_back(EventDecoder{});
+    EventDecoder* decoder = &decoders.back();
+    decoder->group = "sched";
+    decoder->name = "sched_switch";
+    decoder->fields.push_back({1, 8, 16, kFixedCStringToString});
+    decoder->fields.push_back({2, 24, 4, kPid32ToInt32});
+    decoder->fields.push_back({3, 28, 4, kInt32ToInt32});
+    decoder->fields.push_back({4, 32, 8, kInt64ToInt64});
+    decoder->fields.push_back({5, 40, 16, kFixedCStringToString});
+    decoder->fields.push_back({6, 56, 4, kPid32ToInt32});
+    decoder->fields.push_back({7, 60, 4, kInt32ToInt32});
+    decoder->decode = &DecodeSchedSwitch0;
+  }
+
+  {
+    decoders.emplace_back(EventDecoder{});
+    EventDecoder* decoder = &decoders.back();
+    decoder->group = "sched";
+    decoder->name = "sched_switch";
+    decoder->fields.push_back({1, 12, 16, kFixedCStringToString});
+    decoder->fields.push_back({2, 28, 4, kPid32ToInt32});
+    decoder->fields.push_back({3, 32, 4, kInt32ToInt32});
+    decoder->fields.push_back({4, 36, 4, kInt32ToInt64});
+    decoder->fields.push_back({5, 40, 16, kFixedCStringToString});
+    decoder->fields.push_back({6, 56, 4, kPid32ToInt32});
+    decoder->fields.push_back({7, 60, 4, kInt32ToInt32});
+    decoder->decode = &DecodeSchedSwitch1;
+  }
+
+  {
+    decoders.emplace_back(EventDecoder{});
+    EventDecoder* decoder = &decoders.back();
+    decoder->group = "sched";
+    decoder->name = "sched_switch";
+    decoder->fields.push_back({1, 8, 16, kFixedCStringToString});
+    decoder->fields.push_back({2, 24, 4, kPid32ToInt32});
+    decoder->fields.push_back({3, 28, 4, kInt32ToInt32});
+    decoder->fields.push_back({4, 32, 4, kInt32ToInt64});
+    decoder->fields.push_back({5, 36, 16, kFixedCStringToString});
+    decoder->fields.push_back({6, 52, 4, kPid32ToInt32});
+    decoder->fields.push_back({7, 56, 4, kInt32ToInt32});
+    decoder->decode = &DecodeSchedSwitch2;
+  }
+
+  {
+    decoders.emplace_back(EventDecoder{});
+    EventDecoder* decoder = &decoders.back();
+    decoder->group = "sched";
+    decoder->name = "sched_wakeup";
+    decoder->fields.push_back({1, 8, 16, kFixedCStringToString});
+    decoder->fields.push_back({2, 24, 4, kPid32ToInt32});
+    decoder->fields.push_back({3, 28, 4, kInt32ToInt32});
+    decoder->fields.push_back({4, 32, 4, kInt32ToInt32});
+    decoder->fields.push_back({5, 36, 4, kInt32ToInt32});
+    decoder->decode = &DecodeSchedWakeup0;
+  }
+
+  {
+    decoders.emplace_back(EventDecoder{});
+    EventDecoder* decoder = &decoders.back();
+    decoder->group = "sched";
+    decoder->name = "sched_wakeup";
+    decoder->fields.push_back({1, 12, 16, kFixedCStringToString});
+    decoder->fields.push_back({2, 28, 4, kPid32ToInt32});
+    decoder->fields.push_back({3, 32, 4, kInt32ToInt32});
+    decoder->fields.push_back({4, 36, 4, kInt32ToInt32});
+    decoder->fields.push_back({5, 40, 4, kInt32ToInt32});
+    decoder->decode = &DecodeSchedWakeup1;
+  }
+
+  {
+    decoders.emplace_back(EventDecoder{});
+    EventDecoder* decoder = &decoders.back();
+    decoder->group = "sched";
+    decoder->name = "sched_waking";
+    decoder->fields.push_back({1, 8, 16, kFixedCStringToString});
+    decoder->fields.push_back({2, 24, 4, kPid32ToInt32});
+    decoder->fields.push_back({3, 28, 4, kInt32ToInt32});
+    decoder->fields.push_back({4, 32, 4, kInt32ToInt32});
+    decoder->fields.push_back({5, 36, 4, kInt32ToInt32});
+    decoder->decode = &DecodeSchedWaking0;
+  }
+
+  {
+    decoders.emplace_back(EventDecoder{});
+    EventDecoder* decoder = &decoders.back();
+    decoder->group = "power";
+    decoder->name = "cpu_frequency";
+    decoder->fields.push_back({1, 8, 4, kUint32ToUint32});
+    decoder->fields.push_back({2, 12, 4, kUint32ToUint32});
+    decoder->decode = &DecodeCpuFrequency0;
+  }
+
+  {
+    decoders.emplace_back(EventDecoder{});
+    EventDecoder* decoder = &decoders.back();
+    decoder->group = "power";
+    decoder->name = "cpu_frequency";
+    decoder->fields.push_back({1, 12, 4, kUint32ToUint32});
+    decoder->fields.push_back({2, 16, 4, kUint32ToUint32});
+    decoder->decode = &DecodeCpuFrequency1;
+  }
+
+  {
+    decoders.emplace_back(EventDecoder{});
+    EventDecoder* decoder = &decoders.back();
+    decoder->group = "power";
+    decoder->name = "cpu_idle";
+    decoder->fields.push_back({1, 8, 4, kUint32ToUint32});
+    decoder->fields.push_back({2, 12, 4, kUint32ToUint32});
+    decoder->decode = &DecodeCpuIdle0;
+  }
+
+  {
+    decoders.emplace_back(EventDecoder{});
+    EventDecoder* decoder = &decoders.back();
+    decoder->group = "power";
+    decoder->name = "cpu_idle";
+    decoder->fields.push_back({1, 12, 4, kUint32ToUint32});
+    decoder->fields.push_back({2, 16, 4, kUint32ToUint32});
+    decoder->decode = &DecodeCpuIdle1;
+  }
+
+  return decoders;
+}
+
+}  // namespace perfetto
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FTRACE_EVENT_DECODERS_H_
+#define SRC_TRACED_PROBES_FTRACE_EVENT_DECODERS_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "src/traced/probes/ftrace/event_info_constants.h"
+
+namespace protozero {
+class Message;
+}  // namespace protozero
+
+namespace perfetto {
+
+class FtraceMetadata;
+
+// Writes the fields of the event at |start| into |message| (e.g. a
+// SchedSwitchFtraceEvent). |end| is the end of the buffer. Returns false if
+// any of the fields could not be read.
+using EventDecoderFunction = bool (*)(const uint8_t* start,
+                                      const uint8_t* end,
+                                      protozero::Message* message,
+                                      FtraceMetadata* metadata);
+
+// A straight-line decoder for one layout of an event, the equivalent of
+// calling CpuReader::ParseField() for each of the |fields| but without having
+// to look at the Field(s) at runtime.
+struct EventDecoder {
+  struct Field {
+    uint32_t proto_field_id;
+    uint16_t ftrace_offset;
+    uint16_t ftrace_size;
+    TranslationStrategy strategy;
+  };
+
+  const char* group;
+  const char* name;
+  // The layout the decoder was generated for, in the same order as the
+  // Event::fields of the ProtoTranslationTable.
+  std::vector<Field> fields;
+  EventDecoderFunction decode;
+};
+
+// Generated by tools/ftrace_proto_gen (see event_decoder_whitelist) from the
+// format files in src/traced/probes/ftrace/test/data. There is one decoder
+// for each distinct layout of an event found there. The ProtoTranslationTable
+// picks the one that matches the layout of the running kernel, if any.
+std::vector<EventDecoder> GetStaticEventDecoders();
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FTRACE_EVENT_DECODERS_H_
@@ -0,0 +1,487 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ftrace/event_field_filter.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/string_view.h"
+#include "src/traced/probes/ftrace/proto_translation_table.h"
+
+namespace perfetto {
+
+namespace {
+
+// The filters come from the consumer's config and are parsed and evaluated
+// recursively: these caps bound the recursion depth, so that a malicious or
+// broken config can't overflow the stack. They are well above what the kernel
+// accepts in practice.
+constexpr size_t kMaxNestingDepth = 32;  // Of "!" and "(".
+constexpr size_t kMaxNodes = 256;        // Bounds the height of the tree.
+
+struct Token {
+  enum Type { kEnd, kIdentifier, kNumber, kString, kOperator, kError };
+  Type type;
+  std::string text;
+};
+
+class Tokenizer {
+ public:
+  explicit Tokenizer(const std::string& input) : input_(input) {}
+
+  Token Next() {
+    while (pos_ < input_.size() && isspace(input_[pos_]))
+      pos_++;
+    if (pos_ >= input_.size())
+      return {Token::kEnd, ""};
+
+    const char c = input_[pos_];
+    const size_t begin = pos_;
+    if (isalpha(c) || c == '_') {
+      while (pos_ < input_.size() &&
+             (isalnum(input_[pos_]) || input_[pos_] == '_')) {
+        pos_++;
+      }
+      return {Token::kIdentifier, input_.substr(begin, pos_ - begin)};
+    }
+    if (isdigit(c) || (c == '-' && pos_ + 1 < input_.size() &&
+                       isdigit(input_[pos_ + 1]))) {
+      pos_++;
+      while (pos_ < input_.size() && isalnum(input_[pos_]))
+        pos_++;
+      return {Token::kNumber, input_.substr(begin, pos_ - begin)};
+    }
+    if (c == '"' || c == '\'') {
+      size_t close = input_.find(c, pos_ + 1);
+      if (close == std::string::npos)
+        return {Token::kError, ""};
+      pos_ = close + 1;
+      return {Token::kString, input_.substr(begin + 1, close - begin - 1)};
+    }
+    static const char* const kOperators[] = {"==", "!=", "<=", ">=", "&&",
+                                             "||", "<",  ">",  "(",  ")",
+                                             "!"};
+    for (const char* op : kOperators) {
+      size_t len = strlen(op);
+      if (input_.compare(pos_, len, op) == 0) {
+        pos_ += len;
+        return {Token::kOperator, op};
+      }
+    }
+    return {Token::kError, ""};
+  }
+
+ private:
+  const std::string& input_;
+  size_t pos_ = 0;
+};
+
+}  // namespace
+
+// Recursive descent parser for:
+//   or_expr   := and_expr ("||" and_expr)*
+//   and_expr  := unary ("&&" unary)*
+//   unary     := "!" unary | "(" or_expr ")" | field op value
+class EventFieldFilterParser {
+ public:
+  EventFieldFilterParser(const std::string& expression,
+                         const FtraceEvent& format,
+                         EventFieldFilter* filter)
+      : tokenizer_(expression), format_(format), filter_(filter) {
+    Advance();
+  }
+
+  bool Parse() {
+    size_t root;
+    if (!ParseOr(&root) || token_.type != Token::kEnd)
+      return false;
+    if (filter_->nodes_.size() > kMaxNodes)
+      return false;
+    filter_->root_ = root;
+    return true;
+  }
+
+ private:
+  using Node = EventFieldFilter::Node;
+
+  void Advance() { token_ = tokenizer_.Next(); }
+
+  bool IsOperator(const char* op) const {
+    return token_.type == Token::kOperator && token_.text == op;
+  }
+
+  size_t AddNode(Node node) {
+    filter_->nodes_.emplace_back(std::move(node));
+    return filter_->nodes_.size() - 1;
+  }
+
+  size_t AddBinaryNode(Node::Type type, size_t lhs, size_t rhs) {
+    Node node;
+    node.type = type;
+    node.lhs = lhs;
+    node.rhs = rhs;
+    return AddNode(std::move(node));
+  }
+
+  bool ParseOr(size_t* out) {
+    if (!ParseAnd(out))
+      return false;
+    while (IsOperator("||") && filter_->nodes_.size() <= kMaxNodes) {
+      Advance();
+      size_t rhs;
+      if (!ParseAnd(&rhs))
+        return false;
+      *out = AddBinaryNode(Node::kOr, *out, rhs);
+    }
+    return true;
+  }
+
+  bool ParseAnd(size_t* out) {
+    if (!ParseUnary(out))
+      return false;
+    while (IsOperator("&&") && filter_->nodes_.size() <= kMaxNodes) {
+      Advance();
+      size_t rhs;
+      if (!ParseUnary(&rhs))
+        return false;
+      *out = AddBinaryNode(Node::kAnd, *out, rhs);
+    }
+    return true;
+  }
+
+  bool ParseUnary(size_t* out) {
+    if (!IsOperator("!") && !IsOperator("("))
+      return ParseComparison(out);
+    if (depth_ == kMaxNestingDepth)
+      return false;
+    depth_++;
+    bool success;
+    if (IsOperator("!")) {
+      Advance();
+      size_t operand;
+      success = ParseUnary(&operand);
+      if (success)
+        *out = AddBinaryNode(Node::kNot, operand, 0);
+    } else {
+      Advance();
+      success = ParseOr(out) && IsOperator(")");
+      if (success)
+        Advance();
+    }
+    depth_--;
+    return success;
+  }
+
+  bool ParseComparison(size_t* out) {
+    if (token_.type != Token::kIdentifier)
+      return false;
+    Node node;
+    if (!LookupField(token_.text, &node))
+      return false;
+    Advance();
+
+    static const struct {
+      const char* text;
+      Node::Op op;
+    } kOps[] = {{"==", Node::kEq}, {"!=", Node::kNe}, {"<", Node::kLt},
+                {"<=", Node::kLe}, {">", Node::kGt},  {">=", Node::kGe}};
+    bool found_op = false;
+    for (const auto& op : kOps) {
+      if (IsOperator(op.text)) {
+        node.op = op.op;
+        found_op = true;
+        break;
+      }
+    }
+    if (!found_op)
+      return false;
+    Advance();
+
+    if (node.type == Node::kCompareString) {
+      // The kernel accepts unquoted strings too, e.g. "comm == bash".
+      if (node.op != Node::kEq && node.op != Node::kNe)
+        return false;
+      if (token_.type != Token::kString && token_.type != Token::kIdentifier)
+        return false;
+      node.string_value = token_.text;
+    } else {
+      if (token_.type != Token::kNumber)
+        return false;
+      const char* begin = token_.text.c_str();
+      char* end = nullptr;
+      if (node.field_kind == Node::kUnsigned && begin[0] != '-') {
+        node.int_value = static_cast<int64_t>(strtoull(begin, &end, 0));
+      } else {
+        node.int_value = static_cast<int64_t>(strtoll(begin, &end, 0));
+      }
+      if (*end != '\0')
+        return false;
+    }
+    Advance();
+    *out = AddNode(std::move(node));
+    return true;
+  }
+
+  bool LookupField(const std::string& name, Node* node) const {
+    for (const auto* fields : {&format_.common_fields, &format_.fields}) {
+      for (const FtraceEvent::Field& field : *fields) {
+        if (GetNameFromTypeAndName(field.type_and_name) != name)
+          continue;
+        return FieldToNode(field, node);
+      }
+    }
+    return false;
+  }
+
+  static bool FieldToNode(const FtraceEvent::Field& field, Node* node) {
+    FtraceFieldType type;
+    if (!InferFtraceType(field.type_and_name, field.size, field.is_signed,
+                         &type)) {
+      return false;
+    }
+    node->offset = field.offset;
+    node->size = field.size;
+    switch (type) {
+      case kFtraceFixedCString:
+        node->type = Node::kCompareString;
+        node->field_kind = Node::kFixedString;
+        return true;
+      case kFtraceDataLoc:
+        node->type = Node::kCompareString;
+        node->field_kind = Node::kDataLocString;
+        return field.size == sizeof(uint32_t);
+      case kFtraceCString:
+      case kFtraceStringPtr:
+        return false;
+      default:
+        break;
+    }
+    if (field.size != 1 && field.size != 2 && field.size != 4 &&
+        field.size != 8) {
+      return false;
+    }
+    node->type = Node::kCompareInt;
+    node->field_kind = field.is_signed ? Node::kSigned : Node::kUnsigned;
+    return true;
+  }
+
+  Tokenizer tokenizer_;
+  Token token_;
+  const FtraceEvent& format_;
+  EventFieldFilter* filter_;
+  size_t depth_ = 0;
+};
+
+namespace {
+
+uint64_t ReadUnsigned(const uint8_t* ptr, uint16_t size) {
+  switch (size) {
+    case 1:
+      return *ptr;
+    case 2: {
+      uint16_t value;
+      memcpy(&value, ptr, sizeof(value));
+      return value;
+    }
+    case 4: {
+      uint32_t value;
+      memcpy(&value, ptr, sizeof(value));
+      return value;
+    }
+    default: {
+      uint64_t value;
+      memcpy(&value, ptr, sizeof(value));
+      return value;
+    }
+  }
+}
+
+int64_t ReadSigned(const uint8_t* ptr, uint16_t size) {
+  uint64_t value = ReadUnsigned(ptr, size);
+  switch (size) {
+    case 1:
+      return static_cast<int8_t>(value);
+    case 2:
+      return static_cast<int16_t>(value);
+    case 4:
+      return static_cast<int32_t>(value);
+    default:
+      return static_cast<int64_t>(value);
+  }
+}
+
+}  // namespace
+
+// static
+std::unique_ptr<EventFieldFilter> EventFieldFilter::Create(
+    const std::string& expression,
+    const FtraceEvent& format) {
+  std::unique_ptr<EventFieldFilter> filter(new EventFieldFilter());
+  EventFieldFilterParser parser(expression, format, filter.get());
+  if (!parser.Parse())
+    return nullptr;
+  return filter;
+}
+
+EventFieldFilter::EventFieldFilter() = default;
+EventFieldFilter::~EventFieldFilter() = default;
+
+// static
+template <typename T>
+bool EventFieldFilter::Compare(Node::Op op, T lhs, T rhs) {
+  switch (op) {
+    case Node::kEq:
+      return lhs == rhs;
+    case Node::kNe:
+      return lhs != rhs;
+    case Node::kLt:
+      return lhs < rhs;
+    case Node::kLe:
+      return lhs <= rhs;
+    case Node::kGt:
+      return lhs > rhs;
+    case Node::kGe:
+      return lhs >= rhs;
+  }
+  return false;
+}
+
+bool EventFieldFilter::Matches(const uint8_t* start,
+                               const uint8_t* end) const {
+  return Evaluate(root_, start, end);
+}
+
+bool EventFieldFilter::Evaluate(size_t index,
+                                const uint8_t* start,
+                                const uint8_t* end) const {
+  const Node& node = nodes_[index];
+  switch (node.type) {
+    case Node::kAnd:
+      return Evaluate(node.lhs, start, end) && Evaluate(node.rhs, start, end);
+    case Node::kOr:
+      return Evaluate(node.lhs, start, end) || Evaluate(node.rhs, start, end);
+    case Node::kNot:
+      return !Evaluate(node.lhs, start, end);
+    case Node::kCompareInt:
+    case Node::kCompareString:
+      break;
+  }
+
+  const size_t length = static_cast<size_t>(end - start);
+  if (size_t{node.offset} + node.size > length)
+    return false;
+  const uint8_t* field = start + node.offset;
+
+  switch (node.field_kind) {
+    case Node::kSigned:
+      return Compare(node.op, ReadSigned(field, node.size), node.int_value);
+    case Node::kUnsigned:
+      return Compare(node.op, ReadUnsigned(field, node.size),
+                     static_cast<uint64_t>(node.int_value));
+    case Node::kFixedString:
+    case Node::kDataLocString:
+      break;
+  }
+
+  const char* str;
+  size_t max_len;
+  if (node.field_kind == Node::kFixedString) {
+    str = reinterpret_cast<const char*>(field);
+    max_len = node.size;
+  } else {
+    // See ReadDataLoc() in cpu_reader.cc.
+    uint32_t data_loc = static_cast<uint32_t>(ReadUnsigned(field, 4));
+    const auto offset = static_cast<uint16_t>(data_loc & 0xffff);
+    const auto len = static_cast<uint16_t>(data_loc >> 16);
+    if (size_t{offset} + len > length)
+      return false;
+    str = reinterpret_cast<const char*>(start + offset);
+    max_len = len;
+  }
+  bool equal = base::StringView(str, strnlen(str, max_len)) ==
+               base::StringView(node.string_value);
+  return node.op == Node::kEq ? equal : !equal;
+}
+
+UserspaceFilter::UserspaceFilter() = default;
+UserspaceFilter::~UserspaceFilter() = default;
+
+void UserspaceFilter::SetCpus(const std::vector<uint32_t>& cpus) {
+  has_cpus_ = true;
+  cpus_.reset();
+  for (uint32_t cpu : cpus) {
+    if (cpu < base::kMaxCpus)
+      cpus_[cpu] = true;
+  }
+}
+
+void UserspaceFilter::SetPids(const std::vector<int32_t>& pids,
+                              uint16_t common_pid_offset) {
+  pids_ = pids;
+  std::sort(pids_.begin(), pids_.end());
+  common_pid_offset_ = common_pid_offset;
+}
+
+void UserspaceFilter::AddPidField(size_t ftrace_event_id, uint16_t offset) {
+  if (ftrace_event_id >= pid_fields_.size())
+    pid_fields_.resize(ftrace_event_id + 1);
+  pid_fields_[ftrace_event_id].push_back(offset);
+}
+
+void UserspaceFilter::SetFieldFilter(size_t ftrace_event_id,
+                                     std::unique_ptr<EventFieldFilter> filter) {
+  if (ftrace_event_id >= field_filters_.size())
+    field_filters_.resize(ftrace_event_id + 1);
+  field_filters_[ftrace_event_id] = std::move(filter);
+}
+
+bool UserspaceFilter::MatchesPid(const uint8_t* start,
+                                 const uint8_t* end,
+                                 uint16_t offset) const {
+  if (size_t{offset} + sizeof(int32_t) > static_cast<size_t>(end - start))
+    return false;
+  int32_t pid;
+  memcpy(&pid, start + offset, sizeof(pid));
+  return std::binary_search(pids_.begin(), pids_.end(), pid);
+}
+
+bool UserspaceFilter::Matches(size_t ftrace_event_id,
+                              const uint8_t* start,
+                              const uint8_t* end) const {
+  if (!pids_.empty() && !MatchesPid(start, end, common_pid_offset_)) {
+    if (ftrace_event_id >= pid_fields_.size())
+      return false;
+    const std::vector<uint16_t>& fields = pid_fields_[ftrace_event_id];
+    if (std::none_of(fields.begin(), fields.end(), [&](uint16_t offset) {
+          return MatchesPid(start, end, offset);
+        })) {
+      return false;
+    }
+  }
+  if (ftrace_event_id < field_filters_.size() &&
+      field_filters_[ftrace_event_id] &&
+      !field_filters_[ftrace_event_id]->Matches(start, end)) {
+    return false;
+  }
+  return true;
+}
+
+}  // namespace perfetto
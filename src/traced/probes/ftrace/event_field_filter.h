@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FTRACE_EVENT_FIELD_FILTER_H_
+#define SRC_TRACED_PROBES_FTRACE_EVENT_FIELD_FILTER_H_
+
+#include <stdint.h>
+
+#include <bitset>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/utils.h"
+#include "src/traced/probes/ftrace/format_parser.h"
+
+namespace perfetto {
+
+// A filter on the fields of one ftrace event, written in the syntax of the
+// "filter" file of the event, e.g. "prev_state == 0 && next_comm != \"bash\"".
+// Only a subset of the kernel syntax is supported: comparisons of a field with
+// a number (==, !=, <, <=, >, >=) or with a string (==, !=), combined with &&,
+// ||, ! and parentheses.
+class EventFieldFilter {
+ public:
+  // Returns nullptr if |expression| is malformed, uses unsupported syntax or
+  // refers to fields missing from |format|.
+  static std::unique_ptr<EventFieldFilter> Create(const std::string& expression,
+                                                  const FtraceEvent& format);
+  ~EventFieldFilter();
+
+  // Evaluates the filter on the raw event in [start, end), which begins with
+  // the common fields. Fields out of bounds never match.
+  bool Matches(const uint8_t* start, const uint8_t* end) const;
+
+ private:
+  friend class EventFieldFilterParser;
+
+  struct Node {
+    enum Type { kAnd, kOr, kNot, kCompareInt, kCompareString };
+    enum Op { kEq, kNe, kLt, kLe, kGt, kGe };
+    enum FieldKind { kSigned, kUnsigned, kFixedString, kDataLocString };
+
+    Type type;
+    size_t lhs = 0;  // Children, indexes in |nodes_|. Only lhs for kNot.
+    size_t rhs = 0;
+
+    // Only for comparisons.
+    Op op = kEq;
+    FieldKind field_kind = kSigned;
+    uint16_t offset = 0;
+    uint16_t size = 0;
+    int64_t int_value = 0;  // Cast to uint64_t for kUnsigned fields.
+    std::string string_value;
+  };
+
+  EventFieldFilter();
+  EventFieldFilter(const EventFieldFilter&) = delete;
+  EventFieldFilter& operator=(const EventFieldFilter&) = delete;
+
+  bool Evaluate(size_t node, const uint8_t* start, const uint8_t* end) const;
+
+  template <typename T>
+  static bool Compare(Node::Op, T lhs, T rhs);
+
+  std::vector<Node> nodes_;
+  size_t root_ = 0;
+};
+
+// The filters of a FtraceConfig (event_pids, cpus and event_filters) that the
+// kernel doesn't apply exactly, because it applies the union of the filters of
+// all the concurrent configs (see FtraceConfigMuxer). Checked by the CpuReader
+// for the events enabled in the EventFilter of the config.
+class UserspaceFilter {
+ public:
+  UserspaceFilter();
+  ~UserspaceFilter();
+
+  // Only the events of these CPUs pass.
+  void SetCpus(const std::vector<uint32_t>& cpus);
+
+  // Only the events emitted by |pids| pass, plus the ones that have one of
+  // them in a field added with AddPidField().
+  void SetPids(const std::vector<int32_t>& pids, uint16_t common_pid_offset);
+  void AddPidField(size_t ftrace_event_id, uint16_t offset);
+
+  void SetFieldFilter(size_t ftrace_event_id,
+                      std::unique_ptr<EventFieldFilter> filter);
+
+  bool IsCpuEnabled(size_t cpu) const { return !has_cpus_ || cpus_[cpu]; }
+
+  bool Matches(size_t ftrace_event_id,
+               const uint8_t* start,
+               const uint8_t* end) const;
+
+ private:
+  UserspaceFilter(const UserspaceFilter&) = delete;
+  UserspaceFilter& operator=(const UserspaceFilter&) = delete;
+
+  bool MatchesPid(const uint8_t* start,
+                  const uint8_t* end,
+                  uint16_t offset) const;
+
+  bool has_cpus_ = false;
+  std::bitset<base::kMaxCpus> cpus_;
+
+  std::vector<int32_t> pids_;  // Sorted. Empty if there is no pid filter.
+  uint16_t common_pid_offset_ = 0;
+  std::vector<std::vector<uint16_t>> pid_fields_;  // Indexed by event id.
+
+  // Indexed by event id, null for the events without a filter.
+  std::vector<std::unique_ptr<EventFieldFilter>> field_filters_;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FTRACE_EVENT_FIELD_FILTER_H_
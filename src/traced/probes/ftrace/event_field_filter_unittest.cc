@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ftrace/event_field_filter.h"
+
+#include <string.h>
+
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace {
+
+const char kSchedSwitchFormat[] = R"(name: sched_switch
+ID: 47
+format:
+	field:unsigned short common_type;	offset:0;	size:2;	signed:0;
+	field:unsigned char common_flags;	offset:2;	size:1;	signed:0;
+	field:unsigned char common_preempt_count;	offset:3;	size:1;	signed:0;
+	field:int common_pid;	offset:4;	size:4;	signed:1;
+
+	field:char prev_comm[16];	offset:8;	size:16;	signed:0;
+	field:pid_t prev_pid;	offset:24;	size:4;	signed:1;
+	field:int prev_prio;	offset:28;	size:4;	signed:1;
+	field:long prev_state;	offset:32;	size:8;	signed:1;
+	field:char next_comm[16];	offset:40;	size:16;	signed:0;
+	field:pid_t next_pid;	offset:56;	size:4;	signed:1;
+	field:int next_prio;	offset:60;	size:4;	signed:1;
+
+print fmt: "prev_comm=%s prev_pid=%d", REC->prev_comm, REC->prev_pid
+)";
+
+class EventFieldFilterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(ParseFtraceEvent(kSchedSwitchFormat, &format_));
+    memset(event_, 0, sizeof(event_));
+    SetSwitch("bash", 42, 1, "swapper", 0);
+  }
+
+  void SetSwitch(const char* prev_comm,
+                 int32_t prev_pid,
+                 int64_t prev_state,
+                 const char* next_comm,
+                 int32_t next_pid) {
+    memcpy(event_ + 4, &prev_pid, sizeof(prev_pid));  // common_pid
+    strncpy(reinterpret_cast<char*>(event_ + 8), prev_comm, 16);
+    memcpy(event_ + 24, &prev_pid, sizeof(prev_pid));
+    memcpy(event_ + 32, &prev_state, sizeof(prev_state));
+    strncpy(reinterpret_cast<char*>(event_ + 40), next_comm, 16);
+    memcpy(event_ + 56, &next_pid, sizeof(next_pid));
+  }
+
+  bool Matches(const std::string& expression) {
+    std::unique_ptr<EventFieldFilter> filter =
+        EventFieldFilter::Create(expression, format_);
+    EXPECT_TRUE(filter) << expression;
+    return filter && filter->Matches(event_, event_ + sizeof(event_));
+  }
+
+  bool IsSupported(const std::string& expression) {
+    return !!EventFieldFilter::Create(expression, format_);
+  }
+
+  FtraceEvent format_;
+  uint8_t event_[64];
+};
+
+TEST_F(EventFieldFilterTest, CompareNumbers) {
+  EXPECT_TRUE(Matches("prev_pid == 42"));
+  EXPECT_FALSE(Matches("prev_pid != 42"));
+  EXPECT_TRUE(Matches("prev_pid > 41"));
+  EXPECT_FALSE(Matches("prev_pid < 42"));
+  EXPECT_TRUE(Matches("prev_pid <= 42"));
+  EXPECT_TRUE(Matches("common_pid >= 0x2a"));
+  EXPECT_TRUE(Matches("next_pid == 0"));
+
+  SetSwitch("bash", -1, -2, "swapper", 0);
+  EXPECT_TRUE(Matches("prev_pid < 0"));
+  EXPECT_TRUE(Matches("prev_state == -2"));
+}
+
+TEST_F(EventFieldFilterTest, CompareStrings) {
+  EXPECT_TRUE(Matches("prev_comm == \"bash\""));
+  EXPECT_TRUE(Matches("prev_comm == bash"));
+  EXPECT_FALSE(Matches("prev_comm == \"bas\""));
+  EXPECT_TRUE(Matches("next_comm != \"bash\""));
+}
+
+TEST_F(EventFieldFilterTest, Combinations) {
+  EXPECT_TRUE(Matches("prev_pid == 42 && next_pid == 0"));
+  EXPECT_FALSE(Matches("prev_pid == 42 && next_pid == 1"));
+  EXPECT_TRUE(Matches("prev_pid == 1 || next_pid == 0"));
+  EXPECT_FALSE(Matches("!(prev_pid == 42)"));
+  EXPECT_TRUE(Matches("(prev_pid == 1 || prev_pid == 42) && prev_state == 1"));
+  // && binds tighter than ||.
+  EXPECT_TRUE(Matches("next_pid == 0 || prev_pid == 1 && prev_state == 0"));
+}
+
+TEST_F(EventFieldFilterTest, Unsupported) {
+  EXPECT_FALSE(IsSupported(""));
+  EXPECT_FALSE(IsSupported("missing_field == 1"));
+  EXPECT_FALSE(IsSupported("prev_pid == "));
+  EXPECT_FALSE(IsSupported("prev_pid == 1 &&"));
+  EXPECT_FALSE(IsSupported("(prev_pid == 1"));
+  EXPECT_FALSE(IsSupported("prev_pid & 1"));
+  EXPECT_FALSE(IsSupported("prev_pid == bash"));
+  EXPECT_FALSE(IsSupported("prev_comm ~ \"ba*\""));
+  EXPECT_FALSE(IsSupported("prev_comm < \"bash\""));
+}
+
+TEST_F(EventFieldFilterTest, TooDeep) {
+  EXPECT_TRUE(IsSupported(std::string(32, '!') + "prev_pid == 1"));
+  EXPECT_TRUE(IsSupported(std::string(32, '(') + "prev_pid == 1" +
+                          std::string(32, ')')));
+  // Would overflow the stack if the nesting wasn't capped.
+  EXPECT_FALSE(IsSupported(std::string(60000, '!') + "prev_pid == 1"));
+  EXPECT_FALSE(IsSupported(std::string(33, '(') + "prev_pid == 1" +
+                           std::string(33, ')')));
+
+  // Long chains of && and || make trees as deep as they are long.
+  std::string chain = "prev_pid == 1";
+  for (int i = 0; i < 127; i++)
+    chain += " || prev_pid == 1";
+  EXPECT_TRUE(IsSupported(chain));
+  for (int i = 0; i < 10000; i++)
+    chain += " && prev_pid == 1";
+  EXPECT_FALSE(IsSupported(chain));
+}
+
+TEST_F(EventFieldFilterTest, TruncatedEventNeverMatches) {
+  std::unique_ptr<EventFieldFilter> filter =
+      EventFieldFilter::Create("next_pid == 0", format_);
+  ASSERT_TRUE(filter);
+  EXPECT_TRUE(filter->Matches(event_, event_ + sizeof(event_)));
+  EXPECT_FALSE(filter->Matches(event_, event_ + 56));
+}
+
+TEST(UserspaceFilterTest, Pids) {
+  uint8_t event[64] = {};
+  int32_t common_pid = 1;
+  int32_t next_pid = 2;
+  memcpy(event + 4, &common_pid, sizeof(common_pid));
+  memcpy(event + 56, &next_pid, sizeof(next_pid));
+
+  UserspaceFilter filter;
+  EXPECT_TRUE(filter.Matches(47, event, event + sizeof(event)));
+
+  filter.SetPids({3, 2}, 4);
+  EXPECT_FALSE(filter.Matches(47, event, event + sizeof(event)));
+  filter.AddPidField(47, 56);
+  EXPECT_TRUE(filter.Matches(47, event, event + sizeof(event)));
+  EXPECT_FALSE(filter.Matches(48, event, event + sizeof(event)));
+
+  filter.SetPids({1}, 4);
+  EXPECT_TRUE(filter.Matches(48, event, event + sizeof(event)));
+}
+
+TEST(UserspaceFilterTest, Cpus) {
+  UserspaceFilter filter;
+  EXPECT_TRUE(filter.IsCpuEnabled(0));
+  EXPECT_TRUE(filter.IsCpuEnabled(3));
+  filter.SetCpus({1, 3});
+  EXPECT_FALSE(filter.IsCpuEnabled(0));
+  EXPECT_TRUE(filter.IsCpuEnabled(1));
+  EXPECT_TRUE(filter.IsCpuEnabled(3));
+}
+
+TEST(UserspaceFilterTest, FieldFilter) {
+  FtraceEvent format;
+  ASSERT_TRUE(ParseFtraceEvent(kSchedSwitchFormat, &format));
+  uint8_t event[64] = {};
+  int32_t next_pid = 2;
+  memcpy(event + 56, &next_pid, sizeof(next_pid));
+
+  UserspaceFilter filter;
+  filter.SetFieldFilter(47, EventFieldFilter::Create("next_pid == 3", format));
+  EXPECT_FALSE(filter.Matches(47, event, event + sizeof(event)));
+  EXPECT_TRUE(filter.Matches(46, event, event + sizeof(event)));
+  EXPECT_TRUE(filter.Matches(48, event, event + sizeof(event)));
+}
+
+}  // namespace
+}  // namespace perfetto
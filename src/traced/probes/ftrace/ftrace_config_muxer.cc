@@ -25,6 +25,8 @@
 
 #include "perfetto/base/utils.h"
 #include "src/traced/probes/ftrace/atrace_wrapper.h"
+#include "src/traced/probes/ftrace/event_field_filter.h"
+#include "src/traced/probes/ftrace/format_parser.h"
 
 namespace perfetto {
 namespace {
@@ -65,6 +67,39 @@ std::pair<std::string, std::string> EventToStringGroupAndName(
                         event.substr(slash_pos + 1));
 }
 
+template <typename T>
+std::vector<T> SortedAndUnique(std::vector<T> values) {
+  std::sort(values.begin(), values.end());
+  values.erase(std::unique(values.begin(), values.end()), values.end());
+  return values;
+}
+
+// The union of |values| (sorted) across |configs|, or an empty vector (i.e.
+// no filter) if any of them is empty.
+template <typename T>
+std::vector<T> MergeFilters(
+    const std::map<FtraceConfigId, FtraceConfig>& configs,
+    const std::vector<T>& (FtraceConfig::*values)() const) {
+  std::vector<T> merged;
+  for (const auto& id_config : configs) {
+    const std::vector<T>& config_values = (id_config.second.*values)();
+    if (config_values.empty())
+      return std::vector<T>();
+    merged.insert(merged.end(), config_values.begin(), config_values.end());
+  }
+  return SortedAndUnique(std::move(merged));
+}
+
+// The fields of the events that the kernel checks, besides common_pid, to
+// decide whether an event belongs to the pids in set_event_pid.
+constexpr const char* kSchedPidFields[][2] = {
+    {"sched_switch", "prev_pid"},
+    {"sched_switch", "next_pid"},
+    {"sched_wakeup", "pid"},
+    {"sched_wakeup_new", "pid"},
+    {"sched_waking", "pid"},
+};
+
 }  // namespace
 
 std::set<GroupAndName> FtraceConfigMuxer::GetFtraceEvents(
@@ -324,9 +359,14 @@ FtraceConfigId FtraceConfigMuxer::SetupConfig(const FtraceConfig& request) {
     }
   }
 
+  SetupEventFilters(request, filter, &actual);
+  SetupCompactSched(request, &filter, &actual);
+
   FtraceConfigId id = ++last_id_;
   configs_.emplace(id, std::move(actual));
   filters_.emplace(id, std::move(filter));
+  UpdateKernelFilters();
+  UpdateUserspaceFilters();
   return id;
 }
 
@@ -374,6 +414,12 @@ bool FtraceConfigMuxer::RemoveConfig(FtraceConfigId config_id) {
       current_state_.ftrace_events.DisableEvent(event->ftrace_event_id);
   }
 
+  // The kernel filters can only get narrower here, and never narrower than
+  // the filters of any of the remaining configs, so their userspace filters
+  // are still correct (at worst redundant) and the CpuReader(s) can keep
+  // using them.
+  UpdateKernelFilters();
+
   // If there aren't any more active configs, disable ftrace.
   auto active_it = active_configs_.find(config_id);
   if (active_it != active_configs_.end()) {
@@ -391,6 +437,7 @@ bool FtraceConfigMuxer::RemoveConfig(FtraceConfigId config_id) {
   // configs are removed.
   if (configs_.empty()) {
     ftrace_->SetCpuBufferSizeInPages(0);
+    current_state_.cpu_buffer_size_pages = 0;
     ftrace_->DisableAllEvents();
     ftrace_->ClearTrace();
     if (current_state_.atrace_on)
@@ -412,6 +459,243 @@ const EventFilter* FtraceConfigMuxer::GetEventFilter(FtraceConfigId id) {
   return &filters_.at(id);
 }
 
+void FtraceConfigMuxer::SetupEventFilters(const FtraceConfig& request,
+                                          const EventFilter& filter,
+                                          FtraceConfig* actual) {
+  for (int32_t pid : SortedAndUnique(request.event_pids()))
+    *actual->add_event_pids() = pid;
+  for (uint32_t cpu : SortedAndUnique(request.cpus()))
+    *actual->add_cpus() = cpu;
+
+  std::set<std::string> filtered_events;
+  for (const auto& event_filter : request.event_filters()) {
+    std::string group;
+    std::string name;
+    std::tie(group, name) = EventToStringGroupAndName(event_filter.event());
+    const Event* event = group.empty()
+                             ? table_->GetEventByName(name)
+                             : table_->GetEvent(GroupAndName(group, name));
+    if (!event || !filter.IsEventEnabled(event->ftrace_event_id)) {
+      PERFETTO_DLOG("Ignoring the filter of %s, the event is not enabled",
+                    event_filter.event().c_str());
+      continue;
+    }
+    std::string event_name = GroupAndName(event->group, event->name).ToString();
+    if (!filtered_events.insert(event_name).second) {
+      PERFETTO_ELOG("Ignoring the extra filter of %s", event_name.c_str());
+      continue;
+    }
+    if (!CreateEventFieldFilter(*event, event_filter.filter())) {
+      PERFETTO_ELOG("Ignoring the unsupported filter of %s: \"%s\"",
+                    event_name.c_str(), event_filter.filter().c_str());
+      continue;
+    }
+    FtraceConfig::EventFilter* actual_filter = actual->add_event_filters();
+    actual_filter->set_event(event_name);
+    actual_filter->set_filter(event_filter.filter());
+  }
+}
+
+void FtraceConfigMuxer::SetupCompactSched(const FtraceConfig& request,
+                                          EventFilter* filter,
+                                          FtraceConfig* actual) {
+  if (!request.compact_sched())
+    return;
+  // The compact encoding doesn't store the prev_pid of sched_switch, the
+  // parser takes it from the next_pid of the previous switch on the cpu.
+  // Filters drop some of the switches, after which that guess is wrong.
+  bool filtered = !actual->event_pids().empty();
+  for (const auto& event_filter : actual->event_filters())
+    filtered |= event_filter.event() == "sched/sched_switch";
+  if (filtered) {
+    PERFETTO_ELOG("Disabling compact_sched, sched_switch is filtered");
+    return;
+  }
+  filter->set_compact_sched(true);
+  actual->set_compact_sched(true);
+}
+
+void FtraceConfigMuxer::UpdateKernelFilters() {
+  std::vector<int32_t> pids = MergeFilters(configs_, &FtraceConfig::event_pids);
+  if (pids != current_state_.event_pids) {
+    if (ftrace_->SetEventPids(pids)) {
+      current_state_.event_pids = std::move(pids);
+    } else if (ftrace_->SetEventPids({})) {
+      PERFETTO_ELOG("Failed to set the pid filter, filtering in userspace");
+      current_state_.event_pids.clear();
+    }
+  }
+
+  std::vector<uint32_t> cpus = MergeFilters(configs_, &FtraceConfig::cpus);
+  if (cpus != current_state_.cpus) {
+    if (ftrace_->SetTracingCpumask(cpus)) {
+      current_state_.cpus = std::move(cpus);
+    } else if (ftrace_->SetTracingCpumask({})) {
+      PERFETTO_ELOG("Failed to set the cpu mask, filtering in userspace");
+      current_state_.cpus.clear();
+    }
+  }
+
+  // An event gets a filter in the kernel only if all the configs that enable
+  // it have one: "(filter_1) || (filter_2) ...", or just "filter_1" if they
+  // all have the same.
+  std::map<FtraceConfigId, std::map<size_t, std::string>> config_filters;
+  std::set<size_t> filtered_events;
+  for (const auto& id_config : configs_) {
+    for (const auto& event_filter : id_config.second.event_filters()) {
+      size_t event_id = GetEventId(event_filter.event());
+      config_filters[id_config.first][event_id] = event_filter.filter();
+      filtered_events.insert(event_id);
+    }
+  }
+  std::map<size_t, std::set<std::string>> filters_by_event;
+  std::set<size_t> unfiltered_events;
+  for (size_t event_id : filtered_events) {
+    for (const auto& id_filter : filters_) {
+      if (!id_filter.second.IsEventEnabled(event_id))
+        continue;
+      const std::map<size_t, std::string>& filters =
+          config_filters[id_filter.first];
+      auto it = filters.find(event_id);
+      if (it == filters.end())
+        unfiltered_events.insert(event_id);
+      else
+        filters_by_event[event_id].insert(it->second);
+    }
+  }
+  std::map<size_t, std::string> event_filters;
+  for (const auto& event_and_filters : filters_by_event) {
+    if (unfiltered_events.count(event_and_filters.first))
+      continue;
+    const std::set<std::string>& filters = event_and_filters.second;
+    std::string merged;
+    if (filters.size() == 1) {
+      merged = *filters.begin();
+    } else {
+      for (const std::string& filter : filters)
+        merged += (merged.empty() ? "(" : " || (") + filter + ")";
+    }
+    event_filters[event_and_filters.first] = std::move(merged);
+  }
+
+  // Clear the filters that are not needed anymore, then set the new ones.
+  for (auto it = current_state_.event_filters.begin();
+       it != current_state_.event_filters.end();) {
+    const Event* event = table_->GetEventById(it->first);
+    if (event_filters.count(it->first) ||
+        !ftrace_->SetEventFilter(event->group, event->name, "")) {
+      ++it;
+      continue;
+    }
+    it = current_state_.event_filters.erase(it);
+  }
+  for (auto& event_and_filter : event_filters) {
+    size_t event_id = event_and_filter.first;
+    auto it = current_state_.event_filters.find(event_id);
+    if (it != current_state_.event_filters.end() &&
+        it->second == event_and_filter.second) {
+      continue;
+    }
+    const Event* event = table_->GetEventById(event_id);
+    if (ftrace_->SetEventFilter(event->group, event->name,
+                                event_and_filter.second)) {
+      current_state_.event_filters[event_id] =
+          std::move(event_and_filter.second);
+      continue;
+    }
+    // The kernel rejected the filter, it will be applied in userspace.
+    PERFETTO_ELOG("Failed to set the filter of %s/%s, filtering in userspace",
+                  event->group, event->name);
+    if (it != current_state_.event_filters.end() &&
+        ftrace_->SetEventFilter(event->group, event->name, "")) {
+      current_state_.event_filters.erase(it);
+    }
+  }
+}
+
+void FtraceConfigMuxer::UpdateUserspaceFilters() {
+  uint16_t common_pid_offset = 0;
+  for (const Field& field : table_->common_fields()) {
+    if (field.ftrace_type == kFtraceCommonPid32)
+      common_pid_offset = field.ftrace_offset;
+  }
+
+  for (const auto& id_config : configs_) {
+    const FtraceConfig& config = id_config.second;
+    EventFilter& filter = filters_.at(id_config.first);
+    std::unique_ptr<UserspaceFilter> userspace_filter(new UserspaceFilter());
+    bool needed = false;
+
+    if (!config.cpus().empty() && config.cpus() != current_state_.cpus) {
+      userspace_filter->SetCpus(config.cpus());
+      needed = true;
+    }
+
+    // Without the common pid (never the case in practice) it is safer to
+    // give the config more events than to drop them all.
+    if (!config.event_pids().empty() && common_pid_offset &&
+        config.event_pids() != current_state_.event_pids) {
+      userspace_filter->SetPids(config.event_pids(), common_pid_offset);
+      for (const auto& event_and_field : kSchedPidFields) {
+        const Event* event =
+            table_->GetEvent(GroupAndName("sched", event_and_field[0]));
+        if (!event || !filter.IsEventEnabled(event->ftrace_event_id))
+          continue;
+        for (const Field& field : event->fields) {
+          if (field.ftrace_name &&
+              strcmp(field.ftrace_name, event_and_field[1]) == 0) {
+            userspace_filter->AddPidField(event->ftrace_event_id,
+                                          field.ftrace_offset);
+          }
+        }
+      }
+      needed = true;
+    }
+
+    for (const auto& event_filter : config.event_filters()) {
+      const Event* event =
+          table_->GetEventById(GetEventId(event_filter.event()));
+      auto it = current_state_.event_filters.find(event->ftrace_event_id);
+      if (it != current_state_.event_filters.end() &&
+          it->second == event_filter.filter()) {
+        continue;
+      }
+      std::unique_ptr<EventFieldFilter> field_filter =
+          CreateEventFieldFilter(*event, event_filter.filter());
+      if (!field_filter)
+        continue;
+      userspace_filter->SetFieldFilter(event->ftrace_event_id,
+                                       std::move(field_filter));
+      needed = true;
+    }
+
+    filter.set_userspace_filter(needed ? std::move(userspace_filter)
+                                       : nullptr);
+  }
+}
+
+size_t FtraceConfigMuxer::GetEventId(const std::string& event_name) const {
+  std::string group;
+  std::string name;
+  std::tie(group, name) = EventToStringGroupAndName(event_name);
+  const Event* event = table_->GetEvent(GroupAndName(group, name));
+  // Only the filters of the events in the table are kept, see
+  // SetupEventFilters().
+  PERFETTO_CHECK(event);
+  return event->ftrace_event_id;
+}
+
+std::unique_ptr<EventFieldFilter> FtraceConfigMuxer::CreateEventFieldFilter(
+    const Event& event,
+    const std::string& expression) const {
+  FtraceEvent format;
+  if (!ParseFtraceEvent(ftrace_->ReadEventFormat(event.group, event.name),
+                        &format)) {
+    return nullptr;
+  }
+  return EventFieldFilter::Create(expression, format);
+}
+
 void FtraceConfigMuxer::SetupClock(const FtraceConfig&) {
   std::string current_clock = ftrace_->GetClock();
   std::set<std::string> clocks = ftrace_->AvailableClocks();
@@ -19,6 +19,8 @@
 
 #include <map>
 #include <set>
+#include <string>
+#include <vector>
 
 #include "src/traced/probes/ftrace/ftrace_config.h"
 #include "src/traced/probes/ftrace/ftrace_controller.h"
@@ -68,6 +70,12 @@ class FtraceConfigMuxer {
 
   const EventFilter* GetEventFilter(FtraceConfigId id);
 
+  // The size of each per-cpu ftrace buffer as set up for the configs, in
+  // pages. 0 if no config is set up.
+  size_t GetPerCpuBufferSizePages() const {
+    return current_state_.cpu_buffer_size_pages;
+  }
+
   // public for testing
   void SetupClockForTesting(const FtraceConfig& request) {
     SetupClock(request);
@@ -89,6 +97,11 @@ class FtraceConfigMuxer {
     bool tracing_on = false;
     bool atrace_on = false;
     size_t cpu_buffer_size_pages = 0;
+
+    // The filters pushed down to the kernel. Empty means no filter.
+    std::vector<int32_t> event_pids;  // Sorted.
+    std::vector<uint32_t> cpus;       // Sorted.
+    std::map<size_t, std::string> event_filters;  // By ftrace event id.
   };
 
   FtraceConfigMuxer(const FtraceConfigMuxer&) = delete;
@@ -99,6 +112,36 @@ class FtraceConfigMuxer {
   void UpdateAtrace(const FtraceConfig& request);
   void DisableAtrace();
 
+  // Copies into |actual| the event_pids, cpus and event_filters of |request|
+  // that can be honored, i.e. the filters of events enabled in |filter| that
+  // EventFieldFilter supports.
+  void SetupEventFilters(const FtraceConfig& request,
+                         const EventFilter& filter,
+                         FtraceConfig* actual);
+
+  // Enables compact_sched in |filter| and |actual| if |request| asks for it
+  // and the sched_switch events of the config aren't filtered.
+  void SetupCompactSched(const FtraceConfig& request,
+                         EventFilter* filter,
+                         FtraceConfig* actual);
+
+  // Pushes down to the kernel the union of the filters of all the configs:
+  // an event is traced if at least one config wants it. Only writes to the
+  // ftrace files whose filter changed.
+  void UpdateKernelFilters();
+
+  // Gives each config a UserspaceFilter for the parts of its filters that
+  // differ from the ones in the kernel. Must only be called while the
+  // CpuReader(s) are not parsing (see FtraceController::AddDataSource()).
+  void UpdateUserspaceFilters();
+
+  // The id of an event of the table, given its "group/name".
+  size_t GetEventId(const std::string& event_name) const;
+
+  std::unique_ptr<EventFieldFilter> CreateEventFieldFilter(
+      const Event& event,
+      const std::string& expression) const;
+
   // This processes the config to get the exact events.
   // group/* -> Will read the fs and add all events in group.
   // event -> Will look up the event to find the group.
@@ -16,6 +16,8 @@
 
 #include "src/traced/probes/ftrace/ftrace_config_muxer.h"
 
+#include <string.h>
+
 #include <memory>
 
 #include "gmock/gmock.h"
@@ -100,6 +102,12 @@ class FtraceConfigMuxerTest : public ::testing::Test {
   std::unique_ptr<ProtoTranslationTable> CreateFakeTable() {
     std::vector<Field> common_fields;
     std::vector<Event> events;
+    {
+      Field field(4, 4);
+      field.ftrace_type = kFtraceCommonPid32;
+      field.ftrace_name = "common_pid";
+      common_fields.push_back(field);
+    }
     {
       Event event;
       event.name = "sched_switch";
@@ -499,5 +507,218 @@ TEST_F(FtraceConfigMuxerTest, GetFtraceEventsAtraceCategories) {
   EXPECT_THAT(events, Contains(GroupAndName("ftrace", "print")));
 }
 
+const char kSchedSwitchFormat[] = R"(name: sched_switch
+ID: 1
+format:
+	field:unsigned short common_type;	offset:0;	size:2;	signed:0;
+	field:unsigned char common_flags;	offset:2;	size:1;	signed:0;
+	field:unsigned char common_preempt_count;	offset:3;	size:1;	signed:0;
+	field:int common_pid;	offset:4;	size:4;	signed:1;
+
+	field:char prev_comm[16];	offset:8;	size:16;	signed:0;
+	field:pid_t prev_pid;	offset:24;	size:4;	signed:1;
+	field:int prev_prio;	offset:28;	size:4;	signed:1;
+	field:long prev_state;	offset:32;	size:8;	signed:1;
+	field:char next_comm[16];	offset:40;	size:16;	signed:0;
+	field:pid_t next_pid;	offset:56;	size:4;	signed:1;
+	field:int next_prio;	offset:60;	size:4;	signed:1;
+
+print fmt: "prev_comm=%s prev_pid=%d", REC->prev_comm, REC->prev_pid
+)";
+
+FtraceConfig CreateFilteredSchedSwitchConfig(std::vector<int32_t> pids,
+                                             const std::string& filter) {
+  FtraceConfig config = CreateFtraceConfig({"sched/sched_switch"});
+  for (int32_t pid : pids)
+    *config.add_event_pids() = pid;
+  if (!filter.empty()) {
+    FtraceConfig::EventFilter* event_filter = config.add_event_filters();
+    event_filter->set_event("sched_switch");
+    event_filter->set_filter(filter);
+  }
+  return config;
+}
+
+void SetUpFtraceForFilters(MockFtraceProcfs* ftrace) {
+  ON_CALL(*ftrace, ReadFileIntoString("/root/trace_clock"))
+      .WillByDefault(Return("[local] global boot"));
+  ON_CALL(*ftrace,
+          ReadFileIntoString("/root/events/sched/sched_switch/format"))
+      .WillByDefault(Return(kSchedSwitchFormat));
+  EXPECT_CALL(*ftrace, ReadFileIntoString(_)).Times(AnyNumber());
+  EXPECT_CALL(*ftrace, ReadOneCharFromFile("/root/tracing_on"))
+      .WillRepeatedly(Return('0'));
+  EXPECT_CALL(*ftrace, WriteToFile(_, _)).Times(AnyNumber());
+  EXPECT_CALL(*ftrace, ClearFile(_)).Times(AnyNumber());
+}
+
+// A raw sched_switch emitted by |common_pid| that switches to |next_pid|.
+std::vector<uint8_t> SchedSwitch(int32_t common_pid, int32_t next_pid) {
+  std::vector<uint8_t> event(64);
+  memcpy(&event[4], &common_pid, sizeof(common_pid));
+  memcpy(&event[56], &next_pid, sizeof(next_pid));
+  return event;
+}
+
+bool Matches(const EventFilter* filter, const std::vector<uint8_t>& event) {
+  const UserspaceFilter* userspace_filter = filter->userspace_filter();
+  return !userspace_filter ||
+         userspace_filter->Matches(1, event.data(), event.data() + 64);
+}
+
+TEST_F(FtraceConfigMuxerTest, PushDownFilters) {
+  MockFtraceProcfs ftrace;
+  SetUpFtraceForFilters(&ftrace);
+  FtraceConfigMuxer model(&ftrace, table_.get());
+
+  FtraceConfig config = CreateFilteredSchedSwitchConfig({42}, "next_pid == 1");
+  *config.add_cpus() = 0;
+  EXPECT_CALL(ftrace, WriteToFile("/root/set_event_pid", "42"));
+  EXPECT_CALL(ftrace, WriteToFile("/root/tracing_cpumask", "1"));
+  EXPECT_CALL(ftrace, WriteToFile("/root/events/sched/sched_switch/filter",
+                                  "next_pid == 1"));
+  FtraceConfigId id = model.SetupConfig(config);
+  ASSERT_TRUE(id);
+
+  // The kernel does all the filtering.
+  EXPECT_FALSE(model.GetEventFilter(id)->userspace_filter());
+  const FtraceConfig* actual_config = model.GetConfigForTesting(id);
+  ASSERT_EQ(actual_config->event_filters_size(), 1);
+  EXPECT_EQ(actual_config->event_filters()[0].event(), "sched/sched_switch");
+  ::testing::Mock::VerifyAndClearExpectations(&ftrace);
+
+  SetUpFtraceForFilters(&ftrace);
+  EXPECT_CALL(ftrace, ClearFile("/root/set_event_pid"));
+  EXPECT_CALL(ftrace, WriteToFile("/root/tracing_cpumask", "1"));
+  EXPECT_CALL(ftrace,
+              WriteToFile("/root/events/sched/sched_switch/filter", "0"));
+  ASSERT_TRUE(model.RemoveConfig(id));
+}
+
+TEST_F(FtraceConfigMuxerTest, MergeFiltersOfConcurrentConfigs) {
+  MockFtraceProcfs ftrace;
+  SetUpFtraceForFilters(&ftrace);
+  FtraceConfigMuxer model(&ftrace, table_.get());
+
+  FtraceConfigId id_a =
+      model.SetupConfig(CreateFilteredSchedSwitchConfig({1}, "next_pid == 1"));
+  ASSERT_TRUE(id_a);
+  ::testing::Mock::VerifyAndClearExpectations(&ftrace);
+
+  // The kernel gets the union of the filters, each config the rest.
+  SetUpFtraceForFilters(&ftrace);
+  EXPECT_CALL(ftrace, WriteToFile("/root/set_event_pid", "1 2"));
+  EXPECT_CALL(ftrace, WriteToFile("/root/events/sched/sched_switch/filter",
+                                  "(next_pid == 1) || (next_pid == 2)"));
+  FtraceConfigId id_b =
+      model.SetupConfig(CreateFilteredSchedSwitchConfig({2}, "next_pid == 2"));
+  ASSERT_TRUE(id_b);
+  ::testing::Mock::VerifyAndClearExpectations(&ftrace);
+
+  const EventFilter* filter_a = model.GetEventFilter(id_a);
+  const EventFilter* filter_b = model.GetEventFilter(id_b);
+  EXPECT_TRUE(Matches(filter_a, SchedSwitch(1, 1)));
+  EXPECT_FALSE(Matches(filter_a, SchedSwitch(2, 1)));
+  EXPECT_FALSE(Matches(filter_a, SchedSwitch(1, 2)));
+  EXPECT_TRUE(Matches(filter_b, SchedSwitch(2, 2)));
+  EXPECT_FALSE(Matches(filter_b, SchedSwitch(1, 2)));
+
+  // Removing a config narrows the kernel filters again.
+  SetUpFtraceForFilters(&ftrace);
+  EXPECT_CALL(ftrace, WriteToFile("/root/set_event_pid", "1"));
+  EXPECT_CALL(ftrace, WriteToFile("/root/events/sched/sched_switch/filter",
+                                  "next_pid == 1"));
+  ASSERT_TRUE(model.RemoveConfig(id_b));
+  EXPECT_TRUE(Matches(filter_a, SchedSwitch(1, 1)));
+  EXPECT_FALSE(Matches(filter_a, SchedSwitch(2, 1)));
+}
+
+TEST_F(FtraceConfigMuxerTest, UnfilteredConfigDisablesKernelFilters) {
+  MockFtraceProcfs ftrace;
+  SetUpFtraceForFilters(&ftrace);
+  FtraceConfigMuxer model(&ftrace, table_.get());
+
+  FtraceConfigId id_a =
+      model.SetupConfig(CreateFilteredSchedSwitchConfig({1}, "next_pid == 1"));
+  ASSERT_TRUE(id_a);
+  ::testing::Mock::VerifyAndClearExpectations(&ftrace);
+
+  SetUpFtraceForFilters(&ftrace);
+  EXPECT_CALL(ftrace, ClearFile("/root/set_event_pid"));
+  EXPECT_CALL(ftrace,
+              WriteToFile("/root/events/sched/sched_switch/filter", "0"));
+  FtraceConfigId id_b =
+      model.SetupConfig(CreateFilteredSchedSwitchConfig({}, ""));
+  ASSERT_TRUE(id_b);
+
+  EXPECT_FALSE(model.GetEventFilter(id_b)->userspace_filter());
+  EXPECT_TRUE(model.GetEventFilter(id_a)->userspace_filter());
+  EXPECT_TRUE(Matches(model.GetEventFilter(id_a), SchedSwitch(1, 1)));
+  EXPECT_FALSE(Matches(model.GetEventFilter(id_a), SchedSwitch(2, 2)));
+}
+
+TEST_F(FtraceConfigMuxerTest, IgnoreUnsupportedFilters) {
+  MockFtraceProcfs ftrace;
+  SetUpFtraceForFilters(&ftrace);
+  FtraceConfigMuxer model(&ftrace, table_.get());
+
+  EXPECT_CALL(ftrace, WriteToFile("/root/events/sched/sched_switch/filter", _))
+      .Times(0);
+  FtraceConfigId id = model.SetupConfig(
+      CreateFilteredSchedSwitchConfig({}, "next_comm ~ \"ba*\""));
+  ASSERT_TRUE(id);
+  EXPECT_THAT(model.GetConfigForTesting(id)->event_filters(), IsEmpty());
+  EXPECT_FALSE(model.GetEventFilter(id)->userspace_filter());
+}
+
+TEST_F(FtraceConfigMuxerTest, FallBackToUserspaceIfKernelRejectsFilter) {
+  MockFtraceProcfs ftrace;
+  SetUpFtraceForFilters(&ftrace);
+  FtraceConfigMuxer model(&ftrace, table_.get());
+
+  EXPECT_CALL(ftrace, WriteToFile("/root/events/sched/sched_switch/filter",
+                                  "next_pid == 1"))
+      .WillOnce(Return(false));
+  FtraceConfigId id =
+      model.SetupConfig(CreateFilteredSchedSwitchConfig({}, "next_pid == 1"));
+  ASSERT_TRUE(id);
+  EXPECT_TRUE(Matches(model.GetEventFilter(id), SchedSwitch(1, 1)));
+  EXPECT_FALSE(Matches(model.GetEventFilter(id), SchedSwitch(1, 2)));
+}
+
 }  // namespace
+TEST_F(FtraceConfigMuxerTest, FiltersDisableCompactSched) {
+  MockFtraceProcfs ftrace;
+  SetUpFtraceForFilters(&ftrace);
+  FtraceConfigMuxer model(&ftrace, table_.get());
+
+  FtraceConfig config = CreateFilteredSchedSwitchConfig({}, "");
+  config.set_compact_sched(true);
+  FtraceConfigId id = model.SetupConfig(config);
+  ASSERT_TRUE(id);
+  EXPECT_TRUE(model.GetEventFilter(id)->compact_sched());
+  EXPECT_TRUE(model.GetConfigForTesting(id)->compact_sched());
+
+  config = CreateFilteredSchedSwitchConfig({42}, "");
+  config.set_compact_sched(true);
+  id = model.SetupConfig(config);
+  ASSERT_TRUE(id);
+  EXPECT_FALSE(model.GetEventFilter(id)->compact_sched());
+  EXPECT_FALSE(model.GetConfigForTesting(id)->compact_sched());
+
+  config = CreateFilteredSchedSwitchConfig({}, "next_pid == 1");
+  config.set_compact_sched(true);
+  id = model.SetupConfig(config);
+  ASSERT_TRUE(id);
+  EXPECT_FALSE(model.GetEventFilter(id)->compact_sched());
+  EXPECT_FALSE(model.GetConfigForTesting(id)->compact_sched());
+
+  // An unsupported filter is ignored, so it doesn't get in the way either.
+  config = CreateFilteredSchedSwitchConfig({}, "next_comm ~ \"foo*\"");
+  config.set_compact_sched(true);
+  id = model.SetupConfig(config);
+  ASSERT_TRUE(id);
+  EXPECT_TRUE(model.GetEventFilter(id)->compact_sched());
+}
+
 }  // namespace perfetto
@@ -24,9 +24,12 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
+#include <mutex>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/base/file_utils.h"
@@ -53,6 +56,21 @@ constexpr int kMinDrainPeriodMs = 1;
 constexpr int kMaxDrainPeriodMs = 1000 * 60;
 constexpr uint32_t kMainThread = 255;  // for METATRACE
 
+// Bounds of the adaptive drain. The period goes from kMinAdaptiveDrainPeriodMs
+// (or the configured period, if lower) up to kMaxAdaptiveDrainFactor times the
+// configured period. Buffers grow up to kMaxAdaptiveBufferFactor times the
+// configured size, capped at kMaxAdaptiveBufferSizeKb.
+constexpr uint32_t kMinAdaptiveDrainPeriodMs = 10;
+constexpr uint32_t kMaxAdaptiveDrainFactor = 4;
+constexpr size_t kMaxAdaptiveBufferFactor = 4;
+constexpr size_t kMaxAdaptiveBufferSizeKb = 16 * 1024;
+
+// A CPU that filled at least kHighFillPct of its buffer between two drains is
+// at risk of overflowing. If all of them stay below kLowFillPct, the readers
+// are woken up more often than needed.
+constexpr uint32_t kHighFillPct = 50;
+constexpr uint32_t kLowFillPct = 12;
+
 uint32_t ClampDrainPeriodMs(uint32_t drain_period_ms) {
   if (drain_period_ms == 0) {
     return kDefaultDrainPeriodMs;
@@ -146,11 +164,14 @@ FtraceController::FtraceController(std::unique_ptr<FtraceProcfs> ftrace_procfs,
 
 FtraceController::~FtraceController() {
   PERFETTO_DCHECK_THREAD(thread_checker_);
-  for (const auto* data_source : data_sources_)
-    ftrace_config_muxer_->RemoveConfig(data_source->config_id());
+  std::set<FtraceDataSource*> data_sources = std::move(data_sources_);
   data_sources_.clear();
   started_data_sources_.clear();
+
+  // Join the worker threads first, they use the event filters of the configs.
   StopIfNeeded();
+  for (const auto* data_source : data_sources)
+    ftrace_config_muxer_->RemoveConfig(data_source->config_id());
 }
 
 uint64_t FtraceController::NowMs() const {
@@ -164,11 +185,13 @@ uint64_t FtraceController::NowMs() const {
 // static
 void FtraceController::OnCpuReaderRead(size_t cpu,
                                        int generation,
-                                       FtraceThreadSync* thread_sync) {
+                                       FtraceThreadSync* thread_sync,
+                                       size_t pages_read) {
   PERFETTO_METATRACE("OnCpuReaderRead()", cpu);
 
   {
     std::lock_guard<std::mutex> lock(thread_sync->mutex);
+    thread_sync->pages_read[cpu] += static_cast<uint32_t>(pages_read);
     // If this was the first CPU to wake up, schedule a drain for the next
     // drain interval.
     bool post_drain_task = thread_sync->cpus_to_drain.none();
@@ -229,9 +252,11 @@ void FtraceController::DrainCPUs(int generation) {
   PERFETTO_DCHECK(cpu_readers_.size() == num_cpus);
   FlushRequestID ack_flush_request_id = 0;
   std::bitset<base::kMaxCpus> cpus_to_drain;
+  std::array<uint32_t, base::kMaxCpus> pages_read{};
   {
     std::lock_guard<std::mutex> lock(thread_sync_.mutex);
     std::swap(cpus_to_drain, thread_sync_.cpus_to_drain);
+    std::swap(pages_read, thread_sync_.pages_read);
 
     // Check also if a flush is pending and if all cpus have acked. If that's
     // the case, ack the overall Flush() request at the end of this function.
@@ -245,9 +270,9 @@ void FtraceController::DrainCPUs(int generation) {
   for (size_t cpu = 0; cpu < num_cpus; cpu++) {
     if (!cpus_to_drain[cpu])
       continue;
-    // This method reads the pipe and converts the raw ftrace data into
-    // protobufs using the |data_source|'s TraceWriter.
-    cpu_readers_[cpu]->Drain(started_data_sources_);
+    // The worker thread has already converted the raw ftrace data into
+    // protobufs, this copies them into the data sources' TraceWriter(s).
+    cpu_readers_[cpu]->Drain();
     OnDrainCpuForTesting(cpu);
   }
 
@@ -257,6 +282,11 @@ void FtraceController::DrainCPUs(int generation) {
   // from traced. Also, don't unblock the readers until all of them have replied
   // to the flush.
   if (!cur_flush_request_id_) {
+    // Flushes read the buffers regardless of how full they are, only the
+    // periodic drains tell how fast the CPUs fill them.
+    if (!ack_flush_request_id)
+      AdaptDrainPeriod(pages_read);
+
     base::WeakPtr<FtraceController> weak_this = weak_factory_.GetWeakPtr();
     task_runner_->PostTask([weak_this] {
       if (weak_this)
@@ -305,16 +335,23 @@ void FtraceController::StartIfNeeded() {
   }
 
   generation_++;
+  ResetAdaptiveDrain();
   cpu_readers_.clear();
   cpu_readers_.reserve(ftrace_procfs_->NumberOfCpus());
   for (size_t cpu = 0; cpu < ftrace_procfs_->NumberOfCpus(); cpu++) {
-    cpu_readers_.emplace_back(
-        new CpuReader(table_.get(), &thread_sync_, cpu, generation_,
-                      ftrace_procfs_->OpenPipeForCpu(cpu)));
+    cpu_readers_.emplace_back(new CpuReader(
+        table_.get(), &thread_sync_, cpu, generation_,
+        ftrace_procfs_->OpenPipeForCpu(cpu), started_data_sources_));
   }
 }
 
 uint32_t FtraceController::GetDrainPeriodMs() {
+  if (adaptive_drain_period_ms_)
+    return adaptive_drain_period_ms_;
+  return GetConfiguredDrainPeriodMs();
+}
+
+uint32_t FtraceController::GetConfiguredDrainPeriodMs() {
   if (data_sources_.empty())
     return kDefaultDrainPeriodMs;
   uint32_t min_drain_period_ms = kMaxDrainPeriodMs + 1;
@@ -325,6 +362,125 @@ uint32_t FtraceController::GetDrainPeriodMs() {
   return ClampDrainPeriodMs(min_drain_period_ms);
 }
 
+bool FtraceController::IsAdaptiveDrainEnabled() const {
+  if (data_sources_.empty())
+    return false;
+  for (const FtraceDataSource* data_source : data_sources_) {
+    if (!data_source->config().adaptive_drain())
+      return false;
+  }
+  return true;
+}
+
+void FtraceController::ResetAdaptiveDrain() {
+  adaptive_drain_period_ms_ = 0;
+  cpu_buffer_pages_.clear();
+  last_overrun_.clear();
+}
+
+void FtraceController::AdaptDrainPeriod(
+    const std::array<uint32_t, base::kMaxCpus>& pages_read) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  if (!IsAdaptiveDrainEnabled()) {
+    adaptive_drain_period_ms_ = 0;
+    return;
+  }
+  const size_t configured_pages =
+      ftrace_config_muxer_->GetPerCpuBufferSizePages();
+  if (!configured_pages)
+    return;
+
+  const size_t num_cpus = ftrace_procfs_->NumberOfCpus();
+  if (cpu_buffer_pages_.size() != num_cpus) {
+    cpu_buffer_pages_.assign(num_cpus, configured_pages);
+    last_overrun_.assign(num_cpus, 0);
+    for (size_t cpu = 0; cpu < num_cpus; cpu++) {
+      FtraceCpuStats cpu_stats{};
+      if (DumpCpuStats(ftrace_procfs_->ReadCpuStats(cpu), &cpu_stats))
+        last_overrun_[cpu] = cpu_stats.overrun;
+    }
+  }
+
+  const uint32_t configured_ms = GetConfiguredDrainPeriodMs();
+  const uint32_t min_ms = std::min(configured_ms, kMinAdaptiveDrainPeriodMs);
+  const uint32_t max_ms = configured_ms * kMaxAdaptiveDrainFactor;
+  if (!adaptive_drain_period_ms_)
+    adaptive_drain_period_ms_ = configured_ms;
+
+  std::vector<size_t> hot_cpus;
+  uint32_t max_fill_pct = 0;
+  for (size_t cpu = 0; cpu < num_cpus; cpu++) {
+    size_t fill_pct = pages_read[cpu] * 100ul / cpu_buffer_pages_[cpu];
+    auto cpu_fill_pct = static_cast<uint32_t>(std::min<size_t>(fill_pct, 100));
+    max_fill_pct = std::max(max_fill_pct, cpu_fill_pct);
+    if (cpu_fill_pct >= kHighFillPct)
+      hot_cpus.push_back(cpu);
+  }
+
+  FtraceDrainAdjustment adjustment{};
+  adjustment.timestamp = static_cast<uint64_t>(base::GetBootTimeNs().count());
+  adjustment.max_fill_pct = max_fill_pct;
+
+  if (max_fill_pct < kLowFillPct) {
+    if (adaptive_drain_period_ms_ >= max_ms)
+      return;
+    adaptive_drain_period_ms_ = std::min(adaptive_drain_period_ms_ * 2, max_ms);
+    adjustment.reason = FtraceDrainAdjustment::kIdle;
+    adjustment.drain_period_ms = adaptive_drain_period_ms_;
+    NotifyDrainAdjustmentToStartedDataSources(adjustment);
+    return;
+  }
+
+  if (hot_cpus.empty())
+    return;
+
+  // Tell apart the CPUs that already lost events from the ones that got close.
+  adjustment.reason = FtraceDrainAdjustment::kBufferNearlyFull;
+  for (size_t cpu : hot_cpus) {
+    FtraceCpuStats cpu_stats{};
+    if (!DumpCpuStats(ftrace_procfs_->ReadCpuStats(cpu), &cpu_stats))
+      continue;
+    if (cpu_stats.overrun > last_overrun_[cpu])
+      adjustment.reason = FtraceDrainAdjustment::kOverrun;
+    last_overrun_[cpu] = cpu_stats.overrun;
+  }
+
+  // Draining more often is cheaper than pinning more kernel memory, so grow
+  // the buffers only once the period can't go any lower.
+  if (adaptive_drain_period_ms_ > min_ms) {
+    adaptive_drain_period_ms_ = std::max(adaptive_drain_period_ms_ / 2, min_ms);
+    adjustment.drain_period_ms = adaptive_drain_period_ms_;
+    NotifyDrainAdjustmentToStartedDataSources(adjustment);
+    return;
+  }
+
+  const size_t max_pages =
+      std::min(configured_pages * kMaxAdaptiveBufferFactor,
+               kMaxAdaptiveBufferSizeKb * 1024 / base::kPageSize);
+  for (size_t cpu : hot_cpus) {
+    size_t pages = std::min(cpu_buffer_pages_[cpu] * 2, max_pages);
+    if (pages <= cpu_buffer_pages_[cpu])
+      continue;
+    if (!ftrace_procfs_->SetPerCpuBufferSizeInPages(cpu, pages))
+      continue;
+    cpu_buffer_pages_[cpu] = pages;
+    adjustment.drain_period_ms = adaptive_drain_period_ms_;
+    adjustment.resized_buffer = true;
+    adjustment.cpu = static_cast<uint32_t>(cpu);
+    adjustment.buffer_size_kb =
+        static_cast<uint32_t>(pages * base::kPageSize / 1024);
+    NotifyDrainAdjustmentToStartedDataSources(adjustment);
+  }
+}
+
+void FtraceController::NotifyDrainAdjustmentToStartedDataSources(
+    const FtraceDrainAdjustment& adjustment) {
+  PERFETTO_DLOG("Ftrace drain period %u ms (max fill %u%%)",
+                adjustment.drain_period_ms, adjustment.max_fill_pct);
+  for (FtraceDataSource* data_source : started_data_sources_)
+    data_source->OnFtraceDrainAdjustment(adjustment);
+}
+
 void FtraceController::ClearTrace() {
   ftrace_procfs_->ClearTrace();
 }
@@ -399,13 +555,20 @@ bool FtraceController::AddDataSource(FtraceDataSource* data_source) {
   if (!ValidConfig(data_source->config()))
     return false;
 
+  // SetupConfig() can add events to the translation table, which the worker
+  // threads of the sessions already started are using.
+  std::vector<std::unique_lock<std::mutex>> parsing_locks;
+  for (const auto& cpu_reader : cpu_readers_)
+    parsing_locks.emplace_back(cpu_reader->BlockParsing());
   auto config_id = ftrace_config_muxer_->SetupConfig(data_source->config());
+  parsing_locks.clear();
   if (!config_id)
     return false;
 
   const EventFilter* filter = ftrace_config_muxer_->GetEventFilter(config_id);
   auto it_and_inserted = data_sources_.insert(data_source);
   PERFETTO_DCHECK(it_and_inserted.second);
+  adaptive_drain_period_ms_ = 0;  // The configured period may have changed.
   data_source->Initialize(config_id, filter);
   return true;
 }
@@ -419,18 +582,27 @@ bool FtraceController::StartDataSource(FtraceDataSource* data_source) {
   if (!ftrace_config_muxer_->ActivateConfig(config_id))
     return false;
 
-  started_data_sources_.insert(data_source);
+  // If the readers are already running, hook up the data source to them.
+  // Otherwise StartIfNeeded() will create them with all the started ones.
+  if (started_data_sources_.insert(data_source).second) {
+    for (const auto& cpu_reader : cpu_readers_)
+      cpu_reader->AddDataSource(data_source);
+  }
   StartIfNeeded();
   return true;
 }
 
 void FtraceController::RemoveDataSource(FtraceDataSource* data_source) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
+  // This must happen before RemoveConfig(), which frees the event filter.
+  for (const auto& cpu_reader : cpu_readers_)
+    cpu_reader->RemoveDataSource(data_source);
   started_data_sources_.erase(data_source);
   size_t removed = data_sources_.erase(data_source);
   if (!removed)
     return;  // Can happen if AddDataSource failed (e.g. too many sessions).
   ftrace_config_muxer_->RemoveConfig(data_source->config_id());
+  adaptive_drain_period_ms_ = 0;
   StopIfNeeded();
 }
 
@@ -20,12 +20,14 @@
 #include <stdint.h>
 #include <unistd.h>
 
+#include <array>
 #include <bitset>
 #include <functional>
 #include <map>
 #include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "perfetto/base/gtest_prod_util.h"
 #include "perfetto/base/task_runner.h"
@@ -42,6 +44,7 @@ class FtraceConfigMuxer;
 class FtraceDataSource;
 class FtraceProcfs;
 class ProtoTranslationTable;
+struct FtraceDrainAdjustment;
 struct FtraceStats;
 
 // Method of last resort to reset ftrace state.
@@ -63,7 +66,10 @@ class FtraceController {
   virtual ~FtraceController();
 
   // These two methods are called by CpuReader(s) from their worker threads.
-  static void OnCpuReaderRead(size_t cpu, int generation, FtraceThreadSync*);
+  static void OnCpuReaderRead(size_t cpu,
+                              int generation,
+                              FtraceThreadSync*,
+                              size_t pages_read);
   static void OnCpuReaderFlush(size_t cpu, int generation, FtraceThreadSync*);
 
   void DisableAllEvents();
@@ -113,6 +119,16 @@ class FtraceController {
                           std::unique_lock<std::mutex> = {});
 
   uint32_t GetDrainPeriodMs();
+  uint32_t GetConfiguredDrainPeriodMs();
+
+  // Adaptive drain (FtraceConfig.adaptive_drain): after each drain, looks at
+  // how full the per-cpu buffers got (|pages_read| since the last drain) and
+  // shortens the drain period or grows the buffers of the CPUs close to
+  // overflowing, or lengthens the period if all the CPUs are quiet.
+  bool IsAdaptiveDrainEnabled() const;
+  void AdaptDrainPeriod(const std::array<uint32_t, base::kMaxCpus>& pages_read);
+  void ResetAdaptiveDrain();
+  void NotifyDrainAdjustmentToStartedDataSources(const FtraceDrainAdjustment&);
 
   void StartIfNeeded();
   void StopIfNeeded();
@@ -129,6 +145,13 @@ class FtraceController {
   std::vector<std::unique_ptr<CpuReader>> cpu_readers_;
   std::set<FtraceDataSource*> data_sources_;
   std::set<FtraceDataSource*> started_data_sources_;
+
+  // State of the adaptive drain. The period starts over from the configured
+  // one whenever the set of data sources changes, the buffer sizes only when
+  // the readers are restarted.
+  uint32_t adaptive_drain_period_ms_ = 0;  // 0: use the configured period.
+  std::vector<size_t> cpu_buffer_pages_;   // Empty until the first drain.
+  std::vector<uint64_t> last_overrun_;
   base::WeakPtrFactory<FtraceController> weak_factory_;  // Keep last.
   PERFETTO_THREAD_CHECKER(thread_checker_)
 };
@@ -20,7 +20,10 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <array>
+
 #include "perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "perfetto/trace/ftrace/ftrace_stats.pbzero.h"
 #include "perfetto/trace/trace_packet.pb.h"
 #include "perfetto/trace/trace_packet.pbzero.h"
 #include "src/traced/probes/ftrace/cpu_reader.h"
@@ -223,10 +226,19 @@ class TestFtraceController : public FtraceController,
     int generation = generation_;
     auto* thread_sync = &thread_sync_;
     return [cpu, generation, thread_sync] {
-      FtraceController::OnCpuReaderRead(cpu, generation, thread_sync);
+      FtraceController::OnCpuReaderRead(cpu, generation, thread_sync,
+                                        /*pages_read=*/1);
     };
   }
 
+  // Runs the adaptive drain logic as if |cpu| read |pages_read| pages since
+  // the last drain and all the other CPUs were idle.
+  void AdaptDrainPeriodForTesting(size_t cpu, uint32_t pages_read) {
+    std::array<uint32_t, base::kMaxCpus> pages{};
+    pages[cpu] = pages_read;
+    AdaptDrainPeriod(pages);
+  }
+
   void WaitForData(size_t cpu) {
     for (;;) {
       {
@@ -545,6 +557,79 @@ TEST(FtraceControllerTest, PeriodicDrainConfig) {
   }
 }
 
+TEST(FtraceControllerTest, AdaptiveDrain) {
+  auto controller =
+      CreateTestController(true /* nice runner */, false /* nice procfs */);
+
+  EXPECT_CALL(*controller->procfs(), WriteToFile(_, _)).Times(AnyNumber());
+  EXPECT_CALL(*controller->procfs(), ClearFile(_)).Times(AnyNumber());
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_buffer_size_kb(400);  // 100 pages.
+  config.set_drain_period_ms(100);
+  config.set_adaptive_drain(true);
+  auto data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+  EXPECT_EQ(100u, controller->drain_period_ms());
+
+  // A CPU that fills most of its buffer between drains: first the period
+  // shrinks down to the minimum...
+  controller->AdaptDrainPeriodForTesting(0, 80);
+  EXPECT_EQ(50u, controller->drain_period_ms());
+  controller->AdaptDrainPeriodForTesting(0, 80);
+  controller->AdaptDrainPeriodForTesting(0, 80);
+  controller->AdaptDrainPeriodForTesting(0, 80);
+  EXPECT_EQ(10u, controller->drain_period_ms());
+
+  // ...then its buffer grows, up to 4x the configured size.
+  EXPECT_CALL(*controller->procfs(),
+              WriteToFile("/root/per_cpu/cpu0/buffer_size_kb", "800"));
+  controller->AdaptDrainPeriodForTesting(0, 80);
+  EXPECT_CALL(*controller->procfs(),
+              WriteToFile("/root/per_cpu/cpu0/buffer_size_kb", "1600"));
+  controller->AdaptDrainPeriodForTesting(0, 320);
+  controller->AdaptDrainPeriodForTesting(0, 320);
+  ::testing::Mock::VerifyAndClearExpectations(controller->procfs());
+  EXPECT_EQ(10u, controller->drain_period_ms());
+
+  // In between the thresholds nothing changes.
+  EXPECT_CALL(*controller->procfs(), WriteToFile(_, _)).Times(AnyNumber());
+  controller->AdaptDrainPeriodForTesting(0, 100);
+  EXPECT_EQ(10u, controller->drain_period_ms());
+
+  // Idle CPUs: the period grows back, up to 4x the configured one.
+  controller->AdaptDrainPeriodForTesting(0, 0);
+  EXPECT_EQ(20u, controller->drain_period_ms());
+  for (int i = 0; i < 10; i++)
+    controller->AdaptDrainPeriodForTesting(0, 0);
+  EXPECT_EQ(400u, controller->drain_period_ms());
+}
+
+TEST(FtraceControllerTest, AdaptiveDrainNeedsAllDataSources) {
+  auto controller =
+      CreateTestController(true /* nice runner */, false /* nice procfs */);
+
+  EXPECT_CALL(*controller->procfs(), WriteToFile(_, _)).Times(AnyNumber());
+  EXPECT_CALL(*controller->procfs(), ClearFile(_)).Times(AnyNumber());
+
+  FtraceConfig adaptive_config = CreateFtraceConfig({"group/foo"});
+  adaptive_config.set_adaptive_drain(true);
+  auto adaptive_data_source = controller->AddFakeDataSource(adaptive_config);
+  ASSERT_TRUE(controller->StartDataSource(adaptive_data_source.get()));
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  auto data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+
+  controller->AdaptDrainPeriodForTesting(0, 0);
+  EXPECT_EQ(100u, controller->drain_period_ms());
+
+  // Once the non-adaptive data source goes away the period adapts again.
+  data_source.reset();
+  controller->AdaptDrainPeriodForTesting(0, 0);
+  EXPECT_EQ(200u, controller->drain_period_ms());
+}
+
 TEST(FtraceMetadataTest, Clear) {
   FtraceMetadata metadata;
   metadata.inode_and_device.push_back(std::make_pair(1, 1));
@@ -617,4 +702,32 @@ TEST(FtraceStatsTest, Write) {
   EXPECT_EQ(result.overrun(), 2);
 }
 
+TEST(FtraceStatsTest, WriteDrainAdjustment) {
+  FtraceDrainAdjustment adjustment{};
+  adjustment.reason = FtraceDrainAdjustment::kOverrun;
+  adjustment.timestamp = 1234;
+  adjustment.drain_period_ms = 10;
+  adjustment.max_fill_pct = 100;
+  adjustment.resized_buffer = true;
+  adjustment.cpu = 3;
+  adjustment.buffer_size_kb = 800;
+
+  std::unique_ptr<TraceWriterForTesting> writer =
+      std::unique_ptr<TraceWriterForTesting>(new TraceWriterForTesting());
+  {
+    auto packet = writer->NewTracePacket();
+    adjustment.Write(packet->set_ftrace_stats()->add_drain_adjustments());
+  }
+
+  std::unique_ptr<protos::TracePacket> result_packet = writer->ParseProto();
+  ASSERT_EQ(result_packet->ftrace_stats().drain_adjustments_size(), 1);
+  auto result = result_packet->ftrace_stats().drain_adjustments(0);
+  EXPECT_EQ(result.reason(), protos::FtraceDrainAdjustment::OVERRUN);
+  EXPECT_EQ(result.timestamp(), 1234u);
+  EXPECT_EQ(result.drain_period_ms(), 10u);
+  EXPECT_EQ(result.max_fill_pct(), 100u);
+  EXPECT_EQ(result.cpu(), 3u);
+  EXPECT_EQ(result.buffer_size_kb(), 800u);
+}
+
 }  // namespace perfetto
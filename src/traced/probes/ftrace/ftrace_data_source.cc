@@ -98,6 +98,14 @@ void FtraceDataSource::OnFtraceFlushComplete(FlushRequestID flush_request_id) {
   }
 }
 
+void FtraceDataSource::OnFtraceDrainAdjustment(
+    const FtraceDrainAdjustment& adjustment) {
+  if (!writer_)
+    return;
+  auto packet = writer_->NewTracePacket();
+  adjustment.Write(packet->set_ftrace_stats()->add_drain_adjustments());
+}
+
 void FtraceDataSource::WriteStats() {
   {
     auto before_packet = writer_->NewTracePacket();
@@ -73,6 +73,10 @@ class FtraceDataSource : public ProbesDataSource {
   void Flush(FlushRequestID, std::function<void()> callback) override;
   void OnFtraceFlushComplete(FlushRequestID);
 
+  // Called by FtraceController when it changes the drain period or the size
+  // of a kernel buffer, see FtraceConfig.adaptive_drain.
+  void OnFtraceDrainAdjustment(const FtraceDrainAdjustment&);
+
   FtraceConfigId config_id() const { return config_id_; }
   const FtraceConfig& config() const { return config_; }
   const EventFilter* event_filter() { return event_filter_; }
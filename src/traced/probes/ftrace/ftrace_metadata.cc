@@ -37,9 +37,8 @@ void FtraceMetadata::AddInode(Inode inode_number) {
 #if PERFETTO_DCHECK_IS_ON()
   PERFETTO_DCHECK(seen_device_id);
 #endif
-  static int32_t cached_pid = 0;
-  if (!cached_pid)
-    cached_pid = getpid();
+  // Called concurrently by the CpuReader worker threads.
+  static const int32_t cached_pid = getpid();
 
   PERFETTO_DCHECK(last_seen_common_pid);
   PERFETTO_DCHECK(cached_pid == getpid());
@@ -21,6 +21,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 #include <string>
@@ -136,6 +137,59 @@ bool FtraceProcfs::SetCpuBufferSizeInPages(size_t pages) {
   return WriteNumberToFile(path, pages * (base::kPageSize / 1024ul));
 }
 
+bool FtraceProcfs::SetPerCpuBufferSizeInPages(size_t cpu, size_t pages) {
+  if (pages * base::kPageSize > 1 * 1024 * 1024 * 1024) {
+    PERFETTO_ELOG("Tried to set the per CPU buffer size to more than 1gb.");
+    return false;
+  }
+  std::string path =
+      root_ + "per_cpu/cpu" + std::to_string(cpu) + "/buffer_size_kb";
+  return WriteNumberToFile(path, pages * (base::kPageSize / 1024ul));
+}
+
+bool FtraceProcfs::SetEventFilter(const std::string& group,
+                                  const std::string& name,
+                                  const std::string& filter) {
+  std::string path = root_ + "events/" + group + "/" + name + "/filter";
+  return WriteToFile(path, filter.empty() ? "0" : filter);
+}
+
+bool FtraceProcfs::SetEventPids(const std::vector<int32_t>& pids) {
+  std::string path = root_ + "set_event_pid";
+  if (pids.empty())
+    return ClearFile(path);
+  std::string str;
+  for (int32_t pid : pids) {
+    if (!str.empty())
+      str += " ";
+    str += std::to_string(pid);
+  }
+  return WriteToFile(path, str);
+}
+
+bool FtraceProcfs::SetTracingCpumask(const std::vector<uint32_t>& cpus) {
+  size_t num_cpus = NumberOfCpus();
+  // The mask is a list of comma separated 32 bit words in hex, the most
+  // significant first, e.g. "1,00000003" for the CPUs 0, 1 and 32.
+  std::vector<uint32_t> words((num_cpus + 31) / 32);
+  for (size_t cpu = 0; cpu < num_cpus; cpu++) {
+    if (cpus.empty() ||
+        std::find(cpus.begin(), cpus.end(), cpu) != cpus.end()) {
+      words[cpu / 32] |= 1u << (cpu % 32);
+    }
+  }
+  std::string str;
+  char buf[16];
+  for (size_t i = words.size(); i > 0; i--) {
+    if (str.empty())
+      snprintf(buf, sizeof(buf), "%x", words[i - 1]);
+    else
+      snprintf(buf, sizeof(buf), ",%08x", words[i - 1]);
+    str += buf;
+  }
+  return WriteToFile(root_ + "tracing_cpumask", str);
+}
+
 bool FtraceProcfs::EnableTracing() {
   KernelLogWrite("perfetto: enabled ftrace\n");
   std::string path = root_ + "tracing_on";
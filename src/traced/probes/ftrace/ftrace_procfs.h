@@ -20,6 +20,7 @@
 #include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "perfetto/base/scoped_file.h"
 
@@ -57,6 +58,23 @@ class FtraceProcfs {
   // by the number of CPUs.
   bool SetCpuBufferSizeInPages(size_t pages);
 
+  // Set the ftrace buffer size in pages of the given |cpu| only, leaving the
+  // other CPUs alone.
+  bool SetPerCpuBufferSizeInPages(size_t cpu, size_t pages);
+
+  // Set the filter of the event with the given |group| and |name|, in the
+  // syntax of the kernel (e.g. "prev_pid == 42"). An empty |filter| clears it.
+  bool SetEventFilter(const std::string& group,
+                      const std::string& name,
+                      const std::string& filter);
+
+  // Only trace the events emitted by |pids|. An empty |pids| traces all of
+  // them.
+  bool SetEventPids(const std::vector<int32_t>& pids);
+
+  // Only trace the events of |cpus|. An empty |cpus| traces all of them.
+  bool SetTracingCpumask(const std::vector<uint32_t>& cpus);
+
   // Returns the number of CPUs.
   // This will match the number of tracing/per_cpu/cpuXX directories.
   size_t virtual NumberOfCpus() const;
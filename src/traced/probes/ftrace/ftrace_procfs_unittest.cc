@@ -96,5 +96,29 @@ TEST(FtraceProcfsTest, ParseAvailableClocks) {
   EXPECT_THAT(ftrace.AvailableClocks(), IsEmpty());
 }
 
+TEST(FtraceProcfsTest, SetTracingCpumask) {
+  MockFtraceProcfs ftrace;
+  EXPECT_CALL(ftrace, NumberOfCpus()).WillRepeatedly(Return(40));
+
+  EXPECT_CALL(ftrace, WriteToFile("/root/tracing_cpumask", "ff,ffffffff"))
+      .WillOnce(Return(true));
+  EXPECT_TRUE(ftrace.SetTracingCpumask({}));
+
+  EXPECT_CALL(ftrace, WriteToFile("/root/tracing_cpumask", "1,00000005"))
+      .WillOnce(Return(true));
+  EXPECT_TRUE(ftrace.SetTracingCpumask({0, 2, 32, 64}));
+}
+
+TEST(FtraceProcfsTest, SetEventPids) {
+  MockFtraceProcfs ftrace;
+
+  EXPECT_CALL(ftrace, WriteToFile("/root/set_event_pid", "1 42"))
+      .WillOnce(Return(true));
+  EXPECT_TRUE(ftrace.SetEventPids({1, 42}));
+
+  EXPECT_CALL(ftrace, ClearFile("/root/set_event_pid")).WillOnce(Return(true));
+  EXPECT_TRUE(ftrace.SetEventPids({}));
+}
+
 }  // namespace
 }  // namespace perfetto
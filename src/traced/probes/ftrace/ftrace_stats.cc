@@ -38,4 +38,25 @@ void FtraceCpuStats::Write(protos::pbzero::FtraceCpuStats* writer) const {
   writer->set_read_events(read_events);
 }
 
+void FtraceDrainAdjustment::Write(
+    protos::pbzero::FtraceDrainAdjustment* writer) const {
+  using ProtoReason = protos::pbzero::FtraceDrainAdjustment;
+  static_assert(
+      static_cast<int>(kBufferNearlyFull) ==
+              static_cast<int>(ProtoReason::BUFFER_NEARLY_FULL) &&
+          static_cast<int>(kOverrun) ==
+              static_cast<int>(ProtoReason::OVERRUN) &&
+          static_cast<int>(kIdle) == static_cast<int>(ProtoReason::IDLE),
+      "FtraceDrainAdjustment::Reason is out of sync with the proto");
+  writer->set_reason(
+      static_cast<protos::pbzero::FtraceDrainAdjustment::Reason>(reason));
+  writer->set_timestamp(timestamp);
+  writer->set_drain_period_ms(drain_period_ms);
+  writer->set_max_fill_pct(max_fill_pct);
+  if (resized_buffer) {
+    writer->set_cpu(cpu);
+    writer->set_buffer_size_kb(buffer_size_kb);
+  }
+}
+
 }  // namespace perfetto
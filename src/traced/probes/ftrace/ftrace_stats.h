@@ -27,6 +27,7 @@ namespace protos {
 namespace pbzero {
 class FtraceStats;
 class FtraceCpuStats;
+class FtraceDrainAdjustment;
 }  // namespace pbzero
 }  // namespace protos
 
@@ -44,6 +45,21 @@ struct FtraceCpuStats {
   void Write(protos::pbzero::FtraceCpuStats*) const;
 };
 
+// See FtraceDrainAdjustment in ftrace_stats.proto.
+struct FtraceDrainAdjustment {
+  enum Reason { kBufferNearlyFull = 1, kOverrun, kIdle };
+
+  Reason reason;
+  uint64_t timestamp;
+  uint32_t drain_period_ms;
+  uint32_t max_fill_pct;
+  bool resized_buffer;  // If false, |cpu| and |buffer_size_kb| are unset.
+  uint32_t cpu;
+  uint32_t buffer_size_kb;
+
+  void Write(protos::pbzero::FtraceDrainAdjustment*) const;
+};
+
 struct FtraceStats {
   std::vector<FtraceCpuStats> cpu_stats;
 
@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 
+#include <array>
 #include <bitset>
 #include <condition_variable>
 #include <mutex>
@@ -68,6 +69,11 @@ struct FtraceThreadSync {
   // ftrace data during the read cycle.
   std::bitset<base::kMaxCpus> cpus_to_drain;
 
+  // Number of kernel buffer pages each CpuReader has read during the read
+  // cycles since the last drain. Cleared by the FtraceController when it
+  // drains the CPUs, used to estimate how full the per-cpu buffers get.
+  std::array<uint32_t, base::kMaxCpus> pages_read{};
+
   // This bitmap is cleared by the FtraceController before issuing a kFlush
   // command and set by each CpuReader after they have completed the flush.
   std::bitset<base::kMaxCpus> flush_acks;
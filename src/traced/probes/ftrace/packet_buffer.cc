@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ftrace/packet_buffer.h"
+
+#include <algorithm>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/utils.h"
+#include "perfetto/tracing/core/trace_writer.h"
+
+namespace perfetto {
+
+namespace {
+constexpr size_t kMaxSliceSize = 128 * 1024;
+}  // namespace
+
+PacketBuffer::PacketBuffer()
+    : heap_buffer_(base::kPageSize, kMaxSliceSize),
+      stream_writer_(&heap_buffer_) {
+  heap_buffer_.set_writer(&stream_writer_);
+}
+
+PacketBuffer::~PacketBuffer() = default;
+
+protos::pbzero::TracePacket* PacketBuffer::NewPacket() {
+  EndPacket();
+  packet_.Reset(&stream_writer_);
+  packet_open_ = true;
+  return &packet_;
+}
+
+void PacketBuffer::EndPacket() {
+  if (!packet_open_)
+    return;
+  packet_sizes_.push_back(packet_.Finalize());
+  packet_open_ = false;
+}
+
+void PacketBuffer::MoveInto(TraceWriter* writer) {
+  EndPacket();
+  heap_buffer_.AdjustUsedSizeOfCurrentSlice();
+  const auto& slices = heap_buffer_.slices();
+  auto slice = slices.begin();
+  const uint8_t* ptr = nullptr;
+  const uint8_t* end = nullptr;
+  for (uint32_t size : packet_sizes_) {
+    auto packet = writer->NewTracePacket();
+    while (size > 0) {
+      // Packets can straddle slices. Also, the tail of a slice can be unused
+      // if the stream writer needed a contiguous range for a size field.
+      if (ptr == end) {
+        PERFETTO_CHECK(slice != slices.end());
+        auto range = slice->GetUsedRange();
+        ptr = range.begin;
+        end = range.end;
+        ++slice;
+        continue;
+      }
+      uint32_t chunk_size =
+          std::min(size, static_cast<uint32_t>(end - ptr));
+      packet->AppendRawProtoBytes(ptr, chunk_size);
+      ptr += chunk_size;
+      size -= chunk_size;
+    }
+  }
+  packet_sizes_.clear();
+  heap_buffer_.Reset();
+}
+
+}  // namespace perfetto
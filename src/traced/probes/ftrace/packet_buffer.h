@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FTRACE_PACKET_BUFFER_H_
+#define SRC_TRACED_PROBES_FTRACE_PACKET_BUFFER_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "perfetto/protozero/scattered_stream_writer.h"
+#include "perfetto/trace/trace_packet.pbzero.h"
+
+namespace perfetto {
+
+class TraceWriter;
+
+// Accumulates TracePacket(s) in heap memory, so that they can be encoded on a
+// different thread than the one that owns the TraceWriter they are destined
+// to. CpuReader uses this to turn ftrace pages into protos on its worker
+// thread, as TraceWriter(s) (or, rather, the SharedMemoryArbiter behind them)
+// can be used only on the main thread.
+// This class is not thread safe. The caller must synchronize the two threads.
+class PacketBuffer {
+ public:
+  PacketBuffer();
+  ~PacketBuffer();
+
+  // Starts a new packet, ending the previous one. The returned message is
+  // valid until the next call to NewPacket() or MoveInto().
+  protos::pbzero::TracePacket* NewPacket();
+
+  // Copies all the packets into |writer|, one TracePacket each, and clears
+  // the buffer. The heap memory is kept and reused for the next packets.
+  void MoveInto(TraceWriter* writer);
+
+  size_t num_packets() const {
+    return packet_sizes_.size() + (packet_open_ ? 1 : 0);
+  }
+
+ private:
+  PacketBuffer(const PacketBuffer&) = delete;
+  PacketBuffer& operator=(const PacketBuffer&) = delete;
+
+  void EndPacket();
+
+  protozero::ScatteredHeapBuffer heap_buffer_;
+  protozero::ScatteredStreamWriter stream_writer_;
+  protos::pbzero::TracePacket packet_;
+  bool packet_open_ = false;
+
+  // Sizes of the packets ended so far. Packets are laid out back-to-back in
+  // the used part of the slices of |heap_buffer_|.
+  std::vector<uint32_t> packet_sizes_;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FTRACE_PACKET_BUFFER_H_
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ftrace/packet_buffer.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "src/tracing/core/trace_writer_for_testing.h"
+
+#include "perfetto/trace/ftrace/ftrace.pbzero.h"
+#include "perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "perfetto/trace/ftrace/ftrace_event_bundle.pb.h"
+#include "perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "perfetto/trace/trace_packet.pb.h"
+
+namespace perfetto {
+namespace {
+
+// Writes |num_packets| packets with one print event each. The payload is big
+// enough for packets to straddle the slices of the heap buffer.
+void WritePackets(PacketBuffer* buffer, uint32_t first_pid, int num_packets) {
+  const std::string payload(200, 'x');
+  for (int i = 0; i < num_packets; i++) {
+    auto* bundle = buffer->NewPacket()->set_ftrace_events();
+    bundle->set_cpu(1);
+    auto* event = bundle->add_event();
+    event->set_pid(first_pid + static_cast<uint32_t>(i));
+    event->set_print()->set_buf(payload.data(), payload.size());
+  }
+}
+
+// TraceWriterForTesting::ParseProto() merges all the packets. Merging the
+// bundles concatenates their events, so those can be counted.
+void ExpectEvents(TraceWriterForTesting* writer,
+                  uint32_t first_pid,
+                  int num_events) {
+  auto packet = writer->ParseProto();
+  ASSERT_TRUE(packet);
+  const protos::FtraceEventBundle& bundle = packet->ftrace_events();
+  EXPECT_EQ(1u, bundle.cpu());
+  ASSERT_EQ(num_events, bundle.event_size());
+  for (int i = 0; i < num_events; i++) {
+    EXPECT_EQ(first_pid + static_cast<uint32_t>(i), bundle.event(i).pid());
+    EXPECT_EQ(std::string(200, 'x'), bundle.event(i).print().buf());
+  }
+}
+
+TEST(PacketBufferTest, Empty) {
+  PacketBuffer buffer;
+  EXPECT_EQ(0u, buffer.num_packets());
+  TraceWriterForTesting writer;
+  buffer.MoveInto(&writer);
+  EXPECT_EQ(0u, buffer.num_packets());
+}
+
+TEST(PacketBufferTest, MovesAllPackets) {
+  PacketBuffer buffer;
+  WritePackets(&buffer, 100, 100);
+  EXPECT_EQ(100u, buffer.num_packets());
+
+  TraceWriterForTesting writer;
+  buffer.MoveInto(&writer);
+  EXPECT_EQ(0u, buffer.num_packets());
+  ExpectEvents(&writer, 100, 100);
+}
+
+TEST(PacketBufferTest, ReusedAfterMove) {
+  PacketBuffer buffer;
+  for (int round = 0; round < 3; round++) {
+    uint32_t first_pid = static_cast<uint32_t>(round) * 1000;
+    WritePackets(&buffer, first_pid, 50 + round * 50);
+    TraceWriterForTesting writer;
+    buffer.MoveInto(&writer);
+    ExpectEvents(&writer, first_pid, 50 + round * 50);
+  }
+}
+
+}  // namespace
+}  // namespace perfetto
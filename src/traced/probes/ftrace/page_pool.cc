@@ -16,40 +16,92 @@
 
 #include "src/traced/probes/ftrace/page_pool.h"
 
-#include <array>
+#include <algorithm>
 
 namespace perfetto {
 
 namespace {
-constexpr size_t kMaxFreelistBlocks = 128;  // 128 * 32 * 4KB = 16MB.
-}
+// Number of consecutive commits of at most one block after which the spare
+// blocks are madvise()d. CpuReader commits once per read cycle, i.e. about
+// every drain period.
+constexpr uint32_t kIdleCommitsBeforeRelease = 10;
+}  // namespace
+
+constexpr size_t PagePool::kReadyRingBlocks;
+constexpr size_t PagePool::kMaxFreelistBlocks;
 
 void PagePool::NewPageBlock() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (freelist_.empty()) {
-    write_queue_.emplace_back(PageBlock::Create());
+  blocks_since_commit_++;
+  if (spare_blocks_.empty()) {
+    base::Optional<PageBlock> block = free_ring_.Pop();
+    if (block) {
+      write_queue_.emplace_back(std::move(*block));
+    } else {
+      write_queue_.emplace_back(PageBlock::Create());
+    }
   } else {
-    write_queue_.emplace_back(std::move(freelist_.back()));
-    freelist_.pop_back();
+    write_queue_.emplace_back(std::move(spare_blocks_.back()));
+    spare_blocks_.pop_back();
   }
   PERFETTO_DCHECK(write_queue_.back().size() == 0);
 }
 
-void PagePool::EndRead(std::vector<PageBlock> page_blocks) {
-  PERFETTO_DCHECK_THREAD(reader_thread_);
-  for (PageBlock& page_block : page_blocks)
-    page_block.Clear();
+void PagePool::CommitWrittenPages() {
+  PERFETTO_DCHECK_THREAD(writer_thread_);
+  size_t committed = 0;
+  for (; committed < write_queue_.size(); committed++) {
+    if (!ready_ring_.Push(&write_queue_[committed]))
+      break;
+  }
+  write_queue_.erase(write_queue_.begin(),
+                     write_queue_.begin() + static_cast<ptrdiff_t>(committed));
+
+  idle_commits_ = blocks_since_commit_ > 1 ? 0 : idle_commits_ + 1;
+  blocks_since_commit_ = 0;
+  if (idle_commits_ == kIdleCommitsBeforeRelease)
+    ReleaseSpareBlocks();
+}
+
+void PagePool::ReleaseSpareBlocks() {
+  PERFETTO_DCHECK_THREAD(writer_thread_);
+  for (;;) {
+    base::Optional<PageBlock> block = free_ring_.Pop();
+    if (!block)
+      break;
+    spare_blocks_.emplace_back(std::move(*block));
+  }
 
-  std::lock_guard<std::mutex> lock(mutex_);
-  freelist_.insert(freelist_.end(),
-                   std::make_move_iterator(page_blocks.begin()),
-                   std::make_move_iterator(page_blocks.end()));
+  // Even if the spare blocks don't waste any resident memory once released,
+  // let's avoid that in pathological cases we keep accumulating virtual
+  // address space reservations.
+  if (spare_blocks_.size() > kMaxFreelistBlocks) {
+    spare_blocks_.erase(spare_blocks_.begin() + kMaxFreelistBlocks,
+                        spare_blocks_.end());
+  }
+  for (PageBlock& page_block : spare_blocks_)
+    page_block.ReleaseMemory();
+}
 
-  // Even if blocks in the freelist don't waste any resident memory (because
-  // the Clear() call above madvise()s them) let's avoid that in pathological
-  // cases we keep accumulating virtual address space reservations.
-  if (freelist_.size() > kMaxFreelistBlocks)
-    freelist_.erase(freelist_.begin() + kMaxFreelistBlocks, freelist_.end());
+const std::vector<PagePool::PageBlock>& PagePool::BeginRead() {
+  PERFETTO_DCHECK_THREAD(reader_thread_);
+  PERFETTO_DCHECK(read_batch_.empty());
+  for (;;) {
+    base::Optional<PageBlock> block = ready_ring_.Pop();
+    if (!block)
+      break;
+    read_batch_.emplace_back(std::move(*block));
+  }
+  return read_batch_;
+}
+
+void PagePool::EndRead() {
+  PERFETTO_DCHECK_THREAD(reader_thread_);
+  // Blocks that don't fit in the free ring are unmapped straight away.
+  for (PageBlock& page_block : read_batch_) {
+    page_block.Clear();
+    free_ring_.Push(&page_block);
+  }
+  read_batch_.clear();
 }
 
 }  // namespace perfetto
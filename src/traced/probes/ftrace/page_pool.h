@@ -19,7 +19,8 @@
 
 #include <stdint.h>
 
-#include <mutex>
+#include <array>
+#include <atomic>
 #include <vector>
 
 #include "perfetto/base/logging.h"
@@ -33,13 +34,13 @@ namespace perfetto {
 // This class is a page pool tailored around the needs of the ftrace CpuReader.
 // It has two responsibilities:
 // 1) A cheap bump-pointer page allocator for the writing side of CpuReader.
-// 2) A thread-safe producer/consumer queue to synchronize the read/write
+// 2) A lock-free producer/consumer queue to synchronize the read/write
 //    threads of CpuReader.
-// For context, CpuReader (and hence this class) is used on two threads:
-// (1) A worker thread that writes into the buffer and (2) the main thread which
-// reads all the content in big batches and turn them into protos.
-// There is at most one thread writing and at most one thread reading. In rare
-// circumstances they can be active At the same time.
+// For context, CpuReader writes into the buffer while reading the ftrace pipe
+// and then reads all the content in one batch to turn it into protos. Both
+// happen on the CpuReader worker thread.
+// There is at most one thread writing and at most one thread reading. The
+// class doesn't rely on them being the same thread.
 // This class is optimized for the following use case:
 // - Most of the times CpuReader wants to write 4096 bytes. In some rare cases
 //   (read() during flush) it wants to write < 4096 bytes.
@@ -52,8 +53,9 @@ namespace perfetto {
 //   cannot predict the size of the pool, unless we accept a very high bound.
 //   In extreme, yet rare, conditions, CpuReader will read the whole per-cpu
 //   ftrace buffer, while the reader is still reading the previous batch.
-// - Write burst should not be too frequent, so once they are over it's worth
-//   spending some extra cycles to release the memory.
+// - Write bursts come and go with the load. Giving the memory back to the
+//   kernel after each burst costs a madvise() and a page fault per page on
+//   the next one, so it's done only once the writer has been idle for a while.
 // - The reader side always wants to read *all* the written pages in one batch.
 //   While this happens though, the write might want to write more.
 //
@@ -62,14 +64,17 @@ namespace perfetto {
 // unit of memory allocation and frees. Pages within one block are cheaply
 // allocated with a simple bump-pointer allocator.
 //
-//      [      Writer (thread worker)    ] | [    Reader (main thread)   ]
+//      [      Writer (read/splice)      ] | [      Reader (parsing)     ]
 //                                  ~~~~~~~~~~~~~~~~~~~~~
-//      +---> write queue ------------> ready queue --+
-//      |                                             |
-//      +------------------------------- freelist <---+
+//      +---> write queue ------------> ready ring ---> read batch --+
+//      |                                                           |
+//      +--- spare blocks <------------ free ring <-----------------+
 //                                  ~~~~~~~~~~~~~~~~~~~~~
-//                                  ~  mutex protected  ~
+//                                  ~ single-producer / ~
+//                                  ~ single-consumer   ~
 //                                  ~~~~~~~~~~~~~~~~~~~~~
+// The two rings are the only state shared by the two threads. Everything else
+// is owned by one side.
 class PagePool {
  public:
   class PageBlock {
@@ -98,12 +103,21 @@ class PagePool {
     void NextPage() {
       PERFETTO_DCHECK(!IsFull());
       size_++;
+      resident_ = true;
     }
 
-    // Releases memory of the block and marks it available for reuse.
-    void Clear() {
-      size_ = 0;
+    // Marks the block available for reuse. The memory stays resident, the
+    // next writes will overwrite it.
+    void Clear() { size_ = 0; }
+
+    // Gives the memory of the block back to the kernel, if it was written
+    // since the last call.
+    void ReleaseMemory() {
+      PERFETTO_DCHECK(size_ == 0);
+      if (!resident_)
+        return;
       mem_.AdviseDontNeed(mem_.Get(), kBlockSize);
+      resident_ = false;
     }
 
    private:
@@ -113,6 +127,7 @@ class PagePool {
 
     base::PagedMemory mem_;
     size_t size_ = 0;
+    bool resident_ = false;
   };
 
   PagePool() {
@@ -139,47 +154,87 @@ class PagePool {
     write_queue_.back().NextPage();
   }
 
-  // Makes all written pages available to the reader.
-  void CommitWrittenPages() {
-    PERFETTO_DCHECK_THREAD(writer_thread_);
-    std::lock_guard<std::mutex> lock(mutex_);
-    read_queue_.insert(read_queue_.end(),
-                       std::make_move_iterator(write_queue_.begin()),
-                       std::make_move_iterator(write_queue_.end()));
-    write_queue_.clear();
-  }
+  // Makes all written pages available to the reader. Also releases the memory
+  // of the spare blocks once the writer has been idle for a while.
+  void CommitWrittenPages();
 
-  // Moves ownership of all the page blocks in the read queue to the caller.
-  // The caller is expected to move them back after reading through EndRead().
-  // PageBlocks will be freed if the caller doesn't call EndRead().
-  std::vector<PageBlock> BeginRead() {
-    PERFETTO_DCHECK_THREAD(reader_thread_);
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto res = std::move(read_queue_);
-    read_queue_.clear();
-    return res;
-  }
+  // Returns all the page blocks committed so far. They are owned by the pool
+  // and stay valid until EndRead(), which must be called before the next
+  // BeginRead().
+  const std::vector<PageBlock>& BeginRead();
 
-  // Returns the page blocks borrowed for read and makes them available for
-  // reuse. This allows the writer to avoid doing syscalls after the initial
-  // writes.
-  void EndRead(std::vector<PageBlock> page_blocks);
+  // Makes the page blocks returned by BeginRead() available for reuse. This
+  // allows the writer to avoid doing syscalls after the initial writes.
+  void EndRead();
 
-  size_t freelist_size_for_testing() const { return freelist_.size(); }
+  size_t freelist_size_for_testing() const {
+    return free_ring_.size() + spare_blocks_.size();
+  }
 
  private:
+  // Single-producer/single-consumer queue of PageBlock(s), with a fixed
+  // capacity. Push() and Pop() never block: they fail if the ring is full or
+  // empty, respectively.
+  template <size_t kCapacity>
+  class BlockRing {
+   public:
+    // Called only by the producer.
+    bool Push(PageBlock* block) {
+      uint64_t wr = write_pos_.load(std::memory_order_relaxed);
+      uint64_t rd = read_pos_.load(std::memory_order_acquire);
+      if (wr - rd >= kCapacity)
+        return false;
+      slots_[wr % kCapacity] = std::move(*block);
+      write_pos_.store(wr + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Called only by the consumer.
+    base::Optional<PageBlock> Pop() {
+      uint64_t rd = read_pos_.load(std::memory_order_relaxed);
+      uint64_t wr = write_pos_.load(std::memory_order_acquire);
+      if (rd == wr)
+        return base::nullopt;
+      base::Optional<PageBlock>& slot = slots_[rd % kCapacity];
+      base::Optional<PageBlock> block = std::move(slot);
+      slot.reset();
+      read_pos_.store(rd + 1, std::memory_order_release);
+      return block;
+    }
+
+    size_t size() const {
+      return static_cast<size_t>(write_pos_.load(std::memory_order_acquire) -
+                                 read_pos_.load(std::memory_order_acquire));
+    }
+
+   private:
+    std::array<base::Optional<PageBlock>, kCapacity> slots_;
+    std::atomic<uint64_t> write_pos_{0};
+    std::atomic<uint64_t> read_pos_{0};
+  };
+
+  // 512 * 128 KB = 64 MB, the largest per-cpu ftrace buffer we set up. Should
+  // the reader fall behind by more than that, the writer holds on to the
+  // blocks that didn't fit and retries on the next commit.
+  static constexpr size_t kReadyRingBlocks = 512;
+  static constexpr size_t kMaxFreelistBlocks = 128;  // 128 * 128 KB = 16 MB.
+
   PagePool(const PagePool&) = delete;
   PagePool& operator=(const PagePool&) = delete;
   void NewPageBlock();
+  void ReleaseSpareBlocks();
 
   PERFETTO_THREAD_CHECKER(writer_thread_)
-  std::vector<PageBlock> write_queue_;  // Accessed exclusively by the writer.
+  std::vector<PageBlock> write_queue_;   // Accessed exclusively by the writer.
+  std::vector<PageBlock> spare_blocks_;  // Accessed exclusively by the writer.
+  size_t blocks_since_commit_ = 0;       // Accessed exclusively by the writer.
+  uint32_t idle_commits_ = 0;            // Accessed exclusively by the writer.
 
-  std::mutex mutex_;  // Protects both the read queue and the freelist.
+  BlockRing<kReadyRingBlocks> ready_ring_;   // Writer -> reader.
+  BlockRing<kMaxFreelistBlocks> free_ring_;  // Reader -> writer.
 
   PERFETTO_THREAD_CHECKER(reader_thread_)
-  std::vector<PageBlock> read_queue_;  // Accessed by both threads.
-  std::vector<PageBlock> freelist_;    // Accessed by both threads.
+  std::vector<PageBlock> read_batch_;  // Accessed exclusively by the reader.
 };
 
 }  // namespace perfetto
@@ -16,6 +16,9 @@
 
 #include "src/traced/probes/ftrace/page_pool.h"
 
+#include <string.h>
+
+#include <algorithm>
 #include <array>
 #include <mutex>
 #include <random>
@@ -29,8 +32,10 @@ namespace {
 
 TEST(PagePoolTest, SingleThreaded) {
   PagePool pool;
-  for (int i = 0; i < 2; i++)
+  for (int i = 0; i < 2; i++) {
     ASSERT_TRUE(pool.BeginRead().empty());
+    pool.EndRead();
+  }
 
   for (int repeat = 0; repeat < 3; repeat++) {
     for (uint32_t seed = 0; seed < 6; seed++) {
@@ -45,10 +50,11 @@ TEST(PagePoolTest, SingleThreaded) {
 
     // No write should be visible until the CommitWrittenPages() call.
     ASSERT_TRUE(pool.BeginRead().empty());
+    pool.EndRead();
 
     pool.CommitWrittenPages();
 
-    auto blocks = pool.BeginRead();
+    const auto& blocks = pool.BeginRead();
     ASSERT_EQ(blocks.size(), 1);
     ASSERT_EQ(blocks[0].size(), 5);
     for (uint32_t i = 0; i < blocks[0].size(); i++) {
@@ -60,7 +66,7 @@ TEST(PagePoolTest, SingleThreaded) {
       EXPECT_STREQ(page, expected);
     }
 
-    pool.EndRead(std::move(blocks));
+    pool.EndRead();
     ASSERT_EQ(pool.freelist_size_for_testing(), 1);
   }
 }
@@ -92,7 +98,7 @@ TEST(PagePoolTest, MultiThreaded) {
 
   auto reader_fn = [&pool, &expected_pages] {
     for (size_t page_idx = 0; page_idx < expected_pages.size();) {
-      auto blocks = pool.BeginRead();
+      const auto& blocks = pool.BeginRead();
       for (const auto& block : blocks) {
         for (size_t i = 0; i < block.size(); i++) {
           const char* page = reinterpret_cast<const char*>(block.At(i));
@@ -101,7 +107,7 @@ TEST(PagePoolTest, MultiThreaded) {
           page_idx++;
         }
       }
-      pool.EndRead(std::move(blocks));
+      pool.EndRead();
     }
   };
 
@@ -111,5 +117,66 @@ TEST(PagePoolTest, MultiThreaded) {
   reader.join();
 }
 
+TEST(PagePoolTest, ReleasesSpareBlocksWhenIdle) {
+  PagePool pool;
+
+  // A burst that spans several blocks.
+  for (size_t i = 0; i < 3 * PagePool::PageBlock::kPagesPerBlock; i++) {
+    pool.BeginWrite()[0] = 1;
+    pool.EndWrite();
+  }
+  pool.CommitWrittenPages();
+  ASSERT_EQ(pool.BeginRead().size(), 3);
+  pool.EndRead();
+  ASSERT_EQ(pool.freelist_size_for_testing(), 3);
+
+  // Quiet cycles, of at most one page each, reuse the spare blocks and don't
+  // lose any of them when they are released.
+  for (int cycle = 0; cycle < 20; cycle++) {
+    if (cycle % 2) {
+      pool.BeginWrite()[0] = 2;
+      pool.EndWrite();
+    }
+    pool.CommitWrittenPages();
+    const auto& blocks = pool.BeginRead();
+    ASSERT_EQ(blocks.size(), cycle % 2 ? 1u : 0u);
+    if (!blocks.empty()) {
+      ASSERT_EQ(blocks[0].size(), 1);
+      ASSERT_EQ(blocks[0].At(0)[0], 2);
+    }
+    pool.EndRead();
+    ASSERT_EQ(pool.freelist_size_for_testing(), 3);
+  }
+}
+
+TEST(PagePoolTest, ReaderFallsBehind) {
+  PagePool pool;
+
+  // Commit more blocks than the ready ring holds without reading them. The
+  // ones that don't fit become visible after the following commits.
+  const size_t kBlocks = 600;
+  for (size_t i = 0; i < kBlocks; i++) {
+    uint8_t* page = pool.BeginWrite();
+    memcpy(page, &i, sizeof(i));
+    pool.EndWrite();
+    pool.CommitWrittenPages();
+  }
+
+  size_t next = 0;
+  while (next < kBlocks) {
+    const auto& blocks = pool.BeginRead();
+    ASSERT_FALSE(blocks.empty());
+    for (const auto& block : blocks) {
+      for (size_t i = 0; i < block.size(); i++) {
+        size_t value = 0;
+        memcpy(&value, block.At(i), sizeof(value));
+        ASSERT_EQ(value, next++);
+      }
+    }
+    pool.EndRead();
+    pool.CommitWrittenPages();
+  }
+}
+
 }  // namespace
 }  // namespace perfetto
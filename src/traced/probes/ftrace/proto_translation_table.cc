@@ -17,6 +17,7 @@
 #include "src/traced/probes/ftrace/proto_translation_table.h"
 
 #include <regex.h>
+#include <string.h>
 
 #include <algorithm>
 
@@ -147,6 +148,36 @@ uint16_t MergeFields(const std::vector<FtraceEvent::Field>& ftrace_fields,
   return fields_end;
 }
 
+bool MatchesLayout(const EventDecoder& decoder, const Event& event) {
+  if (decoder.fields.size() != event.fields.size())
+    return false;
+  for (size_t i = 0; i < event.fields.size(); i++) {
+    const EventDecoder::Field& expected = decoder.fields[i];
+    const Field& actual = event.fields[i];
+    if (expected.proto_field_id != actual.proto_field_id ||
+        expected.ftrace_offset != actual.ftrace_offset ||
+        expected.ftrace_size != actual.ftrace_size ||
+        expected.strategy != actual.strategy) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Returns the decoder generated for exactly the layout of |event| on this
+// kernel, or nullptr.
+EventDecoderFunction FindEventDecoder(const std::vector<EventDecoder>& decoders,
+                                      const Event& event) {
+  for (const EventDecoder& decoder : decoders) {
+    if (strcmp(decoder.group, event.group) == 0 &&
+        strcmp(decoder.name, event.name) == 0 &&
+        MatchesLayout(decoder, event)) {
+      return decoder.decode;
+    }
+  }
+  return nullptr;
+}
+
 bool Contains(const std::string& haystack, const std::string& needle) {
   return haystack.find(needle) != std::string::npos;
 }
@@ -412,6 +443,27 @@ ProtoTranslationTable::ProtoTranslationTable(
     name_to_events_[event.name].push_back(&events_.at(event.ftrace_event_id));
     group_to_events_[event.group].push_back(&events_.at(event.ftrace_event_id));
   }
+  BindEventDecoders();
+  compact_sched_format_ =
+      ValidateFormatForCompactSched(events_, common_fields_);
+}
+
+void ProtoTranslationTable::BindEventDecoders() {
+  const std::vector<EventDecoder> decoders = GetStaticEventDecoders();
+  event_decoders_.assign(events_.size(), nullptr);
+  for (const Event& event : events_) {
+    if (!event.ftrace_event_id)
+      continue;
+    event_decoders_[event.ftrace_event_id] = FindEventDecoder(decoders, event);
+  }
+}
+
+void ProtoTranslationTable::SetEventDecodersEnabledForTesting(bool enabled) {
+  if (enabled) {
+    BindEventDecoders();
+  } else {
+    event_decoders_.clear();
+  }
 }
 
 const Event* ProtoTranslationTable::GetOrCreateEvent(
@@ -26,6 +26,9 @@
 #include <vector>
 
 #include "perfetto/base/scoped_file.h"
+#include "src/traced/probes/ftrace/compact_sched.h"
+#include "src/traced/probes/ftrace/event_decoders.h"
+#include "src/traced/probes/ftrace/event_field_filter.h"
 #include "src/traced/probes/ftrace/event_info.h"
 #include "src/traced/probes/ftrace/format_parser.h"
 
@@ -119,6 +122,21 @@ class ProtoTranslationTable {
     return &events_.at(id);
   }
 
+  // Returns the generated decoder for the event, if the layout of the event
+  // matches one of the layouts decoders were generated for.
+  EventDecoderFunction GetEventDecoderById(size_t id) const {
+    return id < event_decoders_.size() ? event_decoders_[id] : nullptr;
+  }
+
+  // Allows to compare the generated decoders with the generic parsing code.
+  void SetEventDecodersEnabledForTesting(bool enabled);
+
+  // Where the fields needed by FtraceConfig.compact_sched are, if the events
+  // have a layout it supports.
+  const CompactSchedEventFormat& compact_sched_format() const {
+    return compact_sched_format_;
+  }
+
   size_t EventToFtraceId(const GroupAndName& group_and_name) const {
     if (!group_and_name_to_event_.count(group_and_name))
       return 0;
@@ -158,6 +176,9 @@ class ProtoTranslationTable {
   // Store strings so they can be read when writing the trace output.
   const char* InternString(const std::string& str);
 
+  // Looks up the generated decoder, if any, of each of the events.
+  void BindEventDecoders();
+
   uint16_t CreateGenericEventField(const FtraceEvent::Field& ftrace_field,
                                    Event& event);
 
@@ -168,6 +189,8 @@ class ProtoTranslationTable {
   std::map<std::string, std::vector<const Event*>> name_to_events_;
   std::map<std::string, std::vector<const Event*>> group_to_events_;
   std::vector<Field> common_fields_;
+  std::vector<EventDecoderFunction> event_decoders_;  // Indexed by event id.
+  CompactSchedEventFormat compact_sched_format_;
   FtracePageHeaderSpec ftrace_page_header_spec_{};
   std::set<std::string> interned_strings_;
 };
@@ -188,11 +211,27 @@ class EventFilter {
   std::set<size_t> GetEnabledEvents() const;
   void EnableEventsFrom(const EventFilter&);
 
+  // Null unless some of the kernel-side filters of the config have to be
+  // applied again in userspace, see FtraceConfigMuxer.
+  const UserspaceFilter* userspace_filter() const {
+    return userspace_filter_.get();
+  }
+  void set_userspace_filter(std::unique_ptr<UserspaceFilter> filter) {
+    userspace_filter_ = std::move(filter);
+  }
+
+  // Whether sched_switch and sched_waking are written in the compact format.
+  // Off when the config filters sched_switch, see FtraceConfigMuxer.
+  bool compact_sched() const { return compact_sched_; }
+  void set_compact_sched(bool compact_sched) { compact_sched_ = compact_sched; }
+
  private:
   EventFilter(const EventFilter&) = delete;
   EventFilter& operator=(const EventFilter&) = delete;
 
   std::vector<bool> enabled_ids_;
+  std::unique_ptr<UserspaceFilter> userspace_filter_;
+  bool compact_sched_ = false;
 };
 
 }  // namespace perfetto
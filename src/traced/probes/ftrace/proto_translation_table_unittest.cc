@@ -451,6 +451,109 @@ print fmt: "some format")"));
   EXPECT_EQ(uint_field.ftrace_offset, 33);
 }
 
+TEST_P(AllTranslationTableTest, EventDecoders) {
+  size_t sched_switch_id =
+      table_->EventToFtraceId(GroupAndName("sched", "sched_switch"));
+  size_t print_id = table_->EventToFtraceId(GroupAndName("ftrace", "print"));
+  size_t ext4_id =
+      table_->EventToFtraceId(GroupAndName("ext4", "ext4_da_write_begin"));
+  EXPECT_TRUE(table_->GetEventDecoderById(sched_switch_id));
+  EXPECT_TRUE(table_->GetEventDecoderById(print_id));
+  EXPECT_NE(table_->GetEventDecoderById(sched_switch_id),
+            table_->GetEventDecoderById(print_id));
+  EXPECT_FALSE(table_->GetEventDecoderById(ext4_id));
+  EXPECT_FALSE(table_->GetEventDecoderById(0));
+
+  table_->SetEventDecodersEnabledForTesting(false);
+  EXPECT_FALSE(table_->GetEventDecoderById(sched_switch_id));
+  table_->SetEventDecodersEnabledForTesting(true);
+  EXPECT_TRUE(table_->GetEventDecoderById(sched_switch_id));
+}
+
+TEST_P(AllTranslationTableTest, CompactSchedFormat) {
+  const CompactSchedEventFormat& format = table_->compact_sched_format();
+  EXPECT_EQ(4u, format.common_pid_offset);
+  const CompactSchedSwitchFormat& sched_switch = format.sched_switch;
+  EXPECT_EQ(table_->EventToFtraceId(GroupAndName("sched", "sched_switch")),
+            sched_switch.event_id);
+  EXPECT_EQ(16u, sched_switch.next_comm_size);
+  EXPECT_EQ(sched_switch.next_comm_offset + 16u, sched_switch.next_pid_offset);
+  EXPECT_EQ(sched_switch.next_pid_offset + 4u, sched_switch.next_prio_offset);
+  EXPECT_EQ(4u, sched_switch.prev_state_size);
+  EXPECT_LE(sched_switch.next_prio_offset + 4u, sched_switch.size);
+
+  // None of these kernels has sched_waking.
+  EXPECT_FALSE(table_->GetEvent(GroupAndName("sched", "sched_waking")));
+  EXPECT_EQ(0u, format.sched_waking.event_id);
+}
+
+TEST(TranslationTableTest, CompactSchedFormatWalleye) {
+  std::string path =
+      "src/traced/probes/ftrace/test/data/"
+      "android_walleye_OPM5.171019.017.A1_4.4.88/";
+  FtraceProcfs ftrace_procfs(path);
+  auto table = ProtoTranslationTable::Create(
+      &ftrace_procfs, GetStaticEventInfo(), GetStaticCommonFieldsInfo());
+  PERFETTO_CHECK(table);
+  const CompactSchedEventFormat& format = table->compact_sched_format();
+  EXPECT_EQ(table->EventToFtraceId(GroupAndName("sched", "sched_switch")),
+            format.sched_switch.event_id);
+  EXPECT_EQ(8u, format.sched_switch.prev_state_size);
+  EXPECT_EQ(32u, format.sched_switch.prev_state_offset);
+  EXPECT_EQ(40u, format.sched_switch.next_comm_offset);
+  EXPECT_EQ(56u, format.sched_switch.next_pid_offset);
+  EXPECT_EQ(60u, format.sched_switch.next_prio_offset);
+
+  const CompactSchedWakingFormat& sched_waking = format.sched_waking;
+  EXPECT_EQ(table->EventToFtraceId(GroupAndName("sched", "sched_waking")),
+            sched_waking.event_id);
+  EXPECT_NE(0u, sched_waking.event_id);
+  EXPECT_EQ(8u, sched_waking.comm_offset);
+  EXPECT_EQ(16u, sched_waking.comm_size);
+  EXPECT_EQ(24u, sched_waking.pid_offset);
+  EXPECT_EQ(28u, sched_waking.prio_offset);
+  EXPECT_EQ(36u, sched_waking.target_cpu_offset);
+}
+
+TEST(TranslationTableTest, NoEventDecoderForUnknownLayout) {
+  MockFtraceProcfs ftrace;
+  ON_CALL(ftrace, ReadPageHeaderFormat())
+      .WillByDefault(Return(
+          R"(	field: u64 timestamp;	offset:0;	size:8;	signed:0;
+	field: local_t commit;	offset:8;	size:4;	signed:1;
+	field: int overwrite;	offset:8;	size:1;	signed:1;
+	field: char data;	offset:16;	size:4080;	signed:0;)"));
+  ON_CALL(ftrace, ReadEventFormat(_, _)).WillByDefault(Return(""));
+  // Same as on e.g. walleye, but for the extra field before next_comm.
+  ON_CALL(ftrace, ReadEventFormat("sched", "sched_switch"))
+      .WillByDefault(Return(R"(name: sched_switch
+ID: 68
+format:
+	field:unsigned short common_type;	offset:0;	size:2;	signed:0;
+	field:unsigned char common_flags;	offset:2;	size:1;	signed:0;
+	field:unsigned char common_preempt_count;	offset:3;	size:1;	signed:0;
+	field:int common_pid;	offset:4;	size:4;	signed:1;
+
+	field:char prev_comm[16];	offset:8;	size:16;	signed:0;
+	field:pid_t prev_pid;	offset:24;	size:4;	signed:1;
+	field:int prev_prio;	offset:28;	size:4;	signed:1;
+	field:long prev_state;	offset:32;	size:8;	signed:1;
+	field:int extra;	offset:40;	size:4;	signed:1;
+	field:char next_comm[16];	offset:44;	size:16;	signed:0;
+	field:pid_t next_pid;	offset:60;	size:4;	signed:1;
+	field:int next_prio;	offset:64;	size:4;	signed:1;
+
+print fmt: "some format")"));
+  EXPECT_CALL(ftrace, ReadPageHeaderFormat()).Times(AnyNumber());
+  EXPECT_CALL(ftrace, ReadEventFormat(_, _)).Times(AnyNumber());
+
+  auto table = ProtoTranslationTable::Create(&ftrace, GetStaticEventInfo(),
+                                             GetStaticCommonFieldsInfo());
+  PERFETTO_CHECK(table);
+  ASSERT_TRUE(table->GetEventById(68));
+  EXPECT_FALSE(table->GetEventDecoderById(68));
+}
+
 TEST(EventFilterTest, EnableEventsFrom) {
   EventFilter filter;
   filter.AddEnabledEvent(1);
@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/unix_task_runner.h"
 #include "perfetto/traced/traced.h"
@@ -27,7 +28,20 @@
 #include "src/traced/probes/probes_producer.h"
 #include "src/tracing/ipc/default_socket.h"
 
+#if PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
+#include "perfetto/base/epoll_task_runner.h"
+#endif
+
 namespace perfetto {
+namespace {
+
+#if PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
+using PlatformTaskRunner = base::EpollTaskRunner;
+#else
+using PlatformTaskRunner = base::UnixTaskRunner;
+#endif
+
+}  // namespace
 
 int __attribute__((visibility("default"))) ProbesMain(int argc, char** argv) {
   static struct option long_options[] = {
@@ -67,7 +81,7 @@ int __attribute__((visibility("default"))) ProbesMain(int argc, char** argv) {
     PERFETTO_DCHECK(res == 0);
   }
 
-  base::UnixTaskRunner task_runner;
+  PlatformTaskRunner task_runner;
   ProbesProducer producer;
   producer.ConnectWithRetries(GetProducerSocket(), &task_runner);
   task_runner.Run();
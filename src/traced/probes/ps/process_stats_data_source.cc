@@ -16,7 +16,12 @@
 
 #include "src/traced/probes/ps/process_stats_data_source.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <utility>
@@ -75,9 +80,22 @@ inline int ToInt(const std::string& str) {
   return atoi(str.c_str());
 }
 
-inline uint32_t ToU32(const char* str) {
-  return static_cast<uint32_t>(strtol(str, nullptr, 10));
-}
+// /proc/[pid]/status is usually ~1-2 KB.
+constexpr size_t kReadBufSize = 16 * 1024;
+
+// Above this the status files are reopened at each poll rather than cached,
+// not to run out of fds on hosts with a lot of processes. The cap is lowered
+// to a quarter of RLIMIT_NOFILE, which is shared with the other data sources.
+constexpr size_t kMaxStatusFds = 256;
+
+// The default ProcessStatsConfig.proc_stats_keyframe_interval.
+constexpr uint32_t kDefaultKeyframeInterval = 10;
+
+// The keys of the MemCounters fields in /proc/[pid]/status, in the same order.
+constexpr const char* kMemCounterKeys[] = {
+    "VmSize", "VmLck", "VmHWM", "VmRSS", "RssAnon", "RssFile", "RssShmem",
+    "VmSwap",
+};
 
 }  // namespace
 
@@ -95,6 +113,13 @@ ProcessStatsDataSource::ProcessStatsDataSource(
       record_thread_names_(config.process_stats_config().record_thread_names()),
       dump_all_procs_on_start_(
           config.process_stats_config().scan_all_processes_on_start()),
+      incremental_scan_(
+          config.process_stats_config().proc_stats_incremental_scan()),
+      delta_encoding_(
+          config.process_stats_config().proc_stats_delta_encoding()),
+      delta_threshold_kb_(
+          config.process_stats_config().proc_stats_delta_threshold_kb()),
+      read_buf_(base::PagedMemory::Allocate(kReadBufSize)),
       weak_factory_(this) {
   const auto& ps_config = config.process_stats_config();
   const auto& quirks = ps_config.quirks();
@@ -108,6 +133,15 @@ ProcessStatsDataSource::ProcessStatsDataSource(
                   poll_period_ms_);
     poll_period_ms_ = 100;
   }
+  keyframe_interval_ = ps_config.proc_stats_keyframe_interval();
+  if (!keyframe_interval_)
+    keyframe_interval_ = kDefaultKeyframeInterval;
+
+  max_status_fds_ = kMaxStatusFds;
+  struct rlimit limit {};
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+    max_status_fds_ = std::min(max_status_fds_,
+                               static_cast<size_t>(limit.rlim_cur / 4));
 }
 
 ProcessStatsDataSource::~ProcessStatsDataSource() = default;
@@ -242,6 +276,13 @@ std::string ProcessStatsDataSource::ReadProcPidFile(int32_t pid,
   return contents;
 }
 
+base::ScopedFile ProcessStatsDataSource::OpenProcPidFile(int32_t pid,
+                                                         const char* file) {
+  char path[64];
+  sprintf(path, "/proc/%d/%s", pid, file);
+  return base::OpenFile(path, O_RDONLY);
+}
+
 std::string ProcessStatsDataSource::ReadProcStatusEntry(const std::string& buf,
                                                         const char* key) {
   auto begin = buf.find(key);
@@ -303,23 +344,38 @@ void ProcessStatsDataSource::Tick(
 
 void ProcessStatsDataSource::WriteAllProcessStats() {
   // TODO(primiano): implement whitelisting of processes by names.
-  // TODO(primiano): Have a pid cache to avoid wasting cycles reading kthreads
-  // proc files over and over. Same for non-whitelist processes (see above).
 
   PERFETTO_METATRACE("WriteAllProcessStats", 0);
   base::ScopedDir proc_dir = OpenProcDir();
   if (!proc_dir)
     return;
+  poll_count_++;
+  // The first poll is always a keyframe.
+  const bool keyframe =
+      delta_encoding_ && (poll_count_ - 1) % keyframe_interval_ == 0;
   std::vector<int32_t> pids;
   while (int32_t pid = ReadNextNumericDir(*proc_dir)) {
     uint32_t pid_u = static_cast<uint32_t>(pid);
     if (pids_to_skip_.size() > pid_u && pids_to_skip_[pid_u])
       continue;
-    std::string proc_status = ReadProcPidFile(pid, "status");
-    if (proc_status.empty())
-      continue;
-    if (!WriteProcessStats(pid, proc_status)) {
-      // If WriteProcessStats() fails the pid is very likely a kernel thread
+    MemCounters counters;
+    bool changed = true;
+    if (incremental_scan_) {
+      if (!ReadMemCountersIncrementally(pid, &counters, &changed))
+        continue;
+    } else {
+      std::string proc_status = ReadProcPidFile(pid, "status");
+      if (proc_status.empty())
+        continue;
+      ParseMemCounters(proc_status.data(), proc_status.size(), &counters);
+    }
+    if (delta_encoding_ && counters.present && (changed || keyframe)) {
+      WriteMemCountersDelta(pid, counters, keyframe);
+    } else if (!delta_encoding_ && changed && counters.present) {
+      WriteMemCounters(pid, counters);
+    }
+    if (!counters.has(MemCounters::kVmSize)) {
+      // If there are no memory counters the pid is very likely a kernel thread
       // that has a valid /proc/[pid]/status but no memory values. In this
       // case avoid keep polling it over and over.
       if (pids_to_skip_.size() <= pid_u)
@@ -331,98 +387,186 @@ void ProcessStatsDataSource::WriteAllProcessStats() {
   }
   FinalizeCurPacket();
 
+  // Forget the processes that went away, or that are not polled anymore.
+  for (auto it = polled_processes_.begin(); it != polled_processes_.end();) {
+    if (it->second.last_poll == poll_count_) {
+      ++it;
+      continue;
+    }
+    if (it->second.status_fd)
+      num_status_fds_--;
+    it = polled_processes_.erase(it);
+  }
+
   // Ensure that we write once long-term process info (e.g., name) for new pids
   // that we haven't seen before.
   OnPids(pids);
 }
 
-// Returns true if the stats for the given |pid| have been written, false it
-// it failed (e.g., |pid| was a kernel thread and, as such, didn't report any
-// memory counters).
-bool ProcessStatsDataSource::WriteProcessStats(int32_t pid,
-                                               const std::string& proc_status) {
-  // The MemCounters entry for a process is created lazily on the first call.
-  // This is to prevent creating empty entries that have only a pid for
-  // kernel threads and other /proc/[pid] entries that have no counters
-  // associated.
-  bool proc_status_has_mem_counters = false;
-  protos::pbzero::ProcessStats::MemCounters* mem_counters = nullptr;
-  auto get_counters_lazy = [this, &mem_counters, pid] {
-    if (!mem_counters) {
-      mem_counters = GetOrCreateStats()->add_mem_counters();
-      mem_counters->set_pid(pid);
+// Reads the counters of |pid| through the fd of /proc/[pid]/status cached
+// since the previous poll, if any. |changed| is false if they are the same as
+// in the previous poll. Returns false if the file can't be read.
+bool ProcessStatsDataSource::ReadMemCountersIncrementally(int32_t pid,
+                                                          MemCounters* counters,
+                                                          bool* changed) {
+  PolledProcess& process = polled_processes_[pid];
+  const bool is_new = process.last_poll == 0;
+  process.last_poll = poll_count_;
+
+  size_t size = 0;
+  if (process.status_fd)
+    size = ReadStatusFile(*process.status_fd);
+  if (!size) {
+    // Either a new process, or the fd refers to a process that died in the
+    // meantime (the read fails with ESRCH) and whose pid might have been
+    // recycled, or the fd wasn't cached.
+    if (process.status_fd) {
+      process.status_fd.reset();
+      num_status_fds_--;
     }
-    return mem_counters;
-  };
-
-  // Parse /proc/[pid]/status, which looks like this:
-  // Name:   cat
-  // Umask:  0027
-  // State:  R (running)
-  // FDSize: 256
-  // Groups: 4 20 24 46 997
-  // VmPeak:     5992 kB
-  // VmSize:     5992 kB
-  // VmLck:         0 kB
-  // ...
-  std::vector<char> key;
-  std::vector<char> value;
-  enum { kKey, kSeparator, kValue } state = kKey;
-  for (char c : proc_status) {
-    if (c == '\n') {
-      key.push_back('\0');
-      value.push_back('\0');
-
-      // |value| will contain "1234 KB". We rely on strtol() (in ToU32()) to
-      // stop parsing at the first non-numeric character.
-      if (strcmp(key.data(), "VmSize") == 0) {
-        // Assume that if we see VmSize we'll see also the others.
-        proc_status_has_mem_counters = true;
-        get_counters_lazy()->set_vm_size_kb(ToU32(value.data()));
-      } else if (strcmp(key.data(), "VmLck") == 0) {
-        get_counters_lazy()->set_vm_locked_kb(ToU32(value.data()));
-      } else if (strcmp(key.data(), "VmHWM") == 0) {
-        get_counters_lazy()->set_vm_hwm_kb(ToU32(value.data()));
-      } else if (strcmp(key.data(), "VmRSS") == 0) {
-        get_counters_lazy()->set_vm_rss_kb(ToU32(value.data()));
-      } else if (strcmp(key.data(), "RssAnon") == 0) {
-        get_counters_lazy()->set_rss_anon_kb(ToU32(value.data()));
-      } else if (strcmp(key.data(), "RssFile") == 0) {
-        get_counters_lazy()->set_rss_file_kb(ToU32(value.data()));
-      } else if (strcmp(key.data(), "RssShmem") == 0) {
-        get_counters_lazy()->set_rss_shmem_kb(ToU32(value.data()));
-      } else if (strcmp(key.data(), "VmSwap") == 0) {
-        get_counters_lazy()->set_vm_swap_kb(ToU32(value.data()));
-      }
+    process.counters = MemCounters();
+    process.written = MemCounters();
+    base::ScopedFile fd = OpenProcPidFile(pid, "status");
+    if (!fd && (errno == EMFILE || errno == ENFILE)) {
+      ReleaseStatusFds();
+      fd = OpenProcPidFile(pid, "status");
+    }
+    if (fd)
+      size = ReadStatusFile(*fd);
+    if (!size) {
+      process.last_poll = 0;  // Forgotten at the end of the poll.
+      return false;
+    }
+    if (num_status_fds_ < max_status_fds_) {
+      process.status_fd = std::move(fd);
+      num_status_fds_++;
+    }
+  }
 
-      key.clear();
-      state = kKey;
+  ParseMemCounters(static_cast<const char*>(read_buf_.Get()), size, counters);
+  *changed = is_new || !(*counters == process.counters);
+  process.counters = *counters;
+  return true;
+}
+
+// Closes the cached fds and stops caching them for the rest of the session,
+// after the process ran out of fds.
+void ProcessStatsDataSource::ReleaseStatusFds() {
+  PERFETTO_ELOG("Out of fds, closing %zu cached /proc/[pid]/status fds",
+                num_status_fds_);
+  for (auto& pid_and_process : polled_processes_)
+    pid_and_process.second.status_fd.reset();
+  num_status_fds_ = 0;
+  max_status_fds_ = 0;
+}
+
+size_t ProcessStatsDataSource::ReadStatusFile(int fd) {
+  ssize_t res = pread(fd, read_buf_.Get(), kReadBufSize, 0);
+  return res > 0 ? static_cast<size_t>(res) : 0;
+}
+
+// Parses /proc/[pid]/status, which looks like this:
+// Name:   cat
+// Umask:  0027
+// State:  R (running)
+// FDSize: 256
+// Groups: 4 20 24 46 997
+// VmPeak:     5992 kB
+// VmSize:     5992 kB
+// VmLck:         0 kB
+// ...
+// without copying it: only the lines of the MemCounters are looked at.
+// static
+void ProcessStatsDataSource::ParseMemCounters(const char* buf,
+                                              size_t size,
+                                              MemCounters* counters) {
+  *counters = MemCounters();
+  const char* const end = buf + size;
+  for (const char* line = buf; line < end;) {
+    const char* eol = static_cast<const char*>(
+        memchr(line, '\n', static_cast<size_t>(end - line)));
+    if (!eol)
+      eol = end;
+    const char* next_line = eol + 1;
+
+    // All the keys start with either "Vm" or "Rss".
+    if (*line != 'V' && *line != 'R') {
+      line = next_line;
       continue;
     }
-
-    if (state == kKey) {
-      if (c == ':') {
-        state = kSeparator;
-        continue;
-      }
-      key.push_back(c);
+    const char* colon = static_cast<const char*>(
+        memchr(line, ':', static_cast<size_t>(eol - line)));
+    if (!colon) {
+      line = next_line;
       continue;
     }
-
-    if (state == kSeparator) {
-      if (isspace(c))
+    size_t key_len = static_cast<size_t>(colon - line);
+    for (size_t i = 0; i < MemCounters::kNumFields; i++) {
+      const char* key = kMemCounterKeys[i];
+      if (strlen(key) != key_len || memcmp(line, key, key_len) != 0)
         continue;
-      value.clear();
-      value.push_back(c);
-      state = kValue;
-      continue;
+      // The value looks like "   1234 kB".
+      const char* c = colon + 1;
+      while (c < eol && (*c == ' ' || *c == '\t'))
+        c++;
+      uint64_t value = 0;
+      for (; c < eol && *c >= '0' && *c <= '9'; c++)
+        value = value * 10 + static_cast<uint64_t>(*c - '0');
+      counters->values[i] = value;
+      counters->present |= 1u << i;
+      break;
     }
+    line = next_line;
+  }
+}
 
-    if (state == kValue) {
-      value.push_back(c);
-    }
+void ProcessStatsDataSource::WriteMemCounters(int32_t pid,
+                                              const MemCounters& counters) {
+  auto* mem_counters = GetOrCreateStats()->add_mem_counters();
+  mem_counters->set_pid(pid);
+  if (counters.has(MemCounters::kVmSize))
+    mem_counters->set_vm_size_kb(counters.values[MemCounters::kVmSize]);
+  if (counters.has(MemCounters::kVmLocked))
+    mem_counters->set_vm_locked_kb(counters.values[MemCounters::kVmLocked]);
+  if (counters.has(MemCounters::kVmHwm))
+    mem_counters->set_vm_hwm_kb(counters.values[MemCounters::kVmHwm]);
+  if (counters.has(MemCounters::kVmRss))
+    mem_counters->set_vm_rss_kb(counters.values[MemCounters::kVmRss]);
+  if (counters.has(MemCounters::kRssAnon))
+    mem_counters->set_rss_anon_kb(counters.values[MemCounters::kRssAnon]);
+  if (counters.has(MemCounters::kRssFile))
+    mem_counters->set_rss_file_kb(counters.values[MemCounters::kRssFile]);
+  if (counters.has(MemCounters::kRssShmem))
+    mem_counters->set_rss_shmem_kb(counters.values[MemCounters::kRssShmem]);
+  if (counters.has(MemCounters::kVmSwap))
+    mem_counters->set_vm_swap_kb(counters.values[MemCounters::kVmSwap]);
+}
+
+// Writes the counters that changed by more than |delta_threshold_kb_| since
+// they were last written, or all of them on keyframes.
+void ProcessStatsDataSource::WriteMemCountersDelta(int32_t pid,
+                                                   const MemCounters& counters,
+                                                   bool keyframe) {
+  PolledProcess& process = polled_processes_[pid];
+  process.last_poll = poll_count_;
+  MemCounters& written = process.written;
+  MemCounters delta;
+  for (size_t i = 0; i < MemCounters::kNumFields; i++) {
+    const auto field = static_cast<MemCounters::Field>(i);
+    if (!counters.has(field))
+      continue;
+    const uint64_t value = counters.values[i];
+    const uint64_t last = written.values[i];
+    const uint64_t diff = value > last ? value - last : last - value;
+    if (!keyframe && written.has(field) && diff <= delta_threshold_kb_)
+      continue;
+    delta.values[i] = value;
+    delta.present |= 1u << i;
+    written.values[i] = value;
   }
-  return proc_status_has_mem_counters;
+  written.present |= delta.present;
+  if (delta.present)
+    WriteMemCounters(pid, delta);
 }
 
 }  // namespace perfetto
@@ -17,10 +17,13 @@
 #ifndef SRC_TRACED_PROBES_PS_PROCESS_STATS_DATA_SOURCE_H_
 #define SRC_TRACED_PROBES_PS_PROCESS_STATS_DATA_SOURCE_H_
 
+#include <algorithm>
+#include <map>
 #include <memory>
 #include <set>
 #include <vector>
 
+#include "perfetto/base/paged_memory.h"
 #include "perfetto/base/scoped_file.h"
 #include "perfetto/base/weak_ptr.h"
 #include "perfetto/tracing/core/basic_types.h"
@@ -64,8 +67,42 @@ class ProcessStatsDataSource : public ProbesDataSource {
   // Virtual for testing.
   virtual base::ScopedDir OpenProcDir();
   virtual std::string ReadProcPidFile(int32_t pid, const std::string& file);
+  virtual base::ScopedFile OpenProcPidFile(int32_t pid, const char* file);
 
  private:
+  // The counters of /proc/[pid]/status sampled by the polling.
+  struct MemCounters {
+    enum Field {
+      kVmSize,
+      kVmLocked,
+      kVmHwm,
+      kVmRss,
+      kRssAnon,
+      kRssFile,
+      kRssShmem,
+      kVmSwap,
+      kNumFields
+    };
+
+    bool has(Field field) const { return present & (1u << field); }
+    bool operator==(const MemCounters& other) const {
+      return present == other.present &&
+             std::equal(values, values + kNumFields, other.values);
+    }
+
+    uint32_t present = 0;  // Bitmask of the |values| found in the file.
+    uint64_t values[kNumFields] = {};
+  };
+
+  // A process whose counters are polled with |incremental_scan_| or
+  // |delta_encoding_|.
+  struct PolledProcess {
+    base::ScopedFile status_fd;  // Closed if too many fds are open.
+    MemCounters counters;        // As of |last_poll|.
+    MemCounters written;         // The last values written in the trace.
+    uint32_t last_poll = 0;
+  };
+
   // Common functions.
   ProcessStatsDataSource(const ProcessStatsDataSource&) = delete;
   ProcessStatsDataSource& operator=(const ProcessStatsDataSource&) = delete;
@@ -84,7 +121,14 @@ class ProcessStatsDataSource : public ProbesDataSource {
   // Functions for periodically sampling process stats/counters.
   static void Tick(base::WeakPtr<ProcessStatsDataSource>);
   void WriteAllProcessStats();
-  bool WriteProcessStats(int32_t pid, const std::string& proc_status);
+  static void ParseMemCounters(const char* buf, size_t size, MemCounters*);
+  bool ReadMemCountersIncrementally(int32_t pid,
+                                    MemCounters* counters,
+                                    bool* changed);
+  void ReleaseStatusFds();
+  size_t ReadStatusFile(int fd);
+  void WriteMemCounters(int32_t pid, const MemCounters&);
+  void WriteMemCountersDelta(int32_t pid, const MemCounters&, bool keyframe);
 
   // Common fields used for both process/tree relationships and stats/counters.
   base::TaskRunner* const task_runner_;
@@ -107,6 +151,18 @@ class ProcessStatsDataSource : public ProbesDataSource {
   protos::pbzero::ProcessStats* cur_ps_stats_ = nullptr;
   std::vector<bool> pids_to_skip_;
 
+  // Fields for keeping track of the processes across polls if
+  // |incremental_scan_| or |delta_encoding_| are enabled.
+  bool incremental_scan_ = false;
+  bool delta_encoding_ = false;
+  uint64_t delta_threshold_kb_ = 0;
+  uint32_t keyframe_interval_ = 0;
+  uint32_t poll_count_ = 0;
+  std::map<int32_t, PolledProcess> polled_processes_;
+  size_t num_status_fds_ = 0;
+  size_t max_status_fds_ = 0;
+  base::PagedMemory read_buf_;
+
   base::WeakPtrFactory<ProcessStatsDataSource> weak_factory_;  // Keep last.
 };
 
@@ -17,6 +17,7 @@
 #include "src/traced/probes/ps/process_stats_data_source.h"
 
 #include <dirent.h>
+#include <fcntl.h>
 
 #include "perfetto/base/temp_file.h"
 #include "src/base/test/test_task_runner.h"
@@ -31,7 +32,9 @@
 using ::testing::_;
 using ::testing::ElementsAreArray;
 using ::testing::Invoke;
+using ::testing::Pair;
 using ::testing::Return;
+using ::testing::UnorderedElementsAre;
 
 namespace perfetto {
 namespace {
@@ -46,6 +49,7 @@ class TestProcessStatsDataSource : public ProcessStatsDataSource {
 
   MOCK_METHOD0(OpenProcDir, base::ScopedDir());
   MOCK_METHOD2(ReadProcPidFile, std::string(int32_t pid, const std::string&));
+  MOCK_METHOD2(OpenProcPidFile, base::ScopedFile(int32_t pid, const char*));
 };
 
 class ProcessStatsDataSourceTest : public ::testing::Test {
@@ -191,5 +195,221 @@ TEST_F(ProcessStatsDataSourceTest, MemCounters) {
     rmdir(path.c_str());
 }
 
+TEST_F(ProcessStatsDataSourceTest, IncrementalMemCounters) {
+  DataSourceConfig cfg;
+  cfg.mutable_process_stats_config()->set_proc_stats_poll_ms(1);
+  cfg.mutable_process_stats_config()->set_proc_stats_incremental_scan(true);
+  *(cfg.mutable_process_stats_config()->add_quirks()) =
+      perfetto::ProcessStatsConfig::DISABLE_ON_DEMAND;
+  auto data_source = GetProcessStatsDataSource(cfg);
+
+  // A fake /proc/ directory with the pid dirs, and the status files elsewhere
+  // so that they can outlive the pid dirs.
+  auto fake_proc = base::TempDir::Create();
+  auto status_dir = base::TempDir::Create();
+  auto pid_dir = [&fake_proc](int pid) {
+    return fake_proc.path() + "/" + std::to_string(pid);
+  };
+  auto status_path = [&status_dir](int pid) {
+    return status_dir.path() + "/" + std::to_string(pid);
+  };
+  // Rewrites the file in place, as the kernel does, keeping the open fds.
+  auto write_status = [&status_path](int pid, int vm_rss) {
+    base::ScopedFile fd = base::OpenFile(status_path(pid),
+                                         O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    std::string status = "Name:\tfoo\nVmSize:\t 100 kB\nVmRSS:\t" +
+                         std::to_string(vm_rss) + " kB\n";
+    ASSERT_EQ(write(*fd, status.data(), status.size()),
+              static_cast<ssize_t>(status.size()));
+  };
+  for (int pid : {1, 2}) {
+    mkdir(pid_dir(pid).c_str(), 0755);
+    write_status(pid, 10 * pid);
+  }
+
+  // The status file of each process is opened only once, unless the process
+  // goes away.
+  auto open_status = [&status_path](int32_t pid, const char* file) {
+    EXPECT_STREQ(file, "status");
+    return base::OpenFile(status_path(pid), O_RDONLY);
+  };
+  EXPECT_CALL(*data_source, OpenProcPidFile(1, _))
+      .Times(1)
+      .WillRepeatedly(Invoke(open_status));
+  EXPECT_CALL(*data_source, OpenProcPidFile(2, _))
+      .Times(2)
+      .WillRepeatedly(Invoke(open_status));
+
+  auto checkpoint = task_runner_.CreateCheckpoint("all_done");
+  int poll = 0;
+  EXPECT_CALL(*data_source, OpenProcDir()).WillRepeatedly(Invoke([&] {
+    switch (++poll) {
+      case 2:
+        write_status(1, 11);  // Only process 1 changes.
+        break;
+      case 3:
+        rmdir(pid_dir(2).c_str());  // Process 2 goes away.
+        break;
+      case 4:
+        mkdir(pid_dir(2).c_str(), 0755);  // And comes back.
+        checkpoint();
+        break;
+    }
+    return base::ScopedDir(opendir(fake_proc.path().c_str()));
+  }));
+
+  data_source->Start();
+  task_runner_.RunUntilCheckpoint("all_done");
+  data_source->Flush(1 /* FlushRequestId */, []() {});
+
+  std::unique_ptr<protos::TracePacket> packet = writer_raw_->ParseProto();
+  ASSERT_TRUE(packet);
+  const auto& mem_counters = packet->process_stats().mem_counters();
+  using PidAndRss = std::pair<int32_t, uint64_t>;
+  std::vector<PidAndRss> rss;
+  for (const auto& counters : mem_counters) {
+    EXPECT_EQ(counters.vm_size_kb(), 100u);
+    rss.emplace_back(counters.pid(), counters.vm_rss_kb());
+  }
+  // Both processes in the first poll (in the order of /proc), then only the
+  // ones that changed or that are new.
+  ASSERT_EQ(rss.size(), 4u);
+  EXPECT_THAT(std::vector<PidAndRss>(rss.begin(), rss.begin() + 2),
+              UnorderedElementsAre(Pair(1, 10u), Pair(2, 20u)));
+  EXPECT_EQ(rss[2], PidAndRss(1, 11));
+  EXPECT_EQ(rss[3], PidAndRss(2, 20));
+
+  for (int pid : {1, 2}) {
+    rmdir(pid_dir(pid).c_str());
+    unlink(status_path(pid).c_str());
+  }
+}
+
+// Running out of fds closes the cached status fds and stops caching them.
+TEST_F(ProcessStatsDataSourceTest, StopCachingStatusFdsOnEmfile) {
+  DataSourceConfig cfg;
+  cfg.mutable_process_stats_config()->set_proc_stats_poll_ms(1);
+  cfg.mutable_process_stats_config()->set_proc_stats_incremental_scan(true);
+  *(cfg.mutable_process_stats_config()->add_quirks()) =
+      perfetto::ProcessStatsConfig::DISABLE_ON_DEMAND;
+  auto data_source = GetProcessStatsDataSource(cfg);
+
+  auto fake_proc = base::TempDir::Create();
+  auto status_dir = base::TempDir::Create();
+  auto pid_dir = [&fake_proc](int pid) {
+    return fake_proc.path() + "/" + std::to_string(pid);
+  };
+  auto status_path = [&status_dir](int pid) {
+    return status_dir.path() + "/" + std::to_string(pid);
+  };
+  for (int pid : {1, 2}) {
+    mkdir(pid_dir(pid).c_str(), 0755);
+    base::ScopedFile fd = base::OpenFile(status_path(pid),
+                                         O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    std::string status = "Name:\tfoo\nVmSize:\t 100 kB\nVmRSS:\t" +
+                         std::to_string(pid) + " kB\n";
+    ASSERT_EQ(write(*fd, status.data(), status.size()),
+              static_cast<ssize_t>(status.size()));
+  }
+
+  // The first open of the status file of process 2 fails with EMFILE. From
+  // then on both files are reopened at each of the 3 polls.
+  bool emfile = true;
+  auto open_status = [&status_path, &emfile](int32_t pid, const char*) {
+    if (pid == 2 && emfile) {
+      emfile = false;
+      errno = EMFILE;
+      return base::ScopedFile();
+    }
+    return base::OpenFile(status_path(pid), O_RDONLY);
+  };
+  EXPECT_CALL(*data_source, OpenProcPidFile(1, _))
+      .Times(3)
+      .WillRepeatedly(Invoke(open_status));
+  EXPECT_CALL(*data_source, OpenProcPidFile(2, _))
+      .Times(4)
+      .WillRepeatedly(Invoke(open_status));
+
+  auto checkpoint = task_runner_.CreateCheckpoint("all_done");
+  int poll = 0;
+  EXPECT_CALL(*data_source, OpenProcDir()).WillRepeatedly(Invoke([&] {
+    if (++poll == 3)
+      checkpoint();
+    return base::ScopedDir(opendir(fake_proc.path().c_str()));
+  }));
+
+  data_source->Start();
+  task_runner_.RunUntilCheckpoint("all_done");
+  data_source->Flush(1 /* FlushRequestId */, []() {});
+
+  std::unique_ptr<protos::TracePacket> packet = writer_raw_->ParseProto();
+  ASSERT_TRUE(packet);
+  // The counters of processes without a cached fd are written at each poll,
+  // as their pid might have been recycled in the meantime.
+  using PidAndRss = std::pair<int32_t, uint64_t>;
+  std::vector<PidAndRss> rss;
+  for (const auto& counters : packet->process_stats().mem_counters())
+    rss.emplace_back(counters.pid(), counters.vm_rss_kb());
+  ASSERT_EQ(rss.size(), 6u);
+  for (auto it = rss.begin(); it != rss.end(); it += 2) {
+    EXPECT_THAT(std::vector<PidAndRss>(it, it + 2),
+                UnorderedElementsAre(Pair(1, 1u), Pair(2, 2u)));
+  }
+
+  for (int pid : {1, 2}) {
+    rmdir(pid_dir(pid).c_str());
+    unlink(status_path(pid).c_str());
+  }
+}
+
+TEST_F(ProcessStatsDataSourceTest, DeltaEncodedMemCounters) {
+  DataSourceConfig cfg;
+  cfg.mutable_process_stats_config()->set_proc_stats_poll_ms(1);
+  cfg.mutable_process_stats_config()->set_proc_stats_delta_encoding(true);
+  cfg.mutable_process_stats_config()->set_proc_stats_delta_threshold_kb(5);
+  cfg.mutable_process_stats_config()->set_proc_stats_keyframe_interval(3);
+  *(cfg.mutable_process_stats_config()->add_quirks()) =
+      perfetto::ProcessStatsConfig::DISABLE_ON_DEMAND;
+  auto data_source = GetProcessStatsDataSource(cfg);
+
+  auto fake_proc = base::TempDir::Create();
+  std::string pid_dir = fake_proc.path() + "/1";
+  mkdir(pid_dir.c_str(), 0755);
+  EXPECT_CALL(*data_source, OpenProcDir()).WillRepeatedly(Invoke([&fake_proc] {
+    return base::ScopedDir(opendir(fake_proc.path().c_str()));
+  }));
+
+  // The VmRSS of each poll. Only the changes > 5 kB are written, except in
+  // the keyframes (polls 1 and 4), which have all the counters.
+  const int kRss[] = {10, 13, 20, 21};
+  auto checkpoint = task_runner_.CreateCheckpoint("all_done");
+  size_t poll = 0;
+  EXPECT_CALL(*data_source, ReadProcPidFile(1, "status"))
+      .WillRepeatedly(Invoke([&](int32_t, const std::string&) {
+        std::string status = "Name:\tfoo\nVmSize:\t 100 kB\nVmRSS:\t" +
+                             std::to_string(kRss[poll]) + " kB\n";
+        if (++poll == base::ArraySize(kRss))
+          checkpoint();
+        return status;
+      }));
+
+  data_source->Start();
+  task_runner_.RunUntilCheckpoint("all_done");
+  data_source->Flush(1 /* FlushRequestId */, []() {});
+
+  std::unique_ptr<protos::TracePacket> packet = writer_raw_->ParseProto();
+  ASSERT_TRUE(packet);
+  const auto& mem_counters = packet->process_stats().mem_counters();
+  ASSERT_EQ(mem_counters.size(), 3);
+  EXPECT_EQ(mem_counters.Get(0).vm_size_kb(), 100u);
+  EXPECT_EQ(mem_counters.Get(0).vm_rss_kb(), 10u);
+  EXPECT_FALSE(mem_counters.Get(1).has_vm_size_kb());
+  EXPECT_EQ(mem_counters.Get(1).vm_rss_kb(), 20u);
+  EXPECT_EQ(mem_counters.Get(2).vm_size_kb(), 100u);
+  EXPECT_EQ(mem_counters.Get(2).vm_rss_kb(), 21u);
+
+  rmdir(pid_dir.c_str());
+}
+
 }  // namespace
 }  // namespace perfetto
@@ -16,7 +16,6 @@
 
 #include "src/traced/probes/sys_stats/sys_stats_data_source.h"
 
-#include <stdlib.h>
 #include <unistd.h>
 
 #include <algorithm>
@@ -27,7 +26,6 @@
 #include "perfetto/base/file_utils.h"
 #include "perfetto/base/metatrace.h"
 #include "perfetto/base/scoped_file.h"
-#include "perfetto/base/string_splitter.h"
 #include "perfetto/base/task_runner.h"
 #include "perfetto/base/time.h"
 #include "perfetto/base/utils.h"
@@ -61,6 +59,36 @@ uint32_t ClampTo10Ms(uint32_t period_ms, const char* counter_name) {
   return period_ms;
 }
 
+// Returns the '\n' at the end of the line that starts at |line|, or |end|.
+const char* FindEndOfLine(const char* line, const char* end) {
+  const void* eol = memchr(line, '\n', static_cast<size_t>(end - line));
+  return eol ? static_cast<const char*>(eol) : end;
+}
+
+// Parses the number at |*pos|, after the spaces before it, and moves |*pos|
+// to the end of it. As with strtoll(), the number ends at the first char that
+// is not a digit. Returns false if there are only spaces up to |end|.
+bool ReadNextNumber(const char** pos, const char* end, uint64_t* value) {
+  const char* c = *pos;
+  while (c < end && *c == ' ')
+    c++;
+  if (c == end)
+    return false;
+  uint64_t number = 0;
+  for (; c < end && *c >= '0' && *c <= '9'; c++)
+    number = number * 10 + static_cast<uint64_t>(*c - '0');
+  while (c < end && *c != ' ')
+    c++;
+  *pos = c;
+  *value = number;
+  return true;
+}
+
+template <size_t N>
+bool KeyEquals(const char* key, size_t len, const char (&str)[N]) {
+  return len == N - 1 && memcmp(key, str, N - 1) == 0;
+}
+
 }  // namespace
 
 // static
@@ -86,24 +114,28 @@ SysStatsDataSource::SysStatsDataSource(base::TaskRunner* task_runner,
 
   read_buf_ = base::PagedMemory::Allocate(kReadBufSize);
 
-  // Build a lookup map that allows to quickly translate strings like "MemTotal"
-  // into the corresponding enum value, only for the counters enabled in the
-  // config.
+  // Build the lookup tables that allow to quickly translate strings like
+  // "MemTotal" into the corresponding enum value, only for the counters enabled
+  // in the config.
+  std::vector<std::pair<const char*, int>> keys;
   for (const auto& counter_id : config.meminfo_counters()) {
     for (size_t i = 0; i < base::ArraySize(kMeminfoKeys); i++) {
       const auto& k = kMeminfoKeys[i];
       if (static_cast<int>(k.id) == static_cast<int>(counter_id))
-        meminfo_counters_.emplace(k.str, k.id);
+        keys.emplace_back(k.str, k.id);
     }
   }
+  meminfo_counters_.Build(keys);
 
+  keys.clear();
   for (const auto& counter_id : config.vmstat_counters()) {
     for (size_t i = 0; i < base::ArraySize(kVmstatKeys); i++) {
       const auto& k = kVmstatKeys[i];
       if (static_cast<int>(k.id) == static_cast<int>(counter_id))
-        vmstat_counters_.emplace(k.str, k.id);
+        keys.emplace_back(k.str, k.id);
     }
   }
+  vmstat_counters_.Build(keys);
 
   for (const auto& counter_id : config.stat_counters()) {
     stat_enabled_fields_ |= 1 << counter_id;
@@ -181,23 +213,27 @@ void SysStatsDataSource::ReadMeminfo(protos::pbzero::SysStats* sys_stats) {
   size_t rsize = ReadFile(&meminfo_fd_, "/proc/meminfo");
   if (!rsize)
     return;
-  char* buf = static_cast<char*>(read_buf_.Get());
-  for (base::StringSplitter lines(buf, rsize, '\n'); lines.Next();) {
-    base::StringSplitter words(&lines, ' ');
-    if (!words.Next())
-      continue;
-    // Extract the meminfo key, dropping trailing ':' (e.g., "MemTotal: NN KB").
-    words.cur_token()[words.cur_token_size() - 1] = '\0';
-    auto it = meminfo_counters_.find(words.cur_token());
-    if (it == meminfo_counters_.end())
-      continue;
-    int counter_id = it->second;
-    if (!words.Next())
-      continue;
-    auto value = static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
-    auto* meminfo = sys_stats->add_meminfo();
-    meminfo->set_key(static_cast<protos::pbzero::MeminfoCounters>(counter_id));
-    meminfo->set_value(value);
+  const char* const buf = static_cast<const char*>(read_buf_.Get());
+  const char* const end = buf + rsize;
+  for (const char* line = buf; line < end;) {
+    const char* eol = FindEndOfLine(line, end);
+    // E.g., "MemTotal:        3744240 kB".
+    const char* pos = static_cast<const char*>(
+        memchr(line, ':', static_cast<size_t>(eol - line)));
+    int counter_id = -1;
+    if (pos) {
+      size_t key_len = static_cast<size_t>(pos - line);
+      counter_id = meminfo_counters_.Find(line, key_len);
+      pos++;  // Skip the ':'.
+    }
+    uint64_t value;
+    if (counter_id >= 0 && ReadNextNumber(&pos, eol, &value)) {
+      auto* meminfo = sys_stats->add_meminfo();
+      meminfo->set_key(
+          static_cast<protos::pbzero::MeminfoCounters>(counter_id));
+      meminfo->set_value(value);
+    }
+    line = eol + 1;
   }
 }
 
@@ -205,21 +241,23 @@ void SysStatsDataSource::ReadVmstat(protos::pbzero::SysStats* sys_stats) {
   size_t rsize = ReadFile(&vmstat_fd_, "/proc/vmstat");
   if (!rsize)
     return;
-  char* buf = static_cast<char*>(read_buf_.Get());
-  for (base::StringSplitter lines(buf, rsize, '\n'); lines.Next();) {
-    base::StringSplitter words(&lines, ' ');
-    if (!words.Next())
-      continue;
-    auto it = vmstat_counters_.find(words.cur_token());
-    if (it == vmstat_counters_.end())
-      continue;
-    int counter_id = it->second;
-    if (!words.Next())
-      continue;
-    auto value = static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
-    auto* vmstat = sys_stats->add_vmstat();
-    vmstat->set_key(static_cast<protos::pbzero::VmstatCounters>(counter_id));
-    vmstat->set_value(value);
+  const char* const buf = static_cast<const char*>(read_buf_.Get());
+  const char* const end = buf + rsize;
+  for (const char* line = buf; line < end;) {
+    const char* eol = FindEndOfLine(line, end);
+    // E.g., "nr_free_pages 16449".
+    const char* pos = static_cast<const char*>(
+        memchr(line, ' ', static_cast<size_t>(eol - line)));
+    int counter_id =
+        pos ? vmstat_counters_.Find(line, static_cast<size_t>(pos - line))
+            : -1;
+    uint64_t value;
+    if (counter_id >= 0 && ReadNextNumber(&pos, eol, &value)) {
+      auto* vmstat = sys_stats->add_vmstat();
+      vmstat->set_key(static_cast<protos::pbzero::VmstatCounters>(counter_id));
+      vmstat->set_value(value);
+    }
+    line = eol + 1;
   }
 }
 
@@ -227,70 +265,80 @@ void SysStatsDataSource::ReadStat(protos::pbzero::SysStats* sys_stats) {
   size_t rsize = ReadFile(&stat_fd_, "/proc/stat");
   if (!rsize)
     return;
-  char* buf = static_cast<char*>(read_buf_.Get());
-  for (base::StringSplitter lines(buf, rsize, '\n'); lines.Next();) {
-    base::StringSplitter words(&lines, ' ');
-    if (!words.Next())
-      continue;
-
-    // Per-CPU stats.
-    if ((stat_enabled_fields_ & (1 << SysStatsConfig::STAT_CPU_TIMES)) &&
-        words.cur_token_size() > 3 && !strncmp(words.cur_token(), "cpu", 3)) {
-      long cpu_id = strtol(words.cur_token() + 3, nullptr, 10);
-      std::array<uint64_t, 7> cpu_times{};
-      for (size_t i = 0; i < cpu_times.size() && words.Next(); i++) {
-        cpu_times[i] =
-            static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
-      }
-      auto* cpu_stat = sys_stats->add_cpu_stat();
-      cpu_stat->set_cpu_id(static_cast<uint32_t>(cpu_id));
-      cpu_stat->set_user_ns(cpu_times[0] * ns_per_user_hz_);
-      cpu_stat->set_user_ice_ns(cpu_times[1] * ns_per_user_hz_);
-      cpu_stat->set_system_mode_ns(cpu_times[2] * ns_per_user_hz_);
-      cpu_stat->set_idle_ns(cpu_times[3] * ns_per_user_hz_);
-      cpu_stat->set_io_wait_ns(cpu_times[4] * ns_per_user_hz_);
-      cpu_stat->set_irq_ns(cpu_times[5] * ns_per_user_hz_);
-      cpu_stat->set_softirq_ns(cpu_times[6] * ns_per_user_hz_);
-    }
-    // IRQ counters
-    else if ((stat_enabled_fields_ & (1 << SysStatsConfig::STAT_IRQ_COUNTS)) &&
-             !strcmp(words.cur_token(), "intr")) {
-      for (size_t i = 0; words.Next(); i++) {
-        auto v = static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
-        if (i == 0) {
-          sys_stats->set_num_irq_total(v);
-        } else {
-          auto* irq_stat = sys_stats->add_num_irq();
-          irq_stat->set_irq(static_cast<int32_t>(i - 1));
-          irq_stat->set_count(v);
-        }
-      }
+  const char* const buf = static_cast<const char*>(read_buf_.Get());
+  const char* const end = buf + rsize;
+  for (const char* line = buf; line < end;) {
+    const char* eol = FindEndOfLine(line, end);
+    ParseStatLine(line, eol, sys_stats);
+    line = eol + 1;
+  }
+}
+
+void SysStatsDataSource::ParseStatLine(const char* line,
+                                       const char* eol,
+                                       protos::pbzero::SysStats* sys_stats) {
+  const char* pos = static_cast<const char*>(
+      memchr(line, ' ', static_cast<size_t>(eol - line)));
+  if (!pos)
+    return;
+  const char* key = line;
+  const size_t key_len = static_cast<size_t>(pos - line);
+  uint64_t value;
+
+  // Per-CPU stats.
+  if ((stat_enabled_fields_ & (1 << SysStatsConfig::STAT_CPU_TIMES)) &&
+      key_len > 3 && !memcmp(key, "cpu", 3)) {
+    uint32_t cpu_id = 0;
+    for (const char* c = key + 3; c < pos && *c >= '0' && *c <= '9'; c++)
+      cpu_id = cpu_id * 10 + static_cast<uint32_t>(*c - '0');
+    std::array<uint64_t, 7> cpu_times{};
+    for (size_t i = 0; i < cpu_times.size(); i++) {
+      if (!ReadNextNumber(&pos, eol, &cpu_times[i]))
+        break;
     }
-    // Softirq counters.
-    else if ((stat_enabled_fields_ &
-              (1 << SysStatsConfig::STAT_SOFTIRQ_COUNTS)) &&
-             !strcmp(words.cur_token(), "softirq")) {
-      for (size_t i = 0; words.Next(); i++) {
-        auto v = static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
-        if (i == 0) {
-          sys_stats->set_num_softirq_total(v);
-        } else {
-          auto* softirq_stat = sys_stats->add_num_softirq();
-          softirq_stat->set_irq(static_cast<int32_t>(i - 1));
-          softirq_stat->set_count(v);
-        }
+    auto* cpu_stat = sys_stats->add_cpu_stat();
+    cpu_stat->set_cpu_id(cpu_id);
+    cpu_stat->set_user_ns(cpu_times[0] * ns_per_user_hz_);
+    cpu_stat->set_user_ice_ns(cpu_times[1] * ns_per_user_hz_);
+    cpu_stat->set_system_mode_ns(cpu_times[2] * ns_per_user_hz_);
+    cpu_stat->set_idle_ns(cpu_times[3] * ns_per_user_hz_);
+    cpu_stat->set_io_wait_ns(cpu_times[4] * ns_per_user_hz_);
+    cpu_stat->set_irq_ns(cpu_times[5] * ns_per_user_hz_);
+    cpu_stat->set_softirq_ns(cpu_times[6] * ns_per_user_hz_);
+  }
+  // IRQ counters
+  else if ((stat_enabled_fields_ & (1 << SysStatsConfig::STAT_IRQ_COUNTS)) &&
+           KeyEquals(key, key_len, "intr")) {
+    for (size_t i = 0; ReadNextNumber(&pos, eol, &value); i++) {
+      if (i == 0) {
+        sys_stats->set_num_irq_total(value);
+      } else {
+        auto* irq_stat = sys_stats->add_num_irq();
+        irq_stat->set_irq(static_cast<int32_t>(i - 1));
+        irq_stat->set_count(value);
       }
     }
-    // Number of forked processes since boot.
-    else if ((stat_enabled_fields_ & (1 << SysStatsConfig::STAT_FORK_COUNT)) &&
-             !strcmp(words.cur_token(), "processes")) {
-      if (words.Next()) {
-        sys_stats->set_num_forks(
-            static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10)));
+  }
+  // Softirq counters.
+  else if ((stat_enabled_fields_ &
+            (1 << SysStatsConfig::STAT_SOFTIRQ_COUNTS)) &&
+           KeyEquals(key, key_len, "softirq")) {
+    for (size_t i = 0; ReadNextNumber(&pos, eol, &value); i++) {
+      if (i == 0) {
+        sys_stats->set_num_softirq_total(value);
+      } else {
+        auto* softirq_stat = sys_stats->add_num_softirq();
+        softirq_stat->set_irq(static_cast<int32_t>(i - 1));
+        softirq_stat->set_count(value);
       }
     }
-
-  }  // for (line)
+  }
+  // Number of forked processes since boot.
+  else if ((stat_enabled_fields_ & (1 << SysStatsConfig::STAT_FORK_COUNT)) &&
+           KeyEquals(key, key_len, "processes")) {
+    if (ReadNextNumber(&pos, eol, &value))
+      sys_stats->set_num_forks(value);
+  }
 }
 
 base::WeakPtr<SysStatsDataSource> SysStatsDataSource::GetWeakPtr() const {
@@ -304,15 +352,77 @@ void SysStatsDataSource::Flush(FlushRequestID, std::function<void()> callback) {
 size_t SysStatsDataSource::ReadFile(base::ScopedFile* fd, const char* path) {
   if (!*fd)
     return 0;
-  ssize_t res = pread(**fd, read_buf_.Get(), kReadBufSize - 1, 0);
+  ssize_t res = pread(**fd, read_buf_.Get(), kReadBufSize, 0);
   if (res <= 0) {
     PERFETTO_PLOG("Failed reading %s", path);
     fd->reset();
     return 0;
   }
-  size_t rsize = static_cast<size_t>(res);
-  static_cast<char*>(read_buf_.Get())[rsize] = '\0';
-  return rsize + 1;  // Include null terminator in the count.
+  return static_cast<size_t>(res);
+}
+
+SysStatsDataSource::KeyTable::KeyTable() : seeds_(1), slots_(1) {}
+SysStatsDataSource::KeyTable::~KeyTable() = default;
+
+void SysStatsDataSource::KeyTable::Build(
+    const std::vector<std::pair<const char*, int>>& keys) {
+  std::vector<Entry> entries;
+  for (const auto& key : keys) {
+    Entry entry;
+    entry.key = key.first;
+    entry.len = strlen(key.first);
+    entry.id = key.second;
+    auto same_key = [&entry](const Entry& other) {
+      return other.len == entry.len && !memcmp(other.key, entry.key, entry.len);
+    };
+    if (std::find_if(entries.begin(), entries.end(), same_key) ==
+        entries.end()) {
+      entries.push_back(entry);
+    }
+  }
+
+  // At most half of the slots are used, which makes finding the seeds quick.
+  size_t size = 1;
+  while (size < entries.size() * 2)
+    size *= 2;
+  mask_ = static_cast<uint32_t>(size - 1);
+  seeds_.assign(size, 0);
+  slots_.assign(size, Entry());
+
+  std::vector<std::vector<const Entry*>> buckets(size);
+  for (const Entry& entry : entries)
+    buckets[Hash(entry.key, entry.len, 0) & mask_].push_back(&entry);
+  std::vector<size_t> order(size);
+  for (size_t i = 0; i < size; i++)
+    order[i] = i;
+  // The buckets with the most keys are the hardest to place, do them first.
+  std::stable_sort(order.begin(), order.end(), [&buckets](size_t a, size_t b) {
+    return buckets[a].size() > buckets[b].size();
+  });
+
+  std::vector<uint32_t> bucket_slots;
+  for (size_t bucket : order) {
+    if (buckets[bucket].empty())
+      break;
+    for (uint32_t seed = 1;; seed++) {
+      bucket_slots.clear();
+      for (const Entry* entry : buckets[bucket]) {
+        uint32_t slot = Hash(entry->key, entry->len, seed) & mask_;
+        if (slots_[slot].id != -1 ||
+            std::find(bucket_slots.begin(), bucket_slots.end(), slot) !=
+                bucket_slots.end()) {
+          break;
+        }
+        bucket_slots.push_back(slot);
+      }
+      if (bucket_slots.size() < buckets[bucket].size())
+        continue;
+      for (size_t i = 0; i < bucket_slots.size(); i++)
+        slots_[bucket_slots[i]] = *buckets[bucket][i];
+      seeds_[bucket] = seed;
+      break;
+    }
+  }
 }
 
 }  // namespace perfetto
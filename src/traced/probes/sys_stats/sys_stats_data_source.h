@@ -19,9 +19,10 @@
 
 #include <string.h>
 
-#include <map>
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "perfetto/base/paged_memory.h"
 #include "perfetto/base/scoped_file.h"
@@ -60,24 +61,71 @@ class SysStatsDataSource : public ProbesDataSource {
 
   base::WeakPtr<SysStatsDataSource> GetWeakPtr() const;
 
+  // Reads the counters due at the current tick and writes them in a new
+  // packet. Public for benchmarks.
+  void ReadSysStats();
+
   void set_ns_per_user_hz_for_testing(uint64_t ns) { ns_per_user_hz_ = ns; }
   uint32_t tick_for_testing() const { return tick_; }
 
  private:
-  struct CStrCmp {
-    bool operator()(const char* a, const char* b) const {
-      return strcmp(a, b) < 0;
+  // Maps the keys of the counters enabled in the config (e.g. "MemTotal") to
+  // their ids. It's a perfect hash table (hash and displace): the keys are
+  // spread in buckets by a first hash, and each bucket has the seed of a
+  // second hash that gives each of its keys a slot of its own. A lookup costs
+  // two hashes and at most one memcmp, also for the keys that aren't enabled.
+  class KeyTable {
+   public:
+    KeyTable();
+    ~KeyTable();
+
+    void Build(const std::vector<std::pair<const char*, int>>& keys);
+
+    // Returns the id of the key [key, key + len), or -1 if it isn't enabled.
+    int Find(const char* key, size_t len) const {
+      uint32_t seed = seeds_[Hash(key, len, 0) & mask_];
+      const Entry& entry = slots_[Hash(key, len, seed) & mask_];
+      if (entry.len != len || memcmp(entry.key, key, len) != 0)
+        return -1;
+      return entry.id;
+    }
+
+   private:
+    struct Entry {
+      const char* key = "";
+      size_t len = 0;
+      int id = -1;
+    };
+
+    static uint32_t Hash(const char* key, size_t len, uint32_t seed) {
+      uint32_t hash = 2166136261u ^ seed;  // FNV-1a.
+      for (size_t i = 0; i < len; i++)
+        hash = (hash ^ static_cast<uint8_t>(key[i])) * 16777619u;
+      // The low bits of FNV-1a depend only on the low bits of the input, mix
+      // the high bits in as the slots are chosen by the low bits.
+      hash ^= hash >> 16;
+      hash *= 0x85ebca6bu;
+      hash ^= hash >> 13;
+      return hash;
     }
+
+    // Both have the same size, a power of two. The seed of a bucket is
+    // indexed by the first hash, the entries by the second one.
+    std::vector<uint32_t> seeds_;
+    std::vector<Entry> slots_;
+    uint32_t mask_ = 0;
   };
 
   static void Tick(base::WeakPtr<SysStatsDataSource>);
 
   SysStatsDataSource(const SysStatsDataSource&) = delete;
   SysStatsDataSource& operator=(const SysStatsDataSource&) = delete;
-  void ReadSysStats();  // Virtual for testing.
   void ReadMeminfo(protos::pbzero::SysStats* sys_stats);
   void ReadVmstat(protos::pbzero::SysStats* sys_stats);
   void ReadStat(protos::pbzero::SysStats* sys_stats);
+  void ParseStatLine(const char* line,
+                     const char* eol,
+                     protos::pbzero::SysStats* sys_stats);
   size_t ReadFile(base::ScopedFile*, const char* path);
 
   base::TaskRunner* const task_runner_;
@@ -87,8 +135,8 @@ class SysStatsDataSource : public ProbesDataSource {
   base::ScopedFile stat_fd_;
   base::PagedMemory read_buf_;
   TraceWriter::TracePacketHandle cur_packet_;
-  std::map<const char*, int, CStrCmp> meminfo_counters_;
-  std::map<const char*, int, CStrCmp> vmstat_counters_;
+  KeyTable meminfo_counters_;
+  KeyTable vmstat_counters_;
   uint64_t ns_per_user_hz_ = 0;
   uint32_t tick_ = 0;
   uint32_t tick_period_ms_ = 0;
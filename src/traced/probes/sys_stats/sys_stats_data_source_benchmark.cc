@@ -0,0 +1,185 @@
+// Copyright (C) 2018 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include <memory>
+#include <string>
+
+#include "benchmark/benchmark.h"
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/temp_file.h"
+#include "perfetto/traced/sys_stats_counters.h"
+#include "perfetto/tracing/core/data_source_config.h"
+#include "perfetto/tracing/core/sys_stats_config.h"
+#include "src/base/test/test_task_runner.h"
+#include "src/traced/probes/sys_stats/sys_stats_data_source.h"
+#include "src/tracing/core/null_trace_writer.h"
+
+namespace {
+
+// A /proc/meminfo of a Linux 4.x desktop.
+const char kMeminfo[] = R"(MemTotal:       32839456 kB
+MemFree:         8416860 kB
+MemAvailable:   22683112 kB
+Buffers:         1204188 kB
+Cached:         12488792 kB
+SwapCached:         2048 kB
+Active:         12886476 kB
+Inactive:        8972932 kB
+Active(anon):    7411436 kB
+Inactive(anon):  1043352 kB
+Active(file):    5475040 kB
+Inactive(file):  7929580 kB
+Unevictable:       98972 kB
+Mlocked:           98972 kB
+SwapTotal:       1000444 kB
+SwapFree:         975612 kB
+Dirty:              1228 kB
+Writeback:             0 kB
+AnonPages:       8264732 kB
+Mapped:          1553412 kB
+Shmem:            290224 kB
+Slab:            1742340 kB
+SReclaimable:    1413264 kB
+SUnreclaim:       329076 kB
+KernelStack:       24608 kB
+PageTables:        76400 kB
+NFS_Unstable:          0 kB
+Bounce:                0 kB
+WritebackTmp:          0 kB
+CommitLimit:    17420172 kB
+Committed_AS:   22907044 kB
+VmallocTotal:   34359738367 kB
+VmallocUsed:           0 kB
+VmallocChunk:          0 kB
+HardwareCorrupted:     0 kB
+AnonHugePages:         0 kB
+ShmemHugePages:        0 kB
+ShmemPmdMapped:        0 kB
+CmaTotal:              0 kB
+CmaFree:               0 kB
+HugePages_Total:       0
+HugePages_Free:        0
+HugePages_Rsvd:        0
+HugePages_Surp:        0
+Hugepagesize:       2048 kB
+DirectMap4k:      968512 kB
+DirectMap2M:    24051712 kB
+DirectMap1G:     9437184 kB
+)";
+
+const char kStat[] = R"(cpu  2655987 822682 2352153 8801203 41917 322733 175055 0 0 0
+cpu0 762178 198125 902284 8678856 41716 152974 68262 0 0 0
+cpu1 613833 243394 504323 15194 96 60625 28785 0 0 0
+cpu2 207349 95060 248856 17351 42 32148 26108 0 0 0
+cpu3 138474 92158 174852 17537 48 25076 25035 0 0 0
+cpu4 278720 34689 141048 18117 1 20782 5873 0 0 0
+cpu5 235376 33907 85098 18278 2 10049 3774 0 0 0
+cpu6 239568 67149 155814 17890 5 11518 3807 0 0 0
+cpu7 180484 58196 139874 17975 3 9556 13407 0 0 0
+intr 238128517 0 0 0 63500984 0 6253792 6 4 5 0 0 0 0 0 0 0 160331 0 0 14
+ctxt 484846186
+btime 1540000000
+processes 243320
+procs_running 2
+procs_blocked 0
+softirq 84611084 10220177 28299167 155083 3035679 6390543 66234 4396819 15604187 0 16443195
+)";
+
+// /proc/vmstat is generated from the keys of the counters, which are about
+// all the ones of a recent kernel.
+std::string GetVmstat() {
+  std::string vmstat;
+  for (size_t i = 0; i < perfetto::base::ArraySize(perfetto::kVmstatKeys);
+       i++) {
+    vmstat += perfetto::kVmstatKeys[i].str;
+    vmstat += " " + std::to_string(i * 1234567) + "\n";
+  }
+  return vmstat;
+}
+
+perfetto::base::ScopedFile OpenFakeProcFile(const char* path) {
+  std::string contents;
+  if (!strcmp(path, "/proc/meminfo")) {
+    contents = kMeminfo;
+  } else if (!strcmp(path, "/proc/vmstat")) {
+    contents = GetVmstat();
+  } else if (!strcmp(path, "/proc/stat")) {
+    contents = kStat;
+  } else {
+    PERFETTO_FATAL("Unexpected file opened %s", path);
+  }
+  auto tmp = perfetto::base::TempFile::CreateUnlinked();
+  PERFETTO_CHECK(pwrite(tmp.fd(), contents.data(), contents.size(), 0) ==
+                 static_cast<ssize_t>(contents.size()));
+  return tmp.ReleaseFD();
+}
+
+// Measures the cost of one tick that reads /proc/meminfo, /proc/vmstat and
+// /proc/stat, with either all their counters enabled (|all_counters|) or
+// only a few of them, as in a typical memory config.
+void ReadSysStats(benchmark::State& state, bool all_counters) {
+  using perfetto::SysStatsConfig;
+  perfetto::DataSourceConfig config;
+  SysStatsConfig* sys_stats_config = config.mutable_sys_stats_config();
+  sys_stats_config->set_meminfo_period_ms(10);
+  sys_stats_config->set_vmstat_period_ms(10);
+  sys_stats_config->set_stat_period_ms(10);
+  if (all_counters) {
+    for (const auto& key : perfetto::kMeminfoKeys) {
+      *sys_stats_config->add_meminfo_counters() =
+          static_cast<SysStatsConfig::MeminfoCounters>(key.id);
+    }
+    for (const auto& key : perfetto::kVmstatKeys) {
+      *sys_stats_config->add_vmstat_counters() =
+          static_cast<SysStatsConfig::VmstatCounters>(key.id);
+    }
+  } else {
+    for (auto id : {SysStatsConfig::MEMINFO_MEM_AVAILABLE,
+                    SysStatsConfig::MEMINFO_SWAP_FREE,
+                    SysStatsConfig::MEMINFO_ACTIVE_ANON,
+                    SysStatsConfig::MEMINFO_INACTIVE_ANON}) {
+      *sys_stats_config->add_meminfo_counters() = id;
+    }
+    for (auto id : {SysStatsConfig::VMSTAT_PGSCAN_KSWAPD_NORMAL,
+                    SysStatsConfig::VMSTAT_PSWPIN,
+                    SysStatsConfig::VMSTAT_PSWPOUT}) {
+      *sys_stats_config->add_vmstat_counters() = id;
+    }
+  }
+  *sys_stats_config->add_stat_counters() = SysStatsConfig::STAT_CPU_TIMES;
+  *sys_stats_config->add_stat_counters() = SysStatsConfig::STAT_FORK_COUNT;
+
+  perfetto::base::TestTaskRunner task_runner;
+  perfetto::SysStatsDataSource data_source(
+      &task_runner, 0,
+      std::unique_ptr<perfetto::TraceWriter>(new perfetto::NullTraceWriter()),
+      config, OpenFakeProcFile);
+  while (state.KeepRunning())
+    data_source.ReadSysStats();
+}
+
+}  // namespace
+
+static void BM_SysStatsTickAllCounters(benchmark::State& state) {
+  ReadSysStats(state, true);
+}
+BENCHMARK(BM_SysStatsTickAllCounters);
+
+static void BM_SysStatsTickFewCounters(benchmark::State& state) {
+  ReadSysStats(state, false);
+}
+BENCHMARK(BM_SysStatsTickFewCounters);
@@ -16,9 +16,12 @@
 
 #include <unistd.h>
 
+#include <map>
+
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "perfetto/base/temp_file.h"
+#include "perfetto/traced/sys_stats_counters.h"
 #include "src/base/test/test_task_runner.h"
 #include "src/traced/probes/sys_stats/sys_stats_data_source.h"
 #include "src/tracing/core/trace_writer_for_testing.h"
@@ -298,6 +301,33 @@ TEST_F(SysStatsDataSourceTest, Vmstat) {
                                         KV{C::VMSTAT_PGMIGRATE_FAIL, 3439}));
 }
 
+TEST_F(SysStatsDataSourceTest, VmstatAllCounters) {
+  using C = protos::VmstatCounters;
+  protos::DataSourceConfig config;
+  config.mutable_sys_stats_config()->set_vmstat_period_ms(1);
+  for (const auto& key : kVmstatKeys) {
+    config.mutable_sys_stats_config()->add_vmstat_counters(
+        static_cast<C>(key.id));
+  }
+  DataSourceConfig config_obj;
+  config_obj.FromProto(config);
+  auto data_source = GetSysStatsDataSource(config_obj);
+
+  WaitTick(data_source.get());
+
+  std::unique_ptr<protos::TracePacket> packet = writer_raw_->ParseProto();
+  ASSERT_TRUE(packet->has_sys_stats());
+  std::map<int, uint64_t> kvs;
+  for (const auto& kv : packet->sys_stats().vmstat())
+    kvs[kv.key()] = kv.value();
+
+  // All the lines of kMockVmstat are known counters.
+  EXPECT_EQ(kvs.size(), 92u);
+  EXPECT_EQ(kvs[C::VMSTAT_NR_FREE_PAGES], 16449u);
+  EXPECT_EQ(kvs[C::VMSTAT_PGFAULT], 181696234u);
+  EXPECT_EQ(kvs[C::VMSTAT_UNEVICTABLE_PGS_STRANDED], 2342u);
+}
+
 TEST_F(SysStatsDataSourceTest, StatAll) {
   using C = protos::SysStatsConfig;
   protos::DataSourceConfig config;
@@ -14,16 +14,30 @@
  * limitations under the License.
  */
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/unix_task_runner.h"
 #include "perfetto/base/watchdog.h"
 #include "perfetto/traced/traced.h"
 #include "perfetto/tracing/ipc/service_ipc_host.h"
 #include "src/tracing/ipc/default_socket.h"
 
+#if PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
+#include "perfetto/base/epoll_task_runner.h"
+#endif
+
 namespace perfetto {
+namespace {
+
+#if PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
+using PlatformTaskRunner = base::EpollTaskRunner;
+#else
+using PlatformTaskRunner = base::UnixTaskRunner;
+#endif
+
+}  // namespace
 
 int __attribute__((visibility("default"))) ServiceMain(int, char**) {
-  base::UnixTaskRunner task_runner;
+  PlatformTaskRunner task_runner;
   std::unique_ptr<ServiceIPCHost> svc;
   svc = ServiceIPCHost::CreateInstance(&task_runner);
 
@@ -77,6 +77,37 @@ void FtraceConfig::FromProto(const perfetto::protos::FtraceConfig& proto) {
                 "size mismatch");
   drain_period_ms_ =
       static_cast<decltype(drain_period_ms_)>(proto.drain_period_ms());
+
+  static_assert(sizeof(compact_sched_) == sizeof(proto.compact_sched()),
+                "size mismatch");
+  compact_sched_ = static_cast<decltype(compact_sched_)>(proto.compact_sched());
+
+  static_assert(sizeof(adaptive_drain_) == sizeof(proto.adaptive_drain()),
+                "size mismatch");
+  adaptive_drain_ =
+      static_cast<decltype(adaptive_drain_)>(proto.adaptive_drain());
+
+  event_pids_.clear();
+  for (const auto& field : proto.event_pids()) {
+    event_pids_.emplace_back();
+    static_assert(sizeof(event_pids_.back()) == sizeof(proto.event_pids(0)),
+                  "size mismatch");
+    event_pids_.back() = static_cast<decltype(event_pids_)::value_type>(field);
+  }
+
+  cpus_.clear();
+  for (const auto& field : proto.cpus()) {
+    cpus_.emplace_back();
+    static_assert(sizeof(cpus_.back()) == sizeof(proto.cpus(0)),
+                  "size mismatch");
+    cpus_.back() = static_cast<decltype(cpus_)::value_type>(field);
+  }
+
+  event_filters_.clear();
+  for (const auto& field : proto.event_filters()) {
+    event_filters_.emplace_back();
+    event_filters_.back().FromProto(field);
+  }
   unknown_fields_ = proto.unknown_fields();
 }
 
@@ -111,6 +142,64 @@ void FtraceConfig::ToProto(perfetto::protos::FtraceConfig* proto) const {
                 "size mismatch");
   proto->set_drain_period_ms(
       static_cast<decltype(proto->drain_period_ms())>(drain_period_ms_));
+
+  static_assert(sizeof(compact_sched_) == sizeof(proto->compact_sched()),
+                "size mismatch");
+  proto->set_compact_sched(
+      static_cast<decltype(proto->compact_sched())>(compact_sched_));
+
+  static_assert(sizeof(adaptive_drain_) == sizeof(proto->adaptive_drain()),
+                "size mismatch");
+  proto->set_adaptive_drain(
+      static_cast<decltype(proto->adaptive_drain())>(adaptive_drain_));
+
+  for (const auto& it : event_pids_) {
+    proto->add_event_pids(static_cast<decltype(proto->event_pids(0))>(it));
+    static_assert(sizeof(it) == sizeof(proto->event_pids(0)), "size mismatch");
+  }
+
+  for (const auto& it : cpus_) {
+    proto->add_cpus(static_cast<decltype(proto->cpus(0))>(it));
+    static_assert(sizeof(it) == sizeof(proto->cpus(0)), "size mismatch");
+  }
+
+  for (const auto& it : event_filters_) {
+    auto* entry = proto->add_event_filters();
+    it.ToProto(entry);
+  }
+  *(proto->mutable_unknown_fields()) = unknown_fields_;
+}
+
+FtraceConfig::EventFilter::EventFilter() = default;
+FtraceConfig::EventFilter::~EventFilter() = default;
+FtraceConfig::EventFilter::EventFilter(const FtraceConfig::EventFilter&) =
+    default;
+FtraceConfig::EventFilter& FtraceConfig::EventFilter::operator=(
+    const FtraceConfig::EventFilter&) = default;
+FtraceConfig::EventFilter::EventFilter(FtraceConfig::EventFilter&&) noexcept =
+    default;
+FtraceConfig::EventFilter& FtraceConfig::EventFilter::operator=(
+    FtraceConfig::EventFilter&&) = default;
+
+void FtraceConfig::EventFilter::FromProto(
+    const perfetto::protos::FtraceConfig_EventFilter& proto) {
+  static_assert(sizeof(event_) == sizeof(proto.event()), "size mismatch");
+  event_ = static_cast<decltype(event_)>(proto.event());
+
+  static_assert(sizeof(filter_) == sizeof(proto.filter()), "size mismatch");
+  filter_ = static_cast<decltype(filter_)>(proto.filter());
+  unknown_fields_ = proto.unknown_fields();
+}
+
+void FtraceConfig::EventFilter::ToProto(
+    perfetto::protos::FtraceConfig_EventFilter* proto) const {
+  proto->Clear();
+
+  static_assert(sizeof(event_) == sizeof(proto->event()), "size mismatch");
+  proto->set_event(static_cast<decltype(proto->event())>(event_));
+
+  static_assert(sizeof(filter_) == sizeof(proto->filter()), "size mismatch");
+  proto->set_filter(static_cast<decltype(proto->filter())>(filter_));
   *(proto->mutable_unknown_fields()) = unknown_fields_;
 }
 
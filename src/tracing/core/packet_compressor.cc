@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/packet_compressor.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/lz_codec.h"
+#include "perfetto/protozero/proto_utils.h"
+
+#include "perfetto/trace/trusted_packet.pb.h"
+
+namespace perfetto {
+
+using protozero::proto_utils::MakeTagLengthDelimited;
+using protozero::proto_utils::WriteVarInt;
+
+constexpr size_t PacketCompressor::kMaxBatchSize;
+constexpr size_t PacketCompressor::kMaxSliceSize;
+
+namespace {
+
+// Serializes the packets in [begin, end) as a sequence of Trace.packet fields
+// (i.e. the same format of a trace file) and compresses them into a new
+// TracePacket.
+TracePacket CompressBatch(std::vector<TracePacket>::iterator begin,
+                          std::vector<TracePacket>::iterator end,
+                          size_t raw_size) {
+  std::unique_ptr<uint8_t[]> raw(new uint8_t[raw_size]);
+  uint8_t* wptr = raw.get();
+  for (auto it = begin; it != end; ++it) {
+    char* preamble;
+    size_t preamble_size;
+    std::tie(preamble, preamble_size) = it->GetProtoPreamble();
+    memcpy(wptr, preamble, preamble_size);
+    wptr += preamble_size;
+    for (const Slice& slice : it->slices()) {
+      memcpy(wptr, slice.start, slice.size);
+      wptr += slice.size;
+    }
+  }
+  PERFETTO_DCHECK(wptr == raw.get() + raw_size);
+
+  size_t bound = base::LzCompressBound(raw_size);
+  std::unique_ptr<uint8_t[]> data(new uint8_t[bound]);
+  size_t data_size = base::LzCompress(raw.get(), raw_size, data.get(), bound);
+  PERFETTO_CHECK(data_size > 0);
+
+  // The field header: [tag] [field size] [decompressed size].
+  uint8_t header[16];
+  uint8_t* size_ptr = WriteVarInt(
+      MakeTagLengthDelimited(
+          protos::TrustedPacket::kCompressedPacketsFieldNumber),
+      &header[0]);
+  uint8_t raw_size_varint[10];
+  size_t raw_size_varint_size = static_cast<size_t>(
+      WriteVarInt(raw_size, &raw_size_varint[0]) - &raw_size_varint[0]);
+  uint8_t* hdr_end = WriteVarInt(raw_size_varint_size + data_size, size_ptr);
+  memcpy(hdr_end, raw_size_varint, raw_size_varint_size);
+  hdr_end += raw_size_varint_size;
+
+  size_t header_size = static_cast<size_t>(hdr_end - &header[0]);
+  Slice header_slice = Slice::Allocate(header_size);
+  memcpy(header_slice.own_data(), header, header_size);
+
+  TracePacket packet;
+  packet.AddSlice(std::move(header_slice));
+  // The compressed data of a batch can be larger than an IPC frame, while
+  // ConsumerIPCService needs each slice to fit in one.
+  for (size_t offset = 0; offset < data_size;) {
+    size_t slice_size =
+        std::min(data_size - offset, PacketCompressor::kMaxSliceSize);
+    Slice slice = Slice::Allocate(slice_size);
+    memcpy(slice.own_data(), data.get() + offset, slice_size);
+    packet.AddSlice(std::move(slice));
+    offset += slice_size;
+  }
+  return packet;
+}
+
+}  // namespace
+
+// static
+void PacketCompressor::CompressPackets(std::vector<TracePacket>* packets) {
+  std::vector<TracePacket> compressed_packets;
+  auto batch_begin = packets->begin();
+  size_t batch_size = 0;
+  for (auto it = packets->begin(); it != packets->end(); ++it) {
+    batch_size += it->size() + std::get<1>(it->GetProtoPreamble());
+    if (batch_size >= kMaxBatchSize) {
+      compressed_packets.emplace_back(
+          CompressBatch(batch_begin, it + 1, batch_size));
+      batch_begin = it + 1;
+      batch_size = 0;
+    }
+  }
+  if (batch_begin != packets->end()) {
+    compressed_packets.emplace_back(
+        CompressBatch(batch_begin, packets->end(), batch_size));
+  }
+  *packets = std::move(compressed_packets);
+}
+
+}  // namespace perfetto
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACING_CORE_PACKET_COMPRESSOR_H_
+#define SRC_TRACING_CORE_PACKET_COMPRESSOR_H_
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "perfetto/tracing/core/shared_memory_abi.h"
+#include "perfetto/tracing/core/trace_packet.h"
+
+namespace perfetto {
+
+// Batches trace packets together and compresses them into the
+// TracePacket.compressed_packets field, when TraceConfig.compression_type is
+// set. The resulting packets are fully owned (i.e. don't point to the
+// TraceBuffer anymore) and can be written into a file or sent to the consumer
+// as any other TracePacket.
+class PacketCompressor {
+ public:
+  // Approximate upper bound for the uncompressed size of each batch. This
+  // bounds the memory the trace_processor needs to decompress a packet.
+  static constexpr size_t kMaxBatchSize = 256 * 1024;
+
+  // Upper bound for the size of the slices of the compressed packets, the
+  // same as for the slices read from the TraceBuffer. Larger slices wouldn't
+  // fit in the IPC frames of ConsumerIPCService.
+  static constexpr size_t kMaxSliceSize = SharedMemoryABI::kMaxPageSize;
+
+  PacketCompressor() = delete;
+
+  // Replaces |packets| with the equivalent (but fewer) compressed packets.
+  static void CompressPackets(std::vector<TracePacket>* packets);
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACING_CORE_PACKET_COMPRESSOR_H_
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/packet_compressor.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "perfetto/base/lz_codec.h"
+#include "perfetto/protozero/proto_utils.h"
+
+#include "perfetto/trace/trace.pb.h"
+#include "perfetto/trace/trace_packet.pb.h"
+
+namespace perfetto {
+namespace {
+
+using protozero::proto_utils::ParseVarInt;
+
+TracePacket MakePacket(const std::string& str, std::vector<std::string>* bufs) {
+  protos::TracePacket proto;
+  proto.mutable_for_testing()->set_str(str);
+  bufs->emplace_back(proto.SerializeAsString());
+  const std::string& buf = bufs->back();
+  TracePacket packet;
+  // Split the packet in two slices to check that fragments are handled.
+  size_t half = buf.size() / 2;
+  packet.AddSlice(&buf[0], half);
+  packet.AddSlice(&buf[half], buf.size() - half);
+  return packet;
+}
+
+// Decompresses all the packets in |packets| and returns the for_testing().str()
+// of each decompressed packet.
+std::vector<std::string> Decompress(const std::vector<TracePacket>& packets) {
+  std::vector<std::string> res;
+  for (const TracePacket& packet : packets) {
+    protos::TracePacket proto;
+    EXPECT_TRUE(packet.Decode(&proto));
+    const std::string& data = proto.compressed_packets();
+    EXPECT_FALSE(data.empty());
+    const uint8_t* start = reinterpret_cast<const uint8_t*>(data.data());
+    const uint8_t* end = start + data.size();
+    uint64_t raw_size = 0;
+    const uint8_t* payload = ParseVarInt(start, end, &raw_size);
+    std::string raw(static_cast<size_t>(raw_size), '\0');
+    EXPECT_TRUE(base::LzDecompress(payload, static_cast<size_t>(end - payload),
+                                   reinterpret_cast<uint8_t*>(&raw[0]),
+                                   raw.size()));
+    protos::Trace trace;
+    EXPECT_TRUE(trace.ParseFromString(raw));
+    for (const auto& inner : trace.packet())
+      res.emplace_back(inner.for_testing().str());
+  }
+  return res;
+}
+
+TEST(PacketCompressorTest, Empty) {
+  std::vector<TracePacket> packets;
+  PacketCompressor::CompressPackets(&packets);
+  EXPECT_TRUE(packets.empty());
+}
+
+TEST(PacketCompressorTest, RoundTrip) {
+  std::vector<std::string> bufs;
+  bufs.reserve(100);
+  std::vector<std::string> expected;
+  std::vector<TracePacket> packets;
+  for (int i = 0; i < 100; i++) {
+    expected.emplace_back("packet " + std::to_string(i));
+    packets.emplace_back(MakePacket(expected.back(), &bufs));
+  }
+  size_t size_before = 0;
+  for (const TracePacket& packet : packets)
+    size_before += packet.size();
+
+  PacketCompressor::CompressPackets(&packets);
+  ASSERT_EQ(1u, packets.size());
+  EXPECT_LT(packets[0].size(), size_before);
+  EXPECT_EQ(expected, Decompress(packets));
+}
+
+TEST(PacketCompressorTest, LargeInputIsSplitInBatches) {
+  std::vector<std::string> bufs;
+  bufs.reserve(64);
+  std::vector<std::string> expected;
+  std::vector<TracePacket> packets;
+  for (int i = 0; i < 64; i++) {
+    char c = static_cast<char>('a' + i % 26);
+    expected.emplace_back(std::string(16 * 1024, c));
+    packets.emplace_back(MakePacket(expected.back(), &bufs));
+  }
+  PacketCompressor::CompressPackets(&packets);
+  EXPECT_GT(packets.size(), 1u);
+  EXPECT_EQ(expected, Decompress(packets));
+}
+
+TEST(PacketCompressorTest, LargeBatchIsSplitInSlices) {
+  // Incompressible data, so that the batch is larger than an IPC frame after
+  // the compression too.
+  std::minstd_rand0 rnd(0);
+  std::vector<std::string> bufs;
+  bufs.reserve(32);
+  std::vector<std::string> expected;
+  std::vector<TracePacket> packets;
+  for (int i = 0; i < 32; i++) {
+    std::string str(8 * 1024, '\0');
+    for (char& c : str)
+      c = static_cast<char>(rnd());
+    expected.emplace_back(std::move(str));
+    packets.emplace_back(MakePacket(expected.back(), &bufs));
+  }
+  PacketCompressor::CompressPackets(&packets);
+  ASSERT_EQ(1u, packets.size());
+  EXPECT_GT(packets[0].size(), 128u * 1024);  // ipc::kIPCBufferSize.
+  for (const Slice& slice : packets[0].slices())
+    EXPECT_LE(slice.size, PacketCompressor::kMaxSliceSize);
+  EXPECT_EQ(expected, Decompress(packets));
+}
+
+}  // namespace
+}  // namespace perfetto
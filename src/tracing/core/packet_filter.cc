@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/packet_filter.h"
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/protozero/proto_utils.h"
+
+namespace perfetto {
+
+using protozero::proto_utils::MakeTagLengthDelimited;
+using protozero::proto_utils::ProtoWireType;
+using protozero::proto_utils::WriteVarInt;
+
+namespace {
+
+constexpr size_t kMaxVarIntSize = 10;
+
+enum BytecodeOpcode : uint64_t {
+  kOpcodeSimpleField = 1,
+  kOpcodeSimpleFieldRange = 2,
+  kOpcodeNestedField = 3,
+};
+
+// Unlike protozero's ParseVarInt(), this rejects over-long varints, as both the
+// bytecode and the packets are untrusted.
+bool ReadVarInt(const uint8_t** pos, const uint8_t* end, uint64_t* value) {
+  *value = 0;
+  for (size_t i = 0; i < kMaxVarIntSize && *pos < end; i++) {
+    const uint8_t byte = *((*pos)++);
+    *value |= static_cast<uint64_t>(byte & 0x7f) << (7 * i);
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+struct Field {
+  uint32_t id;
+  ProtoWireType type;
+  const uint8_t* begin;    // Start of the tag.
+  const uint8_t* payload;  // Start of the value, past the length if any.
+  const uint8_t* end;
+};
+
+// Reads the field at |*pos| and advances it past the field. Returns false if
+// the field is malformed or doesn't fit in [*pos, end).
+bool ReadField(const uint8_t** pos, const uint8_t* end, Field* field) {
+  field->begin = *pos;
+  uint64_t tag = 0;
+  if (!ReadVarInt(pos, end, &tag))
+    return false;
+  const uint64_t field_id = tag >> 3;
+  if (field_id == 0 || field_id > std::numeric_limits<uint32_t>::max())
+    return false;
+  field->id = static_cast<uint32_t>(field_id);
+  field->type = static_cast<ProtoWireType>(tag & 7);
+  field->payload = *pos;
+  uint64_t size = 0;
+  switch (field->type) {
+    case ProtoWireType::kVarInt:
+      if (!ReadVarInt(pos, end, &size))
+        return false;
+      field->end = *pos;
+      return true;
+    case ProtoWireType::kFixed64:
+      size = 8;
+      break;
+    case ProtoWireType::kFixed32:
+      size = 4;
+      break;
+    case ProtoWireType::kLengthDelimited:
+      if (!ReadVarInt(pos, end, &size))
+        return false;
+      field->payload = *pos;
+      break;
+    default:
+      return false;  // Groups are deprecated and not supported.
+  }
+  if (size > static_cast<uint64_t>(end - *pos))
+    return false;
+  *pos += size;
+  field->end = *pos;
+  return true;
+}
+
+}  // namespace
+
+// static
+constexpr uint32_t PacketFilter::kMaxFieldId;
+constexpr uint32_t PacketFilter::kMaxDenseFieldId;
+constexpr size_t PacketFilter::kMaxNestingDepth;
+
+PacketFilter::PacketFilter() = default;
+PacketFilter::~PacketFilter() = default;
+
+bool PacketFilter::LoadBytecode(const std::string& bytecode) {
+  const uint8_t* pos = reinterpret_cast<const uint8_t*>(bytecode.data());
+  const uint8_t* const end = pos + bytecode.size();
+  std::vector<Message> messages;
+  Message message;
+  bool message_terminated = true;
+  while (pos < end) {
+    uint64_t word = 0;
+    if (!ReadVarInt(&pos, end, &word))
+      return false;
+    if (word == 0) {
+      messages.emplace_back(std::move(message));
+      message = Message();
+      message_terminated = true;
+      continue;
+    }
+    message_terminated = false;
+    const uint64_t field_id = word >> 3;
+    if (field_id == 0 || field_id > kMaxFieldId)
+      return false;
+    uint64_t num_fields = 1;
+    uint64_t action = kAllowField;
+    switch (word & 7) {
+      case kOpcodeSimpleField:
+        break;
+      case kOpcodeSimpleFieldRange:
+        if (!ReadVarInt(&pos, end, &num_fields) || num_fields == 0 ||
+            num_fields > kMaxFieldId + 1 - field_id) {
+          return false;
+        }
+        break;
+      case kOpcodeNestedField: {
+        uint64_t message_index = 0;
+        // Each message takes at least one byte, so any index >= the bytecode
+        // size is certainly invalid. Real bounds are checked below.
+        if (!ReadVarInt(&pos, end, &message_index) ||
+            message_index >= bytecode.size()) {
+          return false;
+        }
+        action = kNestedMessage + message_index;
+        break;
+      }
+      default:
+        return false;
+    }
+    const uint32_t begin = static_cast<uint32_t>(field_id);
+    const uint32_t last = static_cast<uint32_t>(field_id + num_fields);
+    const uint32_t dense_end = std::min(last, kMaxDenseFieldId);
+    if (begin < dense_end) {
+      std::vector<uint32_t>& dense = message.dense_fields;
+      if (dense.size() < dense_end)
+        dense.resize(dense_end, kDropField);
+      std::fill(dense.begin() + begin, dense.begin() + dense_end,
+                static_cast<uint32_t>(action));
+    }
+    if (last > kMaxDenseFieldId) {
+      message.sparse_fields.push_back(
+          {std::max(begin, kMaxDenseFieldId), last,
+           static_cast<uint32_t>(action)});
+    }
+  }
+  if (!message_terminated || messages.empty())
+    return false;
+
+  for (const Message& msg : messages) {
+    for (uint32_t action : msg.dense_fields) {
+      if (action >= kNestedMessage && action - kNestedMessage >= messages.size())
+        return false;
+    }
+    for (const SparseRange& range : msg.sparse_fields) {
+      if (range.action >= kNestedMessage &&
+          range.action - kNestedMessage >= messages.size()) {
+        return false;
+      }
+    }
+  }
+  messages_ = std::move(messages);
+  return true;
+}
+
+uint32_t PacketFilter::GetFieldAction(uint32_t message,
+                                      uint32_t field_id) const {
+  const Message& msg = messages_[message];
+  if (field_id < msg.dense_fields.size())
+    return msg.dense_fields[field_id];
+  // Later ranges override earlier ones, as for the dense fields.
+  uint32_t action = kDropField;
+  for (const SparseRange& range : msg.sparse_fields) {
+    if (field_id >= range.begin && field_id < range.end)
+      action = range.action;
+  }
+  return action;
+}
+
+bool PacketFilter::FilterPacket(TracePacket* packet) const {
+  PERFETTO_DCHECK(!messages_.empty());
+
+  // The filter needs a contiguous buffer. Packets that span several chunks are
+  // rare, so it's fine to just linearize them here.
+  std::string linearized;
+  const uint8_t* start = nullptr;
+  if (packet->slices().size() == 1) {
+    start = reinterpret_cast<const uint8_t*>(packet->slices()[0].start);
+  } else {
+    linearized.reserve(packet->size());
+    for (const Slice& slice : packet->slices())
+      linearized.append(reinterpret_cast<const char*>(slice.start), slice.size);
+    start = reinterpret_cast<const uint8_t*>(linearized.data());
+  }
+  const uint8_t* end = start + packet->size();
+
+  if (IsAllowed(start, end, 0, 0))
+    return true;
+
+  std::unique_ptr<std::string> filtered(new std::string());
+  filtered->reserve(packet->size());
+  if (!Filter(start, end, 0, 0, filtered.get()) || filtered->empty())
+    return false;
+
+  TracePacket filtered_packet;
+  filtered_packet.AddSlice(Slice(std::move(filtered)));
+  *packet = std::move(filtered_packet);
+  return true;
+}
+
+bool PacketFilter::IsAllowed(const uint8_t* start,
+                             const uint8_t* end,
+                             uint32_t message,
+                             size_t depth) const {
+  for (const uint8_t* pos = start; pos < end;) {
+    Field field;
+    if (!ReadField(&pos, end, &field))
+      return false;
+    const uint32_t action = GetFieldAction(message, field.id);
+    if (action == kAllowField)
+      continue;
+    if (action == kDropField ||
+        field.type != ProtoWireType::kLengthDelimited ||
+        depth >= kMaxNestingDepth ||
+        !IsAllowed(field.payload, field.end, action - kNestedMessage,
+                   depth + 1)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool PacketFilter::Filter(const uint8_t* start,
+                          const uint8_t* end,
+                          uint32_t message,
+                          size_t depth,
+                          std::string* out) const {
+  for (const uint8_t* pos = start; pos < end;) {
+    Field field;
+    if (!ReadField(&pos, end, &field))
+      return false;
+    const uint32_t action = GetFieldAction(message, field.id);
+    if (action == kAllowField) {
+      out->append(reinterpret_cast<const char*>(field.begin),
+                  static_cast<size_t>(field.end - field.begin));
+      continue;
+    }
+    if (action == kDropField ||
+        field.type != ProtoWireType::kLengthDelimited ||
+        depth >= kMaxNestingDepth) {
+      continue;
+    }
+
+    // The size of the nested message is known only after filtering it, so it
+    // has to be filtered into a separate buffer before writing the preamble.
+    std::string nested;
+    if (!Filter(field.payload, field.end, action - kNestedMessage, depth + 1,
+                &nested)) {
+      continue;
+    }
+    uint8_t preamble[2 * kMaxVarIntSize];
+    uint8_t* wptr = WriteVarInt(MakeTagLengthDelimited(field.id), preamble);
+    wptr = WriteVarInt(nested.size(), wptr);
+    out->append(reinterpret_cast<const char*>(preamble),
+                static_cast<size_t>(wptr - preamble));
+    out->append(nested);
+  }
+  return true;
+}
+
+}  // namespace perfetto
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACING_CORE_PACKET_FILTER_H_
+#define SRC_TRACING_CORE_PACKET_FILTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "perfetto/tracing/core/trace_packet.h"
+
+namespace perfetto {
+
+// Drops the fields of the TracePacket(s) that are not allowed by the filter
+// bytecode passed in TraceConfig.TraceFilter (see trace_config.proto for the
+// format). The filter works on the wire format and doesn't need to know the
+// schema of the packets, other than what is encoded in the bytecode.
+class PacketFilter {
+ public:
+  // Largest field id allowed by the protobuf encoding.
+  static constexpr uint32_t kMaxFieldId = (1u << 29) - 1;
+
+  // Field ids below this are looked up in a dense table, the (rare) others
+  // with a linear scan.
+  static constexpr uint32_t kMaxDenseFieldId = 1024;
+
+  // Nested fields beyond this depth are dropped, as the bytecode can describe
+  // recursive messages.
+  static constexpr size_t kMaxNestingDepth = 32;
+
+  PacketFilter();
+  ~PacketFilter();
+
+  // Returns false if the bytecode is malformed.
+  bool LoadBytecode(const std::string& bytecode);
+
+  // Filters |packet| in place. Packets that have only allowed fields are left
+  // untouched and keep pointing to the original memory. The others are
+  // replaced by a single slice owning the filtered copy. Returns false if the
+  // packet is malformed or no field survives, in which case the caller should
+  // drop it.
+  bool FilterPacket(TracePacket* packet) const;
+
+ private:
+  // Entries of the per-message lookup tables, indexed by field id. Values >=
+  // kNestedMessage are nested fields, described by the message at index
+  // (value - kNestedMessage).
+  enum : uint32_t {
+    kDropField = 0,
+    kAllowField = 1,
+    kNestedMessage = 2,
+  };
+
+  // Fields [begin, end) with id >= kMaxDenseFieldId.
+  struct SparseRange {
+    uint32_t begin;
+    uint32_t end;
+    uint32_t action;
+  };
+
+  struct Message {
+    std::vector<uint32_t> dense_fields;  // Indexed by field id.
+    std::vector<SparseRange> sparse_fields;
+  };
+
+  PacketFilter(const PacketFilter&) = delete;
+  PacketFilter& operator=(const PacketFilter&) = delete;
+
+  uint32_t GetFieldAction(uint32_t message, uint32_t field_id) const;
+
+  // Returns true if the message is well formed and all its fields (and the
+  // ones of its nested messages) are allowed. This is the fast path, it
+  // doesn't copy anything and stops at the first field to drop.
+  bool IsAllowed(const uint8_t* start,
+                 const uint8_t* end,
+                 uint32_t message,
+                 size_t depth) const;
+
+  // Appends to |out| the allowed fields of the message. Nested messages that
+  // are malformed are dropped. Returns false if the message itself is
+  // malformed.
+  bool Filter(const uint8_t* start,
+              const uint8_t* end,
+              uint32_t message,
+              size_t depth,
+              std::string* out) const;
+
+  std::vector<Message> messages_;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACING_CORE_PACKET_FILTER_H_
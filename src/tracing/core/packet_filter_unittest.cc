@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/packet_filter.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "perfetto/protozero/proto_utils.h"
+
+#include "perfetto/trace/trace_packet.pb.h"
+
+namespace perfetto {
+namespace {
+
+using protozero::proto_utils::WriteVarInt;
+
+// Field ids of protos::TracePacket and protos::TestEvent used below.
+constexpr uint32_t kTimestamp = 8;
+constexpr uint32_t kForTesting = 268435455;
+constexpr uint32_t kProcessTree = 2;
+constexpr uint32_t kStr = 1;
+constexpr uint32_t kSeqValue = 2;
+
+class Bytecode {
+ public:
+  Bytecode& AddField(uint32_t field_id) { return Add((field_id << 3) | 1); }
+  Bytecode& AddRange(uint32_t field_id, uint32_t num_fields) {
+    return Add((field_id << 3) | 2).Add(num_fields);
+  }
+  Bytecode& AddNested(uint32_t field_id, uint32_t message_index) {
+    return Add((field_id << 3) | 3).Add(message_index);
+  }
+  Bytecode& EndMessage() { return Add(0); }
+
+  Bytecode& Add(uint64_t word) {
+    uint8_t buf[10];
+    uint8_t* end = WriteVarInt(word, buf);
+    str_.append(reinterpret_cast<const char*>(buf),
+                static_cast<size_t>(end - buf));
+    return *this;
+  }
+
+  const std::string& str() const { return str_; }
+
+ private:
+  std::string str_;
+};
+
+protos::TracePacket FilterAndDecode(const PacketFilter& filter,
+                                    const std::string& serialized,
+                                    bool* kept) {
+  TracePacket packet;
+  // Split the packet in two slices to check that fragments are handled.
+  size_t half = serialized.size() / 2;
+  packet.AddSlice(&serialized[0], half);
+  packet.AddSlice(&serialized[half], serialized.size() - half);
+  protos::TracePacket proto;
+  *kept = filter.FilterPacket(&packet);
+  if (*kept)
+    EXPECT_TRUE(packet.Decode(&proto));
+  return proto;
+}
+
+TEST(PacketFilterTest, InvalidBytecode) {
+  PacketFilter filter;
+  EXPECT_FALSE(filter.LoadBytecode(""));
+  // Missing end of message.
+  EXPECT_FALSE(filter.LoadBytecode(Bytecode().AddField(1).str()));
+  // Nested message out of bounds.
+  EXPECT_FALSE(
+      filter.LoadBytecode(Bytecode().AddNested(1, 1).EndMessage().str()));
+  // Unknown opcode.
+  EXPECT_FALSE(filter.LoadBytecode(Bytecode().Add((1 << 3) | 5).str()));
+  // Field id 0 and ranges beyond the max field id.
+  EXPECT_FALSE(filter.LoadBytecode(Bytecode().Add(1).EndMessage().str()));
+  EXPECT_FALSE(filter.LoadBytecode(
+      Bytecode().AddRange(PacketFilter::kMaxFieldId, 2).EndMessage().str()));
+  // Truncated varint.
+  EXPECT_FALSE(filter.LoadBytecode("\x81"));
+
+  EXPECT_TRUE(filter.LoadBytecode(
+      Bytecode().AddRange(PacketFilter::kMaxFieldId, 1).EndMessage().str()));
+}
+
+TEST(PacketFilterTest, AllowedPacketIsNotCopied) {
+  PacketFilter filter;
+  ASSERT_TRUE(filter.LoadBytecode(Bytecode()
+                                      .AddField(kTimestamp)
+                                      .AddNested(kForTesting, 1)
+                                      .EndMessage()
+                                      .AddRange(kStr, 2)
+                                      .EndMessage()
+                                      .str()));
+
+  protos::TracePacket proto;
+  proto.set_timestamp(42);
+  proto.mutable_for_testing()->set_str("foo");
+  proto.mutable_for_testing()->set_seq_value(1);
+  std::string serialized = proto.SerializeAsString();
+
+  TracePacket packet;
+  packet.AddSlice(serialized.data(), serialized.size());
+  EXPECT_TRUE(filter.FilterPacket(&packet));
+  ASSERT_EQ(1u, packet.slices().size());
+  EXPECT_EQ(serialized.data(), packet.slices()[0].start);
+  EXPECT_EQ(serialized.size(), packet.size());
+}
+
+TEST(PacketFilterTest, DropFields) {
+  PacketFilter filter;
+  ASSERT_TRUE(filter.LoadBytecode(Bytecode()
+                                      .AddField(kTimestamp)
+                                      .AddNested(kForTesting, 1)
+                                      .EndMessage()
+                                      .AddField(kSeqValue)
+                                      .EndMessage()
+                                      .str()));
+
+  protos::TracePacket proto;
+  proto.set_timestamp(42);
+  proto.mutable_for_testing()->set_str("private");
+  proto.mutable_for_testing()->set_seq_value(7);
+  bool kept = false;
+  protos::TracePacket filtered =
+      FilterAndDecode(filter, proto.SerializeAsString(), &kept);
+  ASSERT_TRUE(kept);
+  EXPECT_EQ(42u, filtered.timestamp());
+  ASSERT_TRUE(filtered.has_for_testing());
+  EXPECT_FALSE(filtered.for_testing().has_str());
+  EXPECT_EQ(7u, filtered.for_testing().seq_value());
+
+  // Packets with only disallowed fields are dropped entirely.
+  protos::TracePacket other;
+  other.mutable_process_tree()->add_processes()->set_pid(1);
+  FilterAndDecode(filter, other.SerializeAsString(), &kept);
+  EXPECT_FALSE(kept);
+}
+
+TEST(PacketFilterTest, SimpleFieldKeepsNestedMessageAsIs) {
+  PacketFilter filter;
+  ASSERT_TRUE(
+      filter.LoadBytecode(Bytecode().AddField(kProcessTree).EndMessage().str()));
+
+  protos::TracePacket proto;
+  proto.set_timestamp(1);
+  auto* process = proto.mutable_process_tree()->add_processes();
+  process->set_pid(1);
+  process->add_cmdline("init");
+  bool kept = false;
+  protos::TracePacket filtered =
+      FilterAndDecode(filter, proto.SerializeAsString(), &kept);
+  ASSERT_TRUE(kept);
+  EXPECT_FALSE(filtered.has_timestamp());
+  ASSERT_EQ(1, filtered.process_tree().processes_size());
+  EXPECT_EQ("init", filtered.process_tree().processes(0).cmdline(0));
+}
+
+TEST(PacketFilterTest, MalformedPacketIsDropped) {
+  PacketFilter filter;
+  ASSERT_TRUE(filter.LoadBytecode(
+      Bytecode().AddField(kTimestamp).EndMessage().str()));
+
+  // A length-delimited field that overflows the packet.
+  const char kMalformed[] = {0x12, 0x10, 0x00};
+  TracePacket packet;
+  packet.AddSlice(kMalformed, sizeof(kMalformed));
+  EXPECT_FALSE(filter.FilterPacket(&packet));
+}
+
+}  // namespace
+}  // namespace perfetto
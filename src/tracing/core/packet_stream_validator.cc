@@ -53,6 +53,11 @@ bool PacketStreamValidator::Validate(const Slices& slices) {
   if (!packet.synchronization_marker().empty())
     return false;
 
+  // Only the service is allowed to compress packets. Otherwise a producer could
+  // smuggle trusted fields in the compressed payload, which is opaque here.
+  if (!packet.compressed_packets().empty())
+    return false;
+
   // We are deliberately not checking for clock_snapshot for the moment. It's
   // unclear if we want to allow producers to snapshot their clocks. Ideally we
   // want a security model where producers can only snapshot their own clocks
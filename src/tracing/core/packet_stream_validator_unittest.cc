@@ -106,6 +106,16 @@ TEST(PacketStreamValidatorTest, ComplexPacketWithUid) {
   EXPECT_FALSE(PacketStreamValidator::Validate(seq));
 }
 
+TEST(PacketStreamValidatorTest, CompressedPackets) {
+  protos::TracePacket proto;
+  proto.set_compressed_packets("not really compressed");
+  std::string ser_buf = proto.SerializeAsString();
+
+  Slices seq;
+  seq.emplace_back(&ser_buf[0], ser_buf.size());
+  EXPECT_FALSE(PacketStreamValidator::Validate(seq));
+}
+
 TEST(PacketStreamValidatorTest, FragmentedPacket) {
   protos::TracePacket proto;
   proto.mutable_for_testing()->set_str("string field");
@@ -68,6 +68,34 @@ void ProcessStatsConfig::FromProto(
       "size mismatch");
   proc_stats_poll_ms_ =
       static_cast<decltype(proc_stats_poll_ms_)>(proto.proc_stats_poll_ms());
+
+  static_assert(sizeof(proc_stats_incremental_scan_) ==
+                    sizeof(proto.proc_stats_incremental_scan()),
+                "size mismatch");
+  proc_stats_incremental_scan_ =
+      static_cast<decltype(proc_stats_incremental_scan_)>(
+          proto.proc_stats_incremental_scan());
+
+  static_assert(sizeof(proc_stats_delta_encoding_) ==
+                    sizeof(proto.proc_stats_delta_encoding()),
+                "size mismatch");
+  proc_stats_delta_encoding_ =
+      static_cast<decltype(proc_stats_delta_encoding_)>(
+          proto.proc_stats_delta_encoding());
+
+  static_assert(sizeof(proc_stats_delta_threshold_kb_) ==
+                    sizeof(proto.proc_stats_delta_threshold_kb()),
+                "size mismatch");
+  proc_stats_delta_threshold_kb_ =
+      static_cast<decltype(proc_stats_delta_threshold_kb_)>(
+          proto.proc_stats_delta_threshold_kb());
+
+  static_assert(sizeof(proc_stats_keyframe_interval_) ==
+                    sizeof(proto.proc_stats_keyframe_interval()),
+                "size mismatch");
+  proc_stats_keyframe_interval_ =
+      static_cast<decltype(proc_stats_keyframe_interval_)>(
+          proto.proc_stats_keyframe_interval());
   unknown_fields_ = proto.unknown_fields();
 }
 
@@ -99,6 +127,34 @@ void ProcessStatsConfig::ToProto(
       "size mismatch");
   proto->set_proc_stats_poll_ms(
       static_cast<decltype(proto->proc_stats_poll_ms())>(proc_stats_poll_ms_));
+
+  static_assert(sizeof(proc_stats_incremental_scan_) ==
+                    sizeof(proto->proc_stats_incremental_scan()),
+                "size mismatch");
+  proto->set_proc_stats_incremental_scan(
+      static_cast<decltype(proto->proc_stats_incremental_scan())>(
+          proc_stats_incremental_scan_));
+
+  static_assert(sizeof(proc_stats_delta_encoding_) ==
+                    sizeof(proto->proc_stats_delta_encoding()),
+                "size mismatch");
+  proto->set_proc_stats_delta_encoding(
+      static_cast<decltype(proto->proc_stats_delta_encoding())>(
+          proc_stats_delta_encoding_));
+
+  static_assert(sizeof(proc_stats_delta_threshold_kb_) ==
+                    sizeof(proto->proc_stats_delta_threshold_kb()),
+                "size mismatch");
+  proto->set_proc_stats_delta_threshold_kb(
+      static_cast<decltype(proto->proc_stats_delta_threshold_kb())>(
+          proc_stats_delta_threshold_kb_));
+
+  static_assert(sizeof(proc_stats_keyframe_interval_) ==
+                    sizeof(proto->proc_stats_keyframe_interval()),
+                "size mismatch");
+  proto->set_proc_stats_keyframe_interval(
+      static_cast<decltype(proto->proc_stats_keyframe_interval())>(
+          proc_stats_keyframe_interval_));
   *(proto->mutable_unknown_fields()) = unknown_fields_;
 }
 
@@ -23,6 +23,7 @@
 #include "perfetto/base/file_utils.h"
 #include "perfetto/base/temp_file.h"
 #include "perfetto/base/utils.h"
+#include "perfetto/protozero/proto_utils.h"
 #include "perfetto/tracing/core/consumer.h"
 #include "perfetto/tracing/core/data_source_config.h"
 #include "perfetto/tracing/core/data_source_descriptor.h"
@@ -1235,6 +1236,86 @@ TEST_F(TracingServiceImplTest, ScrapeBuffersOnFlush) {
   consumer->WaitForTracingDisabled();
 }
 
+// Test scraping with enough producers to split the work across threads.
+TEST_F(TracingServiceImplTest, ScrapeBuffersOnFlushWithManyProducers) {
+  svc->SetSMBScrapingEnabled(true);
+
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  // Half of the producers write into each buffer, to exercise also the
+  // copy of the chunks sharded by target buffer.
+  static constexpr size_t kNumProducers =
+      TracingServiceImpl::kMinProducersPerScrapingThread *
+      TracingServiceImpl::kMaxScrapingThreads;
+  TraceConfig trace_config;
+  for (uint32_t i = 0; i < 2; i++) {
+    trace_config.add_buffers()->set_size_kb(128);
+    auto* ds_config = trace_config.add_data_sources()->mutable_config();
+    ds_config->set_name("data_source_" + std::to_string(i));
+    ds_config->set_target_buffer(i);
+  }
+  consumer->EnableTracing(trace_config);
+
+  // Producers join the already started session one at a time, so that the
+  // expectations of each mock are set before its callbacks are dispatched.
+  std::vector<std::unique_ptr<MockProducer>> producers;
+  std::vector<ProducerID> producer_ids;
+  std::vector<std::string> ds_names;
+  for (size_t i = 0; i < kNumProducers; i++) {
+    producers.emplace_back(CreateMockProducer());
+    producers.back()->Connect(svc.get(), "mock_producer_" + std::to_string(i));
+    producer_ids.push_back(*last_producer_id());
+    ds_names.push_back("data_source_" + std::to_string(i % 2));
+    producers.back()->RegisterDataSource(ds_names.back());
+    producers.back()->WaitForTracingSetup();
+    producers.back()->WaitForDataSourceSetup(ds_names.back());
+    producers.back()->WaitForDataSourceStart(ds_names.back());
+  }
+
+  std::vector<std::unique_ptr<TraceWriter>> writers;
+  for (size_t i = 0; i < kNumProducers; i++) {
+    BufferID target_buffer = tracing_session()->buffers_index[i % 2];
+    writers.emplace_back(
+        producers[i]->endpoint()->CreateTraceWriter(target_buffer));
+    WaitForTraceWritersChanged(producer_ids[i]);
+    for (int j = 0; j < 3; j++) {
+      std::string payload =
+          "payload_" + std::to_string(i) + "_" + std::to_string(j);
+      writers.back()->NewTracePacket()->set_for_testing()->set_str(
+          payload.c_str());
+    }
+  }
+
+  auto flush_request = consumer->Flush();
+  for (auto& producer : producers)
+    producer->WaitForFlush(nullptr, /*reply=*/true);
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  // The last packet of each writer can't be scraped, as it might be still
+  // incomplete.
+  auto packets = consumer->ReadBuffers();
+  for (size_t i = 0; i < kNumProducers; i++) {
+    for (int j = 0; j < 3; j++) {
+      auto matcher = Property(
+          &protos::TracePacket::for_testing,
+          Property(&protos::TestEvent::str,
+                   Eq("payload_" + std::to_string(i) + "_" +
+                      std::to_string(j))));
+      if (j < 2) {
+        EXPECT_THAT(packets, Contains(matcher));
+      } else {
+        EXPECT_THAT(packets, Not(Contains(matcher)));
+      }
+    }
+  }
+
+  consumer->DisableTracing();
+  for (size_t i = 0; i < kNumProducers; i++)
+    producers[i]->WaitForDataSourceStop(ds_names[i]);
+  consumer->WaitForTracingDisabled();
+}
+
 // Test scraping on producer disconnect.
 TEST_F(TracingServiceImplTest, ScrapeBuffersOnProducerDisconnect) {
   svc->SetSMBScrapingEnabled(true);
@@ -1353,4 +1434,181 @@ TEST_F(TracingServiceImplTest, ScrapeBuffersOnDisable) {
                                                       Eq("payload3"))))));
 }
 
+TEST_F(TracingServiceImplTest, ShareDataSourceWithOtherSession) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+  std::unique_ptr<MockConsumer> consumer2 = CreateMockConsumer();
+  consumer2->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  consumer->EnableTracing(trace_config);
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  // The second session doesn't cause a new data source instance on the
+  // producer (the StrictMock would fail otherwise).
+  TraceConfig trace_config2;
+  trace_config2.add_buffers()->set_size_kb(64);
+  auto* ds2 = trace_config2.add_data_sources();
+  ds2->mutable_config()->set_name("data_source");
+  ds2->mutable_config()->set_target_buffer(0);
+  ds2->set_share_with_other_sessions(true);
+  consumer2->EnableTracing(trace_config2);
+  task_runner.RunUntilIdle();
+
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  writer->NewTracePacket()->set_for_testing()->set_str("payload");
+
+  // Flushing the second session flushes the shared data source instance.
+  auto flush_request = consumer2->Flush();
+  producer->WaitForFlush(writer.get());
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  // Both sessions get the packet, each from its own buffer.
+  auto matcher =
+      Contains(Property(&protos::TracePacket::for_testing,
+                        Property(&protos::TestEvent::str, Eq("payload"))));
+  EXPECT_THAT(consumer->ReadBuffers(), matcher);
+  EXPECT_THAT(consumer2->ReadBuffers(), matcher);
+
+  // Stopping the second session doesn't stop the shared data source.
+  consumer2->DisableTracing();
+  consumer2->WaitForTracingDisabled();
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+}
+
+TEST_F(TracingServiceImplTest, SharedDataSourceOutlivesItsSession) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+  std::unique_ptr<MockConsumer> consumer2 = CreateMockConsumer();
+  consumer2->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  consumer->EnableTracing(trace_config);
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  TraceConfig trace_config2;
+  trace_config2.add_buffers()->set_size_kb(64);
+  auto* ds2 = trace_config2.add_data_sources();
+  ds2->mutable_config()->set_name("data_source");
+  ds2->mutable_config()->set_target_buffer(0);
+  ds2->set_share_with_other_sessions(true);
+  consumer2->EnableTracing(trace_config2);
+  task_runner.RunUntilIdle();
+
+  // Stopping the first session stops its instance and starts a new one for
+  // the second session.
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+  consumer->WaitForTracingDisabled();
+
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  writer->NewTracePacket()->set_for_testing()->set_str("payload");
+
+  auto flush_request = consumer2->Flush();
+  producer->WaitForFlush(writer.get());
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  EXPECT_THAT(
+      consumer2->ReadBuffers(),
+      Contains(Property(&protos::TracePacket::for_testing,
+                        Property(&protos::TestEvent::str, Eq("payload")))));
+
+  consumer2->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer2->WaitForTracingDisabled();
+}
+
+TEST_F(TracingServiceImplTest, FilterPackets) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+
+  // Allows only TracePacket.for_testing and, within it, TestEvent.seq_value.
+  const uint64_t kBytecode[] = {(268435455ull << 3) | 3, 1, 0, (2 << 3) | 1, 0};
+  std::string bytecode;
+  for (uint64_t word : kBytecode) {
+    uint8_t buf[10];
+    uint8_t* end = protozero::proto_utils::WriteVarInt(word, buf);
+    bytecode.append(reinterpret_cast<const char*>(buf),
+                    static_cast<size_t>(end - buf));
+  }
+  trace_config.mutable_trace_filter()->set_bytecode(bytecode);
+
+  consumer->EnableTracing(trace_config);
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  {
+    auto tp = writer->NewTracePacket();
+    tp->set_for_testing()->set_str("private");
+    tp->set_for_testing()->set_seq_value(42);
+  }
+  writer->NewTracePacket()->set_timestamp(1);
+
+  auto flush_request = consumer->Flush();
+  producer->WaitForFlush(writer.get());
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  auto packets = consumer->ReadBuffers();
+  // The packets emitted by the service are not filtered.
+  EXPECT_THAT(packets, Contains(Property(&protos::TracePacket::has_trace_config,
+                                         Eq(true))));
+  EXPECT_THAT(packets,
+              Not(Contains(Property(&protos::TracePacket::timestamp, Eq(1u)))));
+  size_t num_test_packets = 0;
+  for (const auto& packet : packets) {
+    if (!packet.has_for_testing())
+      continue;
+    num_test_packets++;
+    EXPECT_FALSE(packet.for_testing().has_str());
+    EXPECT_EQ(42u, packet.for_testing().seq_value());
+    EXPECT_TRUE(packet.has_trusted_uid());
+  }
+  EXPECT_EQ(1u, num_test_packets);
+}
+
 }  // namespace perfetto
@@ -19,6 +19,7 @@
 #include <limits>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/base/lz_codec.h"
 #include "perfetto/protozero/proto_utils.h"
 #include "perfetto/tracing/core/shared_memory_abi.h"
 #include "perfetto/tracing/core/trace_packet.h"
@@ -62,9 +63,10 @@ constexpr size_t TraceBuffer::ChunkRecord::kMaxSize;
 constexpr size_t TraceBuffer::InlineChunkHeaderSize = sizeof(ChunkRecord);
 
 // static
-std::unique_ptr<TraceBuffer> TraceBuffer::Create(size_t size_in_bytes) {
+std::unique_ptr<TraceBuffer> TraceBuffer::Create(size_t size_in_bytes,
+                                                 bool compress_chunks) {
   std::unique_ptr<TraceBuffer> trace_buffer(new TraceBuffer());
-  if (!trace_buffer->Initialize(size_in_bytes))
+  if (!trace_buffer->Initialize(size_in_bytes, compress_chunks))
     return nullptr;
   return trace_buffer;
 }
@@ -78,7 +80,7 @@ TraceBuffer::TraceBuffer() {
 
 TraceBuffer::~TraceBuffer() = default;
 
-bool TraceBuffer::Initialize(size_t size) {
+bool TraceBuffer::Initialize(size_t size, bool compress_chunks) {
   static_assert(
       base::kPageSize % sizeof(ChunkRecord) == 0,
       "sizeof(ChunkRecord) must be an integer divider of a page size");
@@ -95,6 +97,8 @@ bool TraceBuffer::Initialize(size_t size) {
   index_.clear();
   last_chunk_id_written_.clear();
   read_iter_ = GetReadIterForSequence(index_.end());
+  compress_chunks_ = compress_chunks;
+  decompressed_record_ = nullptr;
   return true;
 }
 
@@ -112,7 +116,7 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
                                      size_t size) {
   // |record_size| = |size| + sizeof(ChunkRecord), rounded up to avoid to end
   // up in a fragmented state where size_to_end() < sizeof(ChunkRecord).
-  const size_t record_size =
+  size_t record_size =
       base::AlignUp<sizeof(ChunkRecord)>(size + sizeof(ChunkRecord));
   if (PERFETTO_UNLIKELY(record_size > max_chunk_size_)) {
     stats_.abi_violations++;
@@ -154,6 +158,20 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
     ChunkMeta* record_meta = &it->second;
     ChunkRecord* prev = record_meta->chunk_record;
 
+    // Only complete chunks are compressed, so the only legitimate case of
+    // recommitting a compressed chunk is a recommit of the identical chunk.
+    if (PERFETTO_UNLIKELY(prev->is_compressed)) {
+      if (PERFETTO_UNLIKELY(ChunkMeta::Key(*prev) != key || !chunk_complete ||
+                            prev->num_fragments != num_fragments ||
+                            prev->flags != chunk_flags)) {
+        stats_.abi_violations++;
+        PERFETTO_DCHECK(suppress_sanity_dchecks_for_testing_);
+        return;
+      }
+      TRACE_BUFFER_DLOG("  skipping recommit of identical compressed chunk");
+      return;
+    }
+
     // Verify that the old chunk's metadata corresponds to the new one.
     // Overridden chunks should never change size, since the page layout is
     // fixed per writer. The number of fragments should also never decrease and
@@ -222,6 +240,26 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
     return;
   }
 
+  // Complete chunks that don't need patching won't be rewritten in future,
+  // they can be stored compressed.
+  size_t uncompressed_size = size;
+  if (compress_chunks_ && chunk_complete &&
+      !(chunk_flags & kChunkNeedsPatching)) {
+    size_t compressed_size = CompressChunkPayload(src, size);
+    if (compressed_size) {
+      src = &compression_buf_[ChunkRecord::kMaxSize];
+      size = compressed_size;
+      record.size = static_cast<decltype(record.size)>(
+          base::AlignUp<sizeof(ChunkRecord)>(size + sizeof(ChunkRecord)));
+      record.is_compressed = 1;
+      stats_.chunks_compressed++;
+      stats_.bytes_saved_by_compression += record_size - record.size;
+      TRACE_BUFFER_DLOG("  compressed chunk, size=%zu -> %u", record_size,
+                        record.size);
+      record_size = record.size;
+    }
+  }
+
   // If there isn't enough room from the given write position. Write a padding
   // record to clear the end of the buffer and wrap back.
   const size_t cached_size_to_end = size_to_end();
@@ -258,7 +296,7 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
 
   // Now first insert the new chunk. At the end, if necessary, add the padding.
   stats_.chunks_written++;
-  stats_.bytes_written += size;
+  stats_.bytes_written += uncompressed_size;
   auto it_and_inserted = index_.emplace(
       key, ChunkMeta(GetChunkRecordAt(wptr_), num_fragments, chunk_complete,
                      chunk_flags, producer_uid_trusted));
@@ -361,6 +399,71 @@ size_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
   return static_cast<size_t>(next_chunk_ptr - search_end);
 }
 
+size_t TraceBuffer::CompressChunkPayload(const uint8_t* src, size_t size) {
+  // The compressed ChunkRecord must be at least sizeof(ChunkRecord) smaller
+  // than the uncompressed one, otherwise there is no point compressing it.
+  const size_t record_size =
+      base::AlignUp<sizeof(ChunkRecord)>(size + sizeof(ChunkRecord));
+  const size_t overhead =
+      2 * sizeof(ChunkRecord) + sizeof(CompressedChunkHeader);
+  if (record_size <= overhead)
+    return 0;
+  const size_t max_compressed_size = record_size - overhead;
+
+  // Layout of |compression_buf_|: the first kMaxSize bytes hold a private copy
+  // of the (untrusted) chunk, the remaining kMaxSize bytes the header and the
+  // compressed data.
+  if (!compression_buf_)
+    compression_buf_.reset(new uint8_t[2 * ChunkRecord::kMaxSize]);
+  uint8_t* copy = &compression_buf_[0];
+  uint8_t* out = &compression_buf_[ChunkRecord::kMaxSize];
+  PERFETTO_DCHECK(size <= ChunkRecord::kMaxSize);
+  memcpy(copy, src, size);
+
+  size_t compressed_size =
+      base::LzCompress(copy, size, out + sizeof(CompressedChunkHeader),
+                       max_compressed_size);
+  if (!compressed_size)
+    return 0;
+  CompressedChunkHeader header;
+  header.uncompressed_size = static_cast<uint16_t>(size);
+  header.compressed_size = static_cast<uint16_t>(compressed_size);
+  memcpy(out, &header, sizeof(header));
+  return sizeof(header) + compressed_size;
+}
+
+const uint8_t* TraceBuffer::GetChunkPayload(const ChunkRecord* record,
+                                            size_t* payload_size) {
+  const uint8_t* payload =
+      reinterpret_cast<const uint8_t*>(record) + sizeof(ChunkRecord);
+  if (PERFETTO_LIKELY(!record->is_compressed)) {
+    *payload_size = record->size - sizeof(ChunkRecord);
+    return payload;
+  }
+
+  CompressedChunkHeader header;
+  memcpy(&header, payload, sizeof(header));
+  if (record != decompressed_record_) {
+    if (!decompression_buf_)
+      decompression_buf_.reset(new uint8_t[ChunkRecord::kMaxSize]);
+    decompressed_record_ = nullptr;
+    // The buffer is not shared with producers, hence this can fail only
+    // because of a bug in the TraceBuffer itself.
+    if (PERFETTO_UNLIKELY(header.compressed_size + sizeof(header) +
+                              sizeof(ChunkRecord) >
+                          record->size) ||
+        PERFETTO_UNLIKELY(!base::LzDecompress(
+            payload + sizeof(header), header.compressed_size,
+            &decompression_buf_[0], header.uncompressed_size))) {
+      PERFETTO_DFATAL("Failed to decompress chunk");
+      return nullptr;
+    }
+    decompressed_record_ = record;
+  }
+  *payload_size = header.uncompressed_size;
+  return &decompression_buf_[0];
+}
+
 void TraceBuffer::AddPaddingRecord(size_t size) {
   PERFETTO_DCHECK(size >= sizeof(ChunkRecord) && size <= ChunkRecord::kMaxSize);
   ChunkRecord record(size);
@@ -385,6 +488,12 @@ bool TraceBuffer::TryPatchChunkContents(ProducerID producer_id,
   }
   ChunkMeta& chunk_meta = it->second;
 
+  // Chunks are compressed only if they didn't need patching when copied.
+  if (PERFETTO_UNLIKELY(chunk_meta.chunk_record->is_compressed)) {
+    stats_.patches_failed++;
+    return false;
+  }
+
   // Check that the index is consistent with the actual ProducerID/WriterID
   // stored in the ChunkRecord.
   PERFETTO_DCHECK(ChunkMeta::Key(*chunk_meta.chunk_record) == key);
@@ -740,10 +849,15 @@ bool TraceBuffer::ReadNextPacketInChunk(ChunkMeta* chunk_meta,
   PERFETTO_DCHECK(chunk_meta->num_fragments_read < chunk_meta->num_fragments);
   PERFETTO_DCHECK(!(chunk_meta->flags & kChunkNeedsPatching));
 
-  const uint8_t* record_begin =
-      reinterpret_cast<const uint8_t*>(chunk_meta->chunk_record);
-  const uint8_t* record_end = record_begin + chunk_meta->chunk_record->size;
-  const uint8_t* packets_begin = record_begin + sizeof(ChunkRecord);
+  size_t payload_size = 0;
+  const uint8_t* packets_begin =
+      GetChunkPayload(chunk_meta->chunk_record, &payload_size);
+  if (PERFETTO_UNLIKELY(!packets_begin)) {
+    chunk_meta->cur_fragment_offset = 0;
+    chunk_meta->num_fragments_read = chunk_meta->num_fragments;
+    return false;
+  }
+  const uint8_t* record_end = packets_begin + payload_size;
   const uint8_t* packet_begin = packets_begin + chunk_meta->cur_fragment_offset;
 
   if (PERFETTO_UNLIKELY(packet_begin < packets_begin ||
@@ -784,8 +898,17 @@ bool TraceBuffer::ReadNextPacketInChunk(ChunkMeta* chunk_meta,
     return false;
   }
 
-  if (PERFETTO_LIKELY(packet))
-    packet->AddSlice(packet_data, static_cast<size_t>(packet_size));
+  if (PERFETTO_LIKELY(packet)) {
+    if (PERFETTO_UNLIKELY(chunk_meta->chunk_record->is_compressed)) {
+      // |packet_data| points into |decompression_buf_|, which is reused for
+      // the next compressed chunk.
+      Slice slice = Slice::Allocate(static_cast<size_t>(packet_size));
+      memcpy(slice.own_data(), packet_data, static_cast<size_t>(packet_size));
+      packet->AddSlice(std::move(slice));
+    } else {
+      packet->AddSlice(packet_data, static_cast<size_t>(packet_size));
+    }
+  }
 
   return true;
 }
@@ -23,6 +23,7 @@
 #include <array>
 #include <limits>
 #include <map>
+#include <memory>
 #include <tuple>
 
 #include "perfetto/base/logging.h"
@@ -99,6 +100,20 @@ class TracePacket;
 // lookaside index is maintained (in |index_|), keeping each chunk in the buffer
 // indexed by their {ProducerID, WriterID, ChunkID} tuple.
 //
+// Compression
+// -----------
+// When created with |compress_chunks| == true, chunks that are complete and
+// don't need patching at the time they are copied are stored LZ-compressed
+// (see base/lz_codec.h) and flagged as such in their ChunkRecord. Their payload
+// is prefixed by a CompressedChunkHeader. The ring-buffer logic is unchanged:
+// a compressed chunk is just a smaller ChunkRecord, which makes room for more
+// chunks before the buffer wraps. Chunks that are scraped while still being
+// written or that need to be patched out-of-band are stored uncompressed, as
+// both cases require rewriting the chunk's payload in place later.
+// Compressed chunks are decompressed lazily, one at a time, when reading them
+// back. Packets read from compressed chunks are copied into Slices that own
+// their memory, as the decompression buffer is reused for the next chunk.
+//
 // Patching data out-of-band
 // -------------------------
 // This buffer also supports patching chunks' payload out-of-band, after they
@@ -140,6 +155,8 @@ class TraceBuffer {
     uint64_t readaheads_succeeded = 0;
     uint64_t readaheads_failed = 0;
     uint64_t abi_violations = 0;
+    uint64_t chunks_compressed = 0;
+    uint64_t bytes_saved_by_compression = 0;
   };
 
   // Argument for out-of-band patches applied through TryPatchChunkContents().
@@ -152,7 +169,10 @@ class TraceBuffer {
   };
 
   // Can return nullptr if the memory allocation fails.
-  static std::unique_ptr<TraceBuffer> Create(size_t size_in_bytes);
+  // If |compress_chunks| is true, complete chunks are stored compressed (see
+  // "Compression" in the class comment).
+  static std::unique_ptr<TraceBuffer> Create(size_t size_in_bytes,
+                                             bool compress_chunks = false);
 
   ~TraceBuffer();
 
@@ -255,7 +275,8 @@ class TraceBuffer {
   // ChunkRecord on top of the moved SMB's header (page + chunk header).
   // This special requirement is covered by static_assert(s) in the .cc file.
   struct ChunkRecord {
-    explicit ChunkRecord(size_t sz) : flags{0}, is_padding{0} {
+    explicit ChunkRecord(size_t sz)
+        : flags{0}, is_padding{0}, is_compressed{0} {
       PERFETTO_DCHECK(sz >= sizeof(ChunkRecord) &&
                       sz % sizeof(ChunkRecord) == 0 && sz <= kMaxSize);
       size = static_cast<decltype(size)>(sz);
@@ -283,7 +304,11 @@ class TraceBuffer {
 
     uint8_t flags : 6;  // See SharedMemoryABI::ChunkHeader::flags.
     uint8_t is_padding : 1;
-    uint8_t unused_flag : 1;
+
+    // If set, the payload starts with a CompressedChunkHeader followed by the
+    // LZ-compressed packets. All the ChunkMeta offsets refer to the
+    // decompressed payload.
+    uint8_t is_compressed : 1;
 
     // Not strictly needed, can be reused for more fields in the future. But
     // right now helps to spot chunks in hex dumps.
@@ -293,6 +318,15 @@ class TraceBuffer {
         std::numeric_limits<decltype(size)>::max();
   };
 
+  // Stored at the beginning of the payload of compressed ChunkRecord(s).
+  struct CompressedChunkHeader {
+    // Size of the original chunk payload.
+    uint16_t uncompressed_size;
+
+    // Size of the compressed data that follows this header.
+    uint16_t compressed_size;
+  };
+
   // Lookaside index entry. This serves two purposes:
   // 1) Allow a fast lookup of ChunkRecord by their ID (the tuple
   //   {ProducerID, WriterID, ChunkID}). This is used when applying out-of-band
@@ -434,7 +468,19 @@ class TraceBuffer {
   TraceBuffer(const TraceBuffer&) = delete;
   TraceBuffer& operator=(const TraceBuffer&) = delete;
 
-  bool Initialize(size_t size);
+  bool Initialize(size_t size, bool compress_chunks);
+
+  // Tries to compress the chunk payload |src| into |compression_buf_|, as a
+  // CompressedChunkHeader followed by the compressed data. Returns the size of
+  // the compressed payload (header included) or 0 if compressing would not
+  // reduce the size of the resulting ChunkRecord.
+  size_t CompressChunkPayload(const uint8_t* src, size_t size);
+
+  // Returns the (decompressed, if necessary) payload of the given chunk and
+  // stores its size in |payload_size|. Returns nullptr if decompression fails.
+  // The returned pointer is valid only until the next call to this method or
+  // any other method that writes into the buffer.
+  const uint8_t* GetChunkPayload(const ChunkRecord*, size_t* payload_size);
 
   // Returns an object that allows to iterate over chunks in the |index_| that
   // have the same {ProducerID, WriterID} of
@@ -518,6 +564,9 @@ class TraceBuffer {
     // We may be writing to this area for the first time.
     data_.EnsureCommitted(static_cast<size_t>(wptr + record.size - begin()));
 
+    // We might be overwriting the chunk that has been decompressed last.
+    decompressed_record_ = nullptr;
+
     // Deliberately not a *D*CHECK.
     PERFETTO_CHECK(wptr + sizeof(record) + size <= end());
     memcpy(wptr, &record, sizeof(record));
@@ -559,6 +608,18 @@ class TraceBuffer {
   // Statistics about buffer usage.
   Stats stats_;
 
+  // See "Compression" in the class comment.
+  bool compress_chunks_ = false;
+
+  // Scratch buffers for compressing a chunk when writing and for decompressing
+  // one when reading. Allocated lazily and only if |compress_chunks_|.
+  std::unique_ptr<uint8_t[]> compression_buf_;
+  std::unique_ptr<uint8_t[]> decompression_buf_;
+
+  // The ChunkRecord whose payload is currently held in |decompression_buf_|,
+  // if any.
+  const ChunkRecord* decompressed_record_ = nullptr;
+
 #if PERFETTO_DCHECK_IS_ON()
   bool changed_since_last_read_ = false;
 #endif
@@ -54,8 +54,8 @@ class TraceBufferTest : public testing::Test {
     return FakeChunk(trace_buffer_.get(), p, w, c);
   }
 
-  void ResetBuffer(size_t size_) {
-    trace_buffer_ = TraceBuffer::Create(size_);
+  void ResetBuffer(size_t size_, bool compress_chunks = false) {
+    trace_buffer_ = TraceBuffer::Create(size_, compress_chunks);
     ASSERT_TRUE(trace_buffer_);
   }
 
@@ -1585,6 +1585,140 @@ TEST_F(TraceBufferTest, Override_ReCommitIncompleteFragmenting) {
   ASSERT_THAT(ReadPacket(), IsEmpty());
 }
 
+// ------------------
+// Compression tests
+// ------------------
+
+TEST_F(TraceBufferTest, Compression_ReadWrite) {
+  // Without compression only 8 of these chunks would fit in the buffer.
+  ResetBuffer(4096, /*compress_chunks=*/true);
+  for (ChunkID chunk_id = 0; chunk_id < 32; chunk_id++) {
+    FakeChunk chunk = CreateChunk(ProducerID(1), WriterID(1), chunk_id);
+    for (int i = 0; i < 15; i++)
+      chunk.AddPacket(32, static_cast<char>('a' + chunk_id % 26));
+    chunk.PadTo(512).CopyIntoTraceBuffer();
+  }
+  EXPECT_EQ(32u, trace_buffer()->stats().chunks_compressed);
+  EXPECT_GT(trace_buffer()->stats().bytes_saved_by_compression, 32u * 256);
+
+  trace_buffer()->BeginRead();
+  for (ChunkID chunk_id = 0; chunk_id < 32; chunk_id++) {
+    for (int i = 0; i < 15; i++) {
+      ASSERT_THAT(ReadPacket(),
+                  ElementsAre(FakePacketFragment(
+                      32, static_cast<char>('a' + chunk_id % 26))));
+    }
+  }
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+  EXPECT_EQ(0u, trace_buffer()->stats().chunks_overwritten);
+}
+
+TEST_F(TraceBufferTest, Compression_FragmentsAcrossChunks) {
+  ResetBuffer(4096, /*compress_chunks=*/true);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(100, 'a')
+      .AddPacket(200, 'b', kContOnNextChunk)
+      .PadTo(512)
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(300, 'x')
+      .PadTo(512)
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(1))
+      .AddPacket(300, 'c', kContFromPrevChunk | kContOnNextChunk)
+      .PadTo(512)
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(2))
+      .AddPacket(50, 'd', kContFromPrevChunk)
+      .AddPacket(60, 'e')
+      .PadTo(512)
+      .CopyIntoTraceBuffer();
+  EXPECT_EQ(4u, trace_buffer()->stats().chunks_compressed);
+
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(100, 'a')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(200, 'b'),
+                                        FakePacketFragment(300, 'c'),
+                                        FakePacketFragment(50, 'd')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(60, 'e')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(300, 'x')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+}
+
+// Chunks that are incomplete or need patching must be stored uncompressed, as
+// they will be rewritten in place.
+TEST_F(TraceBufferTest, Compression_SkipIncompleteAndPatchableChunks) {
+  ResetBuffer(4096, /*compress_chunks=*/true);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(20, 'a')
+      .AddPacket(30, 'b')
+      .PadTo(512)
+      .CopyIntoTraceBuffer(/*chunk_complete=*/false);
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(9, 'c', kChunkNeedsPatching)
+      .ClearBytes(5, 4)
+      .PadTo(512)
+      .CopyIntoTraceBuffer();
+  EXPECT_EQ(0u, trace_buffer()->stats().chunks_compressed);
+
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(20, 'a')
+      .AddPacket(30, 'b')
+      .PadTo(512)
+      .CopyIntoTraceBuffer(/*chunk_complete=*/true);
+  ASSERT_TRUE(TryPatchChunkContents(ProducerID(2), WriterID(1), ChunkID(0),
+                                    {{5, {{'Y', 'M', 'C', 'A'}}}}));
+  EXPECT_EQ(0u, trace_buffer()->stats().chunks_compressed);
+
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(20, 'a')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(30, 'b')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment("c00-YMCA", 8)));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+}
+
+TEST_F(TraceBufferTest, Compression_ReCommitAndPatchCompressedChunk) {
+  ResetBuffer(4096, /*compress_chunks=*/true);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(100, 'a')
+      .PadTo(512)
+      .CopyIntoTraceBuffer();
+  ASSERT_EQ(1u, trace_buffer()->stats().chunks_compressed);
+
+  // Recommitting the identical chunk is a no-op.
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(100, 'a')
+      .PadTo(512)
+      .CopyIntoTraceBuffer();
+  EXPECT_EQ(0u, trace_buffer()->stats().abi_violations);
+
+  // Compressed chunks can't be patched.
+  ASSERT_FALSE(TryPatchChunkContents(ProducerID(1), WriterID(1), ChunkID(0),
+                                     {{5, {{'Y', 'M', 'C', 'A'}}}}));
+
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(100, 'a')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+}
+
+TEST_F(TraceBufferTest, Compression_Wrapping) {
+  ResetBuffer(4096, /*compress_chunks=*/true);
+  for (ChunkID chunk_id = 0; chunk_id < 1000; chunk_id++) {
+    char seed = static_cast<char>('a' + chunk_id % 26);
+    CreateChunk(ProducerID(1), WriterID(1), chunk_id)
+        .AddPacket(200, seed)
+        .AddPacket(200, seed)
+        .PadTo(1024)
+        .CopyIntoTraceBuffer();
+    trace_buffer()->BeginRead();
+    ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(200, seed)));
+    ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(200, seed)));
+    ASSERT_THAT(ReadPacket(), IsEmpty());
+  }
+  EXPECT_EQ(1000u, trace_buffer()->stats().chunks_compressed);
+  EXPECT_GT(trace_buffer()->stats().write_wrap_count, 0u);
+}
+
 // TODO(primiano): test stats().
 // TODO(primiano): test multiple streams interleaved.
 // TODO(primiano): more testing on packet merging.
@@ -102,6 +102,13 @@ void TraceConfig::FromProto(const perfetto::protos::TraceConfig& proto) {
                 "size mismatch");
   flush_period_ms_ =
       static_cast<decltype(flush_period_ms_)>(proto.flush_period_ms());
+
+  static_assert(sizeof(compression_type_) == sizeof(proto.compression_type()),
+                "size mismatch");
+  compression_type_ =
+      static_cast<decltype(compression_type_)>(proto.compression_type());
+
+  trace_filter_.FromProto(proto.trace_filter());
   unknown_fields_ = proto.unknown_fields();
 }
 
@@ -172,6 +179,13 @@ void TraceConfig::ToProto(perfetto::protos::TraceConfig* proto) const {
                 "size mismatch");
   proto->set_flush_period_ms(
       static_cast<decltype(proto->flush_period_ms())>(flush_period_ms_));
+
+  static_assert(sizeof(compression_type_) == sizeof(proto->compression_type()),
+                "size mismatch");
+  proto->set_compression_type(
+      static_cast<decltype(proto->compression_type())>(compression_type_));
+
+  trace_filter_.ToProto(proto->mutable_trace_filter());
   *(proto->mutable_unknown_fields()) = unknown_fields_;
 }
 
@@ -194,6 +208,11 @@ void TraceConfig::BufferConfig::FromProto(
   static_assert(sizeof(fill_policy_) == sizeof(proto.fill_policy()),
                 "size mismatch");
   fill_policy_ = static_cast<decltype(fill_policy_)>(proto.fill_policy());
+
+  static_assert(sizeof(compress_chunks_) == sizeof(proto.compress_chunks()),
+                "size mismatch");
+  compress_chunks_ =
+      static_cast<decltype(compress_chunks_)>(proto.compress_chunks());
   unknown_fields_ = proto.unknown_fields();
 }
 
@@ -208,6 +227,11 @@ void TraceConfig::BufferConfig::ToProto(
                 "size mismatch");
   proto->set_fill_policy(
       static_cast<decltype(proto->fill_policy())>(fill_policy_));
+
+  static_assert(sizeof(compress_chunks_) == sizeof(proto->compress_chunks()),
+                "size mismatch");
+  proto->set_compress_chunks(
+      static_cast<decltype(proto->compress_chunks())>(compress_chunks_));
   *(proto->mutable_unknown_fields()) = unknown_fields_;
 }
 
@@ -234,6 +258,13 @@ void TraceConfig::DataSource::FromProto(
     producer_name_filter_.back() =
         static_cast<decltype(producer_name_filter_)::value_type>(field);
   }
+
+  static_assert(sizeof(share_with_other_sessions_) ==
+                    sizeof(proto.share_with_other_sessions()),
+                "size mismatch");
+  share_with_other_sessions_ =
+      static_cast<decltype(share_with_other_sessions_)>(
+          proto.share_with_other_sessions());
   unknown_fields_ = proto.unknown_fields();
 }
 
@@ -249,6 +280,13 @@ void TraceConfig::DataSource::ToProto(
     static_assert(sizeof(it) == sizeof(proto->producer_name_filter(0)),
                   "size mismatch");
   }
+
+  static_assert(sizeof(share_with_other_sessions_) ==
+                    sizeof(proto->share_with_other_sessions()),
+                "size mismatch");
+  proto->set_share_with_other_sessions(
+      static_cast<decltype(proto->share_with_other_sessions())>(
+          share_with_other_sessions_));
   *(proto->mutable_unknown_fields()) = unknown_fields_;
 }
 
@@ -394,4 +432,32 @@ void TraceConfig::GuardrailOverrides::ToProto(
   *(proto->mutable_unknown_fields()) = unknown_fields_;
 }
 
+TraceConfig::TraceFilter::TraceFilter() = default;
+TraceConfig::TraceFilter::~TraceFilter() = default;
+TraceConfig::TraceFilter::TraceFilter(const TraceConfig::TraceFilter&) =
+    default;
+TraceConfig::TraceFilter& TraceConfig::TraceFilter::operator=(
+    const TraceConfig::TraceFilter&) = default;
+TraceConfig::TraceFilter::TraceFilter(TraceConfig::TraceFilter&&) noexcept =
+    default;
+TraceConfig::TraceFilter& TraceConfig::TraceFilter::operator=(
+    TraceConfig::TraceFilter&&) = default;
+
+void TraceConfig::TraceFilter::FromProto(
+    const perfetto::protos::TraceConfig_TraceFilter& proto) {
+  static_assert(sizeof(bytecode_) == sizeof(proto.bytecode()), "size mismatch");
+  bytecode_ = static_cast<decltype(bytecode_)>(proto.bytecode());
+  unknown_fields_ = proto.unknown_fields();
+}
+
+void TraceConfig::TraceFilter::ToProto(
+    perfetto::protos::TraceConfig_TraceFilter* proto) const {
+  proto->Clear();
+
+  static_assert(sizeof(bytecode_) == sizeof(proto->bytecode()),
+                "size mismatch");
+  proto->set_bytecode(static_cast<decltype(proto->bytecode())>(bytecode_));
+  *(proto->mutable_unknown_fields()) = unknown_fields_;
+}
+
 }  // namespace perfetto
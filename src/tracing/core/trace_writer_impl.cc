@@ -150,6 +150,12 @@ protozero::ContiguousMemoryRange TraceWriterImpl::GetNewBuffer() {
          nested_msg = nested_msg->nested_message()) {
       uint8_t* const cur_hdr = nested_msg->size_field();
 
+      // Messages with a short size field are guaranteed to fit in the chunk
+      // they started in, or to be widened before they outgrow it (see
+      // Message::BeginNestedMessageInternal() and WidenSizeField()).
+      PERFETTO_DCHECK(nested_msg->size_field_size() ==
+                      kMessageLengthFieldSize);
+
       // If this is false the protozero Message has already been instructed to
       // write, upon Finalize(), its size into the patch list.
       bool size_field_points_within_chunk =
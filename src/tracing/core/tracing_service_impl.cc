@@ -29,9 +29,14 @@
 #endif
 
 #include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/base/file_utils.h"
+#include "perfetto/base/metatrace.h"
 #include "perfetto/base/task_runner.h"
 #include "perfetto/base/utils.h"
 #include "perfetto/tracing/core/consumer.h"
@@ -41,10 +46,13 @@
 #include "perfetto/tracing/core/shared_memory_abi.h"
 #include "perfetto/tracing/core/trace_packet.h"
 #include "perfetto/tracing/core/trace_writer.h"
+#include "src/tracing/core/packet_compressor.h"
+#include "src/tracing/core/packet_filter.h"
 #include "src/tracing/core/packet_stream_validator.h"
 #include "src/tracing/core/shared_memory_arbiter_impl.h"
 #include "src/tracing/core/trace_buffer.h"
 
+#include "perfetto/config/data_source_config.pb.h"
 #include "perfetto/trace/clock_snapshot.pb.h"
 #include "perfetto/trace/trusted_packet.pb.h"
 
@@ -99,6 +107,7 @@ uid_t geteuid() {
   return 0;
 }
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+
 }  // namespace
 
 // These constants instead are defined in the header because are used by tests.
@@ -106,6 +115,84 @@ constexpr size_t TracingServiceImpl::kDefaultShmSize;
 constexpr size_t TracingServiceImpl::kMaxShmSize;
 constexpr uint32_t TracingServiceImpl::kDataSourceStopTimeoutMs;
 constexpr uint8_t TracingServiceImpl::kSyncMarker[];
+constexpr size_t TracingServiceImpl::kMinProducersPerScrapingThread;
+constexpr size_t TracingServiceImpl::kMaxScrapingThreads;
+
+// A fixed set of kMaxScrapingThreads - 1 threads, started on the first
+// multi-threaded scrape and kept until the service is destroyed, so that
+// flushes don't pay for creating and joining threads every time.
+class TracingServiceImpl::ScrapingWorkers {
+ public:
+  ScrapingWorkers() {
+    for (size_t i = 1; i < kMaxScrapingThreads; i++)
+      threads_.emplace_back(&ScrapingWorkers::WorkerMain, this, i);
+  }
+
+  ~ScrapingWorkers() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      quit_ = true;
+    }
+    work_cv_.notify_all();
+    for (std::thread& thread : threads_)
+      thread.join();
+  }
+
+  // Runs fn(0) ... fn(num_threads - 1) concurrently and returns only once all
+  // of them are done. fn(0) runs on the calling thread.
+  void Run(size_t num_threads, const std::function<void(size_t)>& fn) {
+    PERFETTO_DCHECK(num_threads >= 1 && num_threads <= kMaxScrapingThreads);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      fn_ = &fn;
+      num_threads_ = num_threads;
+      pending_ = num_threads - 1;
+      generation_++;
+    }
+    work_cv_.notify_all();
+    fn(0);
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return pending_ == 0; });
+    fn_ = nullptr;
+  }
+
+ private:
+  ScrapingWorkers(const ScrapingWorkers&) = delete;
+  ScrapingWorkers& operator=(const ScrapingWorkers&) = delete;
+
+  void WorkerMain(size_t thread_idx) {
+    uint64_t last_generation = 0;
+    for (;;) {
+      const std::function<void(size_t)>* fn = nullptr;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        work_cv_.wait(lock, [this, last_generation] {
+          return quit_ || generation_ != last_generation;
+        });
+        if (quit_)
+          return;
+        last_generation = generation_;
+        if (thread_idx >= num_threads_)
+          continue;
+        fn = fn_;
+      }
+      (*fn)(thread_idx);
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--pending_ == 0)
+        done_cv_.notify_one();
+    }
+  }
+
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  const std::function<void(size_t)>* fn_ = nullptr;
+  size_t num_threads_ = 0;
+  size_t pending_ = 0;
+  uint64_t generation_ = 0;
+  bool quit_ = false;
+};
 
 // static
 std::unique_ptr<TracingService> TracingService::CreateInstance(
@@ -358,6 +445,16 @@ bool TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
     tracing_session->bytes_written_into_file = 0;
   }
 
+  if (!cfg.trace_filter().bytecode().empty()) {
+    tracing_session->packet_filter.reset(new PacketFilter());
+    if (!tracing_session->packet_filter->LoadBytecode(
+            cfg.trace_filter().bytecode())) {
+      PERFETTO_ELOG("The TraceConfig has an invalid trace filter bytecode");
+      tracing_sessions_.erase(tsid);
+      return false;
+    }
+  }
+
   // Initialize the log buffers.
   bool did_allocate_all_buffers = true;
 
@@ -378,8 +475,9 @@ bool TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
     tracing_session->buffers_index.push_back(global_id);
     const size_t buf_size_bytes = buffer_cfg.size_kb() * 1024u;
     total_buf_size_kb += buffer_cfg.size_kb();
-    auto it_and_inserted =
-        buffers_.emplace(global_id, TraceBuffer::Create(buf_size_bytes));
+    auto it_and_inserted = buffers_.emplace(
+        global_id,
+        TraceBuffer::Create(buf_size_bytes, buffer_cfg.compress_chunks()));
     PERFETTO_DCHECK(it_and_inserted.second);  // buffers_.count(global_id) == 0.
     std::unique_ptr<TraceBuffer>& trace_buffer = it_and_inserted.first->second;
     if (!trace_buffer) {
@@ -456,6 +554,11 @@ bool TracingServiceImpl::StartTracing(TracingSessionID tsid) {
 
   tracing_session->state = TracingSession::STARTED;
 
+  for (MirroredBuffer& mirror : mirrored_buffers_) {
+    if (mirror.dst_session == tsid)
+      mirror.enabled = true;
+  }
+
   // Trigger delayed task if the trace is time limited.
   const uint32_t trace_duration_ms = tracing_session->config.duration_ms();
   if (trace_duration_ms > 0) {
@@ -558,6 +661,7 @@ void TracingServiceImpl::DisableTracing(TracingSessionID tsid,
     producer->StopDataSource(ds_inst_id);
   }
   tracing_session->data_source_instances.clear();
+  SetupDataSourcesOfSharingSessions(tsid);
 
   // Either this request is flagged with |disable_immediately| or there are no
   // data sources that are requesting a final handshake. In both cases just mark
@@ -628,8 +732,8 @@ void TracingServiceImpl::DisableTracingNotifyConsumerAndFlushFile(
   tracing_session->state = TracingSession::DISABLED;
 
   // Scrape any remaining chunks that weren't flushed by the producers.
-  for (auto& producer_id_and_producer : producers_)
-    ScrapeSharedMemoryBuffers(tracing_session, producer_id_and_producer.second);
+  ScrapeSharedMemoryBuffers(tracing_session);
+  RemoveMirroredBuffers(tracing_session->id);
 
   if (tracing_session->write_into_file) {
     tracing_session->write_period_ms = 0;
@@ -674,6 +778,18 @@ void TracingServiceImpl::Flush(TracingSessionID tsid,
     flush_map[producer_id].push_back(ds_inst_id);
   }
 
+  // Flush also the data source instances that this session is sharing with
+  // other sessions, as their data ends up in this session's buffers as well.
+  for (const MirroredBuffer& mirror : mirrored_buffers_) {
+    if (mirror.dst_session != tsid)
+      continue;
+    std::vector<DataSourceInstanceID>& ds_insts = flush_map[mirror.producer_id];
+    if (std::find(ds_insts.begin(), ds_insts.end(), mirror.src_instance_id) ==
+        ds_insts.end()) {
+      ds_insts.push_back(mirror.src_instance_id);
+    }
+  }
+
   for (const auto& kv : flush_map) {
     ProducerID producer_id = kv.first;
     ProducerEndpointImpl* producer = GetProducer(producer_id);
@@ -740,10 +856,7 @@ void TracingServiceImpl::CompleteFlush(TracingSessionID tsid,
     // Producers may not have been able to flush all their data, even if they
     // indicated flush completion. If possible, also collect uncommitted chunks
     // to make sure we have everything they wrote so far.
-    for (auto& producer_id_and_producer : producers_) {
-      ScrapeSharedMemoryBuffers(tracing_session,
-                                producer_id_and_producer.second);
-    }
+    ScrapeSharedMemoryBuffers(tracing_session);
   }
   callback(success);
 }
@@ -754,6 +867,97 @@ void TracingServiceImpl::ScrapeSharedMemoryBuffers(
   if (!smb_scraping_enabled_)
     return;
 
+  std::vector<ScrapedChunk> chunks;
+  FindChunksToScrape(GetBuffersToScrape(tracing_session), producer, &chunks);
+  for (const ScrapedChunk& chunk : chunks) {
+    CopyProducerPageIntoLogBuffer(
+        chunk.producer_id, chunk.producer_uid, chunk.writer_id,
+        chunk.chunk_id, chunk.target_buffer, chunk.packet_count, chunk.flags,
+        chunk.chunk_complete, chunk.payload, chunk.payload_size);
+  }
+}
+
+void TracingServiceImpl::ScrapeSharedMemoryBuffers(
+    TracingSession* tracing_session) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  if (!smb_scraping_enabled_)
+    return;
+
+  std::vector<ProducerEndpointImpl*> producers;
+  for (auto& producer_id_and_producer : producers_)
+    producers.push_back(producer_id_and_producer.second);
+
+  const size_t num_threads =
+      std::min(kMaxScrapingThreads,
+               producers.size() / kMinProducersPerScrapingThread);
+  if (num_threads <= 1) {
+    for (ProducerEndpointImpl* producer : producers)
+      ScrapeSharedMemoryBuffers(tracing_session, producer);
+    return;
+  }
+
+  // The service thread is blocked until all the workers are done, so nothing
+  // can mutate the producers or the log buffers in the meantime.
+  if (!scraping_workers_)
+    scraping_workers_.reset(new ScrapingWorkers());
+  // 1) Scan the SMBs, each thread takes a strided subset of the producers.
+  const std::vector<BufferID> session_buffers =
+      GetBuffersToScrape(tracing_session);
+  std::vector<std::vector<ScrapedChunk>> chunks_per_thread(num_threads);
+  scraping_workers_->Run(num_threads, [&producers, &session_buffers,
+                                       &chunks_per_thread,
+                                       num_threads](size_t thread_idx) {
+    for (size_t i = thread_idx; i < producers.size(); i += num_threads) {
+      FindChunksToScrape(session_buffers, producers[i],
+                         &chunks_per_thread[thread_idx]);
+    }
+  });
+
+  // 2) Copy the chunks, sharded by target buffer. A TraceBuffer is not thread
+  // safe, but different TraceBuffer(s) are fully independent. Chunks from the
+  // same producer are kept in their original order.
+  std::map<BufferID, std::vector<const ScrapedChunk*>> chunks_per_buffer;
+  for (const auto& chunks : chunks_per_thread) {
+    for (const ScrapedChunk& chunk : chunks) {
+      chunks_per_buffer[chunk.target_buffer].push_back(&chunk);
+      for (const MirroredBuffer& mirror : mirrored_buffers_) {
+        if (mirror.enabled && mirror.producer_id == chunk.producer_id &&
+            mirror.src_buffer == chunk.target_buffer) {
+          chunks_per_buffer[mirror.dst_buffer].push_back(&chunk);
+        }
+      }
+    }
+  }
+  std::vector<std::pair<TraceBuffer*, const std::vector<const ScrapedChunk*>*>>
+      shards;
+  for (const auto& buffer_id_and_chunks : chunks_per_buffer) {
+    TraceBuffer* buf = GetBufferByID(buffer_id_and_chunks.first);
+    if (buf)
+      shards.emplace_back(buf, &buffer_id_and_chunks.second);
+  }
+  if (shards.empty())
+    return;
+  const size_t num_copy_threads = std::min(num_threads, shards.size());
+  scraping_workers_->Run(num_copy_threads, [&shards, num_copy_threads](
+                                               size_t thread_idx) {
+    for (size_t i = thread_idx; i < shards.size(); i += num_copy_threads) {
+      TraceBuffer* buf = shards[i].first;
+      for (const ScrapedChunk* chunk : *shards[i].second) {
+        buf->CopyChunkUntrusted(chunk->producer_id, chunk->producer_uid,
+                                chunk->writer_id, chunk->chunk_id,
+                                chunk->packet_count, chunk->flags,
+                                chunk->chunk_complete, chunk->payload,
+                                chunk->payload_size);
+      }
+    }
+  });
+}
+
+// static
+void TracingServiceImpl::FindChunksToScrape(
+    const std::vector<BufferID>& session_buffers,
+    ProducerEndpointImpl* producer,
+    std::vector<ScrapedChunk>* chunks) {
   // Can't copy chunks if we don't know about any trace writers.
   if (producer->writers_.empty())
     return;
@@ -763,7 +967,6 @@ void TracingServiceImpl::ScrapeSharedMemoryBuffers(
   // session, there's no need to scape its chunks right now. We can tell if a
   // producer participates in the session by checking if the producer is allowed
   // to write into the session's log buffers.
-  const auto& session_buffers = tracing_session->buffers_index;
   bool producer_in_session =
       std::any_of(session_buffers.begin(), session_buffers.end(),
                   [producer](BufferID buffer_id) {
@@ -774,7 +977,7 @@ void TracingServiceImpl::ScrapeSharedMemoryBuffers(
 
   PERFETTO_DLOG("Scraping SMB for producer %" PRIu16, producer->id_);
 
-  // Find and copy any uncommitted chunks from the SMB.
+  // Find any uncommitted chunks in the SMB.
   //
   // In nominal conditions, the page layout of the used SMB pages should never
   // change because the service is the only one who is supposed to modify used
@@ -857,10 +1060,23 @@ void TracingServiceImpl::ScrapeSharedMemoryBuffers(
       uint32_t chunk_id =
           chunk.header()->chunk_id.load(std::memory_order_relaxed);
 
-      CopyProducerPageIntoLogBuffer(
-          producer->id_, producer->uid_, writer_id, chunk_id, *target_buffer_id,
-          packet_count, flags, chunk_complete, chunk.payload_begin(),
-          chunk.payload_size());
+      // The same checks done by CopyProducerPageIntoLogBuffer(). Here the
+      // buffer comes from |writers_|, so it can only fail on a forbidden one.
+      if (!producer->is_allowed_target_buffer(*target_buffer_id))
+        continue;
+
+      ScrapedChunk scraped_chunk;
+      scraped_chunk.producer_id = producer->id_;
+      scraped_chunk.producer_uid = producer->uid_;
+      scraped_chunk.writer_id = writer_id;
+      scraped_chunk.chunk_id = chunk_id;
+      scraped_chunk.target_buffer = *target_buffer_id;
+      scraped_chunk.packet_count = packet_count;
+      scraped_chunk.flags = flags;
+      scraped_chunk.chunk_complete = chunk_complete;
+      scraped_chunk.payload = chunk.payload_begin();
+      scraped_chunk.payload_size = chunk.payload_size();
+      chunks->push_back(scraped_chunk);
     }
   }
 }
@@ -919,6 +1135,7 @@ void TracingServiceImpl::PeriodicFlushTask(TracingSessionID tsid,
 void TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
                                      ConsumerEndpointImpl* consumer) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
+  PERFETTO_METATRACE("ReadBuffers", 0);
   TracingSession* tracing_session = GetTracingSession(tsid);
   if (!tracing_session) {
     // This will be hit systematically from the PostDelayedTask when directly
@@ -1001,6 +1218,14 @@ void TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
         continue;
       }
 
+      // Filtering happens only after validation, so that a producer can't
+      // sneak in a trusted field by making the packet malformed. The trusted
+      // uid is appended below and is not subject to the filter.
+      if (tracing_session->packet_filter &&
+          !tracing_session->packet_filter->FilterPacket(&packet)) {
+        continue;
+      }
+
       // Append a slice with the trusted UID of the producer. This can't
       // be spoofed because above we validated that the existing slices
       // don't contain any trusted UID fields. For added safety we append
@@ -1028,6 +1253,19 @@ void TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
     }  // for(packets...)
   }    // for(buffers...)
 
+  // Batch and compress the packets, if the config asked for it. This happens
+  // after the trusted uid has been appended, so the uid ends up inside the
+  // compressed payload, and before the packets are written or sent, so that
+  // both the file and the IPC path benefit from it.
+  if (tracing_session->config.compression_type() ==
+          TraceConfig::COMPRESSION_TYPE_LZ &&
+      !packets.empty()) {
+    PacketCompressor::CompressPackets(&packets);
+    total_slices = 0;
+    for (const TracePacket& packet : packets)
+      total_slices += packet.slices().size();
+  }
+
   // If the caller asked us to write into a file by setting
   // |write_into_file| == true in the trace config, drain the packets read
   // (if any) into the given file descriptor.
@@ -1136,6 +1374,7 @@ void TracingServiceImpl::FreeBuffers(TracingSessionID tsid) {
     return;  // TODO(primiano): signal failure?
   }
   DisableTracing(tsid, /*disable_immediately=*/true);
+  RemoveMirroredBuffers(tsid);
 
   for (auto& producer_entry : producers_) {
     ProducerEndpointImpl* producer = producer_entry.second;
@@ -1214,6 +1453,12 @@ void TracingServiceImpl::UnregisterDataSource(ProducerID producer_id,
         DataSourceInstanceID ds_inst_id = it->second.instance_id;
         producer->StopDataSource(ds_inst_id);
         it = ds_instances.erase(it);
+        mirrored_buffers_.erase(
+            std::remove_if(mirrored_buffers_.begin(), mirrored_buffers_.end(),
+                           [ds_inst_id](const MirroredBuffer& mirror) {
+                             return mirror.src_instance_id == ds_inst_id;
+                           }),
+            mirrored_buffers_.end());
       } else {
         ++it;
       }
@@ -1271,6 +1516,11 @@ TracingServiceImpl::DataSourceInstance* TracingServiceImpl::SetupDataSource(
     return nullptr;
   }
 
+  if (cfg_data_source.share_with_other_sessions() &&
+      ShareExistingDataSource(cfg_data_source, producer, tracing_session)) {
+    return nullptr;
+  }
+
   // Create a copy of the DataSourceConfig specified in the trace config. This
   // will be passed to the producer after translating the |target_buffer| id.
   // The |target_buffer| parameter passed by the consumer in the trace config is
@@ -1328,6 +1578,141 @@ TracingServiceImpl::DataSourceInstance* TracingServiceImpl::SetupDataSource(
   return ds_instance;
 }
 
+bool TracingServiceImpl::ShareExistingDataSource(
+    const TraceConfig::DataSource& cfg_data_source,
+    ProducerEndpointImpl* producer,
+    TracingSession* tracing_session) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  const BufferID dst_buffer =
+      tracing_session->buffers_index[cfg_data_source.config().target_buffer()];
+  for (auto& kv : tracing_sessions_) {
+    TracingSession& other_session = kv.second;
+    // Only the sessions of the same uid can share data. Otherwise a consumer
+    // could see data sources that another consumer enabled.
+    if (&other_session == tracing_session ||
+        other_session.consumer_uid != tracing_session->consumer_uid) {
+      continue;
+    }
+    auto range = other_session.data_source_instances.equal_range(producer->id_);
+    for (auto it = range.first; it != range.second; it++) {
+      const DataSourceInstance& ds_inst = it->second;
+      if (ds_inst.data_source_name != cfg_data_source.config().name())
+        continue;
+
+      // The configs must be identical, except for the fields that the service
+      // fills in on a per-session basis.
+      DataSourceConfig cfg = cfg_data_source.config();
+      cfg.set_target_buffer(ds_inst.config.target_buffer());
+      cfg.set_tracing_session_id(ds_inst.config.tracing_session_id());
+      cfg.set_trace_duration_ms(ds_inst.config.trace_duration_ms());
+      protos::DataSourceConfig cfg_proto;
+      protos::DataSourceConfig other_cfg_proto;
+      cfg.ToProto(&cfg_proto);
+      ds_inst.config.ToProto(&other_cfg_proto);
+      if (cfg_proto.SerializeAsString() != other_cfg_proto.SerializeAsString())
+        continue;
+
+      MirroredBuffer mirror{};
+      mirror.producer_id = producer->id_;
+      mirror.src_instance_id = ds_inst.instance_id;
+      mirror.src_session = other_session.id;
+      mirror.src_buffer = static_cast<BufferID>(ds_inst.config.target_buffer());
+      mirror.dst_session = tracing_session->id;
+      mirror.dst_buffer = dst_buffer;
+      mirror.enabled = tracing_session->state == TracingSession::STARTED;
+      bool already_mirrored = std::any_of(
+          mirrored_buffers_.begin(), mirrored_buffers_.end(),
+          [&mirror](const MirroredBuffer& m) {
+            return m.producer_id == mirror.producer_id &&
+                   m.src_buffer == mirror.src_buffer &&
+                   m.dst_buffer == mirror.dst_buffer;
+          });
+      if (!already_mirrored)
+        mirrored_buffers_.push_back(mirror);
+      PERFETTO_DLOG("Sharing data source %s of producer %" PRIu16
+                    " from buffer %" PRIu16 " into buffer %" PRIu16,
+                    cfg.name().c_str(), producer->id_, mirror.src_buffer,
+                    dst_buffer);
+      return true;
+    }
+  }
+  return false;
+}
+
+void TracingServiceImpl::RemoveMirroredBuffers(TracingSessionID tsid) {
+  mirrored_buffers_.erase(
+      std::remove_if(mirrored_buffers_.begin(), mirrored_buffers_.end(),
+                     [tsid](const MirroredBuffer& mirror) {
+                       return mirror.src_session == tsid ||
+                              mirror.dst_session == tsid;
+                     }),
+      mirrored_buffers_.end());
+}
+
+void TracingServiceImpl::SetupDataSourcesOfSharingSessions(
+    TracingSessionID tsid) {
+  std::vector<std::pair<TracingSessionID, ProducerID>> sharing;
+  for (const MirroredBuffer& mirror : mirrored_buffers_) {
+    auto key = std::make_pair(mirror.dst_session, mirror.producer_id);
+    if (mirror.src_session == tsid &&
+        std::find(sharing.begin(), sharing.end(), key) == sharing.end()) {
+      sharing.push_back(key);
+    }
+  }
+
+  for (const auto& key : sharing) {
+    TracingSession* tracing_session = GetTracingSession(key.first);
+    ProducerEndpointImpl* producer = GetProducer(key.second);
+    if (!tracing_session || !producer ||
+        (tracing_session->state != TracingSession::STARTED &&
+         tracing_session->state != TracingSession::CONFIGURED)) {
+      continue;
+    }
+
+    TraceConfig::ProducerConfig producer_config;
+    for (auto& config : tracing_session->config.producers()) {
+      if (producer->name_ == config.producer_name()) {
+        producer_config = config;
+        break;
+      }
+    }
+    for (const TraceConfig::DataSource& cfg_data_source :
+         tracing_session->config.data_sources()) {
+      if (!cfg_data_source.share_with_other_sessions())
+        continue;
+      const std::string& name = cfg_data_source.config().name();
+      bool has_instance = false;
+      auto instances =
+          tracing_session->data_source_instances.equal_range(producer->id_);
+      for (auto it = instances.first; it != instances.second; it++)
+        has_instance |= it->second.data_source_name == name;
+      if (has_instance)
+        continue;
+      auto range = data_sources_.equal_range(name);
+      for (auto it = range.first; it != range.second; it++) {
+        if (it->second.producer_id != producer->id_)
+          continue;
+        PERFETTO_DLOG("Taking over shared data source %s in session %" PRIu64,
+                      name.c_str(), tracing_session->id);
+        DataSourceInstance* ds_inst = SetupDataSource(
+            cfg_data_source, producer_config, it->second, tracing_session);
+        if (ds_inst && tracing_session->state == TracingSession::STARTED)
+          producer->StartDataSource(ds_inst->instance_id, ds_inst->config);
+      }
+    }
+  }
+}
+
+std::vector<BufferID> TracingServiceImpl::GetBuffersToScrape(
+    TracingSession* tracing_session) {
+  std::vector<BufferID> buffers = tracing_session->buffers_index;
+  for (const MirroredBuffer& mirror : mirrored_buffers_) {
+    if (mirror.dst_session == tracing_session->id)
+      buffers.push_back(mirror.src_buffer);
+  }
+  return buffers;
+}
+
 // Note: all the fields % *_trusted ones are untrusted, as in, the Producer
 // might be lying / returning garbage contents. |src| and |size| can be trusted
 // in terms of being a valid pointer, but not the contents.
@@ -1387,6 +1772,19 @@ void TracingServiceImpl::CopyProducerPageIntoLogBuffer(
   buf->CopyChunkUntrusted(producer_id_trusted, producer_uid_trusted, writer_id,
                           chunk_id, num_fragments, chunk_flags, chunk_complete,
                           src, size);
+
+  for (const MirroredBuffer& mirror : mirrored_buffers_) {
+    if (!mirror.enabled || mirror.producer_id != producer_id_trusted ||
+        mirror.src_buffer != buffer_id) {
+      continue;
+    }
+    TraceBuffer* dst_buf = GetBufferByID(mirror.dst_buffer);
+    if (!dst_buf)
+      continue;
+    dst_buf->CopyChunkUntrusted(producer_id_trusted, producer_uid_trusted,
+                                writer_id, chunk_id, num_fragments,
+                                chunk_flags, chunk_complete, src, size);
+  }
 }
 
 void TracingServiceImpl::ApplyChunkPatches(
@@ -1432,6 +1830,18 @@ void TracingServiceImpl::ApplyChunkPatches(
     }
     buf->TryPatchChunkContents(producer_id_trusted, writer_id, chunk_id,
                                &patches[0], i, chunk.has_more_patches());
+
+    for (const MirroredBuffer& mirror : mirrored_buffers_) {
+      if (!mirror.enabled || mirror.producer_id != producer_id_trusted ||
+          mirror.src_buffer != chunk.target_buffer()) {
+        continue;
+      }
+      TraceBuffer* dst_buf = GetBufferByID(mirror.dst_buffer);
+      if (!dst_buf)
+        continue;
+      dst_buf->TryPatchChunkContents(producer_id_trusted, writer_id, chunk_id,
+                                     &patches[0], i, chunk.has_more_patches());
+    }
   }
 }
 
@@ -1610,6 +2020,9 @@ void TracingServiceImpl::SnapshotStats(TracingSession* tracing_session,
     buf_stats_proto->set_readaheads_succeeded(buf_stats.readaheads_succeeded);
     buf_stats_proto->set_readaheads_failed(buf_stats.readaheads_failed);
     buf_stats_proto->set_abi_violations(buf_stats.abi_violations);
+    buf_stats_proto->set_chunks_compressed(buf_stats.chunks_compressed);
+    buf_stats_proto->set_bytes_saved_by_compression(
+        buf_stats.bytes_saved_by_compression);
   }  // for (buf in session).
   Slice slice = Slice::Allocate(static_cast<size_t>(packet.ByteSize()));
   PERFETTO_CHECK(packet.SerializeWithCachedSizesToArray(slice.own_data()));
@@ -1811,6 +2224,7 @@ void TracingServiceImpl::ProducerEndpointImpl::CommitData(
     const CommitDataRequest& req_untrusted,
     CommitDataCallback callback) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
+  PERFETTO_METATRACE("CommitData", 0);
 
   if (!shared_memory_) {
     PERFETTO_DLOG(
@@ -21,6 +21,7 @@
 #include <map>
 #include <memory>
 #include <set>
+#include <vector>
 
 #include "perfetto/base/gtest_prod_util.h"
 #include "perfetto/base/logging.h"
@@ -34,6 +35,7 @@
 #include "perfetto/tracing/core/trace_config.h"
 #include "perfetto/tracing/core/tracing_service.h"
 #include "src/tracing/core/id_allocator.h"
+#include "src/tracing/core/packet_filter.h"
 
 namespace perfetto {
 
@@ -56,6 +58,12 @@ class TracingServiceImpl : public TracingService {
   static constexpr size_t kDefaultShmSize = 256 * 1024ul;
   static constexpr size_t kMaxShmSize = 32 * 1024 * 1024ul;
   static constexpr uint32_t kDataSourceStopTimeoutMs = 5000;
+
+  // When scraping the SMBs of a tracing session, a worker thread is used for
+  // each group of kMinProducersPerScrapingThread producers, up to
+  // kMaxScrapingThreads (inclusive of the service thread).
+  static constexpr size_t kMinProducersPerScrapingThread = 8;
+  static constexpr size_t kMaxScrapingThreads = 4;
   static constexpr uint8_t kSyncMarker[] = {0x82, 0x47, 0x7a, 0x76, 0xb2, 0x8d,
                                             0x42, 0xba, 0x81, 0xdc, 0x33, 0x32,
                                             0x6d, 0x57, 0xa0, 0x79};
@@ -344,8 +352,48 @@ class TracingServiceImpl : public TracingService {
     uint32_t write_period_ms = 0;
     uint64_t max_file_size_bytes = 0;
     uint64_t bytes_written_into_file = 0;
+
+    // Set when the TraceConfig has a |trace_filter|. Applied in ReadBuffers()
+    // to the packets written by the producers.
+    std::unique_ptr<PacketFilter> packet_filter;
+  };
+
+  // A buffer of a producer, whose chunks are copied also into the buffer of
+  // another tracing session. See TraceConfig.DataSource's
+  // |share_with_other_sessions|.
+  struct MirroredBuffer {
+    ProducerID producer_id;
+
+    // The data source instance, owned by |src_session|, that is shared.
+    DataSourceInstanceID src_instance_id;
+    TracingSessionID src_session;
+    BufferID src_buffer;
+
+    TracingSessionID dst_session;
+    BufferID dst_buffer;
+
+    // False until the |dst_session| is started.
+    bool enabled;
+  };
+
+  // A chunk found in a producer's SMB by FindChunksToScrape(), that has to be
+  // copied into the |target_buffer|.
+  struct ScrapedChunk {
+    ProducerID producer_id;
+    uid_t producer_uid;
+    WriterID writer_id;
+    ChunkID chunk_id;
+    BufferID target_buffer;
+    uint16_t packet_count;
+    uint8_t flags;
+    bool chunk_complete;
+    const uint8_t* payload;
+    size_t payload_size;
   };
 
+  // The worker threads used by ScrapeSharedMemoryBuffers(). Defined in the .cc.
+  class ScrapingWorkers;
+
   TracingServiceImpl(const TracingServiceImpl&) = delete;
   TracingServiceImpl& operator=(const TracingServiceImpl&) = delete;
 
@@ -382,8 +430,40 @@ class TracingServiceImpl : public TracingService {
                      bool success);
   void ScrapeSharedMemoryBuffers(TracingSession* tracing_session,
                                  ProducerEndpointImpl* producer);
+
+  // Scrapes the SMBs of all the producers that write into |tracing_session|.
+  // With many producers, both the SMB scanning and the copy of the chunks into
+  // the log buffers are split across worker threads.
+  void ScrapeSharedMemoryBuffers(TracingSession* tracing_session);
+
+  // Appends to |chunks| the chunks of |producer|'s SMB that can be copied into
+  // any of the |session_buffers|. This doesn't touch any state of the service
+  // and is safe to call from a worker thread, as long as the service thread
+  // is not concurrently mutating |producer|.
+  static void FindChunksToScrape(const std::vector<BufferID>& session_buffers,
+                                 ProducerEndpointImpl* producer,
+                                 std::vector<ScrapedChunk>* chunks);
   TraceBuffer* GetBufferByID(BufferID);
 
+  // If |tracing_session| can share an instance of |cfg_data_source| already
+  // running on |producer| for another session, adds a MirroredBuffer for it to
+  // |mirrored_buffers_| and returns true.
+  bool ShareExistingDataSource(const TraceConfig::DataSource& cfg_data_source,
+                               ProducerEndpointImpl* producer,
+                               TracingSession* tracing_session);
+
+  // Removes all the MirroredBuffer(s) that involve the given session.
+  void RemoveMirroredBuffers(TracingSessionID);
+
+  // Called when the given session stops its data sources. The sessions that
+  // were sharing them set up their own instances, so that they keep receiving
+  // data.
+  void SetupDataSourcesOfSharingSessions(TracingSessionID);
+
+  // Returns the buffers that have to be scraped for |tracing_session|. These
+  // are the session buffers plus the source buffers mirrored into them.
+  std::vector<BufferID> GetBuffersToScrape(TracingSession* tracing_session);
+
   base::TaskRunner* const task_runner_;
   std::unique_ptr<SharedMemory::Factory> shm_factory_;
   ProducerID last_producer_id_ = 0;
@@ -402,7 +482,12 @@ class TracingServiceImpl : public TracingService {
   std::map<TracingSessionID, TracingSession> tracing_sessions_;
   std::map<BufferID, std::unique_ptr<TraceBuffer>> buffers_;
 
+  // Typically empty or very small, hence a vector. It's scanned for each chunk
+  // copied into the log buffers.
+  std::vector<MirroredBuffer> mirrored_buffers_;
+
   bool smb_scraping_enabled_ = false;
+  std::unique_ptr<ScrapingWorkers> scraping_workers_;  // Lazily created.
   bool lockdown_mode_ = false;
   uint32_t min_write_period_ms_ = 100;  // Overridable for testing.
 
@@ -23,6 +23,7 @@
 #include "perfetto/ipc/client.h"
 #include "perfetto/tracing/core/consumer.h"
 #include "perfetto/tracing/core/trace_config.h"
+#include "src/tracing/ipc/posix_shared_memory.h"
 
 // TODO(fmayer): Add a test to check to what happens when ConsumerIPCClientImpl
 // gets destroyed w.r.t. the Consumer pointer. Also think to lifetime of the
@@ -39,12 +40,25 @@ std::unique_ptr<TracingService::ConsumerEndpoint> ConsumerIPCClient::Connect(
       new ConsumerIPCClientImpl(service_sock_name, consumer, task_runner));
 }
 
+// static. (Declared in include/tracing/ipc/consumer_ipc_client.h).
+std::unique_ptr<TracingService::ConsumerEndpoint> ConsumerIPCClient::Connect(
+    const char* service_sock_name,
+    Consumer* consumer,
+    base::TaskRunner* task_runner,
+    size_t read_buffers_shm_size) {
+  return std::unique_ptr<TracingService::ConsumerEndpoint>(
+      new ConsumerIPCClientImpl(service_sock_name, consumer, task_runner,
+                                read_buffers_shm_size));
+}
+
 ConsumerIPCClientImpl::ConsumerIPCClientImpl(const char* service_sock_name,
                                              Consumer* consumer,
-                                             base::TaskRunner* task_runner)
+                                             base::TaskRunner* task_runner,
+                                             size_t read_buffers_shm_size)
     : consumer_(consumer),
       ipc_channel_(ipc::Client::CreateInstance(service_sock_name, task_runner)),
       consumer_port_(this /* event_listener */),
+      read_buffers_shm_size_(read_buffers_shm_size),
       weak_ptr_factory_(this) {
   ipc_channel_->BindService(consumer_port_.GetWeakPtr());
 }
@@ -72,6 +86,7 @@ void ConsumerIPCClientImpl::EnableTracing(const TraceConfig& trace_config,
 
   protos::EnableTracingRequest req;
   trace_config.ToProto(req.mutable_trace_config());
+  MaybeRequestReadBuffersRing(trace_config, &req);
   ipc::Deferred<protos::EnableTracingResponse> async_response;
   auto weak_this = weak_ptr_factory_.GetWeakPtr();
   async_response.Bind(
@@ -133,8 +148,12 @@ void ConsumerIPCClientImpl::ReadBuffers() {
       [this](ipc::AsyncResult<protos::ReadBuffersResponse> response) {
         OnReadBuffersResponse(std::move(response));
       });
-  consumer_port_.ReadBuffers(protos::ReadBuffersRequest(),
-                             std::move(async_response));
+  protos::ReadBuffersRequest req;
+  if (read_buffers_shm_size_) {
+    req.set_shared_memory_size_kb(
+        static_cast<uint32_t>(read_buffers_shm_size_ / 1024));
+  }
+  consumer_port_.ReadBuffers(req, std::move(async_response));
 }
 
 void ConsumerIPCClientImpl::OnReadBuffersResponse(
@@ -143,7 +162,25 @@ void ConsumerIPCClientImpl::OnReadBuffersResponse(
     PERFETTO_DLOG("ReadBuffers() failed");
     return;
   }
+  MaybeAttachReadBuffersRing();
+
   std::vector<TracePacket> trace_packets;
+
+  // The packets in the shared memory ring always precede the ones in |slices|.
+  if (response->has_shared_memory_write_offset()) {
+    if (!read_buffers_ring_ ||
+        !read_buffers_ring_->Read(response->shared_memory_write_offset(),
+                                  &trace_packets)) {
+      // The Consumer API has no way to report a gap in the data. Stop asking
+      // for the ring, so that the next reads get the packets as IPC slices.
+      PERFETTO_ELOG(
+          "Failed to read packets from the shared memory ring, the trace data "
+          "is incomplete");
+      read_buffers_ring_.reset();
+      read_buffers_shm_size_ = 0;
+    }
+  }
+
   for (auto& resp_slice : *response->mutable_slices()) {
     partial_packet_.AddSlice(
         Slice(std::unique_ptr<std::string>(resp_slice.release_data())));
@@ -156,10 +193,39 @@ void ConsumerIPCClientImpl::OnReadBuffersResponse(
 
 void ConsumerIPCClientImpl::OnEnableTracingResponse(
     ipc::AsyncResult<protos::EnableTracingResponse> response) {
+  if (response)
+    MaybeAttachReadBuffersRing();
   if (!response || response->disabled())
     consumer_->OnTracingDisabled();
 }
 
+void ConsumerIPCClientImpl::MaybeRequestReadBuffersRing(
+    const TraceConfig& trace_config,
+    protos::EnableTracingRequest* req) {
+  if (!read_buffers_shm_size_ || trace_config.write_into_file())
+    return;
+  req->set_read_buffers_shared_memory_size_kb(
+      static_cast<uint32_t>(read_buffers_shm_size_ / 1024));
+}
+
+void ConsumerIPCClientImpl::MaybeAttachReadBuffersRing() {
+  if (!read_buffers_shm_size_ || read_buffers_ring_)
+    return;
+  base::ScopedFile fd = ipc_channel_->TakeReceivedFD();
+  if (!fd)
+    return;
+  std::unique_ptr<SharedMemory> shm =
+      PosixSharedMemory::AttachToFd(std::move(fd));
+  if (shm && SharedPacketRing::IsValidSize(shm->size())) {
+    read_buffers_ring_.reset(new SharedPacketRing(std::move(shm)));
+    return;
+  }
+  // The service doesn't write into the ring until a ReadBuffers() issued
+  // after this confirms that it was attached, so nothing is lost here.
+  PERFETTO_ELOG("Failed to attach the ReadBuffers() shared memory ring");
+  read_buffers_shm_size_ = 0;
+}
+
 void ConsumerIPCClientImpl::FreeBuffers() {
   if (!connected_) {
     PERFETTO_DLOG("Cannot FreeBuffers(), not connected to tracing service");
@@ -238,6 +304,7 @@ void ConsumerIPCClientImpl::Attach(const std::string& key) {
       // notificaton callback, via EnableTracing(attach_notification_only).
       protos::EnableTracingRequest enable_req;
       enable_req.set_attach_notification_only(true);
+      weak_this->MaybeRequestReadBuffersRing(trace_config, &enable_req);
       ipc::Deferred<protos::EnableTracingResponse> enable_resp;
       enable_resp.Bind(
           [weak_this](ipc::AsyncResult<protos::EnableTracingResponse> resp) {
@@ -28,6 +28,7 @@
 #include "perfetto/tracing/core/trace_packet.h"
 #include "perfetto/tracing/core/tracing_service.h"
 #include "perfetto/tracing/ipc/consumer_ipc_client.h"
+#include "src/tracing/ipc/shared_packet_ring.h"
 
 #include "perfetto/ipc/consumer_port.ipc.h"
 
@@ -53,7 +54,8 @@ class ConsumerIPCClientImpl : public TracingService::ConsumerEndpoint,
  public:
   ConsumerIPCClientImpl(const char* service_sock_name,
                         Consumer*,
-                        base::TaskRunner*);
+                        base::TaskRunner*,
+                        size_t read_buffers_shm_size = 0);
   ~ConsumerIPCClientImpl() override;
 
   // TracingService::ConsumerEndpoint implementation.
@@ -74,10 +76,23 @@ class ConsumerIPCClientImpl : public TracingService::ConsumerEndpoint,
   void OnConnect() override;
   void OnDisconnect() override;
 
+  const SharedPacketRing* read_buffers_ring_for_testing() const {
+    return read_buffers_ring_.get();
+  }
+
  private:
   void OnReadBuffersResponse(ipc::AsyncResult<protos::ReadBuffersResponse>);
   void OnEnableTracingResponse(ipc::AsyncResult<protos::EnableTracingResponse>);
 
+  // Asks the service to create the ReadBuffers() ring upfront, unless the
+  // trace is written into a file and never read through ReadBuffers().
+  void MaybeRequestReadBuffersRing(const TraceConfig&,
+                                   protos::EnableTracingRequest*);
+
+  // Attaches |read_buffers_ring_| if the service sent its file descriptor
+  // with the response being processed.
+  void MaybeAttachReadBuffersRing();
+
   // TODO(primiano): think to dtor order, do we rely on any specific sequence?
   Consumer* const consumer_;
 
@@ -97,6 +112,14 @@ class ConsumerIPCClientImpl : public TracingService::ConsumerEndpoint,
   // one with |last_slice_for_packet| == true is received.
   TracePacket partial_packet_;
 
+  // When non-zero, ReadBuffers() asks the service to return the packets
+  // through a shared memory ring of this size. |read_buffers_ring_| is set
+  // once the service has sent the ring's file descriptor. Reset to zero if
+  // the ring can't be attached or read, so that the service falls back to
+  // sending all the packets as IPC slices.
+  size_t read_buffers_shm_size_;
+  std::unique_ptr<SharedPacketRing> read_buffers_ring_;
+
   base::WeakPtrFactory<ConsumerIPCClientImpl> weak_ptr_factory_;
 };
 
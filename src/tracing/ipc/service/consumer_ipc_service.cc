@@ -28,6 +28,7 @@
 #include "perfetto/tracing/core/trace_config.h"
 #include "perfetto/tracing/core/trace_packet.h"
 #include "perfetto/tracing/core/tracing_service.h"
+#include "src/tracing/ipc/posix_shared_memory.h"
 
 namespace perfetto {
 
@@ -62,6 +63,8 @@ void ConsumerIPCService::OnClientDisconnected() {
 void ConsumerIPCService::EnableTracing(const protos::EnableTracingRequest& req,
                                        DeferredEnableTracingResponse resp) {
   RemoteConsumer* remote_consumer = GetConsumerForCurrentRequest();
+  remote_consumer->MaybeCreateReadBuffersRing(
+      req.read_buffers_shared_memory_size_kb() * 1024ul);
   if (req.attach_notification_only()) {
     remote_consumer->enable_tracing_response = std::move(resp);
     return;
@@ -91,9 +94,22 @@ void ConsumerIPCService::DisableTracing(const protos::DisableTracingRequest&,
 }
 
 // Called by the IPC layer.
-void ConsumerIPCService::ReadBuffers(const protos::ReadBuffersRequest&,
+void ConsumerIPCService::ReadBuffers(const protos::ReadBuffersRequest& req,
                                      DeferredReadBuffersResponse resp) {
   RemoteConsumer* remote_consumer = GetConsumerForCurrentRequest();
+  const size_t ring_size = req.shared_memory_size_kb() * 1024ul;
+
+  // A consumer that stops asking for the ring (e.g. because it failed to
+  // attach or read it) gets all the data as IPC slices from now on.
+  if (!ring_size && remote_consumer->read_buffers_ring) {
+    remote_consumer->read_buffers_ring.reset();
+    remote_consumer->send_read_buffers_ring_fd = false;
+  }
+  remote_consumer->use_read_buffers_ring =
+      remote_consumer->read_buffers_ring &&
+      !remote_consumer->send_read_buffers_ring_fd;
+
+  remote_consumer->MaybeCreateReadBuffersRing(ring_size);
   remote_consumer->read_buffers_response = std::move(resp);
   remote_consumer->service_endpoint->ReadBuffers();
 }
@@ -101,7 +117,10 @@ void ConsumerIPCService::ReadBuffers(const protos::ReadBuffersRequest&,
 // Called by the IPC layer.
 void ConsumerIPCService::FreeBuffers(const protos::FreeBuffersRequest&,
                                      DeferredFreeBuffersResponse resp) {
-  GetConsumerForCurrentRequest()->service_endpoint->FreeBuffers();
+  RemoteConsumer* remote_consumer = GetConsumerForCurrentRequest();
+  remote_consumer->read_buffers_ring.reset();
+  remote_consumer->send_read_buffers_ring_fd = false;
+  remote_consumer->service_endpoint->FreeBuffers();
   resp.Resolve(ipc::AsyncResult<protos::FreeBuffersResponse>::Create());
 }
 
@@ -170,10 +189,29 @@ void ConsumerIPCService::RemoteConsumer::OnTracingDisabled() {
   if (enable_tracing_response.IsBound()) {
     auto result = ipc::AsyncResult<protos::EnableTracingResponse>::Create();
     result->set_disabled(true);
+    if (send_read_buffers_ring_fd) {
+      auto* shm =
+          static_cast<PosixSharedMemory*>(read_buffers_ring->shared_memory());
+      result.set_fd(shm->fd());
+      send_read_buffers_ring_fd = false;
+    }
     enable_tracing_response.Resolve(std::move(result));
   }
 }
 
+void ConsumerIPCService::RemoteConsumer::MaybeCreateReadBuffersRing(
+    size_t size) {
+  if (!size || read_buffers_ring || !SharedPacketRing::IsValidSize(size))
+    return;
+  // The ring is created by the service rather than by the consumer, so that
+  // the consumer can't shrink it and cause a SIGBUS in the service.
+  std::unique_ptr<SharedMemory> shm = PosixSharedMemory::Create(size);
+  if (!shm)
+    return;
+  read_buffers_ring.reset(new SharedPacketRing(std::move(shm)));
+  send_read_buffers_ring_fd = true;
+}
+
 void ConsumerIPCService::RemoteConsumer::OnTraceData(
     std::vector<TracePacket> trace_packets,
     bool has_more) {
@@ -191,14 +229,36 @@ void ConsumerIPCService::RemoteConsumer::OnTraceData(
   static_assert(ipc::kIPCBufferSize >= SharedMemoryABI::kMaxPageSize * 2,
                 "kIPCBufferSize too small given the max possible slice size");
 
-  auto send_ipc_reply = [this, &result](bool more) {
+  bool did_write_into_ring = false;
+  auto send_ipc_reply = [this, &result, &did_write_into_ring](bool more) {
+    if (did_write_into_ring) {
+      result->set_shared_memory_write_offset(
+          read_buffers_ring->write_offset());
+      did_write_into_ring = false;
+    }
+    if (send_read_buffers_ring_fd) {
+      auto* shm =
+          static_cast<PosixSharedMemory*>(read_buffers_ring->shared_memory());
+      result.set_fd(shm->fd());
+      send_read_buffers_ring_fd = false;
+    }
     result.set_has_more(more);
     read_buffers_response.Resolve(std::move(result));
     result = ipc::AsyncResult<protos::ReadBuffersResponse>::Create();
   };
 
+  // Packets go into the shared memory ring until the first one that doesn't
+  // fit. From there on they are sent over IPC, to preserve their order.
+  SharedPacketRing* ring =
+      use_read_buffers_ring ? read_buffers_ring.get() : nullptr;
   size_t approx_reply_size = 0;
   for (const TracePacket& trace_packet : trace_packets) {
+    if (ring && ring->Write(trace_packet)) {
+      did_write_into_ring = true;
+      continue;
+    }
+    ring = nullptr;
+
     size_t num_slices_left_for_packet = trace_packet.slices().size();
     for (const Slice& slice : trace_packet.slices()) {
       // Check if this slice would cause the IPC to overflow its max size and,
@@ -26,6 +26,7 @@
 #include "perfetto/ipc/basic_types.h"
 #include "perfetto/tracing/core/consumer.h"
 #include "perfetto/tracing/core/tracing_service.h"
+#include "src/tracing/ipc/shared_packet_ring.h"
 
 #include "perfetto/ipc/consumer_port.ipc.h"
 
@@ -77,6 +78,9 @@ class ConsumerIPCService : public protos::ConsumerPort {
     void OnDetach(bool) override;
     void OnAttach(bool, const TraceConfig&) override;
 
+    // Creates |read_buffers_ring|, if not created yet and |size| is valid.
+    void MaybeCreateReadBuffersRing(size_t size);
+
     // The interface obtained from the core service business logic through
     // TracingService::ConnectConsumer(this). This allows to invoke methods for
     // a specific Consumer on the Service business logic.
@@ -96,6 +100,20 @@ class ConsumerIPCService : public protos::ConsumerPort {
 
     // As above, but for the Attach() case.
     DeferredAttachResponse attach_response;
+
+    // Set when the consumer asked to receive the ReadBuffers() data through
+    // shared memory (ReadBuffersRequest.shared_memory_size_kb).
+    std::unique_ptr<SharedPacketRing> read_buffers_ring;
+
+    // True until the file descriptor of |read_buffers_ring| has been sent to
+    // the consumer, attached to the first ReadBuffersResponse or to the
+    // EnableTracingResponse, whichever comes first.
+    bool send_read_buffers_ring_fd = false;
+
+    // Set only when the consumer asks for |read_buffers_ring| after having
+    // received its file descriptor, i.e. once it has attached it. Until then
+    // all the packets are sent as IPC slices.
+    bool use_read_buffers_ring = false;
   };
 
   // This has to be a container that doesn't invalidate iterators.
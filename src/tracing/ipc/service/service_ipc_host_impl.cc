@@ -31,12 +31,15 @@ namespace perfetto {
 // Implements the publicly exposed factory method declared in
 // include/tracing/posix_ipc/posix_service_host.h.
 std::unique_ptr<ServiceIPCHost> ServiceIPCHost::CreateInstance(
-    base::TaskRunner* task_runner) {
-  return std::unique_ptr<ServiceIPCHost>(new ServiceIPCHostImpl(task_runner));
+    base::TaskRunner* task_runner,
+    size_t num_io_threads) {
+  return std::unique_ptr<ServiceIPCHost>(
+      new ServiceIPCHostImpl(task_runner, num_io_threads));
 }
 
-ServiceIPCHostImpl::ServiceIPCHostImpl(base::TaskRunner* task_runner)
-    : task_runner_(task_runner) {}
+ServiceIPCHostImpl::ServiceIPCHostImpl(base::TaskRunner* task_runner,
+                                       size_t num_io_threads)
+    : task_runner_(task_runner), num_io_threads_(num_io_threads) {}
 
 ServiceIPCHostImpl::~ServiceIPCHostImpl() {}
 
@@ -45,10 +48,10 @@ bool ServiceIPCHostImpl::Start(const char* producer_socket_name,
   PERFETTO_CHECK(!svc_);  // Check if already started.
 
   // Initialize the IPC transport.
-  producer_ipc_port_ =
-      ipc::Host::CreateInstance(producer_socket_name, task_runner_);
-  consumer_ipc_port_ =
-      ipc::Host::CreateInstance(consumer_socket_name, task_runner_);
+  producer_ipc_port_ = ipc::Host::CreateInstance(
+      producer_socket_name, task_runner_, num_io_threads_);
+  consumer_ipc_port_ = ipc::Host::CreateInstance(
+      consumer_socket_name, task_runner_, num_io_threads_);
   return DoStart();
 }
 
@@ -57,10 +60,10 @@ bool ServiceIPCHostImpl::Start(base::ScopedFile producer_socket_fd,
   PERFETTO_CHECK(!svc_);  // Check if already started.
 
   // Initialize the IPC transport.
-  producer_ipc_port_ =
-      ipc::Host::CreateInstance(std::move(producer_socket_fd), task_runner_);
-  consumer_ipc_port_ =
-      ipc::Host::CreateInstance(std::move(consumer_socket_fd), task_runner_);
+  producer_ipc_port_ = ipc::Host::CreateInstance(
+      std::move(producer_socket_fd), task_runner_, num_io_threads_);
+  consumer_ipc_port_ = ipc::Host::CreateInstance(
+      std::move(consumer_socket_fd), task_runner_, num_io_threads_);
   return DoStart();
 }
 
@@ -17,6 +17,8 @@
 #ifndef SRC_TRACING_IPC_SERVICE_SERVICE_IPC_HOST_IMPL_H_
 #define SRC_TRACING_IPC_SERVICE_SERVICE_IPC_HOST_IMPL_H_
 
+#include <stddef.h>
+
 #include <memory>
 
 #include "perfetto/tracing/ipc/service_ipc_host.h"
@@ -33,7 +35,7 @@ class Host;
 // producer_ipc_service.cc and consumer_ipc_service.cc.
 class ServiceIPCHostImpl : public ServiceIPCHost {
  public:
-  ServiceIPCHostImpl(base::TaskRunner*);
+  ServiceIPCHostImpl(base::TaskRunner*, size_t num_io_threads = 0);
   ~ServiceIPCHostImpl() override;
 
   // ServiceIPCHost implementation.
@@ -49,6 +51,7 @@ class ServiceIPCHostImpl : public ServiceIPCHost {
   void Shutdown();
 
   base::TaskRunner* const task_runner_;
+  const size_t num_io_threads_;
   std::unique_ptr<TracingService> svc_;  // The service business logic.
 
   // The IPC host that listens on the Producer socket. It owns the
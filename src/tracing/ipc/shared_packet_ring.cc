@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/ipc/shared_packet_ring.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+
+namespace {
+using RecordSize = uint32_t;
+}  // namespace
+
+// static
+constexpr size_t SharedPacketRing::kHeaderSize;
+constexpr size_t SharedPacketRing::kMinSize;
+constexpr size_t SharedPacketRing::kMaxSize;
+
+// static
+bool SharedPacketRing::IsValidSize(size_t size) {
+  return size >= kMinSize && size <= kMaxSize && size % kMinSize == 0;
+}
+
+SharedPacketRing::SharedPacketRing(std::unique_ptr<SharedMemory> shared_memory)
+    : shared_memory_(std::move(shared_memory)) {
+  PERFETTO_CHECK(IsValidSize(shared_memory_->size()));
+  data_ = reinterpret_cast<uint8_t*>(shared_memory_->start()) + kHeaderSize;
+  data_size_ = shared_memory_->size() - kHeaderSize;
+}
+
+SharedPacketRing::~SharedPacketRing() = default;
+
+SharedPacketRing::Header* SharedPacketRing::header() const {
+  return reinterpret_cast<Header*>(shared_memory_->start());
+}
+
+bool SharedPacketRing::Write(const TracePacket& packet) {
+  const size_t record_size = sizeof(RecordSize) + packet.size();
+  // The read offset is controlled by the other process, don't trust it.
+  const uint64_t read_offset =
+      header()->read_offset.load(std::memory_order_acquire);
+  if (read_offset > write_offset_ || write_offset_ - read_offset > data_size_)
+    return false;
+  const uint64_t free_size = data_size_ - (write_offset_ - read_offset);
+  if (record_size > free_size)
+    return false;
+
+  const RecordSize size = static_cast<RecordSize>(packet.size());
+  CopyIn(write_offset_, &size, sizeof(size));
+  uint64_t offset = write_offset_ + sizeof(size);
+  for (const Slice& slice : packet.slices()) {
+    CopyIn(offset, slice.start, slice.size);
+    offset += slice.size;
+  }
+  write_offset_ = offset;
+  return true;
+}
+
+bool SharedPacketRing::Read(uint64_t write_offset,
+                            std::vector<TracePacket>* packets) {
+  if (write_offset < read_offset_ || write_offset - read_offset_ > data_size_)
+    return false;
+  bool success = true;
+  while (read_offset_ < write_offset) {
+    RecordSize size = 0;
+    if (write_offset - read_offset_ < sizeof(size)) {
+      success = false;
+      break;
+    }
+    CopyOut(read_offset_, &size, sizeof(size));
+    const uint64_t payload_offset = read_offset_ + sizeof(size);
+    if (size > write_offset - payload_offset) {
+      success = false;
+      break;
+    }
+    if (size > 0) {
+      Slice slice = Slice::Allocate(size);
+      CopyOut(payload_offset, slice.own_data(), size);
+      TracePacket packet;
+      packet.AddSlice(std::move(slice));
+      packets->emplace_back(std::move(packet));
+    }
+    read_offset_ = payload_offset + size;
+  }
+
+  // Release the space also in case of errors, so that the writer can carry on
+  // and the next batch has a chance to succeed.
+  read_offset_ = write_offset;
+  header()->read_offset.store(read_offset_, std::memory_order_release);
+  return success;
+}
+
+void SharedPacketRing::CopyIn(uint64_t offset, const void* src, size_t size) {
+  const size_t pos = static_cast<size_t>(offset % data_size_);
+  const size_t first = std::min(size, data_size_ - pos);
+  memcpy(data_ + pos, src, first);
+  memcpy(data_, reinterpret_cast<const uint8_t*>(src) + first, size - first);
+}
+
+void SharedPacketRing::CopyOut(uint64_t offset, void* dst, size_t size) const {
+  const size_t pos = static_cast<size_t>(offset % data_size_);
+  const size_t first = std::min(size, data_size_ - pos);
+  memcpy(dst, data_ + pos, first);
+  memcpy(reinterpret_cast<uint8_t*>(dst) + first, data_, size - first);
+}
+
+}  // namespace perfetto
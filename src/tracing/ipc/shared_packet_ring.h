@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACING_IPC_SHARED_PACKET_RING_H_
+#define SRC_TRACING_IPC_SHARED_PACKET_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "perfetto/tracing/core/shared_memory.h"
+#include "perfetto/tracing/core/trace_packet.h"
+
+namespace perfetto {
+
+// A single-writer single-reader ring buffer of TracePacket(s), used to return
+// the ReadBuffers() data to local consumers through shared memory rather than
+// serializing it into the IPC frames. The service writes the packets and then
+// sends the (small) ReadBuffersResponse with the updated write offset. The
+// consumer reads the packets up to that offset and releases the space by
+// updating the read offset in the header of the shared memory.
+// Each packet is stored as [uint32 size][payload], wrapping around the end of
+// the buffer. Offsets grow monotonically and are never wrapped.
+// Neither side trusts the other: the service validates the read offset before
+// each write and the consumer validates the write offset and the records.
+class SharedPacketRing {
+ public:
+  static constexpr size_t kHeaderSize = 64;
+  static constexpr size_t kMinSize = 4096;
+  static constexpr size_t kMaxSize = 64 * 1024 * 1024;
+
+  static bool IsValidSize(size_t size);
+
+  // |shared_memory| must be zero-initialized by the creator and have a valid
+  // size.
+  explicit SharedPacketRing(std::unique_ptr<SharedMemory> shared_memory);
+  ~SharedPacketRing();
+
+  // Writer side. Appends the packet to the ring. Returns false if there isn't
+  // enough space left (or if the read offset is corrupted). In this case the
+  // caller is expected to fall back on the IPC channel.
+  bool Write(const TracePacket& packet);
+
+  // Writer side. Offset to pass to the reader to make it consume all the
+  // packets written so far.
+  uint64_t write_offset() const { return write_offset_; }
+
+  // Reader side. Appends to |packets| the packets written up to |write_offset|
+  // and releases their space. Returns false if the data is malformed.
+  bool Read(uint64_t write_offset, std::vector<TracePacket>* packets);
+
+  // Reader side. Offset up to which the packets have been read.
+  uint64_t read_offset() const { return read_offset_; }
+
+  SharedMemory* shared_memory() const { return shared_memory_.get(); }
+
+ private:
+  struct Header {
+    std::atomic<uint64_t> read_offset;
+  };
+  static_assert(sizeof(Header) <= kHeaderSize, "Header too big");
+
+  SharedPacketRing(const SharedPacketRing&) = delete;
+  SharedPacketRing& operator=(const SharedPacketRing&) = delete;
+
+  Header* header() const;
+  void CopyIn(uint64_t offset, const void* src, size_t size);
+  void CopyOut(uint64_t offset, void* dst, size_t size) const;
+
+  std::unique_ptr<SharedMemory> shared_memory_;
+  uint8_t* data_ = nullptr;
+  size_t data_size_ = 0;
+
+  // Only one of the two is used, depending on the side.
+  uint64_t write_offset_ = 0;
+  uint64_t read_offset_ = 0;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACING_IPC_SHARED_PACKET_RING_H_
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/ipc/shared_packet_ring.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "perfetto/base/scoped_file.h"
+#include "src/tracing/ipc/posix_shared_memory.h"
+
+namespace perfetto {
+namespace {
+
+constexpr size_t kRingSize = 4096;
+
+class SharedPacketRingTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    std::unique_ptr<PosixSharedMemory> shm =
+        PosixSharedMemory::Create(kRingSize);
+    ASSERT_TRUE(shm);
+    base::ScopedFile fd(dup(shm->fd()));
+    writer_.reset(new SharedPacketRing(std::move(shm)));
+    reader_.reset(
+        new SharedPacketRing(PosixSharedMemory::AttachToFd(std::move(fd))));
+  }
+
+  // Splits |str| in two slices, to check that fragmented packets are handled.
+  TracePacket MakePacket(const std::string& str) {
+    bufs_.emplace_back(str);
+    const std::string& buf = bufs_.back();
+    TracePacket packet;
+    size_t half = buf.size() / 2;
+    packet.AddSlice(&buf[0], half);
+    packet.AddSlice(&buf[half], buf.size() - half);
+    return packet;
+  }
+
+  static std::string ToString(const TracePacket& packet) {
+    std::string res;
+    for (const Slice& slice : packet.slices())
+      res.append(reinterpret_cast<const char*>(slice.start), slice.size);
+    return res;
+  }
+
+  std::unique_ptr<SharedPacketRing> writer_;
+  std::unique_ptr<SharedPacketRing> reader_;
+  std::vector<std::string> bufs_;
+};
+
+TEST_F(SharedPacketRingTest, IsValidSize) {
+  EXPECT_FALSE(SharedPacketRing::IsValidSize(0));
+  EXPECT_FALSE(SharedPacketRing::IsValidSize(1024));
+  EXPECT_FALSE(SharedPacketRing::IsValidSize(4096 + 1));
+  EXPECT_TRUE(SharedPacketRing::IsValidSize(4096));
+  EXPECT_TRUE(SharedPacketRing::IsValidSize(SharedPacketRing::kMaxSize));
+  EXPECT_FALSE(SharedPacketRing::IsValidSize(SharedPacketRing::kMaxSize * 2));
+}
+
+TEST_F(SharedPacketRingTest, WriteAndReadWithWrapping) {
+  // Each iteration writes ~1/3 of the ring, so the data wraps around several
+  // times. Odd sizes make records straddle the end of the buffer.
+  for (int i = 0; i < 20; i++) {
+    std::vector<std::string> expected;
+    for (int j = 0; j < 3; j++) {
+      expected.emplace_back(static_cast<size_t>(433 + i * 3 + j),
+                            static_cast<char>('a' + j));
+      ASSERT_TRUE(writer_->Write(MakePacket(expected.back())));
+    }
+    std::vector<TracePacket> packets;
+    ASSERT_TRUE(reader_->Read(writer_->write_offset(), &packets));
+    ASSERT_EQ(expected.size(), packets.size());
+    for (size_t j = 0; j < expected.size(); j++)
+      EXPECT_EQ(expected[j], ToString(packets[j]));
+  }
+}
+
+TEST_F(SharedPacketRingTest, WriteFailsWhenFull) {
+  const std::string payload(1000, 'x');
+  size_t num_written = 0;
+  while (writer_->Write(MakePacket(payload)))
+    num_written++;
+  EXPECT_EQ(4u, num_written);
+
+  // Reading releases the space.
+  std::vector<TracePacket> packets;
+  ASSERT_TRUE(reader_->Read(writer_->write_offset(), &packets));
+  EXPECT_EQ(num_written, packets.size());
+  EXPECT_TRUE(writer_->Write(MakePacket(payload)));
+}
+
+TEST_F(SharedPacketRingTest, InvalidOffsets) {
+  ASSERT_TRUE(writer_->Write(MakePacket("foo")));
+  std::vector<TracePacket> packets;
+
+  // The write offset can't be beyond the size of the ring.
+  EXPECT_FALSE(reader_->Read(kRingSize * 2, &packets));
+  EXPECT_TRUE(packets.empty());
+
+  // An offset that cuts a record in half.
+  EXPECT_FALSE(reader_->Read(writer_->write_offset() - 1, &packets));
+  EXPECT_TRUE(packets.empty());
+
+  // A corrupted read offset in the header is detected by the writer.
+  memset(reader_->shared_memory()->start(), 0xff, sizeof(uint64_t));
+  EXPECT_FALSE(writer_->Write(MakePacket("bar")));
+}
+
+}  // namespace
+}  // namespace perfetto
@@ -17,9 +17,15 @@
 #include <inttypes.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <random>
+
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "perfetto/base/lz_codec.h"
 #include "perfetto/base/temp_file.h"
+#include "perfetto/ipc/basic_types.h"
+#include "perfetto/protozero/proto_utils.h"
 #include "perfetto/tracing/core/consumer.h"
 #include "perfetto/tracing/core/data_source_config.h"
 #include "perfetto/tracing/core/data_source_descriptor.h"
@@ -32,6 +38,8 @@
 #include "perfetto/tracing/ipc/service_ipc_host.h"
 #include "src/base/test/test_task_runner.h"
 #include "src/ipc/test/test_socket.h"
+#include "src/tracing/ipc/consumer/consumer_ipc_client_impl.h"
+#include "src/tracing/ipc/shared_packet_ring.h"
 
 #include "perfetto/config/trace_config.pb.h"
 #include "perfetto/trace/test_event.pbzero.h"
@@ -106,6 +114,9 @@ void CheckTraceStats(const protos::TracePacket& packet) {
 
 class TracingIntegrationTest : public ::testing::Test {
  public:
+  explicit TracingIntegrationTest(size_t read_buffers_shm_size = 0)
+      : read_buffers_shm_size_(read_buffers_shm_size) {}
+
   void SetUp() override {
     DESTROY_TEST_SOCK(kProducerSockName);
     DESTROY_TEST_SOCK(kConsumerSockName);
@@ -130,8 +141,9 @@ class TracingIntegrationTest : public ::testing::Test {
     producer_endpoint_->RegisterDataSource(ds_desc);
 
     // Create and connect a Consumer.
-    consumer_endpoint_ = ConsumerIPCClient::Connect(
-        kConsumerSockName, &consumer_, task_runner_.get());
+    consumer_endpoint_ =
+        ConsumerIPCClient::Connect(kConsumerSockName, &consumer_,
+                                   task_runner_.get(), read_buffers_shm_size_);
     auto on_consumer_connect =
         task_runner_->CreateCheckpoint("on_consumer_connect");
     EXPECT_CALL(consumer_, OnConnect()).WillOnce(Invoke(on_consumer_connect));
@@ -167,6 +179,7 @@ class TracingIntegrationTest : public ::testing::Test {
     DESTROY_TEST_SOCK(kConsumerSockName);
   }
 
+  const size_t read_buffers_shm_size_;
   std::unique_ptr<base::TestTaskRunner> task_runner_;
   std::unique_ptr<ServiceIPCHost> svc_;
   std::unique_ptr<TracingService::ProducerEndpoint> producer_endpoint_;
@@ -175,6 +188,20 @@ class TracingIntegrationTest : public ::testing::Test {
   MockConsumer consumer_;
 };
 
+// Uses the smallest shared memory ring for ReadBuffers(), so that the packets
+// that don't fit are sent through the IPC channel.
+class TracingIntegrationTestWithShm : public TracingIntegrationTest {
+ public:
+  TracingIntegrationTestWithShm() : TracingIntegrationTest(4096) {}
+};
+
+// Uses the same ring size as perfetto_cmd.
+class TracingIntegrationTestWithLargeShm : public TracingIntegrationTest {
+ public:
+  TracingIntegrationTestWithLargeShm()
+      : TracingIntegrationTest(4 * 1024 * 1024) {}
+};
+
 TEST_F(TracingIntegrationTest, WithIPCTransport) {
   // Start tracing.
   TraceConfig trace_config;
@@ -390,6 +417,240 @@ TEST_F(TracingIntegrationTest, WriteIntoFile) {
   ASSERT_TRUE(saw_trace_stats);
 }
 
+TEST_F(TracingIntegrationTestWithShm, ReadBuffersThroughSharedMemory) {
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096 * 10);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("perfetto.test");
+  ds_config->set_target_buffer(0);
+  consumer_endpoint_->EnableTracing(trace_config);
+
+  BufferID global_buf_id = 0;
+  auto on_create_ds_instance =
+      task_runner_->CreateCheckpoint("on_create_ds_instance");
+  EXPECT_CALL(producer_, OnTracingSetup());
+  EXPECT_CALL(producer_, SetupDataSource(_, _));
+  EXPECT_CALL(producer_, StartDataSource(_, _))
+      .WillOnce(Invoke([on_create_ds_instance, &global_buf_id](
+                           DataSourceInstanceID, const DataSourceConfig& cfg) {
+        global_buf_id = static_cast<BufferID>(cfg.target_buffer());
+        on_create_ds_instance();
+      }));
+  task_runner_->RunUntilCheckpoint("on_create_ds_instance");
+
+  std::unique_ptr<TraceWriter> writer =
+      producer_endpoint_->CreateTraceWriter(global_buf_id);
+  ASSERT_TRUE(writer);
+
+  // Each iteration writes more than what fits in the ring in a single
+  // ReadBuffers() call. The second one checks that the space released by the
+  // consumer is reused.
+  const size_t kNumPackets = 100;
+  const std::string kPayload(200, 'x');
+  for (int iteration = 0; iteration < 2; iteration++) {
+    for (size_t i = 0; i < kNumPackets; i++) {
+      std::string str = "evt_" + std::to_string(i) + kPayload;
+      writer->NewTracePacket()->set_for_testing()->set_str(str.data(),
+                                                           str.size());
+    }
+    std::string suffix = "_" + std::to_string(iteration);
+    writer->Flush(task_runner_->CreateCheckpoint("on_data_committed" + suffix));
+    task_runner_->RunUntilCheckpoint("on_data_committed" + suffix);
+
+    consumer_endpoint_->ReadBuffers();
+    size_t num_pack_rx = 0;
+    auto all_packets_rx =
+        task_runner_->CreateCheckpoint("all_packets_rx" + suffix);
+    EXPECT_CALL(consumer_, OnTracePackets(_, _))
+        .WillRepeatedly(Invoke([&num_pack_rx, all_packets_rx, &kPayload](
+                                   std::vector<TracePacket>* packets,
+                                   bool has_more) {
+          for (auto& encoded_packet : *packets) {
+            protos::TracePacket packet;
+            ASSERT_TRUE(encoded_packet.Decode(&packet));
+            if (!packet.has_for_testing())
+              continue;
+            EXPECT_EQ("evt_" + std::to_string(num_pack_rx++) + kPayload,
+                      packet.for_testing().str());
+          }
+          if (!has_more)
+            all_packets_rx();
+        }));
+    task_runner_->RunUntilCheckpoint("all_packets_rx" + suffix);
+    ASSERT_EQ(kNumPackets, num_pack_rx);
+  }
+
+  consumer_endpoint_->DisableTracing();
+  auto on_tracing_disabled =
+      task_runner_->CreateCheckpoint("on_tracing_disabled");
+  EXPECT_CALL(producer_, StopDataSource(_));
+  EXPECT_CALL(consumer_, OnTracingDisabled())
+      .WillOnce(Invoke(on_tracing_disabled));
+  task_runner_->RunUntilCheckpoint("on_tracing_disabled");
+}
+
+// Like perfetto_cmd, reads the buffers with a single ReadBuffers() once
+// tracing is disabled. The ring is received with the EnableTracingResponse, so
+// that read already goes through it.
+TEST_F(TracingIntegrationTestWithLargeShm, SingleReadAfterDisableUsesRing) {
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096 * 10);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("perfetto.test");
+  ds_config->set_target_buffer(0);
+  consumer_endpoint_->EnableTracing(trace_config);
+
+  BufferID global_buf_id = 0;
+  auto on_create_ds_instance =
+      task_runner_->CreateCheckpoint("on_create_ds_instance");
+  EXPECT_CALL(producer_, OnTracingSetup());
+  EXPECT_CALL(producer_, SetupDataSource(_, _));
+  EXPECT_CALL(producer_, StartDataSource(_, _))
+      .WillOnce(Invoke([on_create_ds_instance, &global_buf_id](
+                           DataSourceInstanceID, const DataSourceConfig& cfg) {
+        global_buf_id = static_cast<BufferID>(cfg.target_buffer());
+        on_create_ds_instance();
+      }));
+  task_runner_->RunUntilCheckpoint("on_create_ds_instance");
+
+  std::unique_ptr<TraceWriter> writer =
+      producer_endpoint_->CreateTraceWriter(global_buf_id);
+  ASSERT_TRUE(writer);
+  const size_t kNumPackets = 100;
+  const std::string kPayload(200, 'x');
+  for (size_t i = 0; i < kNumPackets; i++) {
+    std::string str = "evt_" + std::to_string(i) + kPayload;
+    writer->NewTracePacket()->set_for_testing()->set_str(str.data(),
+                                                         str.size());
+  }
+  writer->Flush(task_runner_->CreateCheckpoint("on_data_committed"));
+  task_runner_->RunUntilCheckpoint("on_data_committed");
+
+  consumer_endpoint_->DisableTracing();
+  auto on_tracing_disabled =
+      task_runner_->CreateCheckpoint("on_tracing_disabled");
+  EXPECT_CALL(producer_, StopDataSource(_));
+  EXPECT_CALL(consumer_, OnTracingDisabled())
+      .WillOnce(Invoke(on_tracing_disabled));
+  task_runner_->RunUntilCheckpoint("on_tracing_disabled");
+
+  auto* client = static_cast<ConsumerIPCClientImpl*>(consumer_endpoint_.get());
+  ASSERT_TRUE(client->read_buffers_ring_for_testing());
+
+  consumer_endpoint_->ReadBuffers();
+  size_t num_pack_rx = 0;
+  auto all_packets_rx = task_runner_->CreateCheckpoint("all_packets_rx");
+  EXPECT_CALL(consumer_, OnTracePackets(_, _))
+      .WillRepeatedly(
+          Invoke([&num_pack_rx, all_packets_rx, &kPayload](
+                     std::vector<TracePacket>* packets, bool has_more) {
+            for (auto& encoded_packet : *packets) {
+              protos::TracePacket packet;
+              ASSERT_TRUE(encoded_packet.Decode(&packet));
+              if (!packet.has_for_testing())
+                continue;
+              EXPECT_EQ("evt_" + std::to_string(num_pack_rx++) + kPayload,
+                        packet.for_testing().str());
+            }
+            if (!has_more)
+              all_packets_rx();
+          }));
+  task_runner_->RunUntilCheckpoint("all_packets_rx");
+  ASSERT_EQ(kNumPackets, num_pack_rx);
+
+  // All the packets went through the ring rather than the IPC channel.
+  EXPECT_GT(client->read_buffers_ring_for_testing()->read_offset(),
+            kNumPackets * kPayload.size());
+}
+
+// The compressed batches of packets are larger than an IPC frame, they must be
+// sent in slices like any other large packet.
+TEST_F(TracingIntegrationTest, CompressedBatchLargerThanIPCFrame) {
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096 * 10);
+  trace_config.set_compression_type(TraceConfig::COMPRESSION_TYPE_LZ);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("perfetto.test");
+  ds_config->set_target_buffer(0);
+  consumer_endpoint_->EnableTracing(trace_config);
+
+  BufferID global_buf_id = 0;
+  auto on_create_ds_instance =
+      task_runner_->CreateCheckpoint("on_create_ds_instance");
+  EXPECT_CALL(producer_, OnTracingSetup());
+  EXPECT_CALL(producer_, SetupDataSource(_, _));
+  EXPECT_CALL(producer_, StartDataSource(_, _))
+      .WillOnce(Invoke([on_create_ds_instance, &global_buf_id](
+                           DataSourceInstanceID, const DataSourceConfig& cfg) {
+        global_buf_id = static_cast<BufferID>(cfg.target_buffer());
+        on_create_ds_instance();
+      }));
+  task_runner_->RunUntilCheckpoint("on_create_ds_instance");
+
+  std::unique_ptr<TraceWriter> writer =
+      producer_endpoint_->CreateTraceWriter(global_buf_id);
+  ASSERT_TRUE(writer);
+
+  // An incompressible packet larger than ipc::kIPCBufferSize (128 KB). The
+  // service reads ~32 KB per task, so it ends up in a batch of its own, which
+  // is still larger than an IPC frame once compressed.
+  std::minstd_rand0 rnd(0);
+  std::string payload(160 * 1024, '\0');
+  for (char& c : payload)
+    c = static_cast<char>(rnd());
+  writer->NewTracePacket()->set_for_testing()->set_str(payload.data(),
+                                                       payload.size());
+  auto on_data_committed = task_runner_->CreateCheckpoint("on_data_committed");
+  writer->Flush(on_data_committed);
+  task_runner_->RunUntilCheckpoint("on_data_committed");
+
+  consumer_endpoint_->ReadBuffers();
+  std::vector<std::string> received;
+  size_t max_packet_size = 0;
+  auto all_packets_rx = task_runner_->CreateCheckpoint("all_packets_rx");
+  EXPECT_CALL(consumer_, OnTracePackets(_, _))
+      .WillRepeatedly(Invoke([&received, &max_packet_size, all_packets_rx](
+                                 std::vector<TracePacket>* packets,
+                                 bool has_more) {
+        for (auto& encoded_packet : *packets) {
+          max_packet_size = std::max(max_packet_size, encoded_packet.size());
+          protos::TracePacket packet;
+          ASSERT_TRUE(encoded_packet.Decode(&packet));
+          ASSERT_TRUE(packet.has_compressed_packets());
+          const std::string& data = packet.compressed_packets();
+          const uint8_t* start = reinterpret_cast<const uint8_t*>(data.data());
+          const uint8_t* end = start + data.size();
+          uint64_t raw_size = 0;
+          const uint8_t* payload =
+              protozero::proto_utils::ParseVarInt(start, end, &raw_size);
+          std::string raw(static_cast<size_t>(raw_size), '\0');
+          ASSERT_TRUE(base::LzDecompress(
+              payload, static_cast<size_t>(end - payload),
+              reinterpret_cast<uint8_t*>(&raw[0]), raw.size()));
+          protos::Trace trace;
+          ASSERT_TRUE(trace.ParseFromString(raw));
+          for (const auto& inner : trace.packet()) {
+            if (inner.has_for_testing())
+              received.emplace_back(inner.for_testing().str());
+          }
+        }
+        if (!has_more)
+          all_packets_rx();
+      }));
+  task_runner_->RunUntilCheckpoint("all_packets_rx");
+  EXPECT_GT(max_packet_size, ipc::kIPCBufferSize);
+  ASSERT_EQ(1u, received.size());
+  EXPECT_EQ(payload, received[0]);
+
+  consumer_endpoint_->DisableTracing();
+  auto on_tracing_disabled =
+      task_runner_->CreateCheckpoint("on_tracing_disabled");
+  EXPECT_CALL(producer_, StopDataSource(_));
+  EXPECT_CALL(consumer_, OnTracingDisabled())
+      .WillOnce(Invoke(on_tracing_disabled));
+  task_runner_->RunUntilCheckpoint("on_tracing_disabled");
+}
+
 // TODO(primiano): add tests to cover:
 // - unknown fields preserved end-to-end.
 // - >1 data source.
@@ -0,0 +1,363 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tools/ftrace_proto_gen/ftrace_decoder_gen.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <memory>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/string_utils.h"
+#include "src/traced/probes/ftrace/event_info.h"
+#include "src/traced/probes/ftrace/ftrace_procfs.h"
+#include "src/traced/probes/ftrace/proto_translation_table.h"
+
+namespace perfetto {
+
+namespace {
+
+// The distinct layouts of an event and the directories they were found in.
+struct EventLayouts {
+  std::vector<std::vector<Field>> layouts;
+  std::vector<std::vector<std::string>> dirs;
+};
+
+bool SameLayout(const std::vector<Field>& a, const std::vector<Field>& b) {
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); i++) {
+    if (a[i].proto_field_id != b[i].proto_field_id ||
+        a[i].ftrace_offset != b[i].ftrace_offset ||
+        a[i].ftrace_size != b[i].ftrace_size ||
+        a[i].strategy != b[i].strategy) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// "foo/bar/android_walleye/events/" -> "android_walleye".
+std::string DeviceName(std::string input_dir) {
+  while (!input_dir.empty() && input_dir.back() == '/')
+    input_dir.pop_back();
+  if (base::EndsWith(input_dir, "/events"))
+    input_dir.resize(input_dir.size() - strlen("/events"));
+  size_t slash = input_dir.rfind('/');
+  return slash == std::string::npos ? input_dir : input_dir.substr(slash + 1);
+}
+
+std::string ReadVarInt(const Field& field, const char* type) {
+  return "CpuReader::ReadIntoVarInt<" + std::to_string(field.proto_field_id) +
+         ", " + type + ">(start + " + std::to_string(field.ftrace_offset) +
+         ", message);";
+}
+
+std::string ReadWithMetadata(const Field& field,
+                             const char* function,
+                             const char* type) {
+  std::string args = std::to_string(field.proto_field_id);
+  if (type)
+    args += std::string(", ") + type;
+  return std::string("CpuReader::") + function + "<" + args + ">(start + " +
+         std::to_string(field.ftrace_offset) + ", message, metadata);";
+}
+
+bool UsesEnd(const Field& field) {
+  return field.strategy == kCStringToString ||
+         field.strategy == kDataLocToString;
+}
+
+bool UsesMetadata(const Field& field) {
+  switch (field.strategy) {
+    case kInode32ToUint64:
+    case kInode64ToUint64:
+    case kPid32ToInt32:
+    case kPid32ToInt64:
+    case kCommonPid32ToInt32:
+    case kCommonPid32ToInt64:
+    case kDevId32ToUint64:
+    case kDevId64ToUint64:
+      return true;
+    default:
+      return false;
+  }
+}
+
+std::string StrategyName(TranslationStrategy strategy) {
+  switch (strategy) {
+    case kUint8ToUint32:
+      return "kUint8ToUint32";
+    case kUint8ToUint64:
+      return "kUint8ToUint64";
+    case kUint16ToUint32:
+      return "kUint16ToUint32";
+    case kUint16ToUint64:
+      return "kUint16ToUint64";
+    case kUint32ToUint32:
+      return "kUint32ToUint32";
+    case kUint32ToUint64:
+      return "kUint32ToUint64";
+    case kUint64ToUint64:
+      return "kUint64ToUint64";
+    case kInt8ToInt32:
+      return "kInt8ToInt32";
+    case kInt8ToInt64:
+      return "kInt8ToInt64";
+    case kInt16ToInt32:
+      return "kInt16ToInt32";
+    case kInt16ToInt64:
+      return "kInt16ToInt64";
+    case kInt32ToInt32:
+      return "kInt32ToInt32";
+    case kInt32ToInt64:
+      return "kInt32ToInt64";
+    case kInt64ToInt64:
+      return "kInt64ToInt64";
+    case kFixedCStringToString:
+      return "kFixedCStringToString";
+    case kCStringToString:
+      return "kCStringToString";
+    case kStringPtrToString:
+      return "kStringPtrToString";
+    case kBoolToUint32:
+      return "kBoolToUint32";
+    case kBoolToUint64:
+      return "kBoolToUint64";
+    case kInode32ToUint64:
+      return "kInode32ToUint64";
+    case kInode64ToUint64:
+      return "kInode64ToUint64";
+    case kPid32ToInt32:
+      return "kPid32ToInt32";
+    case kPid32ToInt64:
+      return "kPid32ToInt64";
+    case kCommonPid32ToInt32:
+      return "kCommonPid32ToInt32";
+    case kCommonPid32ToInt64:
+      return "kCommonPid32ToInt64";
+    case kDevId32ToUint64:
+      return "kDevId32ToUint64";
+    case kDevId64ToUint64:
+      return "kDevId64ToUint64";
+    case kDataLocToString:
+      return "kDataLocToString";
+  }
+  PERFETTO_FATAL("Not reached");  // For gcc
+}
+
+std::string DecoderFunction(const std::string& function_name,
+                            const std::vector<Field>& fields) {
+  bool uses_start = false;
+  bool uses_end = false;
+  bool uses_metadata = false;
+  bool can_fail = false;
+  std::string body;
+  for (const Field& field : fields) {
+    std::string statement = DecodeFieldStatement(field);
+    if (statement.empty())
+      continue;
+    uses_start = true;
+    uses_end |= UsesEnd(field);
+    uses_metadata |= UsesMetadata(field);
+    can_fail |= base::StartsWith(statement, "success");
+    body += "  " + statement + "\n";
+  }
+
+  std::string s = "bool " + function_name + "(";
+  std::string indent(s.size(), ' ');
+  s += uses_start ? "const uint8_t* start,\n"
+                  : "const uint8_t* /*start*/,\n";
+  s += indent + (uses_end ? "const uint8_t* end,\n"
+                          : "const uint8_t* /*end*/,\n");
+  s += indent + (uses_start ? "protozero::Message* message,\n"
+                            : "protozero::Message* /*message*/,\n");
+  s += indent + (uses_metadata ? "FtraceMetadata* metadata) {\n"
+                               : "FtraceMetadata* /*metadata*/) {\n");
+  if (can_fail)
+    s += "  bool success = true;\n";
+  s += body;
+  s += can_fail ? "  return success;\n" : "  return true;\n";
+  s += "}\n";
+  return s;
+}
+
+}  // namespace
+
+std::string DecodeFieldStatement(const Field& field) {
+  const std::string id = std::to_string(field.proto_field_id);
+  const std::string field_start =
+      "start + " + std::to_string(field.ftrace_offset);
+  switch (field.strategy) {
+    case kUint8ToUint32:
+    case kUint8ToUint64:
+    case kBoolToUint32:
+    case kBoolToUint64:
+      return ReadVarInt(field, "uint8_t");
+    case kUint16ToUint32:
+    case kUint16ToUint64:
+      return ReadVarInt(field, "uint16_t");
+    case kUint32ToUint32:
+    case kUint32ToUint64:
+      return ReadVarInt(field, "uint32_t");
+    case kUint64ToUint64:
+      return ReadVarInt(field, "uint64_t");
+    case kInt8ToInt32:
+    case kInt8ToInt64:
+      return ReadVarInt(field, "int8_t");
+    case kInt16ToInt32:
+    case kInt16ToInt64:
+      return ReadVarInt(field, "int16_t");
+    case kInt32ToInt32:
+    case kInt32ToInt64:
+      return ReadVarInt(field, "int32_t");
+    case kInt64ToInt64:
+      return ReadVarInt(field, "int64_t");
+    case kFixedCStringToString:
+      return "success &= CpuReader::ReadIntoString(" + field_start +
+             ", start + " +
+             std::to_string(field.ftrace_offset + field.ftrace_size) + ", " +
+             id + ", message);";
+    case kCStringToString:
+      return "success &= CpuReader::ReadIntoString(" + field_start +
+             ", end, " + id + ", message);";
+    case kStringPtrToString:
+      // Not supported by CpuReader::ParseField() either.
+      return "";
+    case kDataLocToString:
+      return "success &= CpuReader::ReadDataLoc(start, " + field_start +
+             ", end, " + id + ", message);";
+    case kInode32ToUint64:
+      return ReadWithMetadata(field, "ReadInode", "uint32_t");
+    case kInode64ToUint64:
+      return ReadWithMetadata(field, "ReadInode", "uint64_t");
+    case kPid32ToInt32:
+    case kPid32ToInt64:
+      return ReadWithMetadata(field, "ReadPid", nullptr);
+    case kCommonPid32ToInt32:
+    case kCommonPid32ToInt64:
+      return ReadWithMetadata(field, "ReadCommonPid", nullptr);
+    case kDevId32ToUint64:
+      return ReadWithMetadata(field, "ReadDevId", "uint32_t");
+    case kDevId64ToUint64:
+      return ReadWithMetadata(field, "ReadDevId", "uint64_t");
+  }
+  PERFETTO_FATAL("Not reached");  // For gcc
+}
+
+void GenerateEventDecoders(const std::vector<FtraceEventName>& events,
+                           const std::vector<std::string>& input_dirs,
+                           std::ostream* fout) {
+  std::vector<EventLayouts> layouts(events.size());
+  for (const std::string& input_dir : input_dirs) {
+    PERFETTO_CHECK(base::EndsWith(input_dir, "events/"));
+    FtraceProcfs ftrace_procfs(
+        input_dir.substr(0, input_dir.size() - strlen("events/")));
+    std::unique_ptr<ProtoTranslationTable> table =
+        ProtoTranslationTable::Create(&ftrace_procfs, GetStaticEventInfo(),
+                                      GetStaticCommonFieldsInfo());
+    if (!table) {
+      fprintf(stderr, "Could not read the ftrace formats in %s\n",
+              input_dir.c_str());
+      continue;
+    }
+    for (size_t i = 0; i < events.size(); i++) {
+      if (!events[i].valid())
+        continue;
+      const Event* event =
+          table->GetEvent(GroupAndName(events[i].group(), events[i].name()));
+      if (!event)
+        continue;
+      EventLayouts& event_layouts = layouts[i];
+      size_t j = 0;
+      for (; j < event_layouts.layouts.size(); j++) {
+        if (SameLayout(event_layouts.layouts[j], event->fields))
+          break;
+      }
+      if (j == event_layouts.layouts.size()) {
+        event_layouts.layouts.push_back(event->fields);
+        event_layouts.dirs.emplace_back();
+      }
+      event_layouts.dirs[j].push_back(DeviceName(input_dir));
+    }
+  }
+
+  std::string functions;
+  std::string decoders;
+  for (size_t i = 0; i < events.size(); i++) {
+    const FtraceEventName& event = events[i];
+    for (size_t j = 0; j < layouts[i].layouts.size(); j++) {
+      const std::vector<Field>& fields = layouts[i].layouts[j];
+      std::string function_name =
+          "Decode" + ToCamelCase(event.name()) + std::to_string(j);
+
+      functions += "\n// " + event.group() + "/" + event.name() + " as in:\n";
+      for (const std::string& dir : layouts[i].dirs[j])
+        functions += "//   " + dir + "\n";
+      functions += DecoderFunction(function_name, fields);
+
+      decoders += "\n";
+      decoders += "  {\n";
+      decoders += "    decoders.emplace_back(EventDecoder{});\n";
+      decoders += "    EventDecoder* decoder = &decoders.back();\n";
+      decoders += "    decoder->group = \"" + event.group() + "\";\n";
+      decoders += "    decoder->name = \"" + event.name() + "\";\n";
+      for (const Field& field : fields) {
+        decoders += "    decoder->fields.push_back({" +
+                    std::to_string(field.proto_field_id) + ", " +
+                    std::to_string(field.ftrace_offset) + ", " +
+                    std::to_string(field.ftrace_size) + ", " +
+                    StrategyName(field.strategy) + "});\n";
+      }
+      decoders += "    decoder->decode = &" + function_name + ";\n";
+      decoders += "  }\n";
+    }
+  }
+
+  std::string s = "// Autogenerated by:\n";
+  s += std::string("// ") + __FILE__ + "\n";
+  s += "// Do not edit.\n";
+  s += R"(
+#include "src/traced/probes/ftrace/event_decoders.h"
+
+#include "perfetto/protozero/message.h"
+#include "src/traced/probes/ftrace/cpu_reader.h"
+#include "src/traced/probes/ftrace/ftrace_metadata.h"
+
+namespace perfetto {
+
+namespace {
+)";
+  s += functions;
+  s += R"(
+}  // namespace
+
+std::vector<EventDecoder> GetStaticEventDecoders() {
+  std::vector<EventDecoder> decoders;
+)";
+  s += decoders;
+  s += R"(
+  return decoders;
+}
+
+}  // namespace perfetto
+)";
+
+  *fout << s;
+}
+
+}  // namespace perfetto
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TOOLS_FTRACE_PROTO_GEN_FTRACE_DECODER_GEN_H_
+#define TOOLS_FTRACE_PROTO_GEN_FTRACE_DECODER_GEN_H_
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "src/traced/probes/ftrace/event_info_constants.h"
+#include "tools/ftrace_proto_gen/proto_gen_utils.h"
+
+namespace perfetto {
+
+// Returns the statement of the generated decoder that reads |field|, the
+// equivalent of CpuReader::ParseField() for it.
+std::string DecodeFieldStatement(const Field& field);
+
+// Generates event_decoders.cc with a straight-line decoder for each distinct
+// layout of each of the |events| in the ftrace directories |input_dirs| (e.g.
+// src/traced/probes/ftrace/test/data/*/events/). Layouts are the ones the
+// ProtoTranslationTable would build for those directories.
+void GenerateEventDecoders(const std::vector<FtraceEventName>& events,
+                           const std::vector<std::string>& input_dirs,
+                           std::ostream* fout);
+
+}  // namespace perfetto
+
+#endif  // TOOLS_FTRACE_PROTO_GEN_FTRACE_DECODER_GEN_H_
@@ -16,6 +16,7 @@
 
 #include "tools/ftrace_proto_gen/ftrace_proto_gen.h"
 #include "gtest/gtest.h"
+#include "tools/ftrace_proto_gen/ftrace_decoder_gen.h"
 
 namespace perfetto {
 namespace {
@@ -67,5 +68,33 @@ TEST(FtraceEventParserTest, GenerateProtoName) {
   EXPECT_EQ(output.name, "TheSnakeCaseNameFtraceEvent");
 }
 
+TEST(FtraceDecoderGenTest, DecodeFieldStatement) {
+  Field field(24, 4);
+  field.proto_field_id = 2;
+  field.strategy = kPid32ToInt32;
+  EXPECT_EQ(DecodeFieldStatement(field),
+            "CpuReader::ReadPid<2>(start + 24, message, metadata);");
+  field.strategy = kUint32ToUint64;
+  EXPECT_EQ(DecodeFieldStatement(field),
+            "CpuReader::ReadIntoVarInt<2, uint32_t>(start + 24, message);");
+  field.strategy = kDevId32ToUint64;
+  EXPECT_EQ(DecodeFieldStatement(field),
+            "CpuReader::ReadDevId<2, uint32_t>(start + 24, message, "
+            "metadata);");
+  field.strategy = kDataLocToString;
+  EXPECT_EQ(DecodeFieldStatement(field),
+            "success &= CpuReader::ReadDataLoc(start, start + 24, end, 2, "
+            "message);");
+  field.strategy = kStringPtrToString;
+  EXPECT_EQ(DecodeFieldStatement(field), "");
+
+  Field string_field(8, 16);
+  string_field.proto_field_id = 1;
+  string_field.strategy = kFixedCStringToString;
+  EXPECT_EQ(DecodeFieldStatement(string_field),
+            "success &= CpuReader::ReadIntoString(start + 8, start + 24, 1, "
+            "message);");
+}
+
 }  // namespace
 }  // namespace perfetto
@@ -30,6 +30,7 @@
 #include "perfetto/base/file_utils.h"
 #include "perfetto/base/logging.h"
 #include "src/traced/probes/ftrace/format_parser.h"
+#include "tools/ftrace_proto_gen/ftrace_decoder_gen.h"
 #include "tools/ftrace_proto_gen/ftrace_descriptor_gen.h"
 #include "tools/ftrace_proto_gen/ftrace_proto_gen.h"
 
@@ -47,6 +48,7 @@ inline std::unique_ptr<std::ostream> MakeVerifyStream(
 int main(int argc, char** argv) {
   static struct option long_options[] = {
       {"whitelist_path", required_argument, nullptr, 'w'},
+      {"decoder_whitelist_path", required_argument, nullptr, 'e'},
       {"output_dir", required_argument, nullptr, 'o'},
       {"proto_descriptor", required_argument, nullptr, 'd'},
       {"update_build_files", no_argument, nullptr, 'b'},
@@ -57,6 +59,7 @@ int main(int argc, char** argv) {
   int c;
 
   std::string whitelist_path;
+  std::string decoder_whitelist_path;
   std::string output_dir;
   std::string proto_descriptor;
   bool update_build_files = false;
@@ -69,6 +72,9 @@ int main(int argc, char** argv) {
       case 'w':
         whitelist_path = optarg;
         break;
+      case 'e':
+        decoder_whitelist_path = optarg;
+        break;
       case 'o':
         output_dir = optarg;
         break;
@@ -90,7 +96,8 @@ int main(int argc, char** argv) {
   if (optind >= argc) {
     fprintf(stderr,
             "Usage: ./%s -w whitelist_dir -o output_dir -d proto_descriptor "
-            "[--check_only] input_dir...\n",
+            "[--decoder_whitelist_path decoder_whitelist] [--check_only] "
+            "input_dir...\n",
             argv[0]);
     return 1;
   }
@@ -228,6 +235,16 @@ int main(int argc, char** argv) {
     PERFETTO_CHECK(!out->fail());
   }
 
+  if (!decoder_whitelist_path.empty()) {
+    std::vector<perfetto::FtraceEventName> decoder_whitelist =
+        perfetto::ReadWhitelist(decoder_whitelist_path);
+    std::vector<std::string> input_dirs(argv + optind, argv + argc);
+    std::unique_ptr<std::ostream> out =
+        ostream_factory("src/traced/probes/ftrace/event_decoders.cc");
+    perfetto::GenerateEventDecoders(decoder_whitelist, input_dirs, out.get());
+    PERFETTO_CHECK(!out->fail());
+  }
+
   if (update_build_files) {
     std::unique_ptr<std::ostream> f =
         ostream_factory(output_dir + "/all_protos.gni");